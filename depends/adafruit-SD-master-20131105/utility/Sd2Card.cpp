@@ -27,6 +27,7 @@
 #endif
 #include <core_pins.h>
 #include "Sd2Card.h"
+#include "crc.h"
 typedef uint8_t RwReg;
 #define noInterrupts() __disable_irq()
 #define interrupts()   __enable_irq()
@@ -172,20 +173,19 @@ uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
   // select card
   chipSelectLow();
 
-  // wait up to 300 ms if busy
-  waitNotBusy(300);
+  // wait up to 300 ms if busy, as long as a write may take if one was left
+  // programming (see overlapBusy())
+  waitNotBusy(busy_ ? writeTimeout_ : 300);
+  busy_ = false;
 
-  // send command
-  spiSend(cmd | 0x40);
+  // send command and argument
+  uint8_t buf[5];
+  buf[0] = cmd | 0x40;
+  for (uint8_t i = 1; i < 5; i++) buf[i] = arg >> (32 - 8 * i);
+  for (uint8_t i = 0; i < 5; i++) spiSend(buf[i]);
 
-  // send argument
-  for (int8_t s = 24; s >= 0; s -= 8) spiSend(arg >> s);
-
-  // send CRC
-  uint8_t crc = 0XFF;
-  if (cmd == CMD0) crc = 0X95;  // correct crc for CMD0 with arg 0
-  if (cmd == CMD8) crc = 0X87;  // correct crc for CMD8 with arg 0X1AA
-  spiSend(crc);
+  // send CRC, always valid so the card can check it (see enableCRC())
+  spiSend(crc7(buf, 5));
 
   // wait for response
   for (uint8_t i = 0; ((status_ = spiRec()) & 0X80) && i != 0XFF; i++);
@@ -218,6 +218,21 @@ uint32_t Sd2Card::cardSize(void) {
   }
 }
 //------------------------------------------------------------------------------
+/**
+ * Read the card status with CMD13 (SEND_STATUS). The error bits of the
+ * status are cleared by reading them, so one check covers every write
+ * since the last one.
+ *
+ * \return The R2 response, R1 in the high byte and the second status byte
+ * in the low byte. Zero if the card has no error to report.
+ */
+uint16_t Sd2Card::cardStatus(void) {
+  uint16_t status = cardCommand(CMD13, 0) << 8;
+  status |= spiRec();
+  chipSelectHigh();
+  return status;
+}
+//------------------------------------------------------------------------------
 void Sd2Card::chipSelectHigh(void) {
   digitalWrite(chipSelectPin_, HIGH);
 }
@@ -287,57 +302,40 @@ uint8_t Sd2Card::eraseSingleBlockEnable(void) {
  * can be determined by calling errorCode() and errorData().
  */
 uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin, int8_t misoPin, int8_t clockPin) {
-  writeCRC_ = errorCode_ = inBlock_ = partialBlockRead_ = type_ = 0;
-  chipSelectPin_ = chipSelectPin;
-  mosiPin_ = mosiPin;
-  misoPin_ = misoPin;
-  clockPin_ = clockPin;
+  uint8_t ready = false;
+  if (!initStart(sckRateID, chipSelectPin, mosiPin, misoPin, clockPin)) {
+    return false;
+  }
+  while (!ready) {
+    if (!initPoll(&ready)) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Start initializing an SD flash memory card, the first half of init().
+ *
+ * Resets the card and checks its version, the card is then brought out of
+ * its idle state by calling initPoll() until it is ready. Nothing else may
+ * be done with the card in between.
+ *
+ * \param[in] sckRateID SPI clock rate selector once the card is ready.
+ * \param[in] chipSelectPin SD chip select pin number.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::initStart(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin, int8_t misoPin, int8_t clockPin) {
+  writeCRC_ = readCRC_ = errorCode_ = inBlock_ = partialBlockRead_ = type_ = 0;
+  writeStatusCheck_ = 1;
+  overlapBusy_ = busy_ = false;
+  writeTimeout_ = SD_WRITE_TIMEOUT;
+  initSckRate_ = sckRateID;
   // 16-bit init start time allows over a minute
-  uint16_t t0 = (uint16_t)millis();
-  uint32_t arg;
+  initT0_ = (uint16_t)millis();
 
-  // set pin modes
-  pinMode(chipSelectPin_, OUTPUT);
-  chipSelectHigh();
-  
-  if (clockPin != -1) {
-    // use slow bitbang mode
-    pinMode(misoPin_, INPUT);
-    pinMode(mosiPin_, OUTPUT);
-    pinMode(clockPin_, OUTPUT);
-    clkport     = portOutputRegister(digitalPinToPort(clockPin_));
-    clkpinmask  = digitalPinToBitMask(clockPin_);
-    mosiport    = portOutputRegister(digitalPinToPort(mosiPin_));
-    mosipinmask = digitalPinToBitMask(mosiPin_);
-    misoport    = portInputRegister(digitalPinToPort(misoPin_));
-    misopinmask = digitalPinToBitMask(misoPin_);
-  } else {
+  spiSetup(chipSelectPin, mosiPin, misoPin, clockPin);
 
-    #ifndef USE_SPI_LIB
-      pinMode(SPI_MISO_PIN, INPUT);
-      pinMode(SPI_MOSI_PIN, OUTPUT);
-      pinMode(SPI_SCK_PIN, OUTPUT);
-    #endif
-
-    #ifndef SOFTWARE_SPI
-      #ifndef USE_SPI_LIB
-        // SS must be in output mode even it is not chip select
-        pinMode(SS_PIN, OUTPUT);
-        digitalWrite(SS_PIN, HIGH); // disable any SPI device using hardware SS pin
-        // Enable SPI, Master, clock rate f_osc/128
-        SPCR = (1 << SPE) | (1 << MSTR) | (1 << SPR1) | (1 << SPR0);
-        // clear double speed
-        SPSR &= ~(1 << SPI2X);
-      #else // USE_SPI_LIB
-        SPI.begin();
-        #ifdef SPI_CLOCK_DIV128
-            SPI.setClockDivider(SPI_CLOCK_DIV128);
-        #else
-            SPI.setClockDivider(255);
-        #endif
-      #endif // USE_SPI_LIB
-    #endif // SOFTWARE_SPI
-}
   // must supply min of 74 clock cycles with CS high.
   for (uint8_t i = 0; i < 10; i++) spiSend(0XFF);
 
@@ -345,7 +343,7 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin,
 
   // command to go idle in SPI mode
   while ((status_ = cardCommand(CMD0, 0)) != R1_IDLE_STATE) {
-    if (((uint16_t)millis() - t0) > SD_INIT_TIMEOUT) {
+    if (((uint16_t)millis() - initT0_) > SD_INIT_TIMEOUT) {
       error(SD_CARD_ERROR_CMD0);
       goto fail;
     }
@@ -362,15 +360,37 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin,
     }
     type(SD_CARD_TYPE_SD2);
   }
+  chipSelectHigh();
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
+/**
+ * Continue an initialization begun by initStart(), one ACMD41 per call.
+ *
+ * \param[out] ready Set true once the card is initialized, false while it
+ * is still busy powering up.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.  The reason for failure
+ * can be determined by calling errorCode() and errorData().
+ */
+uint8_t Sd2Card::initPoll(uint8_t* ready) {
   // initialize card and send host supports SDHC if SD2
-  arg = type() == SD_CARD_TYPE_SD2 ? 0X40000000 : 0;
+  uint32_t arg = type() == SD_CARD_TYPE_SD2 ? 0X40000000 : 0;
 
-  while ((status_ = cardAcmd(ACMD41, arg)) != R1_READY_STATE) {
+  *ready = false;
+  if ((status_ = cardAcmd(ACMD41, arg)) != R1_READY_STATE) {
     // check for timeout
-    if (((uint16_t)millis() - t0) > SD_INIT_TIMEOUT) {
+    if (((uint16_t)millis() - initT0_) > SD_INIT_TIMEOUT) {
       error(SD_CARD_ERROR_ACMD41);
       goto fail;
     }
+    chipSelectHigh();
+    return true;
   }
   // if SD2 read OCR register to check for SDHC card
   if (type() == SD_CARD_TYPE_SD2) {
@@ -383,10 +403,11 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin,
     for (uint8_t i = 0; i < 3; i++) spiRec();
   }
   chipSelectHigh();
+  *ready = true;
 
 #ifndef SOFTWARE_SPI
   if (clockPin_ == -1)
-    return setSckRate(sckRateID);
+    return setSckRate(initSckRate_);
   else 
     return true;
 #else  // SOFTWARE_SPI
@@ -398,6 +419,84 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin,
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Check for a card with a single CMD0 at the init clock, so an empty slot
+ * can be polled without the SD_INIT_TIMEOUT wait of initStart(). A card
+ * that was initialized is reset to its idle state by the check.
+ *
+ * \param[in] chipSelectPin SD chip select pin number, the pins are as
+ * for initStart().
+ *
+ * \return The value one, true, is returned if a card answered and
+ * the value zero, false, is returned if there was no answer.
+ */
+uint8_t Sd2Card::cardDetect(uint8_t chipSelectPin, int8_t mosiPin, int8_t misoPin, int8_t clockPin) {
+  errorCode_ = type_ = 0;
+  spiSetup(chipSelectPin, mosiPin, misoPin, clockPin);
+
+  // must supply min of 74 clock cycles with CS high.
+  for (uint8_t i = 0; i < 10; i++) spiSend(0XFF);
+
+  chipSelectLow();
+  status_ = cardCommand(CMD0, 0);
+  chipSelectHigh();
+  return status_ == R1_IDLE_STATE;
+}
+//------------------------------------------------------------------------------
+/**
+ * Set up the pins and the SPI at the init clock, the part of initStart()
+ * shared with cardDetect().
+ */
+void Sd2Card::spiSetup(uint8_t chipSelectPin, int8_t mosiPin, int8_t misoPin, int8_t clockPin) {
+  chipSelectPin_ = chipSelectPin;
+  mosiPin_ = mosiPin;
+  misoPin_ = misoPin;
+  clockPin_ = clockPin;
+
+  // set pin modes
+  pinMode(chipSelectPin_, OUTPUT);
+  chipSelectHigh();
+  
+  if (clockPin != -1) {
+    // use slow bitbang mode
+    pinMode(misoPin_, INPUT);
+    pinMode(mosiPin_, OUTPUT);
+    pinMode(clockPin_, OUTPUT);
+    clkport     = portOutputRegister(digitalPinToPort(clockPin_));
+    clkpinmask  = digitalPinToBitMask(clockPin_);
+    mosiport    = portOutputRegister(digitalPinToPort(mosiPin_));
+    mosipinmask = digitalPinToBitMask(mosiPin_);
+    misoport    = portInputRegister(digitalPinToPort(misoPin_));
+    misopinmask = digitalPinToBitMask(misoPin_);
+  } else {
+
+    #ifndef USE_SPI_LIB
+      pinMode(SPI_MISO_PIN, INPUT);
+      pinMode(SPI_MOSI_PIN, OUTPUT);
+      pinMode(SPI_SCK_PIN, OUTPUT);
+    #endif
+
+    #ifndef SOFTWARE_SPI
+      #ifndef USE_SPI_LIB
+        // SS must be in output mode even it is not chip select
+        pinMode(SS_PIN, OUTPUT);
+        digitalWrite(SS_PIN, HIGH); // disable any SPI device using hardware SS pin
+        // Enable SPI, Master, clock rate f_osc/128
+        SPCR = (1 << SPE) | (1 << MSTR) | (1 << SPR1) | (1 << SPR0);
+        // clear double speed
+        SPSR &= ~(1 << SPI2X);
+      #else // USE_SPI_LIB
+        SPI.begin();
+        #ifdef SPI_CLOCK_DIV128
+            SPI.setClockDivider(SPI_CLOCK_DIV128);
+        #else
+            SPI.setClockDivider(255);
+        #endif
+      #endif // USE_SPI_LIB
+    #endif // SOFTWARE_SPI
+  }
+}
+//------------------------------------------------------------------------------
 /**
  * Enable or disable partial block reads.
  *
@@ -494,6 +593,14 @@ uint8_t Sd2Card::readData(uint32_t block,
 #endif  // OPTIMIZE_HARDWARE_SPI
 
   offset_ += count;
+  // a whole block can be checked against the CRC16 that follows it
+  if (offset == 0 && count == 512) {
+    offset_ += 2;
+    if (!readCRC(dst, 512)) {
+      readEnd();
+      return false;
+    }
+  }
   if (!partialBlockRead_ || offset_ >= 512) {
     // read rest of data, checksum and set chip select high
     readEnd();
@@ -526,6 +633,26 @@ void Sd2Card::readEnd(void) {
   }
 }
 //------------------------------------------------------------------------------
+/**
+ * Receive the CRC16 that follows data read from the card and, with
+ * SD_CRC_READ enabled, check it against the data.
+ *
+ * \param[in] buf The data received.
+ * \param[in] count Number of bytes in \a buf.
+ *
+ * \return The value one, true, is returned if the CRC matched or wasn't
+ * checked and the value zero, false, is returned if it didn't match.
+ */
+uint8_t Sd2Card::readCRC(const uint8_t* buf, uint16_t count) {
+  uint16_t crc = spiRec() << 8;
+  crc |= spiRec();
+  if (readCRC_ && crc != crc16(0, buf, count)) {
+    error(SD_CARD_ERROR_READ_CRC);
+    return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
 /** read CID or CSR register */
 uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
   uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
@@ -536,8 +663,59 @@ uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
   if (!waitStartBlock()) goto fail;
   // transfer data
   for (uint16_t i = 0; i < 16; i++) dst[i] = spiRec();
-  spiRec();  // get first crc byte
-  spiRec();  // get second crc byte
+  if (!readCRC(dst, 16)) goto fail;
+  chipSelectHigh();
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
+/**
+ * Read a cards SCR register. The SCR contains the SD spec version and the
+ * value of erased data, DATA_STAT_AFTER_ERASE.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readSCR(scr_t* scr) {
+  uint8_t* dst = reinterpret_cast<uint8_t*>(scr);
+  if (cardAcmd(ACMD51, 0)) {
+    error(SD_CARD_ERROR_ACMD51);
+    goto fail;
+  }
+  if (!waitStartBlock()) goto fail;
+  // transfer data
+  for (uint16_t i = 0; i < sizeof(scr_t); i++) dst[i] = spiRec();
+  if (!readCRC(dst, sizeof(scr_t))) goto fail;
+  chipSelectHigh();
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
+/**
+ * Read the cards SD Status. The SD Status contains the allocation unit size
+ * and the erase timing parameters.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readSdStatus(sd_status_t* status) {
+  uint8_t* dst = reinterpret_cast<uint8_t*>(status);
+  if (cardAcmd(ACMD13, 0)) {
+    error(SD_CARD_ERROR_ACMD13);
+    goto fail;
+  }
+  // the response is R2, skip the second status byte
+  spiRec();
+  if (!waitStartBlock()) goto fail;
+  // transfer data
+  for (uint16_t i = 0; i < sizeof(sd_status_t); i++) dst[i] = spiRec();
+  if (!readCRC(dst, sizeof(sd_status_t))) goto fail;
   chipSelectHigh();
   return true;
 
@@ -593,6 +771,33 @@ uint8_t Sd2Card::setSckRate(uint8_t sckRateID) {
   return true;
 }
 //------------------------------------------------------------------------------
+/**
+ * Check or switch a card function with CMD6 (SWITCH_FUNC).
+ *
+ * \param[in] arg The mode, check (0) or switch (bit 31), and the function of
+ * each of the 6 function groups in 4 bit fields, 0XF keeps the current one.
+ * \param[out] status The 64 byte switch status.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::switchFunction(uint32_t arg, uint8_t* status) {
+  if (cardCommand(CMD6, arg)) {
+    error(SD_CARD_ERROR_CMD6);
+    goto fail;
+  }
+  if (!waitStartBlock()) goto fail;
+  // transfer data
+  for (uint16_t i = 0; i < 64; i++) status[i] = spiRec();
+  if (!readCRC(status, 64)) goto fail;
+  chipSelectHigh();
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
 // wait for card to go not busy
 uint8_t Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
   uint16_t t0 = millis();
@@ -648,13 +853,20 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
   }
   if (!writeData(DATA_START_BLOCK, src)) goto fail;
 
+  // programming goes on with the card deselected, the next command waits
+  if (overlapBusy_) {
+    busy_ = true;
+    chipSelectHigh();
+    return true;
+  }
+
   // wait for flash programming to complete
-  if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
+  if (!waitNotBusy(writeTimeout_)) {
     error(SD_CARD_ERROR_WRITE_TIMEOUT);
     goto fail;
   }
   // response is r2 so get and check two bytes for nonzero
-  if (cardCommand(CMD13, 0) || spiRec()) {
+  if (writeStatusCheck_ && (cardCommand(CMD13, 0) || spiRec())) {
     error(SD_CARD_ERROR_WRITE_PROGRAMMING);
     goto fail;
   }
@@ -666,15 +878,99 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Enable or disable the CMD13 status check after each writeBlock().
+ *
+ * Without it a single block write relies on the card's data response token
+ * and errors of the programming itself are left for a later cardStatus().
+ *
+ * \param[in] value The value TRUE (non-zero) or FALSE (zero).
+ */
+void Sd2Card::writeStatusCheck(uint8_t value) {
+  writeStatusCheck_ = value;
+}
+//------------------------------------------------------------------------------
+/**
+ * Set how long a write may keep the card busy before it fails with a
+ * timeout, SD_WRITE_TIMEOUT after init().
+ *
+ * \param[in] timeoutMillis The timeout in milliseconds.
+ */
+void Sd2Card::writeTimeout(uint16_t timeoutMillis) {
+  writeTimeout_ = timeoutMillis;
+}
+//------------------------------------------------------------------------------
+/**
+ * Enable or disable returning from writeBlock(), writeData() and writeStop()
+ * as soon as the card took the block or token, with the card deselected.
+ * Another card on the bus can then be used while this one programs, the
+ * wait for it is done by the next command to this card. Off after init().
+ *
+ * \param[in] value The value TRUE (non-zero) or FALSE (zero).
+ */
+void Sd2Card::overlapBusy(uint8_t value) {
+  overlapBusy_ = value;
+}
+//------------------------------------------------------------------------------
+/**
+ * Check whether the card is still programming a write left to it by
+ * overlapBusy(), without waiting.
+ *
+ * \return The value one, true, is returned while the card is busy and
+ * the value zero, false, is returned once it is ready for a command.
+ */
+uint8_t Sd2Card::isBusy(void) {
+  if (!busy_) return false;
+  chipSelectLow();
+  busy_ = spiRec() != 0XFF;
+  chipSelectHigh();
+  return busy_;
+}
+//------------------------------------------------------------------------------
+/**
+ * Read the number of blocks of the last multiple block write the card wrote
+ * without error with ACMD22 (SEND_NUM_WR_BLOCKS).
+ *
+ * \param[out] count The number of blocks.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::writtenBlocks(uint32_t* count) {
+  uint8_t buf[4];
+  if (cardAcmd(ACMD22, 0)) {
+    error(SD_CARD_ERROR_ACMD22);
+    goto fail;
+  }
+  if (!waitStartBlock()) goto fail;
+  for (uint8_t i = 0; i < 4; i++) buf[i] = spiRec();
+  if (!readCRC(buf, 4)) goto fail;
+  chipSelectHigh();
+  *count = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+    ((uint32_t)buf[2] << 8) | buf[3];
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
 /** Write one data block in a multiple block write sequence */
 uint8_t Sd2Card::writeData(const uint8_t* src) {
+  // the card may have been deselected while it programmed the last block
+  chipSelectLow();
   // wait for previous write to finish
-  if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
+  if (!waitNotBusy(writeTimeout_)) {
     error(SD_CARD_ERROR_WRITE_MULTIPLE);
     chipSelectHigh();
     return false;
   }
-  return writeData(WRITE_MULTIPLE_TOKEN, src);
+  if (!writeData(WRITE_MULTIPLE_TOKEN, src)) return false;
+  if (overlapBusy_) {
+    busy_ = true;
+    chipSelectHigh();
+  }
+  return true;
 }
 //------------------------------------------------------------------------------
 // send one block of data for write block or write multiple blocks
@@ -683,17 +979,10 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
   // CRC16 checksum is supposed to be ignored in SPI mode (unless
   // explicitly enabled) and a dummy value is normally written.
   // A few funny cards (e.g. Eye-Fi X2) expect a valid CRC anyway.
-  // Call setCRC(true) to enable CRC16 checksum on block writes.
-  // This has a noticeable impact on write speed. :(
-  int16_t crc;
+  // Call enableCRC(SD_CRC_WRITE) to enable CRC16 checksum on block writes.
+  uint16_t crc;
   if(writeCRC_) {
-    int16_t i, x;
-    // CRC16 code via Scott Dattalo www.dattalo.com
-    for(crc=i=0; i<512; i++) {
-      x   = ((crc >> 8) ^ src[i]) & 0xff;
-      x  ^= x >> 4;
-      crc = (crc << 8) ^ (x << 12) ^ (x << 5) ^ x;
-    }
+    crc = crc16(0, src, 512);
   } else {
     crc = 0xffff; // Dummy CRC value
   }
@@ -736,7 +1025,7 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
 /** Start a write multiple blocks sequence.
  *
  * \param[in] blockNumber Address of first block in sequence.
- * \param[in] eraseCount The number of blocks to be pre-erased.
+ * \param[in] eraseCount The number of blocks to be pre-erased, zero for none.
  *
  * \note This function is used with writeData() and writeStop()
  * for optimized multiple block writes.
@@ -752,8 +1041,8 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
     goto fail;
   }
 #endif  // SD_PROTECT_BLOCK_ZERO
-  // send pre-erase count
-  if (cardAcmd(ACMD23, eraseCount)) {
+  // send pre-erase count, none for zero
+  if (eraseCount && cardAcmd(ACMD23, eraseCount)) {
     error(SD_CARD_ERROR_ACMD23);
     goto fail;
   }
@@ -776,9 +1065,17 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
  * the value zero, false, is returned for failure.
  */
 uint8_t Sd2Card::writeStop(void) {
-  if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
+  chipSelectLow();
+  if (!waitNotBusy(writeTimeout_)) goto fail;
   spiSend(STOP_TRAN_TOKEN);
-  if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
+  if (overlapBusy_) {
+    // busy starts a byte after the token
+    spiRec();
+    busy_ = true;
+    chipSelectHigh();
+    return true;
+  }
+  if (!waitNotBusy(writeTimeout_)) goto fail;
   chipSelectHigh();
   return true;
 
@@ -788,7 +1085,26 @@ uint8_t Sd2Card::writeStop(void) {
   return false;
 }
 
-void Sd2Card::enableCRC(uint8_t mode) {
-  writeCRC_ = mode;
+/**
+ * Enable or disable CRC16 checksums of data blocks.
+ *
+ * \param[in] mode SD_CRC_WRITE sends the CRC of written blocks and turns on
+ * the card's checking of them (CMD59), a block with a bad CRC is then
+ * rejected. SD_CRC_READ checks the CRC of blocks and registers read. Zero
+ * turns both off.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned if the card refused CMD59.
+ */
+uint8_t Sd2Card::enableCRC(uint8_t mode) {
+  writeCRC_ = (mode & SD_CRC_WRITE) != 0;
+  readCRC_ = (mode & SD_CRC_READ) != 0;
+  if (cardCommand(CMD59, writeCRC_)) {
+    error(SD_CARD_ERROR_CMD59);
+    chipSelectHigh();
+    return false;
+  }
+  chipSelectHigh();
+  return true;
 }
 
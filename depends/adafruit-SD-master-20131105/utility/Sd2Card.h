@@ -143,6 +143,24 @@ uint8_t const SD_CARD_ERROR_WRITE_PROGRAMMING = 0X14;
 uint8_t const SD_CARD_ERROR_WRITE_TIMEOUT = 0X15;
 /** incorrect rate selected */
 uint8_t const SD_CARD_ERROR_SCK_RATE = 0X16;
+/** card returned an error to ACMD51 (read SCR) */
+uint8_t const SD_CARD_ERROR_ACMD51 = 0X17;
+/** card returned an error to ACMD13 (read SD Status) */
+uint8_t const SD_CARD_ERROR_ACMD13 = 0X18;
+/** card returned an error to CMD6 (switch function) */
+uint8_t const SD_CARD_ERROR_CMD6 = 0X19;
+/** CRC16 of data read from the card didn't match its data */
+uint8_t const SD_CARD_ERROR_READ_CRC = 0X1A;
+/** card returned an error to CMD59 (CRC on/off) */
+uint8_t const SD_CARD_ERROR_CMD59 = 0X1B;
+/** card returned an error to ACMD22 (number of well written blocks) */
+uint8_t const SD_CARD_ERROR_ACMD22 = 0X1C;
+//------------------------------------------------------------------------------
+// CRC modes, see Sd2Card::enableCRC()
+/** send the CRC16 of written blocks and have the card check it */
+uint8_t const SD_CRC_WRITE = 1;
+/** check the CRC16 of blocks and registers read */
+uint8_t const SD_CRC_READ = 2;
 //------------------------------------------------------------------------------
 // card types
 /** Standard capacity V1 SD card */
@@ -159,8 +177,10 @@ uint8_t const SD_CARD_TYPE_SDHC = 3;
 class Sd2Card {
  public:
   /** Construct an instance of Sd2Card. */
-  Sd2Card(void) : errorCode_(0), inBlock_(0), partialBlockRead_(0), type_(0) {}
+  Sd2Card(void) : errorCode_(0), inBlock_(0), partialBlockRead_(0), type_(0),
+    overlapBusy_(0), busy_(0) {}
   uint32_t cardSize(void);
+  uint16_t cardStatus(void);
   uint8_t erase(uint32_t firstBlock, uint32_t lastBlock);
   uint8_t eraseSingleBlockEnable(void);
   /**
@@ -185,6 +205,10 @@ class Sd2Card {
     return init(sckRateID, SD_CHIP_SELECT_PIN);
   }
   uint8_t init(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin = -1, int8_t misoPin = -1, int8_t clockPin = -1);
+  uint8_t initStart(uint8_t sckRateID, uint8_t chipSelectPin, int8_t mosiPin = -1, int8_t misoPin = -1, int8_t clockPin = -1);
+  uint8_t initPoll(uint8_t* ready);
+  uint8_t isBusy(void);
+  uint8_t cardDetect(uint8_t chipSelectPin, int8_t mosiPin = -1, int8_t misoPin = -1, int8_t clockPin = -1);
   void partialBlockRead(uint8_t value);
   /** Returns the current value, true or false, for partial block read. */
   uint8_t partialBlockRead(void) const {return partialBlockRead_;}
@@ -204,15 +228,28 @@ class Sd2Card {
   uint8_t readCSD(csd_t* csd) {
     return readRegister(CMD9, csd);
   }
+  uint8_t readSCR(scr_t* scr);
+  uint8_t readSdStatus(sd_status_t* status);
   void readEnd(void);
   uint8_t setSckRate(uint8_t sckRateID);
+  uint8_t switchFunction(uint32_t arg, uint8_t* status);
   /** Return the card type: SD V1, SD V2 or SDHC */
   uint8_t type(void) const {return type_;}
   uint8_t writeBlock(uint32_t blockNumber, const uint8_t* src);
+  uint8_t writtenBlocks(uint32_t* count);
   uint8_t writeData(const uint8_t* src);
   uint8_t writeStart(uint32_t blockNumber, uint32_t eraseCount);
   uint8_t writeStop(void);
-  void    enableCRC(uint8_t mode);
+  uint8_t enableCRC(uint8_t mode);
+  void writeStatusCheck(uint8_t value);
+  /** Returns the current value, true or false, for write status checks. */
+  uint8_t writeStatusCheck(void) const {return writeStatusCheck_;}
+  void writeTimeout(uint16_t timeoutMillis);
+  void overlapBusy(uint8_t value);
+  /** Returns the current value, true or false, for overlapped busy waits. */
+  uint8_t overlapBusy(void) const {return overlapBusy_;}
+  /** Returns how long, in ms, a write may keep the card busy. */
+  uint16_t writeTimeout(void) const {return writeTimeout_;}
 
 private:
   uint32_t block_;
@@ -224,6 +261,13 @@ private:
   uint8_t status_;
   uint8_t type_;
   uint8_t writeCRC_;
+  uint8_t readCRC_;
+  uint8_t writeStatusCheck_;
+  uint8_t overlapBusy_;
+  uint8_t busy_;
+  uint16_t writeTimeout_;
+  uint16_t initT0_;
+  uint8_t initSckRate_;
 
   
   // private functions
@@ -233,10 +277,12 @@ private:
   }
   uint8_t cardCommand(uint8_t cmd, uint32_t arg);
   void error(uint8_t code) {errorCode_ = code;}
+  uint8_t readCRC(const uint8_t* buf, uint16_t count);
   uint8_t readRegister(uint8_t cmd, void* buf);
   uint8_t sendWriteCommand(uint32_t blockNumber, uint32_t eraseCount);
   void chipSelectHigh(void);
   void chipSelectLow(void);
+  void spiSetup(uint8_t chipSelectPin, int8_t mosiPin, int8_t misoPin, int8_t clockPin);
   void type(uint8_t value) {type_ = value;}
   uint8_t waitNotBusy(uint16_t timeoutMillis);
   uint8_t writeData(uint8_t token, const uint8_t* src);
@@ -34,6 +34,9 @@
 // SD card commands
 /** GO_IDLE_STATE - init card in spi mode if CS low */
 uint8_t const CMD0 = 0X00;
+/** SWITCH_FUNC - check or switch a function of the card, returns the 64 byte
+    switch status */
+uint8_t const CMD6 = 0X06;
 /** SEND_IF_COND - verify SD Memory Card interface operating condition.*/
 uint8_t const CMD8 = 0X08;
 /** SEND_CSD - read the Card Specific Data (CSD register) */
@@ -59,12 +62,22 @@ uint8_t const CMD38 = 0X26;
 uint8_t const CMD55 = 0X37;
 /** READ_OCR - read the OCR register of a card */
 uint8_t const CMD58 = 0X3A;
+/** CRC_ON_OFF - turn the card's checking of command and write data CRCs on
+    (bit 0 of the argument set) or off */
+uint8_t const CMD59 = 0X3B;
+/** SD_STATUS - read the 64 byte SD Status */
+uint8_t const ACMD13 = 0X0D;
+/** SEND_NUM_WR_BLOCKS - the number of blocks of the last multiple block
+    write the card wrote without error */
+uint8_t const ACMD22 = 0X16;
 /** SET_WR_BLK_ERASE_COUNT - Set the number of write blocks to be
      pre-erased before writing */
 uint8_t const ACMD23 = 0X17;
 /** SD_SEND_OP_COMD - Sends host capacity support information and
     activates the card's initialization process */
 uint8_t const ACMD41 = 0X29;
+/** SEND_SCR - read the SD Configuration Register */
+uint8_t const ACMD51 = 0X33;
 //------------------------------------------------------------------------------
 /** status for card in the ready state */
 uint8_t const R1_READY_STATE = 0X00;
@@ -82,6 +95,8 @@ uint8_t const WRITE_MULTIPLE_TOKEN = 0XFC;
 uint8_t const DATA_RES_MASK = 0X1F;
 /** write data accepted token */
 uint8_t const DATA_RES_ACCEPTED = 0X05;
+/** write data rejected token, the data's CRC16 was wrong */
+uint8_t const DATA_RES_CRC_ERROR = 0X0B;
 //------------------------------------------------------------------------------
 typedef struct CID {
   // byte 0
@@ -106,6 +121,46 @@ typedef struct CID {
   unsigned crc : 7;
 }cid_t;
 //------------------------------------------------------------------------------
+// SD Configuration Register
+typedef struct SCR {
+  // byte 0
+  unsigned sd_spec : 4;
+  unsigned scr_structure : 4;
+  // byte 1
+  unsigned sd_bus_widths : 4;
+  unsigned sd_security : 3;
+  unsigned data_stat_after_erase : 1;
+  // byte 2-7
+  uint8_t reserved[6];
+}scr_t;
+//------------------------------------------------------------------------------
+// SD Status, only the fields up to the erase parameters are broken out
+typedef struct SDSTATUS {
+  // byte 0-1
+  unsigned reserved1 : 5;
+  unsigned secured_mode : 1;
+  unsigned dat_bus_width : 2;
+  uint8_t reserved2;
+  // byte 2-3
+  uint8_t sd_card_type[2];
+  // byte 4-7
+  uint8_t size_of_protected_area[4];
+  // byte 8
+  uint8_t speed_class;
+  // byte 9
+  uint8_t performance_move;
+  // byte 10
+  unsigned reserved3 : 4;
+  unsigned au_size : 4;
+  // byte 11-12
+  uint8_t erase_size[2];
+  // byte 13
+  unsigned erase_offset : 2;
+  unsigned erase_timeout : 6;
+  // byte 14-63
+  uint8_t reserved4[50];
+}sd_status_t;
+//------------------------------------------------------------------------------
 // CSD for version 1.00 cards
 typedef struct CSDV1 {
   // byte 0
@@ -0,0 +1,84 @@
+#ifndef _bench_h_
+#define _bench_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Card self benchmark, started by SEND DIAGNOSTIC and read back with RECEIVE
+ * DIAGNOSTIC RESULTS (see scsi_sd.c). The tests run against a scratch region
+ * of the card no lun maps, so no data is at risk, with the sd_* functions
+ * directly so neither the usb nor the host's caching is measured. Every
+ * operation is timed with the cpu's cycle counter.
+ *
+ * A run is done one operation per `bench_step`, from `scsi_sd_poll`, so it
+ * goes on between commands and the usb is never held off for all of it.
+ */
+
+/* blocks at the end of the card kept for the benchmark, set with
+   -DSD_SCRATCH_BLOCKS (see the Makefile). The luns see a card this much
+   smaller, 0 leaves the benchmark unavailable */
+#ifndef SD_SCRATCH_BLOCKS
+#define SD_SCRATCH_BLOCKS (0)
+#endif
+
+/* blocks per operation of the sequential tests, a single CMD25 for writes */
+#define BENCH_SEQ_OP_BLOCKS    (32)
+/* blocks per operation of the random tests, 4 KiB aligned to 4 KiB */
+#define BENCH_RANDOM_OP_BLOCKS (8)
+
+/* the tests, in the order they are run */
+enum bench_test {
+    BENCH_SEQ_READ = 0,
+    BENCH_SEQ_WRITE,
+    BENCH_RANDOM_READ,
+    BENCH_RANDOM_WRITE,
+    BENCH_TESTS
+};
+
+enum bench_status {
+    BENCH_IDLE = 0,                     /* never started                      */
+    BENCH_RUNNING,
+    BENCH_DONE,
+    BENCH_FAILED,                       /* the card returned an error         */
+    BENCH_ABORTED
+};
+
+typedef struct {
+    uint32_t seq_blocks;                /* blocks read then written in order  */
+    uint32_t random_ops;                /* 4 KiB reads, then as many writes   */
+    uint32_t seed;                      /* of the random offsets, 0 picks one */
+} bench_config_t;
+
+typedef struct {
+    uint32_t ops;                       /* operations completed               */
+    uint32_t blocks;                    /* blocks they transferred            */
+    uint64_t cycles;                    /* total of the operations            */
+    uint32_t min_cycles;                /* fastest operation                  */
+    uint32_t max_cycles;                /* slowest operation                  */
+} bench_result_t;
+
+/* clear the results and start a run over [lba, lba + count) of the card,
+   aborting the one in progress. Returns -1 if the region is too small */
+int bench_start(uint32_t lba, uint32_t count, const bench_config_t *config);
+/* do the next operation, returns 1 while the run goes on, 0 once it is over
+   and -1 if the card failed */
+int bench_step(void);
+void bench_abort(void);
+
+enum bench_status bench_status(void);
+/* the test being run */
+enum bench_test bench_test(void);
+/* the config of the last run, clamped to its region */
+const bench_config_t *bench_config(void);
+/* BENCH_TESTS results of the last run, indexed by `enum bench_test` */
+const bench_result_t *bench_results(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _crc_h_
+#define _crc_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+#include <stddef.h>
+#include <stdint.h>
+    
+/*
+ * The checksums of the sd card's spi protocol, sd physical layer simplified
+ * spec 4.5. Commands end with a CRC7 (x^7 + x^3 + 1), data blocks with a
+ * CRC16-CCITT (x^16 + x^12 + x^5 + 1), both with a 0 seed and sent msb first.
+ *
+ * CRC7 is table driven. CRC16 runs on the Kinetis CRC module, fed a word at a
+ * time, unless built with -DCRC_SOFTWARE or for another target, which slice
+ * by 4 bytes through tables built on first use.
+ */
+    
+/* the last byte of an sd command of the `length` bytes before it, the CRC7
+   shifted up with the end bit set */
+uint8_t crc7(const void *buf, size_t length);
+/* CRC16-CCITT of `length` bytes, continued from `crc` (0 to start) */
+uint16_t crc16(uint16_t crc, const void *buf, size_t length);
+    
+/* check both against known answers, returns -1 if they are wrong */
+int crc_self_test(void);
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _ftl_h_
+#define _ftl_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Optional log structured translation layer between scsi_sd.c and the card,
+ * enabled by building with -DSD_FTL (see the Makefile).
+ *
+ * The end of the card is reserved for FTL_SEGMENTS log segments of one
+ * allocation unit each and a checkpoint region. Every multiple block write is
+ * appended to the current segment as a record: the data blocks followed by a
+ * footer block naming the lbas they hold. Random writes from the host so
+ * become sequential writes to the card. A compact extent map in RAM says
+ * which lbas live in the log, every other lba is read from its home location
+ * (the same physical lba). The map is checkpointed to the card and a scan of
+ * the records written after the checkpoint rebuilds it on init. In the main
+ * loop the oldest segment is garbage collected by copying its live blocks back
+ * home, after which it is reused. When the host writes faster than that, each
+ * record first copies a few blocks home itself, and a record that still
+ * doesn't fit is refused (see `ftl_full`) rather than collecting a whole
+ * segment inside the usb interrupt. Writes of FTL_DIRECT_BLOCKS or more are
+ * sequential already and go to their home location, dropping what the log
+ * held of them.
+ *
+ * Every block the log takes is written twice and read once, which only pays
+ * off when the card is slower at out of order writes than that. On the card
+ * model tools/ftlbench assumes (`ftlbench -n 2000`), 512 byte random writes
+ * gain, 0.155 against 0.105 MB/s, but 4 KiB random writes sustain 0.49
+ * against 0.65 MB/s through the log. Their mean latency drops from 6.3 to
+ * 2.0 ms while the longest, of a write that collects for itself, rises from
+ * 6.7 to 19 ms. With the host pausing 10 ms between them (-g 10000) the
+ * collection runs in the pauses and they come out ahead, 0.29 against 0.25
+ * MB/s. Measure the card before building with -DSD_FTL.
+ *
+ * The interface mirrors the parts of sd.h that scsi_sd.c uses, `sd_init` has
+ * to be called before `ftl_init`.
+ */
+
+/* load the checkpoint and replay the log, formats the log when the card has
+   none. Returns 0 on success */
+int ftl_init(void);
+/* # of blocks available to the host, the card minus the reserved region */
+uint32_t ftl_max_lba(void);
+int ftl_read_block(void *dest, uint32_t lba);
+
+/* same as the sd_write_* functions, the blocks of a multiple block write are
+   only mapped, and so readable, once `ftl_write_stop` returns */
+int ftl_write_start(uint32_t lba, uint32_t count);
+int ftl_write_data(const void *src);
+int ftl_write_stop(void);
+
+/* erasing isn't supported through the log, always 0 */
+uint32_t ftl_erase_group(void);
+
+/* background garbage collection and checkpointing, call from the main loop */
+void ftl_poll(void);
+/* writes the checkpoint if records were added since the last one, so a power
+   loss leaves no log to replay. Returns < 0 if it failed */
+int ftl_sync(void);
+/* 1 if the last write failed because the log had no room for its record, it
+   didn't touch the card and can be retried once `ftl_poll` collected more */
+int ftl_full(void);
+/* collects until a record fits, for writes that can't be retried later. It
+   may take seconds. Returns < 0 if it failed */
+int ftl_make_room(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _ramdisk_h_
+#define _ramdisk_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Blocks of SRAM for SCSI_SD_BACKEND_RAM luns (see scsi_sd.h), a scratch 
+ * volume without the card's latency. The contents are lost on a power cycle
+ * but survive a usb reset or reconfiguration. The interface mirrors the block
+ * operations of sd.h.
+ */
+
+/* # of 512 byte blocks reserved, set with -DRAMDISK_BLOCKS (see the Makefile) */
+#ifndef RAMDISK_BLOCKS
+#define RAMDISK_BLOCKS (0)
+#endif
+
+uint32_t ramdisk_max_lba(void);
+int ramdisk_read_block(void *dest, uint32_t lba);
+int ramdisk_write_block(uint32_t lba, const void *src);
+
+/* the block itself so it can be sent without a copy, NULL if out of range */
+const void *ramdisk_block(uint32_t lba);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _buffer_h_
+#define _buffer_h_
+
+#include <stdint.h>
+
+/*
+ * scsi spc 4r37 READ BUFFER (10) command
+ * scsi spc 4r37 WRITE BUFFER command
+ */
+
+#define READ_BUFFER10_LENGTH    (0x0a)
+#define READ_BUFFER10_OPCODE    (0x3c)
+#define WRITE_BUFFER_LENGTH     (0x0a)
+#define WRITE_BUFFER_OPCODE     (0x3b)
+
+/* MODES, the ones shared by both commands */
+#define BUFFER_MODE_MASK                (0x1f)
+#define BUFFER_MODE_DATA                (0x02)
+#define BUFFER_MODE_DESCRIPTOR          (0x03) /* READ BUFFER only            */
+#define BUFFER_MODE_ECHO                (0x0a)
+#define BUFFER_MODE_ECHO_DESCRIPTOR     (0x0b) /* READ BUFFER only            */
+
+/* the buffer id and offset share a big endian word, as do the 24 bit length 
+   and the control byte */
+#define BUFFER_ID_SHIFT                 (24)
+#define BUFFER_OFFSET_MASK              (0x00ffffff)
+#define BUFFER_LENGTH_SHIFT             (8)
+
+/* descriptor mode: offset boundary as a power of 2 and the buffer capacity */
+#define BUFFER_DESCRIPTOR_LENGTH        (0x04)
+/* echo buffer descriptor mode: the capacity is at most 4096 bytes */
+#define BUFFER_ECHO_CAPACITY_MASK       (0x1fff)
+#define BUFFER_ECHO_CAPACITY_MAX        (0x1000)
+
+
+struct read_buffer10 {
+    uint8_t  opcode;
+    uint8_t  mode;                      /* mode specific, mode                */
+    uint32_t id_offset;                 /* buffer id, 24 bit offset           */
+    uint32_t length_control;            /* 24 bit allocation length, control  */
+} __attribute__((packed));
+
+struct write_buffer {
+    uint8_t  opcode;
+    uint8_t  mode;                      /* mode specific, mode                */
+    uint32_t id_offset;                 /* buffer id, 24 bit offset           */
+    uint32_t length_control;            /* 24 bit parameter list length, 
+                                           control                            */
+} __attribute__((packed));
+
+struct buffer_descriptor {
+    uint8_t  offset_boundary;
+    uint8_t  capacity[3];               /* big endian                         */
+} __attribute__((packed));
+
+struct echo_buffer_descriptor {
+    uint8_t  flags;                     /* EBOS                               */
+    uint8_t  _reserved;
+    uint16_t capacity;                  /* 13 bits, big endian                */
+} __attribute__((packed));
+
+
+typedef struct read_buffer10 read_buffer10_t;
+typedef struct write_buffer write_buffer_t;
+typedef struct buffer_descriptor buffer_descriptor_t;
+typedef struct echo_buffer_descriptor echo_buffer_descriptor_t;
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _diagnostic_page_h_
+#define _diagnostic_page_h_
+
+#include <stdint.h>
+
+/*
+ * scsi spc 3r23 7.1 Diagnostic parameters, the pages sent by SEND DIAGNOSTIC
+ * and returned by RECEIVE DIAGNOSTIC RESULTS
+ */
+
+#define DIAGNOSTIC_PAGE_SUPPORTED_PAGES     (0x00)
+#define DIAGNOSTIC_PAGE_BENCH               (0x80) /* vendor, see bench.h     */
+
+/* calculate the page_length field of struct diagnostic_page_header */
+#define DIAGNOSTIC_PAGE_LENGTH(resplen)                                        \
+    ((resplen) - sizeof(struct diagnostic_page_header))
+
+
+/* Table 190, every page starts with this header */
+struct diagnostic_page_header {
+    uint8_t  page_code;
+    uint8_t  page_specific;
+    uint16_t page_length;
+} __attribute__((packed));
+
+/* the bench page sent by SEND DIAGNOSTIC starts a run with these values */
+struct diagnostic_bench_parameters {
+    struct diagnostic_page_header header;
+    uint32_t seq_blocks;
+    uint32_t random_ops;
+    uint32_t seed;
+} __attribute__((packed));
+
+/* the results of one test, times are in cpu cycles */
+struct diagnostic_bench_result {
+    uint32_t ops;
+    uint32_t blocks;
+    uint32_t cycles_high;
+    uint32_t cycles_low;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+} __attribute__((packed));
+
+/* the bench page returned by RECEIVE DIAGNOSTIC RESULTS, every field is big 
+   endian */
+struct diagnostic_bench_page {
+    struct diagnostic_page_header header;
+    uint8_t  status;                    /* enum bench_status                  */
+    uint8_t  test;                      /* enum bench_test being run          */
+    uint16_t _reserved;
+    uint32_t cpu_hz;                    /* cycles per second                  */
+    uint32_t scratch_lba;               /* the card's blocks tested           */
+    uint32_t scratch_blocks;
+    uint32_t seq_blocks;
+    uint32_t random_ops;
+    uint32_t seed;
+    struct diagnostic_bench_result results[4]; /* by enum bench_test          */
+} __attribute__((packed));
+
+typedef struct diagnostic_page_header diagnostic_page_header_t;
+typedef struct diagnostic_bench_parameters diagnostic_bench_parameters_t;
+typedef struct diagnostic_bench_result diagnostic_bench_result_t;
+typedef struct diagnostic_bench_page diagnostic_bench_page_t;
+
+#endif
@@ -10,7 +10,7 @@
 #define INQUIRY_LENGTH                    (0x06)
 
 /* MASKS */
-#define INQUIRY_EVPD_MASK                 (0x80)
+#define INQUIRY_EVPD_MASK                 (0x01)
 
 /* COMMAND VALUES */
 #define INQUIRY_OPCODE                    (0x12)
@@ -23,6 +23,7 @@
 #define INQUIRY_DATA_PQ_CONNECTED         (0x00) /* periph dev is connected   */
 #define INQUIRY_DATA_RMB_REMOVABLE        (0x80) 
 #define INQUIRY_DATA_VERSION_NON_STANDARD (0x00)
+#define INQUIRY_DATA_VERSION_SPC4         (0x06) /* scsi-spc-4r37             */
 #define INQUIRY_DATA_RDF_STANDARD         (0x02) /* conforms to scsi standard */
 
 /* calculate the additional_length field of struct inquiry_data */
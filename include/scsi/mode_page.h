@@ -10,6 +10,11 @@
 #define FLEXIBLE_DISK_PAGE_CODE     (0x05)
 #define FLEXIBLE_DISK_PAGE_LENGTH   (0x1e)
 
+#define CACHING_PAGE_CODE           (0x08)
+#define CACHING_PAGE_LENGTH         (0x12)
+#define CACHING_PAGE_WCE            (0x04)  /* write cache enable            */
+#define CACHING_PAGE_RCD            (0x01)  /* read cache disable            */
+
 /* scsi-spc-3r23 p282 7.4.5 Table 242 */
 
 struct mode_page_0 {
@@ -29,6 +34,24 @@ struct mode_page_flexible_disk {
     uint8_t  _reserved[22];       /* ufi motor on/off speed and rotation info */
 } __attribute__((packed));
 
+/* sbc-3r25 Caching mode page */
+struct mode_page_caching {
+    uint8_t  page_code;
+    uint8_t  page_length;               /* n - 1 */
+    uint8_t  flags;                     /* ic, abpf, cap, disc, size, wce,
+                                           mf, rcd                            */
+    uint8_t  retention_priority;        /* demand read and write              */
+    uint16_t disable_prefetch_transfer_length;
+    uint16_t minimum_prefetch;
+    uint16_t maximum_prefetch;
+    uint16_t maximum_prefetch_ceiling;
+    uint8_t  flags2;                    /* fsw, lbcss, dra, nv_dis            */
+    uint8_t  cache_segment_count;
+    uint16_t cache_segment_size;
+    uint8_t  _reserved[4];
+} __attribute__((packed));
+
 typedef struct mode_page_flexible_disk mode_page_flexible_disk_t;
+typedef struct mode_page_caching       mode_page_caching_t;
 
 #endif
\ No newline at end of file
@@ -5,13 +5,23 @@
 
 /*
  * scsi-sbc-344r0.pdf p53 5.10 READ CAPACITY (10) command
+ * scsi-sbc-3r25.pdf p102 5.16 READ CAPACITY (16) command
  */
 
 #define READ_CAPACITY10_LENGTH      (0x0a)
+#define READ_CAPACITY16_LENGTH      (0x10)
 /* MASKS */
 #define READ_CAPACITY10_PMI_MASK    (0x01)
+#define READ_CAPACITY16_PMI_MASK    (0x01)
+#define SERVICE_ACTION_MASK         (0x1f)
 /* COMMAND VALUES */
 #define READ_CAPACITY10_OPCODE      (0x25)
+/* READ CAPACITY (16) is a service action of SERVICE ACTION IN (16) */
+#define SERVICE_ACTION_IN16_OPCODE  (0x9e)
+#define READ_CAPACITY16_SERVICE_ACTION (0x10)
+/* DATA VALUES */
+#define READ_CAPACITY16_DATA_LBPME  (0x80) /* logical block provisioning      */
+#define READ_CAPACITY16_DATA_LBPRZ  (0x40) /* unmapped blocks read as zero    */
 
 
 struct read_capacity10 {
@@ -30,7 +40,31 @@ struct read_capacity10_data {
 } __attribute__((packed));
 
 
+struct read_capacity16 {
+    uint8_t     opcode;
+    uint8_t     service_action;
+    uint32_t    lba_high;           /* 64 bit lba big-endian                  */
+    uint32_t    lba;
+    uint32_t    allocation_length;
+    uint8_t     pmi;
+    uint8_t     control;
+} __attribute__((packed));
+
+
+struct read_capacity16_data {
+    uint32_t lba_high;              /* last lba, 64 bit big-endian            */
+    uint32_t lba;
+    uint32_t block_length;
+    uint8_t  protection;            /* p_type, prot_en                        */
+    uint8_t  exponents;             /* p_i_exponent, lb per pb exponent       */
+    uint16_t lbp_lowest_aligned;    /* lbpme, lbprz, lowest aligned lba       */
+    uint8_t  _reserved[16];
+} __attribute__((packed));
+
+
 typedef struct read_capacity10      read_capacity10_t;
 typedef struct read_capacity10_data read_capacity10_data_t;
+typedef struct read_capacity16      read_capacity16_t;
+typedef struct read_capacity16_data read_capacity16_data_t;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef _receive_diagnostic_results_h_
+#define _receive_diagnostic_results_h_
+
+#include <stdint.h>
+
+/* scsi spc 3r23 6.24 RECEIVE DIAGNOSTIC RESULTS command */
+
+#define RECEIVE_DIAGNOSTIC_RESULTS_OPCODE       (0x1c)
+
+/* masks */
+#define RECEIVE_DIAGNOSTIC_RESULTS_PCV_MASK     (0x01) /* page code is valid  */
+
+
+struct receive_diagnostic_results {
+    uint8_t  opcode;
+    uint8_t  pcv;
+    uint8_t  page_code;
+    uint16_t allocation_length;
+    uint8_t  control;
+} __attribute__((packed));
+
+typedef struct receive_diagnostic_results receive_diagnostic_results_t;
+
+#endif
@@ -1,12 +1,14 @@
 #ifndef _scsi_h_
 #define _scsi_h_
 
-/* SENSE and MODE data */
+/* SENSE, MODE and diagnostic data */
 #include "sense_data.h"
 #include "mode_parameter.h"
 #include "mode_page.h"
+#include "diagnostic_page.h"
 
 /* SCSI Command Descriptor Blocks */
+#include "buffer.h"
 #include "inquiry.h"
 #include "load_unload.h"
 #include "mode_sense.h"
@@ -14,11 +16,18 @@
 #include "read.h"
 #include "read_capacity.h"
 #include "read_format_capacities.h"
+#include "receive_diagnostic_results.h"
 #include "report_luns.h"
 #include "request_sense.h"
 #include "send_diagnostic.h"
+#include "synchronize_cache.h"
 #include "test_unit_ready.h"
+#include "unmap.h"
 #include "write.h"
+#include "write_same.h"
+
+/* Vital Product Data pages returned by INQUIRY */
+#include "vpd.h"
 
 /* currently there is no header file for this command */
 #define FORMAT_UNIT_OPCODE          (0x04)
@@ -41,14 +41,21 @@
 
 #define ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT      (0x0300)
 #define ASC_ASCQ_LUN_NOT_READY                      (0x0400)
+#define ASC_ASCQ_LUN_BECOMING_READY                 (0x0401)
+#define ASC_ASCQ_LUN_OPERATION_IN_PROGRESS          (0x0407)
 #define ASC_ASCQ_UNRECOVERD_READ_ERROR              (0x1100)
+#define ASC_ASCQ_PARAMETER_LIST_LENGTH_ERROR        (0x1a00)
 #define ASC_ASCQ_INVALID_COMMAND                    (0x2000)
 #define ASC_ASCQ_LBA_OUT_OF_RANGE                   (0x2100)
 #define ASC_ASCQ_LUN_NOT_SUPPORTED                  (0x2500)
 #define ASC_ASCQ_INVALID_FIELD_IN_CDB               (0x2400)
+#define ASC_ASCQ_INVALID_FIELD_IN_PARAMETER_LIST    (0x2600)
+#define ASC_ASCQ_WRITE_PROTECTED                    (0x2700)
 #define ASC_ASCQ_NOT_READY_MEDIUM_MAY_HAVE_CHANGED  (0x2800)
+#define ASC_ASCQ_COMMAND_SEQUENCE_ERROR             (0x2c00)
 #define ASC_ASCQ_FORMAT_COMMAND_FAILED              (0x3101)
 #define ASC_ASCQ_MEDIUM_NOT_PRESENT                 (0x3a00)
+#define ASC_ASCQ_LUN_FAILED_SELF_TEST               (0x3e03)
 
 
 #define FIXED_FORMAT_SENSE_DATA_DEFAULT                                         \
@@ -0,0 +1,30 @@
+#ifndef _synchronize_cache_h_
+#define _synchronize_cache_h_
+
+#include <stdint.h>
+
+/*
+ * scsi-sbc-3r25.pdf p175 5.20 SYNCHRONIZE CACHE (10) command
+ */
+
+#define SYNCHRONIZE_CACHE10_LENGTH  (0x0a)
+/* COMMAND VALUES */
+#define SYNCHRONIZE_CACHE10_OPCODE  (0x35)
+/* MASKS */
+#define SYNCHRONIZE_CACHE_IMMED_MASK (0x02)
+
+
+struct synchronize_cache10 {
+    uint8_t  opcode;
+    uint8_t  flags;                         /* sync_nv, immed                 */
+    uint32_t lba;
+    uint8_t  group;
+    uint16_t block_count;                   /* 0 for all blocks from lba on   */
+    uint8_t  control;
+} __attribute__((packed));
+
+
+typedef struct synchronize_cache10 synchronize_cache10_t;
+
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _unmap_h_
+#define _unmap_h_
+
+#include <stdint.h>
+
+/*
+ * scsi-sbc-3r25.pdf p162 5.28 UNMAP command
+ */
+
+#define UNMAP_LENGTH                        (0x0a)
+/* COMMAND VALUES */
+#define UNMAP_OPCODE                        (0x42)
+/* MASKS */
+#define UNMAP_ANCHOR_MASK                   (0x01)
+
+/* p163 Table 151 and 152, UNMAP parameter list header and descriptors */
+#define UNMAP_PARAMETER_LIST_HEADER_LENGTH  (0x08)
+#define UNMAP_BLOCK_DESCRIPTOR_LENGTH       (0x10)
+
+
+struct unmap {
+    uint8_t  opcode;
+    uint8_t  anchor;
+    uint8_t  _reserved[4];
+    uint8_t  group;
+    uint16_t parameter_list_length;
+    uint8_t  control;
+} __attribute__((packed));
+
+
+struct unmap_parameter_list_header {
+    uint16_t unmap_data_length;             /* n - 1                          */
+    uint16_t block_descriptor_data_length;  /* descriptor count * 16          */
+    uint32_t _reserved;
+} __attribute__((packed));
+
+
+struct unmap_block_descriptor {
+    uint32_t lba_high;                      /* 64 bit lba big-endian          */
+    uint32_t lba;
+    uint32_t count;                         /* # of blocks to unmap           */
+    uint32_t _reserved;
+} __attribute__((packed));
+
+
+typedef struct unmap                        unmap_t;
+typedef struct unmap_parameter_list_header  unmap_parameter_list_header_t;
+typedef struct unmap_block_descriptor       unmap_block_descriptor_t;
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _vpd_h_
+#define _vpd_h_
+
+#include <stdint.h>
+
+/*
+ * scsi-spc-4r37.pdf p600 7.8 Vital product data parameters, returned by an 
+ * INQUIRY with the EVPD bit set
+ */
+
+#define VPD_PAGE_SUPPORTED_PAGES            (0x00)
+#define VPD_PAGE_UNIT_SERIAL_NUMBER         (0x80)
+#define VPD_PAGE_BLOCK_LIMITS               (0xb0)
+#define VPD_PAGE_BLOCK_DEVICE_CHARACTERISTICS (0xb1)
+#define VPD_PAGE_LOGICAL_BLOCK_PROVISIONING (0xb2)
+#define VPD_PAGE_DEVICE_STATISTICS          (0xc0) /* vendor, see stats.h */
+#define VPD_PAGE_CARD_INTERFACE             (0xc1) /* vendor, see sd.h    */
+
+/* sbc-3r25 p273 6.5.3 Table 193, Block Limits page */
+#define VPD_BL_WSNZ                         (0x01) /* WRITE SAME count != 0   */
+#define VPD_BL_UGAVALID                     (0x80000000)
+
+/* sbc-3r25 p275 6.5.2 Table 196, Block Device Characteristics page */
+#define VPD_BDC_NON_ROTATING_MEDIUM         (0x0001)
+
+/* sbc-3r25 p277 6.5.4 Table 199, Logical Block Provisioning page */
+#define VPD_LBP_LBPU                        (0x80) /* UNMAP supported         */
+#define VPD_LBP_LBPWS                       (0x40) /* WRITE SAME(16) unmap    */
+#define VPD_LBP_LBPWS10                     (0x20) /* WRITE SAME(10) unmap    */
+#define VPD_LBP_LBPRZ                       (0x04) /* unmapped reads as zeros */
+#define VPD_LBP_ANC_SUP                     (0x02) /* anchor supported        */
+#define VPD_LBP_PROVISIONING_TYPE_FULL      (0x00)
+#define VPD_LBP_PROVISIONING_TYPE_RESOURCE  (0x01)
+#define VPD_LBP_PROVISIONING_TYPE_THIN      (0x02)
+
+/* calculate the page_length field of struct vpd_page_header */
+#define VPD_PAGE_LENGTH(resplen) ((resplen) - sizeof(struct vpd_page_header))
+
+
+/* p600 Table 487, every page starts with this header */
+struct vpd_page_header {
+    uint8_t  peripheral;                /* same as in the standard inquiry    */
+    uint8_t  page_code;
+    uint16_t page_length;               /* n - 3                              */
+} __attribute__((packed));
+
+
+/* p656 Table 587, followed by the ascii serial number. The card's serial number
+   and the lun, both in hex */
+struct vpd_unit_serial_number {
+    struct vpd_page_header header;
+    char     serial_number[10];
+} __attribute__((packed));
+
+
+/* counts are in logical blocks, 0 is no limit/reported */
+struct vpd_block_limits {
+    struct vpd_page_header header;
+    uint8_t  flags;                     /* wsnz                               */
+    uint8_t  maximum_compare_and_write_length;
+    uint16_t optimal_transfer_length_granularity;
+    uint32_t maximum_transfer_length;
+    uint32_t optimal_transfer_length;
+    uint32_t maximum_prefetch_length;
+    uint32_t maximum_unmap_lba_count;
+    uint32_t maximum_unmap_block_descriptor_count;
+    uint32_t optimal_unmap_granularity;
+    uint32_t unmap_granularity_alignment; /* ugavalid is the top bit          */
+    uint32_t maximum_write_same_length_high;
+    uint32_t maximum_write_same_length;
+    uint8_t  _reserved[20];
+} __attribute__((packed));
+
+
+struct vpd_block_device_characteristics {
+    struct vpd_page_header header;
+    uint16_t medium_rotation_rate;
+    uint8_t  product_type;
+    uint8_t  form_factor;               /* wabereq, wacereq, nominal form     */
+    uint8_t  flags;                     /* vbuls, fuab                        */
+    uint8_t  _reserved[55];
+} __attribute__((packed));
+
+
+struct vpd_logical_block_provisioning {
+    struct vpd_page_header header;
+    uint8_t  threshold_exponent;
+    uint8_t  flags;                     /* lbpu, lbpws, lbpws10, lbprz, ...   */
+    uint8_t  provisioning_type;
+    uint8_t  _reserved;
+} __attribute__((packed));
+
+
+/* vendor page, how the card is run. The modes are SD_SPEED_* of sd.h */
+struct vpd_card_interface {
+    struct vpd_page_header header;
+    uint8_t  speed_mode;                /* bus speed mode switched to         */
+    uint8_t  _reserved;
+    uint16_t speed_modes;               /* a bit per mode the card supports   */
+    uint32_t spi_hz;                    /* spi clock                          */
+} __attribute__((packed));
+
+
+typedef struct vpd_page_header                vpd_page_header_t;
+typedef struct vpd_unit_serial_number         vpd_unit_serial_number_t;
+typedef struct vpd_block_limits               vpd_block_limits_t;
+typedef struct vpd_block_device_characteristics vpd_block_device_characteristics_t;
+typedef struct vpd_logical_block_provisioning vpd_logical_block_provisioning_t;
+typedef struct vpd_card_interface             vpd_card_interface_t;
+
+#endif
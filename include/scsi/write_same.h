@@ -0,0 +1,48 @@
+#ifndef _write_same_h_
+#define _write_same_h_
+
+#include <stdint.h>
+
+/*
+ * scsi-sbc-3r25.pdf p179 5.40 WRITE SAME (10) command
+ * scsi-sbc-3r25.pdf p183 5.42 WRITE SAME (16) command
+ */
+
+#define WRITE_SAME10_LENGTH     (0x0a)
+#define WRITE_SAME16_LENGTH     (0x10)
+
+/* COMMAND VALUES */
+#define WRITE_SAME10_OPCODE     (0x41)
+#define WRITE_SAME16_OPCODE     (0x93)
+
+/* MASKS */
+#define WRITE_SAME_UNMAP_MASK   (0x08)
+#define WRITE_SAME_ANCHOR_MASK  (0x10)
+#define WRITE_SAME_NDOB_MASK    (0x01)  /* (16) only, no data-out buffer      */
+
+
+struct write_same10 {
+    uint8_t  opcode;
+    uint8_t  flags;                     /* wrprotect, anchor, unmap           */
+    uint32_t lba;
+    uint8_t  group;
+    uint16_t transfer_length;           /* # of blocks to write               */
+    uint8_t  control;
+} __attribute__((packed));
+
+
+struct write_same16 {
+    uint8_t  opcode;
+    uint8_t  flags;                     /* wrprotect, anchor, unmap, ndob     */
+    uint32_t lba_high;                  /* 64 bit lba big-endian              */
+    uint32_t lba;
+    uint32_t transfer_length;
+    uint8_t  group;
+    uint8_t  control;
+} __attribute__((packed));
+
+
+typedef struct write_same10 write_same10_t;
+typedef struct write_same16 write_same16_t;
+
+#endif
@@ -2,24 +2,84 @@
 #define _scsi_sd_h_
 
 #include <unistd.h>
+#include <stdint.h>
 #include "scsi/scsi.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
+
+/* # of luns that can be configured, the CBW allows for up to 16 */
+#ifndef SCSI_SD_MAX_LUNS
+#define SCSI_SD_MAX_LUNS (4)
+#endif
+
+/* what the blocks of a lun are stored on */
+#define SCSI_SD_BACKEND_CARD   (0) /* a slice of the sd card                  */
+#define SCSI_SD_BACKEND_IMAGE  (1) /* a read only image in flash              */
+#define SCSI_SD_BACKEND_RAM    (2) /* a slice of the ram disk, see ramdisk.h  */
+
+/* per lun flags, the cache flags are only valid on card luns */
+#define SCSI_SD_LUN_READ_ONLY  (0x01) /* writes fail with DATA PROTECT        */
+#define SCSI_SD_LUN_STAGE      (0x02) /* gather writes in the write stage,
+                                         otherwise they go straight to card.
+                                         Reported as a write cache (WCE) the
+                                         host flushes with SYNCHRONIZE CACHE */
+#define SCSI_SD_LUN_SKIP_ZEROS (0x04) /* erase or skip zero filled blocks     */
+
+typedef struct {
+    uint8_t     backend;
+    uint8_t     flags;
+    uint32_t    lba;    /* card/ram: first lba of the slice                   */
+    uint32_t    count;  /* # of blocks, card/ram: 0 for the rest              */
+    const void *image;  /* image: `count` blocks                              */
+} scsi_sd_lun_config_t;
+
+/* 
+ * the luns presented to the host, lun n is `luns[n]`. Card or ram disk slices
+ * may not overlap and only card luns may have the cache flags. Takes effect 
+ * on the next `scsi_sd_init`, returns < 0 if the configuration is invalid and
+ * the previous one is kept. Without it the SCSI_SD_LUNS build option, or the 
+ * whole card as a single lun, is used.
+ */
+int scsi_sd_configure(const scsi_sd_lun_config_t *luns, size_t count);
+
+/* the highest lun number, for GET MAX LUN and the CBW's bCBWLUN */
+uint8_t scsi_sd_max_lun(void);
     
 /* 
- * sets up communication with the sd card and intializing SCSI structures. 
- * Returns 0 on success, error otherwise. 
+ * intializes the SCSI structures of the luns. The card itself is brought up 
+ * in the background by `scsi_sd_poll`, until then its luns report NOT READY 
+ * and once it's ready a UNIT ATTENTION. Returns 0 on success, error otherwise.
  */    
 int scsi_sd_init(void);
 
 /*
- * Sets up state information for the new CDB. Returning the number of bytes, 
- * expected to be transfered in the DATA PHASE. Returns < 0 if there is an 
- * error.
+ * Sets up state information for the new CDB addressed to `lun`. Returning the
+ * number of bytes, expected to be transfered in the DATA PHASE. Returns < 0 if
+ * there is an error.
  */
-ssize_t scsi_sd_begin(const void *cdb, size_t cdblen);
+ssize_t scsi_sd_begin(uint8_t lun, const void *cdb, size_t cdblen);
+
+/*
+ * `scsi_sd_begin` of a READ (`write` 0) or WRITE of `count` blocks at `lba`,
+ * for transports without CDBs (see usb_blk.h). The data is then moved like
+ * that of a READ(10)/WRITE(10). Returns the number of bytes, < 0 on error.
+ */
+ssize_t scsi_sd_begin_blocks(uint8_t lun, int write, uint32_t lba,
+    uint16_t count);
+
+/* sets `blocks` to the size of `lun`, returns < 0 if it isn't ready */
+int scsi_sd_lun_blocks(uint8_t lun, uint32_t *blocks);
+
+/* the sense of `lun` after a failure, cleared like by REQUEST SENSE */
+void scsi_sd_sense(uint8_t lun, uint8_t *sense_key, uint16_t *asc_ascq);
+
+/* 
+ * 1 if the data of the CDB begun last comes from the host (`scsi_sd_data_in`),
+ * for transports that don't carry the direction like the CBW does (usb_uas.h)
+ */
+int scsi_sd_is_data_in(void);
 
 /*
  * Returns the number of valid bytes that `ptr` will point to (<= maxlen). If
@@ -46,6 +106,42 @@ int scsi_sd_data_in(const void *ptr, size_t length);
  */
 ssize_t scsi_sd_data_in_commit(void);
 
+/*
+ * Background work that isn't tied to a CDB, like bringing up the card from 
+ * reset on, checking it wasn't pulled or closing an idle write session. A 
+ * pulled card's luns report MEDIUM NOT PRESENT until one is put in and ready.
+ * Must not be called while `usb_isr()` can run the other scsi_sd_* routines.
+ */
+void scsi_sd_poll(void);
+
+/*
+ * 1 while the CDB begun last, one without data, still runs in the background
+ * and its status is held, like a foreground self test of SEND DIAGNOSTIC.
+ * `scsi_sd_poll` moves it along, once it's over this returns 0 if it passed
+ * and < 0 with the sense set if it failed.
+ */
+int scsi_sd_pending(void);
+
+/*
+ * Called on a bulk only transport reset, finishes any card operation left open
+ * between commands.
+ */
+void scsi_sd_reset(void);
+
+/*
+ * Called from the main loop once the usb bus is suspended, the staged blocks
+ * are written and the write session is closed before the card is put in
+ * standby with its clock off (`sd_suspend`). With the log full that may take
+ * seconds, so not from `usb_isr`. `scsi_sd_poll` leaves the card alone until
+ * resumed.
+ */
+void scsi_sd_suspend(void);
+/*
+ * Called when the bus resumes (or is reset while suspended), the card is used
+ * as it was left. One that no longer answers is brought up again.
+ */
+void scsi_sd_resume(void);
+
 #ifdef __cplusplus
 }
 #endif
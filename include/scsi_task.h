@@ -0,0 +1,79 @@
+#ifndef _scsi_task_h_
+#define _scsi_task_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <unistd.h>
+#include <stdint.h>
+
+/*
+ * The task set of a transport that queues tagged commands (usb_uas.h). A task
+ * is a CDB with its tag, lun and task attribute. scsi_sd has the state of a
+ * single CDB, so the tasks run one at a time: `scsi_task_start` picks the next
+ * one, which stays in the set until `scsi_task_done`. A HEAD OF QUEUE task
+ * runs before the others, the rest in the order they came, which also keeps
+ * the order ORDERED asks for.
+ */
+
+/* # of tasks the set holds, -DSCSI_TASK_QUEUE_DEPTH (see the Makefile) */
+#ifndef SCSI_TASK_QUEUE_DEPTH
+#define SCSI_TASK_QUEUE_DEPTH (8)
+#endif
+
+/* task attributes, SAM-5 */
+#define SCSI_TASK_SIMPLE        (0x00)
+#define SCSI_TASK_HEAD_OF_QUEUE (0x01)
+#define SCSI_TASK_ORDERED       (0x02)
+#define SCSI_TASK_ACA           (0x04)
+
+#define SCSI_TASK_CDB_MAX_LENGTH (16)
+
+/* return values of `scsi_task_add` */
+#define SCSI_TASK_ADDED         (0)
+#define SCSI_TASK_FULL          (-1) /* report TASK SET FULL                  */
+#define SCSI_TASK_OVERLAPPED    (-2) /* the tag is in use by another task     */
+
+typedef struct {
+    uint16_t    tag;
+    uint8_t     lun;
+    uint8_t     attribute;
+    uint8_t     cdblen;
+    uint8_t     cdb[SCSI_TASK_CDB_MAX_LENGTH];
+} scsi_task_t;
+
+/* empties the task set */
+void scsi_task_init(void);
+
+/* adds a task, returns SCSI_TASK_ADDED or why it wasn't */
+int scsi_task_add(uint16_t tag, uint8_t lun, uint8_t attribute, 
+    const void *cdb, size_t cdblen);
+
+/* the task to run next, NULL if there is none or one is running already */
+const scsi_task_t *scsi_task_start(void);
+/* the running task, NULL if there is none */
+const scsi_task_t *scsi_task_running(void);
+/* the running task completed, it leaves the set */
+void scsi_task_done(void);
+
+/* 1 if the task with `tag` is in the set */
+int scsi_task_exists(uint16_t tag);
+
+/*
+ * removes the task with `tag`, or the tasks of `lun` (all luns if < 0), that
+ * haven't started. Returns 1 if the running task is one of them, the transport
+ * then stops it and calls `scsi_task_done` without reporting a status.
+ * `scsi_task_abort` returns < 0 if there is no such task.
+ */
+int scsi_task_abort(uint16_t tag);
+int scsi_task_abort_lun(int lun);
+
+/* # of tasks of `lun` (all luns if < 0) including the running one */
+size_t scsi_task_count(int lun);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,10 +9,94 @@ extern "C" {
     
 #define SD_BLOCK_SIZE (512)
     
+/* bring up the card, `sd_init_start` and step until done. 0 on success */
 int sd_init(void);    
+/* 
+ * start bringing up the card in the background, the slow part of the power up
+ * and the tuning of the clock are left to `sd_init_step`. No other sd_* call 
+ * may be made until it returns 0. Returns < 0 if there is no card.
+ */
+int sd_init_start(void);
+/* do the next short step of the bring up, returns 1 while there is more to 
+   do, 0 once the card is ready and -1 if it failed. The same card brought up
+   again keeps the profile and spi clock it had and skips the tuning */
+int sd_init_step(void);
+/* 
+ * 1 if there is a card in the slot, read from the card detect switch when 
+ * there is one (-DSD_CARD_DETECT_PIN, see the Makefile). Otherwise a card 
+ * that is up is asked for its status (CMD13), a card that isn't gets a CMD0 
+ * which resets it. A card that was pulled and put back answers from its idle
+ * state, it reads as 0 so it is brought up again. Not while a multiple block
+ * write is open.
+ */
+int sd_present(void);
+/*
+ * the usb bus was suspended: waits for a block still programming, leaves the
+ * card deselected in its standby state and gates the spi clock off. No other
+ * sd_* call may be made until `sd_resume`, nor may a multiple block write be
+ * open. Returns < 0 if a block written since the last `sd_write_check` failed.
+ */
+int sd_suspend(void);
+/* clocks the spi again at the rate it had, the card kept its state and
+   tuning so nothing is brought up again. Returns < 0 if it no longer answers
+   from the transfer state (pulled or powered down while suspended) */
+int sd_resume(void);
 uint32_t sd_max_lba(void);
 int sd_read_block(void *dest, uint32_t lba);
+/* single block write (CMD24), only the card's data response is checked. An 
+   error programming the block is reported by the next `sd_write_check` or
+   `sd_write_stop` */
 int sd_write_block(uint32_t lba, const void *src);
+/* the card status (CMD13) if anything was written since the last check, -1 
+   if the card failed to program a block */
+int sd_write_check(void);
+
+/* 
+ * multiple block write (CMD25). `count` is only a hint used to pre-erase 
+ * blocks, any number of blocks can be written with `sd_write_data` until 
+ * `sd_write_stop` is called. No other sd_* call may be made while it is open.
+ * The blocks are checked once, by `sd_write_stop`.
+ */
+int sd_write_start(uint32_t lba, uint32_t count);
+int sd_write_data(const void *src);
+int sd_write_stop(void);
+/* after a failed multiple block write, the # of its blocks the card wrote 
+   without error (ACMD22). The first bad block is `lba + count` */
+int sd_written_blocks(uint32_t *count);
+
+/* 
+ * # of blocks in the card's erase group, erases aligned to it are the fastest.
+ * 0 if the card does not support erasing.
+ */
+uint32_t sd_erase_group(void);
+/* the value of every byte in an erased block, 0x00 or 0xff */
+uint8_t sd_erased_byte(void);
+/* erase (CMD32/33/38) `count` blocks starting at `lba` */
+int sd_erase(uint32_t lba, uint32_t count);
+
+/* 
+ * # of blocks in the card's allocation unit (AU_SIZE of the SD Status), writes
+ * of whole aligned units are the fastest. 0 if the card doesn't report it.
+ */
+uint32_t sd_au_size(void);
+/* 
+ * # of blocks the card writes best as one aligned piece, the one of its model
+ * in sd_profile.c or else `sd_au_size`. 0 if neither is known.
+ */
+uint32_t sd_write_chunk(void);
+/* the product serial number from the card's CID */
+uint32_t sd_serial_number(void);
+
+/* bus speed modes, the functions of CMD6 function group 1 */
+#define SD_SPEED_DEFAULT (0)    /* up to 25 MHz */
+#define SD_SPEED_HIGH    (1)    /* up to 50 MHz */
+
+/* the mode `sd_init` switched the card to, SD_SPEED_HIGH when it has it */
+uint8_t sd_speed_mode(void);
+/* the modes the card supports as a bit per SD_SPEED_*, 0 if it can't switch */
+uint16_t sd_speed_modes(void);
+/* the spi clock the card is run at, see `sd_init` */
+uint32_t sd_spi_hz(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,44 @@
+#ifndef _sd_array_h_
+#define _sd_array_h_
+
+/*
+ * Two or more cards on the spi bus, each on its own chip select, presented as
+ * one card through the functions of sd.h. Built in place of sd.cpp with
+ * -DSD_ARRAY=SD_ARRAY_STRIPED or -DSD_ARRAY=SD_ARRAY_MIRRORED (see the
+ * Makefile).
+ *
+ * Striped (RAID-0): the blocks are dealt out SD_ARRAY_STRIPE_BLOCKS at a time
+ * to one member after the other, the array is as many times the smallest
+ * member as there are members. Mirrored (RAID-1): every member holds every
+ * block, writes go to all of them and a read goes to a member that isn't busy
+ * programming, or to the next member if it fails.
+ *
+ * The members are left programming deselected after each block they take
+ * (see Sd2Card::overlapBusy()), so while one is busy the bus moves the next
+ * block to another. A multiple block write is a CMD25 on every member, open
+ * side by side. The members run at a fixed clock without the tuning or the
+ * model profile of sd.cpp, and erasing isn't passed on to them.
+ */
+
+/* the values of SD_ARRAY */
+#define SD_ARRAY_STRIPED  (0)
+#define SD_ARRAY_MIRRORED (1)
+
+/* chip select pins of the members, in the order their blocks are dealt out */
+#ifndef SD_ARRAY_PINS
+#define SD_ARRAY_PINS 4, 10
+#endif
+
+/* blocks of a member before the next member's, striped arrays only. The
+   write stage gathers a stripe of every member (see `sd_write_chunk`) */
+#ifndef SD_ARRAY_STRIPE_BLOCKS
+#define SD_ARRAY_STRIPE_BLOCKS (8)
+#endif
+
+/* spi clock of the members, the most the default bus speed mode allows. The
+   fastest the CTAR can make that isn't above it is used */
+#ifndef SD_ARRAY_SPI_HZ
+#define SD_ARRAY_SPI_HZ (25000000)
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _sd_profile_h_
+#define _sd_profile_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Per card model tuning, looked up by `sd_init` (see sd.cpp) from the card's
+ * CID register. The table in sd_profile.c is searched in order and the first
+ * entry whose set fields all match is used, the last entry matches any card
+ * and holds the defaults. New models go in front of it, the more specific
+ * entries of a manufacturer before its catch all. The SEND DIAGNOSTIC bench
+ * (include/bench.h) is the way to find a model's numbers, entries not measured
+ * yet are only built in with -DSD_PROFILE_UNVERIFIED.
+ */
+
+/* CID product revision n.m as the register holds it, a BCD byte */
+#define SD_PROFILE_PRV(n, m) ((uint8_t) (((n) << 4) | (m)))
+
+typedef struct {
+    const char *name;               /* reported in the log                  */
+    
+    /* what to match, 0 and "" match any card */
+    uint8_t     mid;                /* manufacturer id                      */
+    char        oid[3];             /* oem/application id, 2 chars          */
+    char        pnm[6];             /* product name, 5 chars                */
+    uint8_t     prv;                /* product revision, SD_PROFILE_PRV     */
+    
+    /* the knobs, 0 leaves the driver's own choice */
+    uint32_t    max_spi_hz;         /* fastest clock the tuning may pick    */
+    uint32_t    write_chunk;        /* blocks per write the stage groups by,
+                                       the card's allocation unit if 0      */
+    uint16_t    busy_timeout_ms;    /* longest a write may keep it busy     */
+    uint8_t     no_pre_erase;       /* 1 skips the ACMD23 before multiple
+                                       block writes                         */
+} sd_profile_t;
+
+/* the entry for the 16 byte CID register `cid`, never NULL */
+const sd_profile_t *sd_profile_lookup(const uint8_t *cid);
+/* the position of `profile` in the table, 0 is the first entry */
+uint32_t sd_profile_index(const sd_profile_t *profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
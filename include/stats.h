@@ -0,0 +1,96 @@
+#ifndef _stats_h_
+#define _stats_h_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 
+ * counters kept by the different modules. Every field is a uint32_t so the 
+ * struct can be sent as an array, see the device statistics vpd page in 
+ * scsi_sd.c. New counters are only ever added to the end.
+ */
+typedef struct {
+    /*--- WRITE STAGING (scsi_sd.c) ---*/
+    uint32_t stage_blocks;          /* blocks taken in by the stage           */
+    uint32_t stage_flushes;         /* times the stage was written out        */
+    uint32_t stage_runs;            /* multiple block writes of the flushes   */
+    uint32_t stage_merge_ratio;     /* stage_blocks * 100 / stage_runs        */
+    
+    /*--- TRANSLATION LAYER (ftl.c) ---*/
+    uint32_t ftl_records;           /* records appended to the log            */
+    uint32_t ftl_gc_blocks;         /* blocks copied home by the collector    */
+    uint32_t ftl_checkpoints;       /* checkpoints written                    */
+    uint32_t ftl_recovered_records; /* records replayed by the init scan      */
+    
+    /*--- CARD (sd.cpp) ---*/
+    uint32_t sd_spi_hz;             /* spi clock picked by the init tuning    */
+    uint32_t sd_spi_downshifts;     /* times repeated errors lowered it       */
+    uint32_t sd_link_errors;        /* crc, token and response errors         */
+    uint32_t sd_crc_errors;         /* blocks read or written with a bad crc  */
+    uint32_t sd_status_checks;      /* CMD13s sent after writes               */
+    uint32_t sd_profile;            /* entry of sd_profile.c the card matched */
+    
+    /*--- CARD BRING UP (scsi_sd.c, sd.cpp) ---*/
+    uint32_t card_init_ms;          /* ms the bring up took                   */
+    uint32_t card_mountable_ms;     /* ms from power up to a passed card TUR  */
+    uint32_t card_removals;         /* cards found gone while they were up    */
+    uint32_t card_fast_inits;       /* the same card back, tuning skipped     */
+    
+    /*--- CARD ARRAY (sd_array.cpp) ---*/
+    uint32_t array_idle_reads;      /* mirror reads moved off a busy member   */
+    uint32_t array_read_retries;    /* mirror reads the next member served    */
+    
+    /*--- VENDOR BLOCK INTERFACE (usb_blk.c) ---*/
+    uint32_t blk_requests;          /* requests taken in                      */
+    uint32_t blk_ranges;            /* lba ranges of the read/write requests  */
+    uint32_t blk_failed;            /* requests completed without success     */
+    
+    /*--- USB ATTACHED SCSI (usb_uas.c) ---*/
+    uint32_t uas_commands;          /* command IUs taken in                   */
+    uint32_t uas_task_set_full;     /* commands answered with TASK SET FULL   */
+    uint32_t uas_max_queued;        /* most tasks that were in the set        */
+    uint32_t uas_task_management;   /* task management IUs taken in           */
+    
+    /*--- USB INTERRUPT (usb_dev.c) ---*/
+    uint32_t usb_isr_entries;       /* times usb_isr ran                      */
+    uint32_t usb_isr_per_sec;       /* entries a second, over the last second */
+    uint32_t usb_tokens;            /* TOKDNEs handled                        */
+    uint32_t usb_tokens_per_isr;    /* usb_tokens * 100 / usb_isr_entries     */
+    uint32_t usb_isr_cycles;        /* cpu cycles spent in usb_isr, wraps     */
+    uint32_t usb_isr_max_cycles;    /* cycles of the longest run              */
+    uint32_t usb_isr_load;          /* cpu share the last second, in 1/1000   */
+    
+    /*--- SUSPEND (usb_dev.c, scsi_sd.c) ---*/
+    uint32_t usb_suspends;          /* times the host suspended the bus       */
+    uint32_t usb_resumes;           /* and resumed it, a reset counts as one  */
+    uint32_t resume_io_ms;          /* ms from the last resume to a block I/O */
+    uint32_t resume_io_max_ms;      /* the longest of them                    */
+    
+    /*--- TRACE PORT (usb_cdc.c) ---*/
+    uint32_t cdc_records;           /* records queued on the port             */
+    uint32_t cdc_dropped;           /* records dropped for a full buffer      */
+    uint32_t cdc_bytes;             /* bytes of records the host took         */
+    
+    /*--- TRANSLATION LAYER ROOM (ftl.c) ---*/
+    uint32_t ftl_gc_write_blocks;   /* blocks records copied home themselves  */
+    uint32_t ftl_full;              /* records refused for a full log         */
+    
+    /*--- READ RETRIES (sd.cpp) ---*/
+    uint32_t sd_read_retries;       /* blocks read again after a crc error    */
+    
+    /*--- TRANSLATION LAYER BYPASS (ftl.c) ---*/
+    uint32_t ftl_direct_blocks;     /* blocks of long writes written home     */
+} stats_t;
+
+#define STATS_COUNT (sizeof(stats_t) / sizeof(uint32_t))
+
+extern stats_t stats;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef _usb_blk_h_
+#define _usb_blk_h_
+
+#include <stdint.h>
+
+/*
+ * A vendor specific interface next to the mass storage one, built with
+ * -DUSB_BLK (see the Makefile). It reads and writes the blocks of the same
+ * luns (scsi_sd.h) without the CBW and CSW of every bulk only command and
+ * without SCSI: a request lists up to USB_BLK_MAX_RANGES lba ranges and fits
+ * a single packet, the host may send the next one before the last completed.
+ * tools/blkclient is a libusb client, it shares this header so it only has
+ * the wire format and stdint types besides the device's functions.
+ *
+ * Every request on the RX endpoint gets a `usb_blk_completion` on the TX
+ * endpoint, in the order the requests were sent:
+ *
+ *   READ      request ->, <- blocks of the ranges in order, <- completion
+ *   WRITE     request ->, blocks of the ranges in order ->, <- completion
+ *   CAPACITY  request ->, <- completion with the lun's size in `blocks`
+ *
+ * A READ that fails ends its data early with a zero length packet. The data
+ * of a WRITE that fails is still taken in and dropped. `blocks` of a READ or
+ * WRITE is the number of blocks moved before the first failure. A request
+ * that can't be parsed completes INVALID without a data phase, after which
+ * the host has to send USB_BLK_RESET.
+ *
+ * Only one of the two interfaces has the luns at a time, a request waits for
+ * a bulk only command in progress to finish and the other way around.
+ */
+
+/* implementation details of the interface */
+#define USB_BLK_INTERFACE       (1)
+#define USB_BLK_RX_ENDPOINT     (3)
+#define USB_BLK_TX_ENDPOINT     (4)
+#define USB_BLK_PACKET_SIZE     (64)
+/******************************************/
+
+/* vendor request to the interface, drops the requests in progress */
+#define USB_BLK_RESET           (0x01)
+
+#define USB_BLK_REQUEST_SIGNATURE       (0x514b4c42) /* "BLKQ" */
+#define USB_BLK_COMPLETION_SIGNATURE    (0x434b4c42) /* "BLKC" */
+
+#define USB_BLK_OP_READ         (0x01)
+#define USB_BLK_OP_WRITE        (0x02)
+#define USB_BLK_OP_CAPACITY     (0x03)
+
+#define USB_BLK_MAX_RANGES      (8)
+#define USB_BLK_BLOCK_SIZE      (512)
+
+#define USB_BLK_STATUS_GOOD     (0x00)
+#define USB_BLK_STATUS_FAILED   (0x01) /* see the sense fields              */
+#define USB_BLK_STATUS_INVALID  (0x02) /* the request couldn't be parsed    */
+
+/* all fields are little endian */
+struct usb_blk_range {
+    uint32_t    lba;
+    uint16_t    count;                  /* blocks, > 0                      */
+} __attribute__((packed));
+
+struct usb_blk_request {
+    uint32_t    signature;
+    uint32_t    tag;                    /* echoed in the completion         */
+    uint8_t     op;
+    uint8_t     lun;
+    uint8_t     range_count;            /* 0 for CAPACITY                   */
+    uint8_t     reserved;
+    struct usb_blk_range ranges[USB_BLK_MAX_RANGES];
+} __attribute__((packed));
+
+/* a request is sent without its unused ranges */
+#define USB_BLK_REQUEST_LENGTH(range_count)                                    \
+    (12 + (range_count) * sizeof(struct usb_blk_range))
+
+struct usb_blk_completion {
+    uint32_t    signature;
+    uint32_t    tag;
+    uint32_t    blocks;
+    uint8_t     status;
+    uint8_t     sense_key;              /* scsi sense of a FAILED request   */
+    uint16_t    asc_ascq;
+} __attribute__((packed));
+
+#define USB_BLK_COMPLETION_LENGTH (16)
+
+/******************************************************************************/
+
+/* the endpoints are set up on SET CONFIGURATION */
+void usb_blk_init(void);
+/* USB_BLK_RESET from the host */
+void usb_blk_reset(void);
+/* 1 while a request has the luns */
+int usb_blk_busy(void);
+/* called by usb_msd once a bulk only command no longer has the luns */
+void usb_blk_resume(void);
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef _usb_cdc_h_
+#define _usb_cdc_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A CDC-ACM serial port next to the mass storage interface, built with
+ * -DUSB_CDC (see the Makefile). It is a trace port: the device streams binary
+ * records on it while the host has the port open (DTR set), anything the host
+ * writes is dropped. The two interfaces of the port are tied together by an
+ * interface association descriptor so the host binds one driver to both.
+ *
+ * Storage always goes first. A packet of the port is only queued while no
+ * bulk only command, UAS task or vendor block request has the luns, the
+ * host's IN tokens are NAKed otherwise. Records that don't fit the buffer
+ * while it drains are dropped whole and counted, a USB_CDC_RECORD_DROPPED
+ * record says how many once there is room again.
+ *
+ * Every record is a `usb_cdc_record_header` and `length` bytes of payload:
+ *
+ *   STATS    every counter of stats.h as a uint32_t, every USB_CDC_STATS_MS
+ *            and when the port is opened
+ *   COMMAND  a `usb_cdc_command_record` for each bulk only command, from its
+ *            CBW to its CSW
+ *   LOG      a line of the LOG* macros of serialize.h, without the newline
+ *   DROPPED  the # of records dropped since the last DROPPED as a uint32_t
+ *
+ * tools/cdctrace prints the records read from the port.
+ */
+
+/* implementation details of the interface */
+#ifdef USB_BLK
+#define USB_CDC_COMM_INTERFACE      (2)
+#else
+#define USB_CDC_COMM_INTERFACE      (1)
+#endif
+#define USB_CDC_DATA_INTERFACE      (USB_CDC_COMM_INTERFACE + 1)
+#define USB_CDC_NOTIFY_ENDPOINT     (9)  /* IN, interrupt, never sends     */
+#define USB_CDC_RX_ENDPOINT         (10) /* OUT */
+#define USB_CDC_TX_ENDPOINT         (11) /* IN  */
+/* bytes of records buffered for the TX endpoint */
+#ifndef USB_CDC_BUFFER_SIZE
+#define USB_CDC_BUFFER_SIZE         (2048)
+#endif
+/* how often a STATS record is sent while the port is open */
+#ifndef USB_CDC_STATS_MS
+#define USB_CDC_STATS_MS            (1000)
+#endif
+/*******************************************/
+
+/* class specific descriptors of the communications interface */
+#define USB_CDC_CS_INTERFACE            (0x24)
+#define USB_CDC_SUBTYPE_HEADER          (0x00)
+#define USB_CDC_SUBTYPE_CALL_MANAGEMENT (0x01)
+#define USB_CDC_SUBTYPE_ACM             (0x02)
+#define USB_CDC_SUBTYPE_UNION           (0x06)
+#define USB_CDC_SUBCLASS_ACM            (0x02)
+#define USB_CDC_ACM_LINE_CODING         (0x02) /* bmCapabilities          */
+
+/* class requests to the communications interface */
+#define USB_CDC_SET_LINE_CODING         (0x20)
+#define USB_CDC_GET_LINE_CODING         (0x21)
+#define USB_CDC_SET_CONTROL_LINE_STATE  (0x22)
+#define USB_CDC_CONTROL_LINE_DTR        (0x01)
+#define USB_CDC_LINE_CODING_LENGTH      (7)
+
+#define USB_CDC_RECORD_SYNC             (0xa5)
+
+#define USB_CDC_RECORD_STATS            (0x01)
+#define USB_CDC_RECORD_COMMAND          (0x02)
+#define USB_CDC_RECORD_LOG              (0x03)
+#define USB_CDC_RECORD_DROPPED          (0x04)
+
+/* all fields are little endian */
+struct usb_cdc_record_header {
+    uint8_t     sync;                   /* USB_CDC_RECORD_SYNC              */
+    uint8_t     type;
+    uint16_t    length;                 /* of the payload                   */
+    uint32_t    ms;                     /* millis() it was made at          */
+} __attribute__((packed));
+
+struct usb_cdc_command_record {
+    uint8_t     lun;
+    uint8_t     status;                 /* of the CSW                       */
+    uint8_t     cdb_length;
+    uint8_t     reserved;
+    uint32_t    bytes;                  /* moved in the data phase          */
+    uint32_t    us;                     /* from the CBW to the CSW          */
+    uint8_t     cdb[16];
+} __attribute__((packed));
+
+/******************************************************************************/
+
+/* the endpoints are set up on SET CONFIGURATION, the port starts closed */
+void usb_cdc_init(void);
+/* SET CONTROL LINE STATE, the port is open while DTR is set */
+void usb_cdc_control_line_state(uint16_t state);
+/* the data stage of SET LINE CODING, kept only to be read back */
+void usb_cdc_line_coding(const void *data, size_t length);
+/* for GET LINE CODING, USB_CDC_LINE_CODING_LENGTH bytes */
+const void *usb_cdc_get_line_coding(void);
+/*
+ * queues a record if the port is open, 0 if it was or it is closed and < 0 if
+ * it was dropped. Only from `usb_isr` or while it is held off, the LOG*
+ * macros call it for every line.
+ */
+int usb_cdc_record(uint8_t type, const void *payload, size_t length);
+/* the STATS records and the packets held back for storage, from the main
+   loop while `usb_isr` is held off (usb_msd_poll) */
+void usb_cdc_poll(void);
+
+#endif
@@ -13,12 +13,41 @@
 #define EP0_SIZE                64
 #define EP1_SIZE                64
 #define EP2_SIZE                64
+#ifdef USB_BLK
+// vendor block interface, see usb_blk.h
+#define EP3_SIZE                64
+#define EP4_SIZE                64
+#endif
+#ifdef USB_UAS
+// USB Attached SCSI alternate setting, see usb_uas.h
+#define EP5_SIZE                64
+#define EP6_SIZE                64
+#define EP7_SIZE                64
+#define EP8_SIZE                64
+#endif
+#ifdef USB_CDC
+// CDC-ACM trace port, see usb_cdc.h
+#define EP9_SIZE                16
+#define EP10_SIZE               64
+#define EP11_SIZE               64
+#define NUM_ENDPOINTS           11 // ignoring endpoint 0 which has to be there
+#elif defined(USB_UAS)
+#define NUM_ENDPOINTS           8 // ignoring endpoint 0 which has to be there
+#elif defined(USB_BLK)
+#define NUM_ENDPOINTS           4 // ignoring endpoint 0 which has to be there
+#else
 #define NUM_ENDPOINTS           2 // ignoring endpoint 0 which has to be there
+#endif
 ////////////////////////////////////////////////////////////////////////////////
 
 // Device Classes specified in the Device/Interface descriptors
+#define USB_DESCRIPTOR_CLASS_CDC                    (0x02)
 #define USB_DESCRIPTOR_CLASS_CDC_DATA               (0x0a)
 #define USB_DESCRIPTOR_CLASS_MSD                    (0x08)
+#define USB_DESCRIPTOR_CLASS_VENDOR                 (0xff)
+#define USB_DESCRIPTOR_CLASS_MISC                   (0xef)
+#define USB_DESCRIPTOR_SUBCLASS_COMMON              (0x02)
+#define USB_DESCRIPTOR_PROTOCOL_IAD                 (0x01)
 
 // 
 #define USB_DESCRIPTOR_DEVICE_LENGTH                (0x12)
@@ -31,10 +60,15 @@
 #define USB_DESCRIPTOR_INTERFACE_TYPE               (0x04)
 #define USB_DESCRIPTOR_INTERFACE_SUBCLASS_SCSI      (0x06)
 #define USB_DESCRIPTOR_INTERFACE_PROTOCOL_BULKONLY  (0x50)
+#define USB_DESCRIPTOR_INTERFACE_PROTOCOL_UAS       (0x62)
 
 #define USB_DESCRIPTOR_ENDPOINT_LENGTH              (0x07)
 #define USB_DESCRIPTOR_ENDPOINT_TYPE                (0x05)
 #define USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY  (0x02)
+#define USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_INTERRUPT (0x03)
+
+#define USB_DESCRIPTOR_INTERFACE_ASSOCIATION_LENGTH (0x08)
+#define USB_DESCRIPTOR_INTERFACE_ASSOCIATION_TYPE   (0x0b)
 
 #define USB_DESCRIPTOR_ENDPOINT_ADDRESS_OUT(_num)   (_num)
 #define USB_DESCRIPTOR_ENDPOINT_ADDRESS_IN(_num)    ((_num) | 0x80)
@@ -78,6 +112,81 @@ typedef struct {
     ep_descriptor_t endpoints[2];
 } __attribute__((packed)) int_descriptor_t;
  
+// an endpoint of the UAS alternate setting and the pipe it is
+typedef struct {
+    ep_descriptor_t endpoint;
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bPipeID;
+    uint8_t Reserved;
+} __attribute__((packed)) uas_ep_descriptor_t;
+
+typedef struct {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bInterfaceNumber;
+    uint8_t bAlternateSetting;
+    uint8_t bNumEndpoints;
+    uint8_t bInterfaceClass;
+    uint8_t bInterfaceSubClass;
+    uint8_t bInterfaceProtocol;
+    uint8_t iInterface;
+    uas_ep_descriptor_t endpoints[4];
+} __attribute__((packed)) uas_int_descriptor_t;
+
+// ties the interfaces of one function together, the CDC port's two
+typedef struct {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bFirstInterface;
+    uint8_t bInterfaceCount;
+    uint8_t bFunctionClass;
+    uint8_t bFunctionSubClass;
+    uint8_t bFunctionProtocol;
+    uint8_t iFunction;
+} __attribute__((packed)) iad_descriptor_t;
+
+// the communications interface of the CDC port, its class specific
+// functional descriptors and its notification endpoint
+typedef struct {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bInterfaceNumber;
+    uint8_t bAlternateSetting;
+    uint8_t bNumEndpoints;
+    uint8_t bInterfaceClass;
+    uint8_t bInterfaceSubClass;
+    uint8_t bInterfaceProtocol;
+    uint8_t iInterface;
+    struct {
+        uint8_t bFunctionLength;
+        uint8_t bDescriptorType;
+        uint8_t bDescriptorSubtype;
+        uint16_t bcdCDC;
+    } __attribute__((packed)) header;
+    struct {
+        uint8_t bFunctionLength;
+        uint8_t bDescriptorType;
+        uint8_t bDescriptorSubtype;
+        uint8_t bmCapabilities;
+        uint8_t bDataInterface;
+    } __attribute__((packed)) call_management;
+    struct {
+        uint8_t bFunctionLength;
+        uint8_t bDescriptorType;
+        uint8_t bDescriptorSubtype;
+        uint8_t bmCapabilities;
+    } __attribute__((packed)) acm;
+    struct {
+        uint8_t bFunctionLength;
+        uint8_t bDescriptorType;
+        uint8_t bDescriptorSubtype;
+        uint8_t bMasterInterface;
+        uint8_t bSlaveInterface0;
+    } __attribute__((packed)) union_;
+    ep_descriptor_t endpoint;
+} __attribute__((packed)) cdc_int_descriptor_t;
+
 typedef struct {
     uint8_t bLength;
     uint8_t bDescriptorType;
@@ -87,7 +196,6 @@ typedef struct {
     uint8_t iConfiguration;
     uint8_t bmAttributes;
     uint8_t bMaxPower;
-    int_descriptor_t interfaces[];
 } __attribute__((packed)) cfg_descriptor_t;
  
 typedef struct {
@@ -59,6 +59,21 @@ void usb_isr(void);
 
 void usb_stall_endpoint(uint8_t ep);
 
+/* 
+ * `callback` runs from `usb_isr` on every start of frame, once a ms while the 
+ * host has the bus up. The SOF interrupt is only on while a callback is set, 
+ * NULL turns it back off.
+ */
+void usb_sof_callback(void (*callback)(void));
+
+/* 1 while the host has the bus suspended, from the SLEEP interrupt until it
+   resumes or resets the bus */
+int usb_suspended(void);
+/* from the main loop while `usb_suspended`, once the card is put away: the
+   transceiver goes to low power until the host resumes the bus. Called with
+   the usb interrupt off */
+void usb_sleep(void);
+
 /* What configuration has the host selected as the active one */
 extern volatile uint8_t usb_active_configuration;
 
@@ -9,7 +9,6 @@
 #define MSD_RX_ENDPOINT_SIZE EP1_SIZE
 #define MSD_TX_ENDPOINT (2)
 #define MSD_TX_ENDPOINT_SIZE EP2_SIZE
-#define MSD_IMPL_MAX_LUN     (0)
 /**************************************/
 
 #define CBW_LENGTH              (0x1f)
@@ -51,6 +50,17 @@ struct usb_msd_csw {
 
 void usb_msd_init(void);
 void usb_msd_bulk_only_reset(void);
+/* run from the main loop, does the msd's work that isn't interrupt driven */
+void usb_msd_poll(void);
+/* 1 while a bulk only command has the luns or waits for them */
+int usb_msd_busy(void);
+/* runs a CBW that waited for the vendor block interface (usb_blk.h) */
+void usb_msd_resume(void);
+/* SET INTERFACE, 0 is bulk only and 1 USB Attached SCSI (usb_uas.h) if built
+   in. Returns < 0 if there is no such alternate setting */
+int usb_msd_set_alternate(uint8_t alternate);
+/* the alternate setting for GET INTERFACE */
+uint8_t usb_msd_alternate(void);
 
 
 #endif
@@ -0,0 +1,135 @@
+#ifndef _usb_uas_h_
+#define _usb_uas_h_
+
+#include <stdint.h>
+
+/*
+ * USB Attached SCSI, built with -DUSB_UAS (see the Makefile). It is alternate
+ * setting 1 of the mass storage interface, bulk only stays alternate setting
+ * 0 so hosts without a UAS driver see no difference. The host may queue up to
+ * SCSI_TASK_QUEUE_DEPTH tagged commands (scsi_task.h) on the command pipe,
+ * the device takes them in while another one moves its data and starts the
+ * next one as soon as the last sent its status.
+ *
+ * Like any USB 2.0 UAS device there are no streams, a command's data phase is
+ * announced with a READ READY or WRITE READY IU on the status pipe and its
+ * status is a SENSE IU with the sense data. Task management IUs get a
+ * RESPONSE IU.
+ */
+
+/* implementation details of the interface */
+#define UAS_ALTERNATE_SETTING       (1)
+#define UAS_COMMAND_ENDPOINT        (5) /* OUT */
+#define UAS_STATUS_ENDPOINT         (6) /* IN  */
+#define UAS_DATA_IN_ENDPOINT        (7) /* IN  */
+#define UAS_DATA_OUT_ENDPOINT       (8) /* OUT */
+/*******************************************/
+
+/* the pipe usage descriptor after each endpoint descriptor */
+#define UAS_PIPE_USAGE_LENGTH       (0x04)
+#define UAS_PIPE_USAGE_TYPE         (0x24)
+#define UAS_PIPE_ID_COMMAND         (0x01)
+#define UAS_PIPE_ID_STATUS          (0x02)
+#define UAS_PIPE_ID_DATA_IN         (0x03)
+#define UAS_PIPE_ID_DATA_OUT        (0x04)
+
+/* information unit ids */
+#define UAS_IU_COMMAND              (0x01)
+#define UAS_IU_SENSE                (0x03)
+#define UAS_IU_RESPONSE             (0x04)
+#define UAS_IU_TASK_MANAGEMENT      (0x05)
+#define UAS_IU_READ_READY           (0x06)
+#define UAS_IU_WRITE_READY          (0x07)
+
+/* task management functions */
+#define UAS_TMF_ABORT_TASK          (0x01)
+#define UAS_TMF_ABORT_TASK_SET      (0x02)
+#define UAS_TMF_CLEAR_TASK_SET      (0x04)
+#define UAS_TMF_LOGICAL_UNIT_RESET  (0x08)
+#define UAS_TMF_I_T_NEXUS_RESET     (0x10)
+#define UAS_TMF_QUERY_TASK          (0x80)
+#define UAS_TMF_QUERY_TASK_SET      (0x81)
+
+/* response codes of the RESPONSE IU */
+#define UAS_RC_COMPLETE             (0x00)
+#define UAS_RC_INVALID_IU           (0x02)
+#define UAS_RC_NOT_SUPPORTED        (0x04)
+#define UAS_RC_SUCCEEDED            (0x08)
+#define UAS_RC_INCORRECT_LUN        (0x09)
+#define UAS_RC_OVERLAPPED_TAG       (0x0a)
+
+/* status of the SENSE IU */
+#define UAS_STATUS_GOOD             (0x00)
+#define UAS_STATUS_CHECK_CONDITION  (0x02)
+#define UAS_STATUS_TASK_SET_FULL    (0x28)
+
+/* all multi byte fields are big endian */
+struct uas_command_iu {
+    uint8_t     iu_id;
+    uint8_t     reserved1;
+    uint16_t    tag;
+    uint8_t     attribute;              /* task attribute in bits 2..0      */
+    uint8_t     reserved5;
+    uint8_t     additional_cdb_length;  /* in dwords, bits 7..2             */
+    uint8_t     reserved7;
+    uint8_t     lun[8];
+    uint8_t     cdb[16];
+} __attribute__((packed));
+
+#define UAS_COMMAND_IU_LENGTH       (32)
+#define UAS_COMMAND_IU_ATTRIBUTE_MASK (0x07)
+
+struct uas_task_management_iu {
+    uint8_t     iu_id;
+    uint8_t     reserved1;
+    uint16_t    tag;
+    uint8_t     function;
+    uint8_t     reserved5;
+    uint16_t    task_tag;               /* of the task to be managed        */
+    uint8_t     lun[8];
+} __attribute__((packed));
+
+#define UAS_TASK_MANAGEMENT_IU_LENGTH (16)
+
+struct uas_sense_iu {
+    uint8_t     iu_id;
+    uint8_t     reserved1;
+    uint16_t    tag;
+    uint16_t    status_qualifier;
+    uint8_t     status;
+    uint8_t     reserved7[7];
+    uint16_t    length;                 /* of the sense data                */
+    uint8_t     sense[18];              /* fixed format                     */
+} __attribute__((packed));
+
+#define UAS_SENSE_IU_HEADER_LENGTH  (16)
+
+struct uas_response_iu {
+    uint8_t     iu_id;
+    uint8_t     reserved1;
+    uint16_t    tag;
+    uint8_t     additional_information[3];
+    uint8_t     response_code;
+} __attribute__((packed));
+
+/* READ READY and WRITE READY */
+struct uas_ready_iu {
+    uint8_t     iu_id;
+    uint8_t     reserved1;
+    uint16_t    tag;
+} __attribute__((packed));
+
+/******************************************************************************/
+
+/* SET INTERFACE to the UAS alternate setting, sets up its endpoints */
+void usb_uas_init(void);
+/* drops the tasks, on SET INTERFACE to bulk only or a new configuration */
+void usb_uas_reset(void);
+/* 1 while a task runs or waits */
+int usb_uas_busy(void);
+/* starts the next task once the vendor block interface is done (usb_blk.h) */
+void usb_uas_resume(void);
+/* from `usb_msd_poll`, the SENSE IU of a task scsi_sd held once it is over */
+void usb_uas_poll(void);
+
+#endif
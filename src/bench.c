@@ -0,0 +1,260 @@
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+#include <string.h> /* memset */
+
+#include "bench.h"
+#include "sd.h"
+
+#include "serialize.h" /* logging */
+#include "kinetis.h" /* cycle counter */
+
+
+/******************************************************************************/
+
+
+/* the region has to hold at least one random operation */
+#define BENCH_MIN_BLOCKS (BENCH_RANDOM_OP_BLOCKS)
+
+/* used when the config leaves the seed 0, xorshift never leaves 0 */
+#define BENCH_DEFAULT_SEED (0x2545f491)
+
+
+/******************************************************************************/
+
+
+/*--- STATE ------------------------------------------------------------------*/
+static enum bench_status _status = BENCH_IDLE;
+static enum bench_test _test;
+static bench_config_t _config;
+static bench_result_t _results[BENCH_TESTS];
+
+/* the scratch region of the run */
+static uint32_t _lba;
+static uint32_t _count;
+/* blocks of a sequential test or operations of a random test done so far */
+static uint32_t _done;
+/* xorshift state for the random offsets */
+static uint32_t _random;
+
+/* every read lands in `_read_block`, every write is of `_write_block` */
+static uint8_t _read_block[SD_BLOCK_SIZE] __attribute__((aligned(4)));
+static uint8_t _write_block[SD_BLOCK_SIZE] __attribute__((aligned(4)));
+
+
+/******************************************************************************/
+
+
+/* # of blocks or operations `test` does in total */
+static uint32_t test_length(enum bench_test test);
+/* time one operation of the current test, returns < 0 if the card failed */
+static int test_op(void);
+/* read/write `count` blocks from `lba`, writes are a single CMD25 */
+static int read_blocks(uint32_t lba, uint32_t count);
+static int write_blocks(uint32_t lba, uint32_t count);
+/* xorshift, the next pseudo random number */
+static uint32_t random_next(void);
+/* a random 4 KiB aligned lba of the region */
+static uint32_t random_lba(void);
+static void record(bench_result_t *result, uint32_t blocks, uint32_t cycles);
+
+
+/******************************************************************************/
+
+
+int bench_start(uint32_t lba, uint32_t count, const bench_config_t *config) 
+{
+    size_t i;
+    
+    if (count < BENCH_MIN_BLOCKS) 
+    {
+        LOGERROR("bench region of %u blocks too small", count);
+        return -1;
+    }
+    
+    _lba    = lba;
+    _count  = count;
+    _config = *config;
+    if (_config.seq_blocks > count) { _config.seq_blocks = count; }
+    if (_config.seed == 0) { _config.seed = BENCH_DEFAULT_SEED; }
+    
+    memset(_results, 0, sizeof(_results));
+    _test   = BENCH_SEQ_READ;
+    _done   = 0;
+    _random = _config.seed;
+    
+    /* written blocks are random so the card can't compress them */
+    for (i = 0; i < sizeof(_write_block); i++) 
+    {
+        _write_block[i] = random_next();
+    }
+    
+    /* the cycle counter is off until the debug blocks are enabled */
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+    
+    LOGINFO("bench 0x%x (%u blocks) seq %u random %u", lba, count,
+        _config.seq_blocks, _config.random_ops);
+    _status = BENCH_RUNNING;
+    return 0;
+}
+
+int bench_step(void) 
+{
+    if (_status != BENCH_RUNNING) { return 0; }
+    
+    /* move past the tests that are done, or have nothing to do */
+    while (_done >= test_length(_test)) 
+    {
+        _done = 0;
+        if (++_test == BENCH_TESTS) 
+        {
+            LOGINFO("bench done");
+            _status = BENCH_DONE;
+            return 0;
+        }
+    }
+    
+    if (test_op() < 0) 
+    {
+        LOGERROR("bench failed in test %u", _test);
+        _status = BENCH_FAILED;
+        return -1;
+    }
+    return 1;
+}
+
+void bench_abort(void) 
+{
+    if (_status != BENCH_RUNNING) { return; }
+    LOGINFO("bench aborted");
+    _status = BENCH_ABORTED;
+}
+
+enum bench_status bench_status(void) 
+{
+    return _status;
+}
+
+enum bench_test bench_test(void) 
+{
+    return _test;
+}
+
+const bench_config_t *bench_config(void) 
+{
+    return &_config;
+}
+
+const bench_result_t *bench_results(void) 
+{
+    return _results;
+}
+
+
+/******************************************************************************/
+
+
+uint32_t test_length(enum bench_test test) 
+{
+    switch (test) 
+    {
+    case BENCH_SEQ_READ:
+    case BENCH_SEQ_WRITE:
+        return _config.seq_blocks;
+    
+    case BENCH_RANDOM_READ:
+    case BENCH_RANDOM_WRITE:
+        return _config.random_ops;
+    
+    default:
+        return 0;
+    }
+}
+
+int test_op(void) 
+{
+    uint32_t lba, count, start;
+    int ret;
+    
+    switch (_test) 
+    {
+    case BENCH_SEQ_READ:
+    case BENCH_SEQ_WRITE:
+        lba   = _lba + _done;
+        count = _config.seq_blocks - _done;
+        if (count > BENCH_SEQ_OP_BLOCKS) { count = BENCH_SEQ_OP_BLOCKS; }
+        _done += count;
+        break;
+    
+    default:
+        lba   = random_lba();
+        count = BENCH_RANDOM_OP_BLOCKS;
+        _done++;
+        break;
+    }
+    
+    start = ARM_DWT_CYCCNT;
+    if (_test == BENCH_SEQ_READ || _test == BENCH_RANDOM_READ) 
+    {
+        ret = read_blocks(lba, count);
+    } else {
+        ret = write_blocks(lba, count);
+    }
+    /* unsigned so a wrap of the counter during the op doesn't matter */
+    record(&_results[_test], count, ARM_DWT_CYCCNT - start);
+    return ret;
+}
+
+int read_blocks(uint32_t lba, uint32_t count) 
+{
+    uint32_t i;
+    
+    /* there is no multiple block read, see sd.h */
+    for (i = 0; i < count; i++) 
+    {
+        if (sd_read_block(_read_block, lba + i) < 0) { return -1; }
+    }
+    return 0;
+}
+
+int write_blocks(uint32_t lba, uint32_t count) 
+{
+    uint32_t i;
+    int ret;
+    
+    if (sd_write_start(lba, count) < 0) { return -1; }
+    ret = 0;
+    for (i = 0; i < count && ret == 0; i++) 
+    {
+        ret = sd_write_data(_write_block);
+    }
+    /* always stopped so the card is usable again */
+    if (sd_write_stop() < 0) { ret = -1; }
+    return ret;
+}
+
+uint32_t random_next(void) 
+{
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random;
+}
+
+uint32_t random_lba(void) 
+{
+    return _lba + (random_next() % (_count / BENCH_RANDOM_OP_BLOCKS)) * 
+        BENCH_RANDOM_OP_BLOCKS;
+}
+
+void record(bench_result_t *result, uint32_t blocks, uint32_t cycles) 
+{
+    if (result->ops == 0 || cycles < result->min_cycles) 
+    {
+        result->min_cycles = cycles;
+    }
+    if (cycles > result->max_cycles) { result->max_cycles = cycles; }
+    result->ops++;
+    result->blocks += blocks;
+    result->cycles += cycles;
+}
@@ -0,0 +1,182 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc.h"
+
+#if defined(__MK20DX256__) && !defined(CRC_SOFTWARE)
+#define CRC_HARDWARE
+#include "kinetis.h"
+#endif
+
+
+/******************************************************************************/
+
+
+/* CRC16-CCITT polynomial */
+#define CRC16_POLY (0x1021)
+
+#ifdef CRC_HARDWARE
+/* CRC_CTRL, K20 reference manual 31.2.3. The rest of the register left 0 is a
+   16 bit crc without any transposes or final xor */
+#define CRC_CTRL_WAS  ((uint32_t)0x02000000)  /* writes to CRC_CRC are a seed */
+/* byte access to the data register feeds a single byte */
+#define CRC_CRCLL     (*(volatile uint8_t *)0x40032000)
+#endif
+
+/* check value of both, the crc of the ascii string "123456789" */
+#define CRC_CHECK_STRING "123456789"
+#define CRC7_CHECK       (0xeb) /* 0x75 shifted up with the end bit */
+#define CRC16_CHECK      (0x31c3)
+
+
+/******************************************************************************/
+
+
+/*--- STATE ------------------------------------------------------------------*/
+/* the crc of each byte from a 0 crc, shifted up a bit so the table gives the
+   next crc of `crc ^ byte` directly */
+static const uint8_t _crc7_table[256] = {
+    0x00, 0x12, 0x24, 0x36, 0x48, 0x5a, 0x6c, 0x7e, 0x90, 0x82, 0xb4, 0xa6,
+    0xd8, 0xca, 0xfc, 0xee, 0x32, 0x20, 0x16, 0x04, 0x7a, 0x68, 0x5e, 0x4c,
+    0xa2, 0xb0, 0x86, 0x94, 0xea, 0xf8, 0xce, 0xdc, 0x64, 0x76, 0x40, 0x52,
+    0x2c, 0x3e, 0x08, 0x1a, 0xf4, 0xe6, 0xd0, 0xc2, 0xbc, 0xae, 0x98, 0x8a,
+    0x56, 0x44, 0x72, 0x60, 0x1e, 0x0c, 0x3a, 0x28, 0xc6, 0xd4, 0xe2, 0xf0,
+    0x8e, 0x9c, 0xaa, 0xb8, 0xc8, 0xda, 0xec, 0xfe, 0x80, 0x92, 0xa4, 0xb6,
+    0x58, 0x4a, 0x7c, 0x6e, 0x10, 0x02, 0x34, 0x26, 0xfa, 0xe8, 0xde, 0xcc,
+    0xb2, 0xa0, 0x96, 0x84, 0x6a, 0x78, 0x4e, 0x5c, 0x22, 0x30, 0x06, 0x14,
+    0xac, 0xbe, 0x88, 0x9a, 0xe4, 0xf6, 0xc0, 0xd2, 0x3c, 0x2e, 0x18, 0x0a,
+    0x74, 0x66, 0x50, 0x42, 0x9e, 0x8c, 0xba, 0xa8, 0xd6, 0xc4, 0xf2, 0xe0,
+    0x0e, 0x1c, 0x2a, 0x38, 0x46, 0x54, 0x62, 0x70, 0x82, 0x90, 0xa6, 0xb4,
+    0xca, 0xd8, 0xee, 0xfc, 0x12, 0x00, 0x36, 0x24, 0x5a, 0x48, 0x7e, 0x6c,
+    0xb0, 0xa2, 0x94, 0x86, 0xf8, 0xea, 0xdc, 0xce, 0x20, 0x32, 0x04, 0x16,
+    0x68, 0x7a, 0x4c, 0x5e, 0xe6, 0xf4, 0xc2, 0xd0, 0xae, 0xbc, 0x8a, 0x98,
+    0x76, 0x64, 0x52, 0x40, 0x3e, 0x2c, 0x1a, 0x08, 0xd4, 0xc6, 0xf0, 0xe2,
+    0x9c, 0x8e, 0xb8, 0xaa, 0x44, 0x56, 0x60, 0x72, 0x0c, 0x1e, 0x28, 0x3a,
+    0x4a, 0x58, 0x6e, 0x7c, 0x02, 0x10, 0x26, 0x34, 0xda, 0xc8, 0xfe, 0xec,
+    0x92, 0x80, 0xb6, 0xa4, 0x78, 0x6a, 0x5c, 0x4e, 0x30, 0x22, 0x14, 0x06,
+    0xe8, 0xfa, 0xcc, 0xde, 0xa0, 0xb2, 0x84, 0x96, 0x2e, 0x3c, 0x0a, 0x18,
+    0x66, 0x74, 0x42, 0x50, 0xbe, 0xac, 0x9a, 0x88, 0xf6, 0xe4, 0xd2, 0xc0,
+    0x1c, 0x0e, 0x38, 0x2a, 0x54, 0x46, 0x70, 0x62, 0x8c, 0x9e, 0xa8, 0xba,
+    0xc4, 0xd6, 0xe0, 0xf2
+};
+
+#ifndef CRC_HARDWARE
+/* slice by 4, `_crc16_table[k][i]` is the crc of byte i followed by k 0 bytes.
+   Built on first use */
+static uint16_t _crc16_table[4][256];
+static int _crc16_ready = 0;
+#endif
+
+
+/******************************************************************************/
+
+
+#ifndef CRC_HARDWARE
+static void crc16_tables(void);
+#endif
+
+
+/******************************************************************************/
+
+
+uint8_t crc7(const void *buf, size_t length) 
+{
+    const uint8_t *p = buf;
+    uint8_t crc = 0;
+    
+    while (length--) 
+    {
+        crc = _crc7_table[crc ^ *p++];
+    }
+    return crc | 0x01;
+}
+
+#ifdef CRC_HARDWARE
+uint16_t crc16(uint16_t crc, const void *buf, size_t length) 
+{
+    const uint8_t *p = buf;
+    
+    SIM_SCGC6 |= SIM_SCGC6_CRC;
+    CRC_CTRL  = CRC_CTRL_WAS;
+    CRC_GPOLY = CRC16_POLY;
+    CRC_CRC   = crc;
+    CRC_CTRL  = 0;
+    
+    /* a word write is fed from bit 31 down, the buffer's bytes are little 
+       endian so they are swapped to go in in order */
+    while (length && ((uintptr_t) p & 0x03)) 
+    {
+        CRC_CRCLL = *p++;
+        length--;
+    }
+    for (; length >= 4; length -= 4, p += 4) 
+    {
+        CRC_CRC = __builtin_bswap32(*(const uint32_t *) p);
+    }
+    while (length--) 
+    {
+        CRC_CRCLL = *p++;
+    }
+    return CRC_CRC;
+}
+#else
+uint16_t crc16(uint16_t crc, const void *buf, size_t length) 
+{
+    const uint8_t *p = buf;
+    
+    if (!_crc16_ready) { crc16_tables(); }
+    
+    /* 4 bytes per step, the 16 bit crc only overlaps the first 2 */
+    for (; length >= 4; length -= 4, p += 4) 
+    {
+        crc = _crc16_table[3][(crc >> 8) ^ p[0]] ^ 
+            _crc16_table[2][(crc & 0xff) ^ p[1]] ^ 
+            _crc16_table[1][p[2]] ^ _crc16_table[0][p[3]];
+    }
+    while (length--) 
+    {
+        crc = (crc << 8) ^ _crc16_table[0][(crc >> 8) ^ *p++];
+    }
+    return crc;
+}
+
+void crc16_tables(void) 
+{
+    uint16_t crc;
+    size_t i, k;
+    
+    for (i = 0; i < 256; i++) 
+    {
+        crc = i << 8;
+        for (k = 0; k < 8; k++) 
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ CRC16_POLY : crc << 1;
+        }
+        _crc16_table[0][i] = crc;
+    }
+    for (k = 1; k < 4; k++) 
+    {
+        for (i = 0; i < 256; i++) 
+        {
+            crc = _crc16_table[k - 1][i];
+            _crc16_table[k][i] = (crc << 8) ^ _crc16_table[0][crc >> 8];
+        }
+    }
+    _crc16_ready = 1;
+}
+#endif
+
+int crc_self_test(void) 
+{
+    const char check[] = CRC_CHECK_STRING;
+    const size_t length = sizeof(check) - 1;
+    
+    if (crc7(check, length) != CRC7_CHECK) { return -1; }
+    if (crc16(0, check, length) != CRC16_CHECK) { return -1; }
+    /* continued across an odd split, the hardware feeds it both ways */
+    if (crc16(crc16(0, check, 3), check + 3, length - 3) != CRC16_CHECK) 
+    {
+        return -1;
+    }
+    return 0;
+}
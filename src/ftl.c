@@ -0,0 +1,974 @@
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+#include <string.h> /* memcpy */
+
+#include "ftl.h"
+#include "sd.h"
+#include "stats.h"
+
+#include "serialize.h" /* logging */
+#include "core_pins.h" /* millis */
+
+
+/******************************************************************************/
+
+
+/* # of log segments, each is one allocation unit of the card */
+#define FTL_SEGMENTS (8)
+/* segment size when the card doesn't report its allocation unit, 4 MiB */
+#define FTL_DEFAULT_AU_BLOCKS (8192)
+
+/* # of lba ranges in the log the map can hold, see `map_room` */
+#define FTL_MAP_EXTENTS (256)
+
+/* data blocks in a record before a footer is forced, this bounds the blocks
+   read looking for a footer during the recovery scan */
+#define FTL_RECORD_MAX (128)
+
+/* writes of this many blocks go home directly, they are sequential on the 
+   card already and through the log they would be written twice */
+#define FTL_DIRECT_BLOCKS (64)
+
+/* garbage collect once this many segments are in use or the map holds this
+   many extents, or when idle. A map that full with the head as the only 
+   segment moves on from the head so the extents can be collected */
+#define FTL_GC_SEGMENTS (3)
+#define FTL_GC_EXTENTS (FTL_MAP_EXTENTS / 4)
+/* blocks copied home per step, the usb interrupt is masked meanwhile */
+#define FTL_GC_STEP_BLOCKS (8)
+/* with one free segment left or the map this full, the background collection
+   fell behind and every record first copies home at least as many blocks as 
+   it takes, in at most FTL_GC_WRITE_STEPS steps. A record that still doesn't
+   fit is refused, see `ftl_full` */
+#define FTL_GC_WRITE_EXTENTS (FTL_MAP_EXTENTS - FTL_MAP_EXTENTS / 4)
+#define FTL_GC_WRITE_STEPS (FTL_RECORD_MAX / FTL_GC_STEP_BLOCKS + 1)
+/* no writes for this long and the background work doesn't wait for limits */
+#define FTL_IDLE_MS (1000)
+/* records written before a checkpoint is forced, bounds the recovery scan */
+#define FTL_CHECKPOINT_RECORDS (16)
+
+#define FTL_FOOTER_MAGIC     (0x52544c46) /* "FLTR" */
+#define FTL_CHECKPOINT_MAGIC (0x50434c46) /* "FLCP" */
+
+/* blocks of a checkpoint slot, the header block then the extents */
+#define FTL_CHECKPOINT_BLOCKS                                                  \
+    (1 + (FTL_MAP_EXTENTS * sizeof(ftl_extent_t) + SD_BLOCK_SIZE - 1) /        \
+        SD_BLOCK_SIZE)
+
+
+/******************************************************************************/
+
+
+/* `count` lbas from `lba` are stored at the physical blocks from `pba` */
+typedef struct {
+    uint32_t lba;
+    uint32_t count;
+    uint32_t pba;
+} ftl_extent_t;
+
+/* the block written after the data of every record */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;                       /* one higher than the last record    */
+    uint32_t lba;                       /* lba of the first data block        */
+    uint32_t count;                     /* # of data blocks before the footer */
+    uint32_t pba;                       /* where the first data block is      */
+    uint32_t check;                     /* over the fields above              */
+} ftl_footer_t;
+
+/* the first block of a checkpoint slot, the map's extents follow it */
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;                /* the newest valid slot is used      */
+    uint32_t next_seq;                  /* first record not in the map        */
+    uint32_t cursor;                    /* where that record starts           */
+    uint32_t head;                      /* segment being appended to          */
+    uint32_t tail;                      /* oldest segment in use              */
+    uint32_t used;                      /* # of segments from tail to head    */
+    uint32_t count;                     /* # of extents                       */
+    uint32_t check;                     /* over the fields above and extents  */
+} ftl_checkpoint_t;
+
+
+/******************************************************************************/
+
+
+/*--- LAYOUT -----------------------------------------------------------------*/
+static uint32_t _au;                    /* blocks per segment                 */
+static uint32_t _base;                  /* pba of segment 0, the host's size  */
+static uint32_t _checkpoint;            /* pba of checkpoint slot 0           */
+
+/*--- LOG STATE --------------------------------------------------------------*/
+static struct {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t used;
+    uint32_t cursor;                    /* next free pba in the head segment  */
+    uint32_t next_seq;
+    uint32_t generation;                /* of the last checkpoint written     */
+    uint32_t dirty;                     /* records since that checkpoint      */
+    uint32_t last_ms;                   /* millis() of the last write         */
+} _log = {0};
+
+/* the record being written, see `ftl_write_start` */
+static struct {
+    int      open;
+    int      direct;                    /* written home, not to the log       */
+    uint32_t lba;
+    uint32_t count;
+    uint32_t pba;
+} _record = {0};
+
+/* next lba of the tail segment to copy home */
+static uint32_t _gc_lba = 0;
+
+/* the last record was refused for a lack of room, see `ftl_full` */
+static int _full = 0;
+
+/*--- MAP --------------------------------------------------------------------*/
+/* sorted by lba, only changed by records, by whole segments being freed and
+   by direct writes, which are checkpointed, so a replay of the records after
+   a checkpoint rebuilds it exactly */
+static struct {
+    size_t       count;
+    ftl_extent_t extents[FTL_MAP_EXTENTS];
+} _map = {0};
+
+/* footers, checkpoint blocks and the recovery scan */
+static uint8_t _block[SD_BLOCK_SIZE] __attribute__((aligned(4)));
+/* blocks on their way home, written back as one multiple block write */
+static uint8_t _gc_blocks[FTL_GC_STEP_BLOCKS][SD_BLOCK_SIZE];
+
+
+/******************************************************************************/
+
+
+/*--- LOG OPERATIONS ---------------------------------------------------------*/
+/* start a record at the cursor, moving to a new segment if needed */
+static int record_begin(uint32_t lba, uint32_t count);
+/* write the footer and map the record's blocks */
+static int record_end(void);
+/* a write of FTL_DIRECT_BLOCKS or more to its home location, the lbas are
+   unmapped once it's done */
+static int direct_begin(uint32_t lba, uint32_t count);
+static int direct_end(void);
+/* make the next segment the head, there has to be a free one */
+static int advance_segment(void);
+/* # of blocks left in `segment` from `pba`, the cursor may sit right at the 
+   end so the segment can't be derived from it */
+static uint32_t segment_remaining(uint32_t segment, uint32_t pba);
+static uint32_t segment_start(uint32_t segment);
+static uint32_t segment_of(uint32_t pba);
+/* returns 1 if `_block` is the footer of record `seq` that started at `pba`
+   with `count` data blocks */
+static int is_footer(uint32_t seq, uint32_t pba, uint32_t count);
+static uint32_t checksum(uint32_t check, const void *src, size_t length);
+
+/*--- GARBAGE COLLECTION -----------------------------------------------------*/
+/* copy the next FTL_GC_STEP_BLOCKS live blocks of the tail segment home. Once
+   it holds none the segment is freed. Returns the # of blocks copied or < 0 
+   on error */
+static int gc_step(void);
+/* a step of `gc_step`, or moving on from the head when it is the only segment
+   in use as it can't be collected. Returns the # of blocks copied or < 0 */
+static int collect_step(void);
+/* the writer's share of the collection before a record of `blocks` blocks,
+   see FTL_GC_WRITE_STEPS */
+static int collect_for_write(uint32_t blocks);
+/* 1 if the background collection fell behind and writers help it */
+static int short_of_room(void);
+/* 1 if a record can be started without collecting first */
+static int has_room(void);
+
+/*--- CHECKPOINT -------------------------------------------------------------*/
+static int checkpoint_write(void);
+/* load the newest valid checkpoint, returns < 0 if there is none */
+static int checkpoint_load(void);
+/* rebuild the state from after the checkpoint by finding its records */
+static void recovery_scan(void);
+
+/*--- MAP OPERATIONS ---------------------------------------------------------*/
+/* returns 1 if a record can be added without overflowing the map */
+static int map_room(void);
+static void map_insert(uint32_t lba, uint32_t count, uint32_t pba);
+static void map_clear(uint32_t lba, uint32_t count);
+/* 1 if any of the `count` lbas from `lba` are in the log */
+static int map_overlaps(uint32_t lba, uint32_t count);
+/* drop every extent stored in `segment` */
+static void map_remove_segment(uint32_t segment);
+static const ftl_extent_t *map_lookup(uint32_t lba);
+
+
+/******************************************************************************/
+
+
+/*--- INIT -------------------------------------------------------------------*/
+int ftl_init(void) 
+{
+    uint32_t total;
+    
+    _au = sd_au_size();
+    if (_au == 0) { _au = FTL_DEFAULT_AU_BLOCKS; }
+    
+    /* the segments and the checkpoint slots take the last allocation units of
+       the card, the checkpoint one of its own */
+    total = sd_max_lba() / _au;
+    if (total < FTL_SEGMENTS + 2) 
+    {
+        LOGERROR("card too small for the log");
+        return -1;
+    }
+    _base       = (total - FTL_SEGMENTS - 1) * _au;
+    _checkpoint = _base + FTL_SEGMENTS * _au;
+    
+    _record.open = 0;
+    _gc_lba      = 0;
+    _full        = 0;
+    
+    if (checkpoint_load() < 0) 
+    {
+        LOGINFO("no log found, formatting");
+        _map.count      = 0;
+        _log.head       = 0;
+        _log.tail       = 0;
+        _log.used       = 1;
+        _log.cursor     = _base;
+        _log.next_seq   = 1;
+        _log.generation = 0;
+        _log.dirty      = 0;
+        _log.last_ms    = millis();
+        if (sd_erase_group() != 0) { sd_erase(_base, _au); }
+        if (checkpoint_write() < 0) { return -1; }
+    }
+    else 
+    {
+        recovery_scan();
+    }
+    
+    LOGINFO("log at 0x%08x, %u extents, segments %u..%u", 
+        _base, _map.count, _log.tail, _log.head);
+    return 0;
+}
+
+uint32_t ftl_max_lba(void) 
+{
+    return _base;
+}
+
+uint32_t ftl_erase_group(void) 
+{
+    return 0;
+}
+
+
+/*--- READ -------------------------------------------------------------------*/
+int ftl_read_block(void *dest, uint32_t lba) 
+{
+    const ftl_extent_t *e;
+    
+    if (_record.open) 
+    {
+        LOGCRITICAL("read with a record open");
+        return -1;
+    }
+    
+    if ((e = map_lookup(lba)) != NULL) 
+    {
+        return sd_read_block(dest, e->pba + (lba - e->lba));
+    }
+    return sd_read_block(dest, lba);
+}
+
+
+/*--- WRITE ------------------------------------------------------------------*/
+int ftl_write_start(uint32_t lba, uint32_t count) 
+{
+    if (_record.open) 
+    {
+        LOGCRITICAL("record already open");
+        return -1;
+    }
+    
+    /* unmapping may split an extent, without room it goes to the log and
+       waits there like any other write */
+    if (count >= FTL_DIRECT_BLOCKS && map_room()) 
+    {
+        return direct_begin(lba, count);
+    }
+    return record_begin(lba, count);
+}
+
+int ftl_write_data(const void *src) 
+{
+    if (!_record.open) 
+    {
+        LOGCRITICAL("write without a record open");
+        return -1;
+    }
+    
+    if (_record.direct) 
+    {
+        if (sd_write_data(src) != 0) 
+        {
+            /* a failed write, the lbas the log holds keep its older copies */
+            _record.open = 0;
+            sd_write_stop();
+            return -1;
+        }
+        _record.count++;
+        _log.last_ms = millis();
+        return 0;
+    }
+    
+    /* a long write is split into records, the footer needs a block too */
+    if (_record.count == FTL_RECORD_MAX || 
+            segment_remaining(_log.head, _log.cursor) < 2) 
+    {
+        if (record_end() < 0) { return -1; }
+        if (record_begin(_record.lba + _record.count, 1) < 0) { return -1; }
+    }
+    
+    if (sd_write_data(src) != 0) 
+    {
+        /* nothing of the record is mapped, step over the failed block and
+           checkpoint so the recovery scan starts after it */
+        _record.open = 0;
+        sd_write_stop();
+        _log.cursor++;
+        checkpoint_write();
+        return -1;
+    }
+    
+    _record.count++;
+    _log.cursor++;
+    _log.last_ms = millis();
+    return 0;
+}
+
+int ftl_write_stop(void) 
+{
+    if (!_record.open) { return 0; }
+    return _record.direct ? direct_end() : record_end();
+}
+
+
+/*--- BACKGROUND WORK --------------------------------------------------------*/
+void ftl_poll(void) 
+{
+    int idle;
+    
+    /* the card is busy with a record */
+    if (_record.open) { return; }
+    
+    idle = (millis() - _log.last_ms) > FTL_IDLE_MS;
+    
+    if (_log.used > 1 && 
+            (idle || _log.used >= FTL_GC_SEGMENTS || 
+                _map.count > FTL_GC_EXTENTS)) 
+    {
+        if (gc_step() < 0) 
+        {
+            LOGERROR("garbage collection failed");
+        }
+        return;
+    }
+    if (_log.used == 1 && _map.count > FTL_GC_EXTENTS) 
+    {
+        if (advance_segment() < 0) 
+        {
+            LOGERROR("failed to move on from the head segment");
+        }
+        return;
+    }
+    
+    if (_log.dirty > 0 && (idle || _log.dirty >= FTL_CHECKPOINT_RECORDS)) 
+    {
+        checkpoint_write();
+    }
+}
+
+int ftl_sync(void) 
+{
+    if (_record.open || _log.dirty == 0) { return 0; }
+    return checkpoint_write();
+}
+
+int ftl_full(void) 
+{
+    return _full;
+}
+
+int ftl_make_room(void) 
+{
+    if (_record.open) { return 0; }
+    
+    while (!has_room()) 
+    {
+        if (collect_step() < 0) { return -1; }
+    }
+    _full = 0;
+    return 0;
+}
+
+
+/******************************************************************************/
+
+
+int record_begin(uint32_t lba, uint32_t count) 
+{
+    if (count > FTL_RECORD_MAX) { count = FTL_RECORD_MAX; }
+    
+    if (short_of_room() && collect_for_write(count + 1) < 0) { return -1; }
+    
+    /* collecting a whole segment here would hold usb_isr up for seconds, the
+       write is refused instead and the host retries it */
+    if (!has_room()) 
+    {
+        if (!_full) { LOGWARN("log full, refusing writes"); }
+        _full = 1;
+        stats.ftl_full++;
+        return -1;
+    }
+    _full = 0;
+    
+    if (segment_remaining(_log.head, _log.cursor) < 2 && advance_segment() < 0) 
+    {
+        return -1;
+    }
+    
+    if (sd_write_start(_log.cursor, count + 1) != 0) { return -1; }
+    
+    _record.open   = 1;
+    _record.direct = 0;
+    _record.lba    = lba;
+    _record.count = 0;
+    _record.pba   = _log.cursor;
+    return 0;
+}
+
+int record_end(void) 
+{
+    ftl_footer_t *footer = (void *) _block;
+    
+    _record.open = 0;
+    
+    if (_record.count == 0) 
+    {
+        return sd_write_stop() != 0 ? -1 : 0;
+    }
+    
+    memset(_block, 0, sizeof(_block));
+    *footer = (ftl_footer_t) {
+        .magic = FTL_FOOTER_MAGIC, 
+        .seq   = _log.next_seq, 
+        .lba   = _record.lba, 
+        .count = _record.count, 
+        .pba   = _record.pba, 
+        .check = 0
+    };
+    footer->check = checksum(0, footer, offsetof(ftl_footer_t, check));
+    
+    _log.cursor++;
+    if (sd_write_data(_block) != 0) 
+    {
+        sd_write_stop();
+        goto error;
+    }
+    if (sd_write_stop() != 0) { goto error; }
+    
+    map_insert(_record.lba, _record.count, _record.pba);
+    _log.next_seq++;
+    _log.dirty++;
+    stats.ftl_records++;
+    return 0;
+    
+error:
+    /* the record is lost, the scan has to start after it */
+    LOGERROR("failed to end the record at 0x%08x", _record.pba);
+    checkpoint_write();
+    return -1;
+}
+
+int advance_segment(void) 
+{
+    uint32_t next, head, cursor;
+    
+    if (_log.used == FTL_SEGMENTS) 
+    {
+        LOGCRITICAL("no free segment to advance to");
+        return -1;
+    }
+    
+    head   = _log.head;
+    cursor = _log.cursor;
+    next   = (_log.head + 1) % FTL_SEGMENTS;
+    
+    /* pre-erased units are written fastest, stale records left in the segment
+       are never replayed since their sequence numbers are old */
+    if (sd_erase_group() != 0 && sd_erase(segment_start(next), _au) != 0) 
+    {
+        LOGWARN("failed to erase segment %u", next);
+    }
+    
+    _log.head   = next;
+    _log.used  += 1;
+    _log.cursor = segment_start(next);
+    
+    /* the recovery scan only follows the writer into the next segment once 
+       the head is full, moving on before that has to be checkpointed */
+    if (segment_remaining(head, cursor) >= 2 && checkpoint_write() < 0) 
+    {
+        _log.head   = head;
+        _log.used  -= 1;
+        _log.cursor = cursor;
+        return -1;
+    }
+    return 0;
+}
+
+int direct_begin(uint32_t lba, uint32_t count) 
+{
+    /* a failure of this write isn't for a lack of room */
+    _full = 0;
+    if (sd_write_start(lba, count) != 0) { return -1; }
+    
+    _record.open   = 1;
+    _record.direct = 1;
+    _record.lba    = lba;
+    _record.count  = 0;
+    _record.pba    = lba;
+    return 0;
+}
+
+int direct_end(void) 
+{
+    _record.open = 0;
+    if (sd_write_stop() != 0) { return -1; }
+    stats.ftl_direct_blocks += _record.count;
+    
+    /* the older copies in the log are dropped. The records that map them may
+       be replayed, so the checkpoint has to be on the card before the write
+       is done */
+    if (!map_overlaps(_record.lba, _record.count)) { return 0; }
+    map_clear(_record.lba, _record.count);
+    return checkpoint_write();
+}
+
+uint32_t segment_remaining(uint32_t segment, uint32_t pba) 
+{
+    return segment_start(segment) + _au - pba;
+}
+
+uint32_t segment_start(uint32_t segment) 
+{
+    return _base + segment * _au;
+}
+
+uint32_t segment_of(uint32_t pba) 
+{
+    return (pba - _base) / _au;
+}
+
+int is_footer(uint32_t seq, uint32_t pba, uint32_t count) 
+{
+    const ftl_footer_t *footer = (const void *) _block;
+    
+    return footer->magic == FTL_FOOTER_MAGIC && footer->seq == seq && 
+        footer->pba == pba && footer->count == count && 
+        footer->check == checksum(0, footer, offsetof(ftl_footer_t, check));
+}
+
+/* FNV-1a over 32 bit words, `length` is a multiple of 4 */
+uint32_t checksum(uint32_t check, const void *src, size_t length) 
+{
+    const uint32_t *word = src;
+    size_t i;
+    
+    if (check == 0) { check = 2166136261u; }
+    for (i = 0; i < length / sizeof(*word); i++) 
+    {
+        check = (check ^ word[i]) * 16777619u;
+    }
+    return check;
+}
+
+
+/******************************************************************************/
+
+
+int gc_step(void) 
+{
+    const ftl_extent_t *e;
+    uint32_t first, lba, pba, n;
+    size_t j;
+    
+    if (_log.used == 1) { return 0; }
+    
+    /* gather the next run of contiguous lbas stored in the tail, in lba order
+       so the home writes are ascending too */
+    first = lba = _gc_lba;
+    for (n = 0, j = 0; n < FTL_GC_STEP_BLOCKS && j < _map.count; j++) 
+    {
+        e = &_map.extents[j];
+        if (segment_of(e->pba) != _log.tail || e->lba + e->count <= lba) 
+        {
+            continue;
+        }
+        if (n > 0 && e->lba != lba) { break; }
+        if (n == 0) { first = lba = e->lba > lba ? e->lba : lba; }
+        
+        for (pba = e->pba + (lba - e->lba);
+                lba < e->lba + e->count && n < FTL_GC_STEP_BLOCKS;
+                lba++, pba++, n++) 
+        {
+            if (sd_read_block(_gc_blocks[n], pba) != 0) { return -1; }
+        }
+    }
+    
+    /* everything is home, forget the segment. The checkpoint has to be on the
+       card before the segment is written to again */
+    if (n == 0) 
+    {
+        map_remove_segment(_log.tail);
+        _log.tail = (_log.tail + 1) % FTL_SEGMENTS;
+        _log.used--;
+        _gc_lba = 0;
+        return checkpoint_write() < 0 ? -1 : 0;
+    }
+    
+    if (sd_write_start(first, n) != 0) { return -1; }
+    for (j = 0; j < n; j++) 
+    {
+        if (sd_write_data(_gc_blocks[j]) != 0) 
+        {
+            sd_write_stop();
+            return -1;
+        }
+    }
+    if (sd_write_stop() != 0) { return -1; }
+    
+    _gc_lba = lba;
+    stats.ftl_gc_blocks += n;
+    return n;
+}
+
+int collect_step(void) 
+{
+    if (_log.used == 1) 
+    {
+        return advance_segment() < 0 ? -1 : 0;
+    }
+    return gc_step();
+}
+
+int collect_for_write(uint32_t blocks) 
+{
+    uint32_t copied, steps;
+    int n;
+    
+    /* the tail holds at most a segment of live blocks and writers start to
+       help with a segment still free, so copying as much as is written gets
+       the tail home before the head runs into it */
+    for (copied = 0, steps = 0; 
+            copied < blocks && steps < FTL_GC_WRITE_STEPS && short_of_room(); 
+            steps++) 
+    {
+        if ((n = collect_step()) < 0) { return -1; }
+        copied += n;
+    }
+    stats.ftl_gc_write_blocks += copied;
+    return 0;
+}
+
+int short_of_room(void) 
+{
+    return _log.used >= FTL_SEGMENTS - 1 || _map.count >= FTL_GC_WRITE_EXTENTS;
+}
+
+int has_room(void) 
+{
+    if (!map_room()) { return 0; }
+    return _log.used < FTL_SEGMENTS || 
+        segment_remaining(_log.head, _log.cursor) >= 2;
+}
+
+
+/******************************************************************************/
+
+
+int checkpoint_write(void) 
+{
+    ftl_checkpoint_t *header = (void *) _block;
+    const uint8_t *extents;
+    size_t length, n, i;
+    uint32_t slot, check;
+    
+    slot = _checkpoint + ((_log.generation + 1) % 2) * FTL_CHECKPOINT_BLOCKS;
+    
+    memset(_block, 0, sizeof(_block));
+    *header = (ftl_checkpoint_t) {
+        .magic      = FTL_CHECKPOINT_MAGIC, 
+        .generation = _log.generation + 1, 
+        .next_seq   = _log.next_seq, 
+        .cursor     = _log.cursor, 
+        .head       = _log.head, 
+        .tail       = _log.tail, 
+        .used       = _log.used, 
+        .count      = _map.count, 
+        .check      = 0
+    };
+    length = _map.count * sizeof(ftl_extent_t);
+    check  = checksum(0, header, offsetof(ftl_checkpoint_t, check));
+    header->check = checksum(check, _map.extents, length);
+    
+    if (sd_write_start(slot, FTL_CHECKPOINT_BLOCKS) != 0) { return -1; }
+    if (sd_write_data(_block) != 0) { goto error; }
+    
+    extents = (const void *) _map.extents;
+    for (i = 0; i < length; i += n) 
+    {
+        n = length - i < SD_BLOCK_SIZE ? length - i : SD_BLOCK_SIZE;
+        memset(_block, 0, sizeof(_block));
+        memcpy(_block, extents + i, n);
+        if (sd_write_data(_block) != 0) { goto error; }
+    }
+    if (sd_write_stop() != 0) { return -1; }
+    
+    _log.generation++;
+    _log.dirty = 0;
+    stats.ftl_checkpoints++;
+    return 0;
+    
+error:
+    sd_write_stop();
+    LOGERROR("failed to write checkpoint %u", _log.generation + 1);
+    return -1;
+}
+
+int checkpoint_load(void) 
+{
+    ftl_checkpoint_t headers[2];
+    const ftl_checkpoint_t *h;
+    uint8_t *extents;
+    size_t length, n, i;
+    uint32_t slot, pba, check;
+    int s, order[2];
+    
+    for (s = 0; s < 2; s++) 
+    {
+        slot = _checkpoint + s * FTL_CHECKPOINT_BLOCKS;
+        if (sd_read_block(_block, slot) != 0) { return -1; }
+        memcpy(&headers[s], _block, sizeof(headers[s]));
+    }
+    
+    /* newest generation first, fall back to the other slot if it is torn */
+    order[0] = headers[1].generation > headers[0].generation ? 1 : 0;
+    order[1] = !order[0];
+    
+    for (s = 0; s < 2; s++) 
+    {
+        h = &headers[order[s]];
+        if (h->magic != FTL_CHECKPOINT_MAGIC || h->count > FTL_MAP_EXTENTS || 
+                h->used == 0 || h->used > FTL_SEGMENTS || 
+                h->head >= FTL_SEGMENTS || h->tail >= FTL_SEGMENTS || 
+                h->cursor < _base || h->cursor > _checkpoint) 
+        {
+            continue;
+        }
+        
+        slot    = _checkpoint + order[s] * FTL_CHECKPOINT_BLOCKS;
+        length  = h->count * sizeof(ftl_extent_t);
+        extents = (void *) _map.extents;
+        for (i = 0, pba = slot + 1; i < length; i += n, pba++) 
+        {
+            n = length - i < SD_BLOCK_SIZE ? length - i : SD_BLOCK_SIZE;
+            if (sd_read_block(_block, pba) != 0) { return -1; }
+            memcpy(extents + i, _block, n);
+        }
+        
+        check = checksum(0, h, offsetof(ftl_checkpoint_t, check));
+        if (checksum(check, _map.extents, length) != h->check) 
+        {
+            LOGWARN("checkpoint %u is torn", h->generation);
+            continue;
+        }
+        
+        _map.count      = h->count;
+        _log.head       = h->head;
+        _log.tail       = h->tail;
+        _log.used       = h->used;
+        _log.cursor     = h->cursor;
+        _log.next_seq   = h->next_seq;
+        _log.generation = h->generation;
+        _log.dirty      = 0;
+        _log.last_ms    = millis();
+        return 0;
+    }
+    return -1;
+}
+
+void recovery_scan(void) 
+{
+    const ftl_footer_t *footer = (const void *) _block;
+    uint32_t pos, head, used, k, limit;
+    int found;
+    
+    pos  = _log.cursor;
+    head = _log.head;
+    used = _log.used;
+    
+    while (1) 
+    {
+        /* the writer moves to the next segment the same way */
+        if (segment_remaining(head, pos) < 2) 
+        {
+            if (used == FTL_SEGMENTS) { break; }
+            head = (head + 1) % FTL_SEGMENTS;
+            used++;
+            pos  = segment_start(head);
+        }
+        
+        limit = segment_remaining(head, pos) - 1;
+        if (limit > FTL_RECORD_MAX) { limit = FTL_RECORD_MAX; }
+        
+        for (k = 1, found = 0; k <= limit && !found; k++) 
+        {
+            if (sd_read_block(_block, pos + k) != 0) { break; }
+            found = is_footer(_log.next_seq, pos, k);
+        }
+        if (!found) { break; }
+        
+        /* the record made it to the card completely */
+        map_insert(footer->lba, footer->count, pos);
+        _log.next_seq++;
+        _log.head   = head;
+        _log.used   = used;
+        _log.dirty++;
+        pos += footer->count + 1;
+        _log.cursor = pos;
+        stats.ftl_recovered_records++;
+    }
+    
+    LOGINFO("recovered %u records", _log.dirty);
+    if (_log.dirty > 0) { checkpoint_write(); }
+}
+
+
+/******************************************************************************/
+
+
+int map_room(void) 
+{
+    /* a record splits at most one extent in two and adds itself */
+    return _map.count + 2 <= FTL_MAP_EXTENTS;
+}
+
+void map_insert(uint32_t lba, uint32_t count, uint32_t pba) 
+{
+    ftl_extent_t *e = _map.extents;
+    size_t i;
+    
+    map_clear(lba, count);
+    
+    for (i = 0; i < _map.count && e[i].lba < lba; i++);
+    
+    /* continues the extent before it on the card too */
+    if (i > 0 && e[i-1].lba + e[i-1].count == lba && 
+            e[i-1].pba + e[i-1].count == pba) 
+    {
+        e[i-1].count += count;
+        return;
+    }
+    
+    memmove(&e[i + 1], &e[i], (_map.count - i) * sizeof(*e));
+    e[i] = (ftl_extent_t) { lba, count, pba };
+    _map.count++;
+}
+
+void map_clear(uint32_t lba, uint32_t count) 
+{
+    ftl_extent_t *e = _map.extents;
+    uint32_t end, eend;
+    size_t i;
+    
+    end = lba + count;
+    for (i = 0; i < _map.count; i++) 
+    {
+        eend = e[i].lba + e[i].count;
+        if (eend <= lba || e[i].lba >= end) { continue; }
+        
+        if (e[i].lba < lba && eend > end) 
+        {
+            /* split in two, `map_room` made sure there is space */
+            memmove(&e[i + 1], &e[i], (_map.count - i) * sizeof(*e));
+            _map.count++;
+            e[i].count = lba - e[i].lba;
+            e[i + 1]   = (ftl_extent_t) {
+                end, eend - end, e[i].pba + (end - e[i].lba)
+            };
+            return;
+        }
+        
+        if (e[i].lba < lba) 
+        {
+            e[i].count = lba - e[i].lba;
+        }
+        else if (eend > end) 
+        {
+            e[i].pba  += end - e[i].lba;
+            e[i].count = eend - end;
+            e[i].lba   = end;
+        }
+        else 
+        {
+            memmove(&e[i], &e[i + 1], (_map.count - i - 1) * sizeof(*e));
+            _map.count--;
+            i--;
+        }
+    }
+}
+
+int map_overlaps(uint32_t lba, uint32_t count) 
+{
+    size_t i;
+    
+    for (i = 0; i < _map.count && _map.extents[i].lba < lba + count; i++) 
+    {
+        if (_map.extents[i].lba + _map.extents[i].count > lba) { return 1; }
+    }
+    return 0;
+}
+
+void map_remove_segment(uint32_t segment) 
+{
+    size_t i, j;
+    
+    for (i = 0, j = 0; i < _map.count; i++) 
+    {
+        if (segment_of(_map.extents[i].pba) == segment) { continue; }
+        _map.extents[j++] = _map.extents[i];
+    }
+    _map.count = j;
+}
+
+const ftl_extent_t *map_lookup(uint32_t lba) 
+{
+    size_t lo, hi, mid;
+    
+    /* binary search for the last extent starting at or before `lba` */
+    lo = 0;
+    hi = _map.count;
+    while (lo < hi) 
+    {
+        mid = (lo + hi) / 2;
+        if (_map.extents[mid].lba <= lba) { lo = mid + 1; }
+        else                              { hi = mid; }
+    }
+    
+    if (lo == 0) { return NULL; }
+    if (lba >= _map.extents[lo - 1].lba + _map.extents[lo - 1].count) 
+    {
+        return NULL;
+    }
+    return &_map.extents[lo - 1];
+}
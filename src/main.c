@@ -1,9 +1,12 @@
+#include "usb_msd.h"
 
 void yield(void) {}
 
 int main(void)
 {
-    while (1) {}
+    while (1) 
+    {
+        usb_msd_poll();
+    }
     return 0;
 }
-
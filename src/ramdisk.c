@@ -0,0 +1,51 @@
+#include <stddef.h>
+#include <string.h> /* memcpy */
+
+#include "ramdisk.h"
+#include "sd.h" /* SD_BLOCK_SIZE */
+
+
+/******************************************************************************/
+
+
+#if RAMDISK_BLOCKS > 0
+/* word aligned for the usb dma and the zero block checks in scsi_sd.c */
+static uint8_t _blocks[RAMDISK_BLOCKS][SD_BLOCK_SIZE] __attribute__((aligned(4)));
+#endif
+
+
+/******************************************************************************/
+
+
+uint32_t ramdisk_max_lba(void) 
+{
+    return RAMDISK_BLOCKS;
+}
+
+int ramdisk_read_block(void *dest, uint32_t lba) 
+{
+    const void *block;
+    
+    if ((block = ramdisk_block(lba)) == NULL) { return -1; }
+    memcpy(dest, block, SD_BLOCK_SIZE);
+    return 0;
+}
+
+int ramdisk_write_block(uint32_t lba, const void *src) 
+{
+    void *block;
+    
+    if ((block = (void *) ramdisk_block(lba)) == NULL) { return -1; }
+    memcpy(block, src, SD_BLOCK_SIZE);
+    return 0;
+}
+
+const void *ramdisk_block(uint32_t lba) 
+{
+#if RAMDISK_BLOCKS > 0
+    if (lba < RAMDISK_BLOCKS) { return _blocks[lba]; }
+#else
+    (void) lba;
+#endif
+    return NULL;
+}
@@ -4,11 +4,31 @@
 
 #include "scsi_sd.h"
 #include "sd.h"
+#include "ramdisk.h"
+#include "bench.h"
 #include "scsi/scsi.h"
 #include "chs.h"
 #include "endian.h"
 
+#include "stats.h"
 #include "serialize.h" /* logging */
+#include "core_pins.h" /* millis */
+
+#ifdef SD_FTL
+/* the translation layer takes the card's place for the blocks the host sees,
+   see ftl.h */
+#include "ftl.h"
+#define sd_max_lba     ftl_max_lba
+#define sd_read_block  ftl_read_block
+#define sd_write_start ftl_write_start
+#define sd_write_data  ftl_write_data
+#define sd_write_stop  ftl_write_stop
+#define sd_erase_group ftl_erase_group
+#else
+/* only the translation layer refuses writes for a lack of room */
+#define ftl_full()      (0)
+#define ftl_make_room() (0)
+#endif
 
 
 /******************************************************************************/
@@ -21,25 +41,105 @@
 #error buffer byte count must be a multiple of the block size and > than 0
 #endif
 
+/* how long an idle CMD25 write session is kept open waiting for the next 
+   contiguous WRITE before it is closed from `scsi_sd_poll` */
+#define WRITE_SESSION_TIMEOUT_MS (100)
+
+/* largest WRITE SAME accepted, the blocks that can't be erased are written one
+   at a time from within the usb interrupt so keep it well under host timeouts*/
+#define WRITE_SAME_MAX_BLOCKS (0x2000)
+
+/* benchmark runs of the SEND DIAGNOSTIC short and extended self tests, both
+   are clamped to the scratch region. The short one is sized to finish in a
+   few seconds */
+#define BENCH_SHORT_SEQ_BLOCKS     (1024)
+#define BENCH_SHORT_RANDOM_OPS     (64)
+#define BENCH_EXTENDED_SEQ_BLOCKS  (UINT32_MAX)
+#define BENCH_EXTENDED_RANDOM_OPS  (1024)
+
+/* UNMAP parameter lists are processed from the io buffer */
+#define UNMAP_MAX_DESCRIPTORS                                                  \
+    ((IO_BUFFER_SIZE - UNMAP_PARAMETER_LIST_HEADER_LENGTH) /                   \
+        UNMAP_BLOCK_DESCRIPTOR_LENGTH)
+
+/* the write stage holds up to STAGE_BLOCKS blocks of the same write chunk of
+   the card (see `sd_write_chunk`) for at most STAGE_TIMEOUT_MS before they are
+   written out in lba order */
+#define STAGE_BLOCKS (16)
+#define STAGE_TIMEOUT_MS (20)
+/* write chunk assumed when the card has none, 4 MiB */
+#define STAGE_DEFAULT_CHUNK_BLOCKS (8192)
+
+/* how often the card is checked for being pulled or put in, from 
+   `scsi_sd_poll` while nothing else is going on with it */
+#define CARD_PROBE_MS (250)
+
+/* # of known zero extents tracked, when full the smallest extent is forgotten
+   and its blocks are read from the card again */
+#define ZERO_MAP_EXTENTS (32)
+
 
 /******************************************************************************/
 
 
 typedef struct { 
-    uint32_t   lba;       /* starting lba for this lun */
-    uint32_t   count;     /* number of blocks in the lun */
+    scsi_sd_lun_config_t config;
+    uint32_t   lba;       /* starting card lba for this lun */
+    uint32_t   count;     /* number of blocks in the lun, 0 if not ready */
+    fixed_format_sense_data_t sense;
+    mode_page_flexible_disk_t fdmp;
+    mode_page_caching_t cmp;
 } lun_t;
 
+typedef struct {
+    uint32_t   lba;
+    uint32_t   count;
+} extent_t;
+
 
 /******************************************************************************/
 
 
 /*--- SD CARD INFORMATION ----------------------------------------------------*/
-static int      _initialized    = 0;
+/* the card is brought up a step at a time by `scsi_sd_poll` from reset on, so
+   enumeration doesn't wait for it. Card luns are laid out once it is ready,
+   and emptied again when it is pulled */
+static enum {
+    CARD_IDLE = 0,                      /* bring up not started yet           */
+    CARD_STARTING,                      /* `sd_init_step` has work left       */
+    CARD_READY,
+    CARD_FAILED,                        /* there, but the bring up failed     */
+    CARD_ABSENT                         /* the slot is empty                  */
+} _card_state = CARD_IDLE;
+static uint32_t _card_blocks    = 0;    /* of the card, less the scratch      */
+static uint32_t _card_start_ms  = 0;    /* millis() the bring up started at   */
+static uint32_t _card_probe_ms  = 0;    /* millis() it was last checked for   */
+
+/*--- SUSPEND ----------------------------------------------------------------*/
+/* the usb bus is suspended and the card in standby, see `scsi_sd_suspend` */
+static int      _suspended      = 0;
+/* millis() the bus resumed at, kept until the first block is read or written
+   for the resume_io_ms stat */
+static uint32_t _resume_ms      = 0;
+static int      _resume_pending = 0;
+
+/*--- LUN CONFIGURATION ------------------------------------------------------*/
+/* initializers of the `scsi_sd_lun_config_t`s to use when `scsi_sd_configure`
+   isn't called, see the Makefile */
+#ifndef SCSI_SD_LUNS
+#define SCSI_SD_LUNS                                                           \
+    { SCSI_SD_BACKEND_CARD, SCSI_SD_LUN_STAGE | SCSI_SD_LUN_SKIP_ZEROS, 0, 0, NULL }
+#endif
+
+static const scsi_sd_lun_config_t _default_config[] = { SCSI_SD_LUNS };
+
+static const scsi_sd_lun_config_t *_config = _default_config;
+static size_t _config_count = sizeof(_default_config)/sizeof(_default_config[0]);
 
 /*--- STATE ------------------------------------------------------------------*/
 /* information on what luns are set and which one is selected */
-static lun_t    _luns[1]        = { {0, 0} };
+static lun_t    _luns[SCSI_SD_MAX_LUNS];
+static size_t   _lun_count      = 0;
 static lun_t   *_lun            = NULL;
 
 /*--- CDB STATE --------------------------------------------------------------*/
@@ -50,6 +150,35 @@ static const scsi_cdb_t *_cdb = NULL;
    read/written from the lba specified in `_cdb` */
 static size_t _lba_offset; 
 
+/* the READ(10)/WRITE(10) `scsi_sd_begin_blocks` runs, `_cdb` points at it */
+static union {
+    read10_t  read;
+    write10_t write;
+} _block_cdb;
+
+/*--- DIRECT READS -----------------------------------------------------------*/
+/* the rest of a READ of a ram disk lun, sent straight from the ram disk */
+static struct {
+    const uint8_t *ptr;
+    size_t count;
+} _direct = {0};
+
+/*--- SELF BENCHMARK ---------------------------------------------------------*/
+/* the blocks at the end of the card no lun may use, see bench.h */
+static struct {
+    uint32_t lba;
+    uint32_t count;                     /* 0 if the card is too small         */
+} _scratch = {0};
+
+/* the lun of a foreground self test, its status is held until `scsi_sd_poll`
+   finished the run (see `scsi_sd_pending`). NULL if there is none */
+static lun_t   *_foreground     = NULL;
+
+/*--- READ/WRITE BUFFER -----------------------------------------------------*/
+/* # of bytes at the start of the io buffer written by the last echo mode WRITE
+   BUFFER, 0 once any other command may have reused the buffer */
+static size_t _echo_length = 0;
+
 /*--- DATA IN/OUT OPERATIONS -------------------------------------------------*/
 static struct {
     size_t count;                       /* # of valid bytes in the buffer     */
@@ -60,15 +189,52 @@ static struct {
     uint8_t *write_ptr;                 /* where to put the next IN data      */
     size_t write_count;                 /* how much free space is left        */
     
-    uint8_t bytes[IO_BUFFER_SIZE];
+    /* word aligned for the zero block checks, see `is_zero_block` */
+    uint8_t bytes[IO_BUFFER_SIZE] __attribute__((aligned(4)));
 } _io = {0};
 
-/*--- REPORT LUNS DATA -------------------------------------------------------*/
-static const report_luns_parameter_data_t _report_luns_data = {
-    .lun_list_length = htobe32(1),
-    ._reserved       = 0,
-    .lun_list        = { 0 }
-};
+/*--- WRITE SESSION ----------------------------------------------------------*/
+/* a CMD25 multiple block write left open between CDBs, so back to back WRITEs
+   of contiguous lbas don't pay the card's stop and program penalty each time */
+static struct {
+    int      open;
+    uint32_t lba;                       /* first lba of the session           */
+    uint32_t next_lba;                  /* lba expected to continue session   */
+    uint32_t last_ms;                   /* millis() of the last block written */
+    lun_t   *lun;                       /* gets the sense of a failed close   */
+    uint32_t failed_lba;                /* first lba a failed session missed  */
+} _session = {0};
+
+/*--- WRITE STAGE ----------------------------------------------------------*/
+/* blocks of completed WRITEs not yet sent to the card. They all fall in the 
+   same write chunk (`segment`), random writes within a chunk are gathered 
+   and sorted so the card sees them as few ascending multiple block writes */
+static struct {
+    size_t   count;
+    uint32_t segment;                   /* lba / write chunk size             */
+    uint32_t first_ms;                  /* millis() of the oldest block       */
+    lun_t   *lun;                       /* the lun all the blocks belong to   */
+    uint32_t lbas[STAGE_BLOCKS];
+    uint8_t  blocks[STAGE_BLOCKS][SD_BLOCK_SIZE];
+} _stage = {0};
+
+/*--- KNOWN ZERO BLOCKS ------------------------------------------------------*/
+/* sorted, non touching extents of blocks known to read back as all zeros.
+   Reads of them are served from `_zero_block` without touching the card */
+static struct {
+    size_t   count;
+    extent_t extents[ZERO_MAP_EXTENTS];
+} _zero_map = {0};
+
+/* zero blocks recieved by the current WRITE that were not written yet, they 
+   are erased or skipped as one run once a data block or the end arrives */
+static struct {
+    uint32_t lba;
+    uint32_t count;
+    size_t   offset;                    /* `_lba_offset` of the first block   */
+} _zero_run = {0};
+
+static uint8_t _zero_block[SD_BLOCK_SIZE] __attribute__((aligned(4))) = {0};
 
 /*--- INQUIRY DATA -----------------------------------------------------------*/
 /* scsi spc 4.4.1 - all left aligned ascii strings will have extra bytes filled
@@ -76,58 +242,201 @@ static const report_luns_parameter_data_t _report_luns_data = {
 static const inquiry_data_t _inquiry_data = {
     .peripheral           = INQUIRY_DATA_PDT_DABD | INQUIRY_DATA_PQ_CONNECTED,
     .removable            = INQUIRY_DATA_RMB_REMOVABLE,
-    .version              = INQUIRY_DATA_VERSION_NON_STANDARD,
-    .response_data_format = 0x01, // UNKNOWN obsolete value
+    .version              = INQUIRY_DATA_VERSION_SPC4, /* for the vpd pages */
+    .response_data_format = INQUIRY_DATA_RDF_STANDARD,
     .additional_length    = INQUIRY_DATA_ADDITIONAL_LENGTH(sizeof(_inquiry_data)),
     .flags                = {0, 0, 0},
     .vendor_id            = {'T','e','e','n','s','y',' ',' '},
     .product_id           = {'U','S','B',' ','M','I','C','R','O',' ','S','D',' ',' ',' ',' '},
     .product_revision     = {'M','S','D','1'}
 };
-/*--- SENSE DATA: FIXED FORMAT -----------------------------------------------*/
-static fixed_format_sense_data_t _ffsd = FIXED_FORMAT_SENSE_DATA_DEFAULT;
+/*--- DIAGNOSTIC PAGES -------------------------------------------------------*/
+/* supported diagnostic pages in ascending order, scsi spc 3r23 7.1.2 */
+static const uint8_t _diagnostic_pages[] = {
+    DIAGNOSTIC_PAGE_SUPPORTED_PAGES,
+    DIAGNOSTIC_PAGE_BENCH
+};
 
-/*--- MODE PAGE: FLEXIBLE DISK -----------------------------------------------*/
-static mode_page_flexible_disk_t _fdmp = { 0 };
+/*--- VPD PAGES --------------------------------------------------------------*/
+/* supported vpd pages in ascending order, scsi spc 4r37 7.8.15 */
+static const uint8_t _vpd_pages[] = {
+    VPD_PAGE_SUPPORTED_PAGES,
+    VPD_PAGE_UNIT_SERIAL_NUMBER,
+    VPD_PAGE_BLOCK_LIMITS,
+    VPD_PAGE_BLOCK_DEVICE_CHARACTERISTICS,
+    VPD_PAGE_LOGICAL_BLOCK_PROVISIONING,
+    VPD_PAGE_DEVICE_STATISTICS,
+    VPD_PAGE_CARD_INTERFACE
+};
 
 
 /******************************************************************************/
 
 
+/*--- CARD OPERATIONS --------------------------------------------------------*/
+/* start bringing up the card, nothing is known about its contents anymore */
+static void card_start(void);
+/* do the next step of the bring up, lays out the card luns once it's done */
+static void card_step(void);
+/* check every CARD_PROBE_MS whether the card was pulled or put in */
+static void card_probe(void);
+/* the card is gone, drop what was held for it and empty the card luns */
+static void card_removed(void);
+/* after a failed card operation of the current lun, 1 if it failed because
+   the card was pulled. The sense is then set to MEDIUM NOT PRESENT */
+static int  card_lost(void);
+/* after a failed write of the current lun, 1 if the translation layer had no
+   room for it. The sense is then set to NOT READY, OPERATION IN PROGRESS so 
+   the host retries the command */
+static int  log_full(void);
+/* the first block read or written since the bus resumed, see stats.h */
+static void resume_io(void);
+
+/*--- LUN OPERATIONS ---------------------------------------------------------*/
+/* returns 1 if the slices and images of `luns` can be used */
+static int is_valid_config(const scsi_sd_lun_config_t *luns, size_t count);
+/* lay the lun out on a card of `card_blocks` blocks, or on the ram disk, and 
+   reset its state */
+static void lun_init(lun_t *lun, const scsi_sd_lun_config_t *config, 
+    uint32_t card_blocks);
+/* returns 1 if the lun's blocks can be accessed */
+static int lun_ready(const lun_t *lun);
+/* erase group of the selected lun, 0 if it can't be erased */
+static uint32_t lun_erase_group(void);
+/* read/write a block of the selected lun, `lba` is relative to the lun.
+   `count` is the blocks of the write from this one on, a write session that
+   opens has them pre-erased */
+static int lun_read_block(void *dest, uint32_t lba);
+static int lun_write_block(uint32_t lba, const void *src, uint32_t count);
+
 /*--- DATA VALIDATION --------------------------------------------------------*/
 /* generic test, everything is of valid sizes and sane values */
 static int is_valid_cdb(const scsi_cdb_t *cdb, size_t length);
 /* checks if the command can be completed at this time, ex is there an sd card
    to read from. Returns 1 if the command can be completed, 0 otherwise */
 static int in_state_to_complete(const scsi_cdb_t *cdb);
+/* returns 1 if the cdb's DATA phase is from the host, see `scsi_sd_data_in` */
+static int is_data_in_cdb(const scsi_cdb_t *cdb);
+/* returns 1 if the cdb changes the blocks of the lun */
+static int is_lun_write_cdb(const scsi_cdb_t *cdb);
 
 /*--- SCSI OPERATIONS --------------------------------------------------------*/
 /* code for parsing and completing the differnt SCSI Command CDBs supported   */
 static ssize_t format_unit(const void *cdb);
 static ssize_t inquiry(const void *cdb);
+static ssize_t inquiry_vpd(uint8_t page_code, uint16_t allocation_length);
+static void    vpd_unit_serial_number(vpd_page_header_t header);
+static void    vpd_block_limits(vpd_page_header_t header);
 static ssize_t load_unload(const void *cdb);
 static ssize_t mode_sense6(const void *cdb);
 static ssize_t prevent_allow_medium_removal(const void *cdb);
 static ssize_t read6(const void *cdb);
 static ssize_t read10(const void *cdb);
 static ssize_t read_capacity10(const void *cdb);
+static ssize_t read_capacity16(const void *cdb);
+static ssize_t read_buffer10(const void *cdb);
 static ssize_t read_format_capacities(const void *cdb);
+static ssize_t receive_diagnostic_results(const void *cdb);
 static ssize_t report_luns(const void *cdb);
 static ssize_t request_sense(const void *cdb);
 static ssize_t send_diagnostic(const void *cdb);
+static ssize_t service_action_in16(const void *cdb);
+static ssize_t synchronize_cache10(const void *cdb);
 static ssize_t test_unit_ready(const void *cdb);
+static ssize_t unmap(const void *cdb);
 static ssize_t write6(const void *cdb);
 static ssize_t write10(const void *cdb);
+static ssize_t write_buffer(const void *cdb);
+static ssize_t write_same10(const void *cdb);
+static ssize_t write_same16(const void *cdb);
 
 /*--- READ/WRITE OPERATIONS --------------------------------------------------*/
 /* handles reading and writing data from sd card to/from our buffer */
 static int scsi_read(uint32_t lba, size_t bcount);
 static int scsi_write(uint32_t lba, size_t bcount);
 
+/*--- DIAGNOSTIC OPERATIONS --------------------------------------------------*/
+/* start a benchmark of the scratch region, stepped by `scsi_sd_poll`. With
+   `foreground` set the command's status is held until the run is over.
+   Returns < 0 with the sense set if it can't be started */
+static ssize_t diagnostic_bench(const bench_config_t *config, int foreground);
+/* parses the SEND DIAGNOSTIC parameter list in the io buffer */
+static ssize_t scsi_send_diagnostic(void);
+static void    diagnostic_bench_page(diagnostic_page_header_t header);
+
+/*--- WRITE BUFFER OPERATIONS ------------------------------------------------*/
+/* the data of a WRITE BUFFER is already in place, remember the echo buffer */
+static ssize_t scsi_write_buffer(void);
+
+/*--- UNMAP/WRITE SAME OPERATIONS --------------------------------------------*/
+/* parses the UNMAP parameter list in the io buffer and erases the extents */
+static ssize_t scsi_unmap(void);
+/* once the block arrives, writes it to `count` blocks starting at `lba`. When
+   `unmap` is set and the block matches erased data the range is erased */
+static ssize_t scsi_write_same(uint32_t lba, uint32_t count, int unmap);
+/* erase the part of [lba, lba + count) aligned to the card's erase groups. The 
+   range left unerased is [lba, *start) and [*end, lba + count) */
+static int erase_aligned(uint32_t lba,uint32_t count,uint32_t *start,uint32_t *end);
+/* write `block` to [lba, lba + count) except for the range [start, end) */
+static int write_around(uint32_t lba, uint32_t count, const void *block,
+    uint32_t start, uint32_t end);
+
+/*--- WRITE STAGE OPERATIONS -------------------------------------------------*/
+/* copy a block into the stage, flushing it first when full or when `lba` is
+   in another write chunk */
+static int stage_write(uint32_t lba, const void *src);
+/* write every staged block to the card in ascending lba order. Anything that
+   writes to the card without the stage has to flush it first */
+static int stage_flush(void);
+/* returns the staged copy of `lba` or NULL if it isn't staged */
+static const void *stage_lookup(uint32_t lba);
+
+/*--- ZERO BLOCK OPERATIONS --------------------------------------------------*/
+/* returns 1 if every byte of the block is 0 */
+static int is_zero_block(const void *block);
+/* add a zero block of the current WRITE to the pending run, flushing the run 
+   first if `lba` doesn't continue it */
+static int zero_run_add(uint32_t lba);
+/* zero the blocks of the pending run that aren't known to be zero already, by
+   erasing when the card erases to 0 and writing `_zero_block` otherwise. On a
+   failure `_lba_offset` is set back to the start of the run */
+static int zero_run_flush(void);
+/* record [lba, lba + count) as reading back zeros */
+static void zero_map_add(uint32_t lba, uint32_t count);
+/* forget [lba, lba + count), it was written with data */
+static void zero_map_clear(uint32_t lba, uint32_t count);
+/* returns the # of known zero blocks starting at `lba`. When `lba` isn't known
+   to be zero 0 is returned and `*next` is set to the next known zero lba */
+static uint32_t zero_map_lookup(uint32_t lba, uint32_t *next);
+
+/*--- WRITE SESSION OPERATIONS -----------------------------------------------*/
+/* write a block of `lun` through the open session, opening a new one if `lba`
+   does not continue it. `count` is the # of blocks the caller still expects to
+   write */
+static int session_write(lun_t *lun,uint32_t lba,const void *src,uint32_t count);
+/* stop the session if one is open, returns < 0 if the card reports an error */
+static int session_close(void);
+/* set `_session.failed_lba` to the first block of the failed session the card
+   didn't write, `lba` if the card can't tell */
+static void session_failed(uint32_t lba);
+/* report a failed close to the session's lun as a deferred error */
+static void session_fault(void);
+
 /*--- SCSI SENSE OPERATIONS --------------------------------------------------*/
-/* update the request sense data to tell the host what type of error happened
-   asc_ascq will be put into the correct byte order */
+/* update the selected lun's request sense data to tell the host what type of 
+   error happened asc_ascq will be put into the correct byte order */
 static void set_sense(uint8_t sense_key, uint16_t asc_ascq);
+/* NOT READY for a command of the selected lun it can't complete, becoming 
+   ready while the card is still being brought up */
+static void set_not_ready_sense(void);
+/* same as `set_sense` but for an error of an already completed command of 
+   `lun`, which need not be the selected one */
+static void set_deferred_sense(lun_t *lun,uint8_t sense_key,uint16_t asc_ascq);
+/* set the INFORMATION field of the sense data `lun` has, the lba of an error */
+static void set_sense_information(lun_t *lun, uint32_t information);
+/* point the sense of a failed WRITE starting at `lba` at the first block the
+   card didn't write and count only the blocks before it as transferred */
+static void write_fault(uint32_t lba);
 
 /*--- BUFFERED IO OPERATIONS -------------------------------------------------*/
 static void   io_reset(void);
@@ -144,734 +453,2775 @@ static size_t io_limit(size_t allocation_length);
 
 
 /*--- INIT -------------------------------------------------------------------*/
-int scsi_sd_init(void) 
+int scsi_sd_configure(const scsi_sd_lun_config_t *luns, size_t count) 
 {
-    size_t max_lba;
-    chslimits_t limits;
-    
-    if (sd_init() != 0) { return -1; }
-    
-    max_lba = sd_max_lba();
-    LOGINFO("Max LBA 0x%08x", max_lba);
-    LOGINFO("Block Size %u (0x%04x) bytes", SD_BLOCK_SIZE, SD_BLOCK_SIZE);
-    LOGINFO("Size %u (0x%08x) bytes", 
-        max_lba * SD_BLOCK_SIZE, max_lba * SD_BLOCK_SIZE);
-    
-    /* split the sd card into 2 */
-    _luns[0] = (lun_t) { 0, max_lba };
-    _lun = &_luns[0];
-    
-    LOGINFO("LUN 0  0x%x (%u blocks)", _luns[0].lba, _luns[0].count);
-    
-    
-    LOGINFO("initializing the flexible data mode page");
-    /* calculate CHS limits for an lba = our max lba */
-    lba2chslimits(&limits, _lun->count);
-    _fdmp.page_code          = FLEXIBLE_DISK_PAGE_CODE;
-    _fdmp.page_length        = FLEXIBLE_DISK_PAGE_LENGTH;
-    _fdmp.transfer_rate      = htobe16(0x3c00); // TODO value from an sd reader
-    _fdmp.head_count         = limits.head_count;
-    _fdmp.track_sector_count = limits.track_sector_count;
-    _fdmp.sector_byte_count  = htobe16(SD_BLOCK_SIZE);
-    _fdmp.cylinder_count     = htobe16(limits.cylinder_count);
-    
-    /**/
-    _ffsd = FIXED_FORMAT_SENSE_DATA_DEFAULT;
-    
-    /* flag to tell rest of the impl we are ready */
-    _initialized = 1;
-    
-    /* on initization tell the host the medium has changed */
-    set_sense(
-        SENSE_KEY_UNIT_ATTENTION, ASC_ASCQ_NOT_READY_MEDIUM_MAY_HAVE_CHANGED
-    );
-    
+    if (!is_valid_config(luns, count)) { return -1; }
+    _config       = luns;
+    _config_count = count;
     return 0;
 }
 
+uint8_t scsi_sd_max_lun(void) 
+{
+    return _config_count - 1;
+}
 
-/*--- START TRANSACTION ------------------------------------------------------*/
-ssize_t scsi_sd_begin(const void *cdb, size_t cdblen) 
+int scsi_sd_init(void) 
 {
-    if (!is_valid_cdb(cdb, cdblen)) 
+    size_t i;
+    
+    /* a new SET CONFIGURATION while writes were pending, finish them properly 
+       before the luns are reset */
+    if (stage_flush() < 0) { LOGERROR("staged blocks lost on init"); }
+    session_close();
+    bench_abort();
+    
+    _lun_count  = 0;
+    _lun        = NULL;
+    _foreground = NULL;
+    if (!is_valid_config(_config, _config_count)) 
     {
-        LOGERROR("invalid cdb recieved");
-        sxxd(cdb, cdblen);
+        LOGCRITICAL("invalid lun configuration");
         return -1;
     }
     
-    /* initialize all state information */
-    _cdb        = cdb;
-    _lba_offset = 0;
-    io_reset();
-    
-    if (!in_state_to_complete(cdb)) { return -1; }
+    /* a card that is ready or still coming up is kept, one that failed is 
+       tried again by `scsi_sd_poll` */
+    if (_card_state == CARD_FAILED) { _card_state = CARD_IDLE; }
     
-    switch (_cdb->opcode) 
+    /* luns that don't need the card are usable right away, card luns are 
+       empty until it is ready */
+    for (i = 0; i < _config_count; i++) 
     {
-    case FORMAT_UNIT_OPCODE:                  return format_unit(cdb);
-    case INQUIRY_OPCODE:                      return inquiry(cdb);
-    case LOAD_UNLOAD_OPCODE:                  return load_unload(cdb);
-    case MODE_SENSE6_OPCODE:                  return mode_sense6(cdb);
-    case PREVENT_ALLOW_MEDIUM_REMOVAL_OPCODE: return prevent_allow_medium_removal(cdb);
-    case READ6_OPCODE:                        return read6(cdb);
-    case READ10_OPCODE:                       return read10(cdb);
-    case READ_CAPACITY10_OPCODE:              return read_capacity10(cdb);
-    case READ_FORMAT_CAPACITIES_OPCODE:       return read_format_capacities(cdb);
-    case REPORT_LUNS_OPCODE:                  return report_luns(cdb);
-    case REQUEST_SENSE_OPCODE:                return request_sense(cdb);
-    case SEND_DIAGNOSTIC_OPCODE:              return send_diagnostic(cdb);
-    case TEST_UNIT_READY_OPCODE:              return test_unit_ready(cdb);
-    case WRITE6_OPCODE:                       return write6(cdb); 
-    case WRITE10_OPCODE:                      return write10(cdb);
-    
-    default:
-        /* if we get here then the command is not supported */
-        LOGERROR("unsupported SCSI opcode 0x%02x",_cdb->opcode);
-        sxxd(cdb, cdblen);
-        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
-        return -1;
+        lun_init(&_luns[i], &_config[i], _card_blocks);
+        LOGINFO("LUN %u  0x%x (%u blocks)", i, _luns[i].lba, _luns[i].count);
     }
+    _lun_count = _config_count;
+    _lun = &_luns[0];
+    
+    return 0;
 }
 
-/* return 1 if cdb is valid, 0 otherwise */
-int is_valid_cdb(const scsi_cdb_t *cdb, size_t cdblen) 
+void card_start(void) 
 {
-    if (cdb == NULL) 
+    /* the card may have been swapped */
+    _zero_map.count = 0;
+    _zero_run.count = 0;
+    _scratch.count  = 0;
+    _card_blocks    = 0;
+    
+    _card_start_ms = millis();
+    _card_probe_ms = _card_start_ms;
+    _card_state    = sd_init_start() == 0 ? CARD_STARTING : CARD_ABSENT;
+}
+
+void card_step(void) 
+{
+    scsi_sd_lun_config_t config;
+    uint32_t max_lba;
+    size_t i;
+    int ret;
+    
+    if ((ret = sd_init_step()) > 0) { return; }
+#ifdef SD_FTL
+    if (ret == 0) { ret = ftl_init(); }
+#endif
+    if (ret != 0) 
     {
-        LOGERROR("cdb is NULL");
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
-        return 0;
+        LOGERROR("card bring up failed, card luns stay not ready");
+        _card_state = CARD_FAILED;
+        return;
     }
     
-    /* windows sets cdblen to 12 for these 6 byte cdbs, just accept */
-    if ((cdb->opcode == REQUEST_SENSE_OPCODE || cdb->opcode == INQUIRY_OPCODE)
-            && cdblen == 12) 
+    /* the scratch region comes off the end before the luns are laid out */
+    max_lba = sd_max_lba();
+    if (SD_SCRATCH_BLOCKS > 0 && max_lba > SD_SCRATCH_BLOCKS) 
     {
-        return 1;
+        max_lba -= SD_SCRATCH_BLOCKS;
+        _scratch.lba   = max_lba;
+        _scratch.count = SD_SCRATCH_BLOCKS;
+        LOGINFO("Scratch 0x%x (%u blocks)", _scratch.lba, _scratch.count);
     }
+    _card_blocks = max_lba;
+    _card_state  = CARD_READY;
+    stats.card_init_ms = millis() - _card_start_ms;
     
-    /* validate cdb lengths */
-    switch (cdb->opcode & GROUP_CODE_MASK) 
+    LOGINFO("Card ready in %u ms", stats.card_init_ms);
+    LOGINFO("Max LBA 0x%08x", max_lba);
+    LOGINFO("Block Size %u (0x%04x) bytes", SD_BLOCK_SIZE, SD_BLOCK_SIZE);
+    LOGINFO("Size %u (0x%08x) bytes", 
+        max_lba * SD_BLOCK_SIZE, max_lba * SD_BLOCK_SIZE);
+    
+    /* the card luns get their blocks, and a UNIT ATTENTION telling the host */
+    for (i = 0; i < _lun_count; i++) 
     {
-    case GROUP_CODE_CDB6:
-        if (cdblen != 6) {
-            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
-            return 0;
-        }
+        if (_luns[i].config.backend != SCSI_SD_BACKEND_CARD) { continue; }
+        config = _luns[i].config;
+        lun_init(&_luns[i], &config, _card_blocks);
+        LOGINFO("LUN %u  0x%x (%u blocks)", i, _luns[i].lba, _luns[i].count);
+    }
+}
+
+void card_probe(void) 
+{
+    if (millis() - _card_probe_ms < CARD_PROBE_MS) { return; }
+    /* the card takes no other command while a CMD25 is open */
+    if (_session.open || bench_status() == BENCH_RUNNING) { return; }
+    _card_probe_ms = millis();
+    
+    switch (_card_state) 
+    {
+    case CARD_READY:
+        if (!sd_present()) { card_removed(); }
         break;
         
-    /* there are 2 group codes for 10 byte CDBs */
-    case GROUP_CODE_CDB10:
-    case GROUP_CODE_CDB10_2:
-        if (cdblen != 10) {
-            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
-            return 0;
+    case CARD_FAILED:
+        /* left alone until it is swapped for another card */
+        if (!sd_present()) 
+        {
+            LOGINFO("failed card removed");
+            _card_state = CARD_ABSENT;
         }
         break;
         
-    case GROUP_CODE_CDB12:
-        if (cdblen != 12) {
-            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
-            return 0;
+    case CARD_ABSENT:
+        if (sd_present()) 
+        {
+            LOGINFO("card inserted");
+            card_start();
         }
         break;
         
-    /* we currently don't support any 16|32|variable length CDBs */
     default:
-        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
+        break;
+    }
+}
+
+void card_removed(void) 
+{
+    size_t i;
+    
+    LOGWARN("card removed");
+    stats.card_removals++;
+    
+    /* nothing can be written anymore, the host was told the blocks of the 
+       stage were written but a pulled card loses its cache anyway */
+    if (_stage.count > 0) 
+    {
+        LOGERROR("%u staged blocks lost with the card", _stage.count);
+    }
+    _stage.count    = 0;
+    _session.open   = 0;
+    _zero_run.count = 0;
+    _zero_map.count = 0;
+    _scratch.count  = 0;
+    _card_blocks    = 0;
+    _card_state     = CARD_ABSENT;
+    bench_abort();
+    
+    /* the card luns read MEDIUM NOT PRESENT until a card is ready again, and
+       get a UNIT ATTENTION then */
+    for (i = 0; i < _lun_count; i++) 
+    {
+        if (_luns[i].config.backend != SCSI_SD_BACKEND_CARD) { continue; }
+        _luns[i].count = 0;
+    }
+}
+
+int card_lost(void) 
+{
+    if (_lun->config.backend != SCSI_SD_BACKEND_CARD || 
+            _card_state != CARD_READY || _session.open) 
+    {
         return 0;
     }
+    if (sd_present()) { return 0; }
     
-    /* cdb is valid if we get here */
+    card_removed();
+    set_not_ready_sense();
     return 1;
 }
 
-int in_state_to_complete(const scsi_cdb_t *cdb) 
+int log_full(void) 
 {
-    /* the following commands can be completed even if communication with sd 
-       card is not working */
-    switch (cdb->opcode) 
+    if (_lun->config.backend != SCSI_SD_BACKEND_CARD || !ftl_full()) 
     {
-        case INQUIRY_OPCODE:
-        case REPORT_LUNS_OPCODE:
-        case REQUEST_SENSE_OPCODE:
-        case SEND_DIAGNOSTIC_OPCODE:
-        case TEST_UNIT_READY_OPCODE:
-            return 1;
-            
-        default: 
-            return _initialized;
+        return 0;
     }
+    set_sense(SENSE_KEY_NOT_READY, ASC_ASCQ_LUN_OPERATION_IN_PROGRESS);
+    return 1;
 }
 
-/*--- SCSI SD DATA OUT -------------------------------------------------------*/
-ssize_t scsi_sd_data_out(void **ptr, size_t maxlen) 
+void resume_io(void) 
 {
-    ssize_t ret;
-    size_t count;
-    
-    /* if we didn't initialize successfully, and the opcode is not one of the 
-       ones supported in an uninitialized state, error */
-    if (!in_state_to_complete(_cdb)) 
+    _resume_pending = 0;
+    stats.resume_io_ms = millis() - _resume_ms;
+    if (stats.resume_io_ms > stats.resume_io_max_ms) 
     {
-        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LUN_NOT_READY);
-        return -1;
+        stats.resume_io_max_ms = stats.resume_io_ms;
     }
+}
+
+int is_valid_config(const scsi_sd_lun_config_t *luns, size_t count) 
+{
+    uint32_t end, other;
+    size_t i, j;
     
-    /* if we are dealing with a DATA IN cdb, ERROR */
-    if (_cdb->opcode == WRITE6_OPCODE || _cdb->opcode == WRITE10_OPCODE) 
-    {
-        LOGCRITICAL("`scsi_sd_data_out` called with IN cdb");
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
-        return -1;
-    }
+    if (count == 0 || count > SCSI_SD_MAX_LUNS) { return 0; }
     
-    /* the buffer is always filled if there are >= IO_BUFFER_SIZE bytes to 
-       be processed in the data OUT phase. Therefore if the # of valid bytes in
-       the buffer is less than max data OUT is done once we empty the buffer */
-    if (_io.count < IO_BUFFER_SIZE) 
+    for (i = 0; i < count; i++) 
     {
-        count = io_read(ptr, maxlen);
-        /* no data to read, and the buffer wasn't filled, signal no more bytes*/
-        if (count == 0) { *ptr = NULL; }
-        return count;
+        /* the write stage and the zero map only hold blocks of the card */
+        if (luns[i].backend != SCSI_SD_BACKEND_CARD && 
+                (luns[i].flags & (SCSI_SD_LUN_STAGE | SCSI_SD_LUN_SKIP_ZEROS))) 
+        {
+            LOGERROR("lun %u cache flags are only for card luns", i);
+            return 0;
+        }
         
-    } else {
-        /* The buffer is full! We must check if there are more bytes to be sent
-           once we hand off all the bytes in the buffer to the caller */
-        if (_io.read_count == 0) 
+        switch (luns[i].backend) 
         {
-            io_reset(); /* reset the buffer counters to be filled */
-            switch (_cdb->opcode) 
+        case SCSI_SD_BACKEND_RAM:
+            if (luns[i].lba >= ramdisk_max_lba()) 
             {
-                case READ6_OPCODE:  ret = read6(_cdb);  break;
-                case READ10_OPCODE: ret = read10(_cdb); break;
-                default:
-                    LOGCRITICAL("buffer filled by non read opcode: 0x%02hhx",
-                        _cdb->opcode);
-                    set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
-                    return -1;
+                LOGERROR("lun %u starts past the ram disk", i);
+                return 0;
+            }
+            /* slices of the ram disk follow the card's rules */
+            /* fall through */
+        case SCSI_SD_BACKEND_CARD:
+            /* a count of 0 is the rest of the card, so slices can't overlap
+               the ones after them */
+            end = luns[i].count == 0 ? UINT32_MAX : luns[i].lba + luns[i].count;
+            for (j = 0; j < count; j++) 
+            {
+                if (j == i || luns[j].backend != luns[i].backend) 
+                {
+                    continue;
+                }
+                other = luns[j].count == 0 ? 
+                    UINT32_MAX : luns[j].lba + luns[j].count;
+                if (luns[i].lba < other && luns[j].lba < end) 
+                {
+                    LOGERROR("luns %u and %u overlap", i, j);
+                    return 0;
+                }
             }
+            break;
             
-            /* make sure refilling the buffer was successfull */
-            if (ret < 0) 
+        case SCSI_SD_BACKEND_IMAGE:
+            if (luns[i].image == NULL || luns[i].count == 0 || 
+                    !(luns[i].flags & SCSI_SD_LUN_READ_ONLY)) 
             {
-                LOGERROR("failed to refill the buffer");
-                return ret;
+                LOGERROR("lun %u image has to be set and read only", i);
+                return 0;
             }
+            break;
+            
+        default:
+            LOGERROR("lun %u unknown backend %u", i, luns[i].backend);
+            return 0;
         }
-        count = io_read(ptr, maxlen);
-        
-        /* if there are no more bytes to send set `ptr` to NULL */
-        if (count == 0) { *ptr = NULL; }
-        return count;
     }
+    return 1;
 }
 
-/**** SCSI SD DATA IN *********************************************************/
-int scsi_sd_data_in(const void *src, size_t length) 
+void lun_init(lun_t *lun, const scsi_sd_lun_config_t *config, 
+    uint32_t card_blocks) 
 {
+    chslimits_t limits;
     
-    /* validate we are initialized and the cbw opcode is valid */
-    if (!_initialized) 
+    lun->config = *config;
+    lun->lba    = 0;
+    lun->count  = config->count;
+    
+    /* slices are cut down to what the card or ram disk holds */
+    if (config->backend == SCSI_SD_BACKEND_RAM) 
     {
-        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LUN_NOT_READY);
-        return -1;
+        card_blocks = ramdisk_max_lba();
     }
-    
-    if (_cdb->opcode != WRITE6_OPCODE && _cdb->opcode != WRITE10_OPCODE) 
+    if (config->backend == SCSI_SD_BACKEND_CARD || 
+            config->backend == SCSI_SD_BACKEND_RAM) 
     {
-        LOGCRITICAL("`scsi_sd_data_in` called with an OUT opcode: 0x%02hhx", 
-            _cdb->opcode);
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
-        return -1;
+        lun->lba = config->lba;
+        if (config->lba >= card_blocks) 
+        {
+            lun->count = 0;
+        } 
+        else if (config->count == 0 || config->count > card_blocks - config->lba)
+        {
+            lun->count = card_blocks - config->lba;
+        }
     }
     
-    /* we are initialized and it's a write opcode */
-    
-    if (io_write(src, length) != 0) 
+    /* calculate CHS limits for an lba = our max lba */
+    lba2chslimits(&limits, lun->count);
+    memset(&lun->fdmp, 0, sizeof(lun->fdmp));
+    lun->fdmp.page_code          = FLEXIBLE_DISK_PAGE_CODE;
+    lun->fdmp.page_length        = FLEXIBLE_DISK_PAGE_LENGTH;
+    lun->fdmp.transfer_rate      = htobe16(0x3c00); // TODO value from an sd reader
+    lun->fdmp.head_count         = limits.head_count;
+    lun->fdmp.track_sector_count = limits.track_sector_count;
+    lun->fdmp.sector_byte_count  = htobe16(SD_BLOCK_SIZE);
+    lun->fdmp.cylinder_count     = htobe16(limits.cylinder_count);
+    
+    /* a staged WRITE is GOOD before its blocks are on the card, so the host
+       is told the write cache is on and sends SYNCHRONIZE CACHE to flush */
+    memset(&lun->cmp, 0, sizeof(lun->cmp));
+    lun->cmp.page_code   = CACHING_PAGE_CODE;
+    lun->cmp.page_length = CACHING_PAGE_LENGTH;
+    if (config->backend == SCSI_SD_BACKEND_CARD && 
+            (config->flags & SCSI_SD_LUN_STAGE)) 
     {
-        LOGCRITICAL("buffer is full??????????");
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
-        return -1;
+        lun->cmp.flags = CACHING_PAGE_WCE;
     }
     
-    /* if the buffer is now full flush it */
-    if (_io.count == IO_BUFFER_SIZE) 
+    /* on initization tell the host the medium has changed */
+    lun->sense = FIXED_FORMAT_SENSE_DATA_DEFAULT;
+    lun->sense.response_code = 
+        FixedFormatResponseCode(0, RESPONSE_CODE_CURRENT_FIXED);
+    lun->sense.sense_key = FixedFormatSenseKey(0, 0, 0, SENSE_KEY_UNIT_ATTENTION);
+    lun->sense.asc_ascq = htobe16(ASC_ASCQ_NOT_READY_MEDIUM_MAY_HAVE_CHANGED);
+}
+
+int lun_ready(const lun_t *lun) 
+{
+    if (lun->count == 0) { return 0; }
+    return lun->config.backend != SCSI_SD_BACKEND_CARD || 
+        _card_state == CARD_READY;
+}
+
+uint32_t lun_erase_group(void) 
+{
+    if (_lun->config.backend != SCSI_SD_BACKEND_CARD || !lun_ready(_lun)) 
     {
-        if (scsi_sd_data_in_commit() < 0) 
+        return 0;
+    }
+    return sd_erase_group();
+}
+
+int lun_read_block(void *dest, uint32_t lba) 
+{
+    const void *staged;
+    uint32_t next;
+    
+    switch (_lun->config.backend) 
+    {
+    case SCSI_SD_BACKEND_CARD:
+        lba += _lun->lba;
+        if ((staged = stage_lookup(lba)) != NULL) 
+        {
+            memcpy(dest, staged, SD_BLOCK_SIZE);
+            return 0;
+        } 
+        if (zero_map_lookup(lba, &next) > 0) 
+        {
+            memcpy(dest, _zero_block, SD_BLOCK_SIZE);
+            return 0;
+        }
+        return sd_read_block(dest, lba);
+        
+    case SCSI_SD_BACKEND_IMAGE:
+        memcpy(dest, 
+            (const uint8_t *) _lun->config.image + lba * SD_BLOCK_SIZE, 
+            SD_BLOCK_SIZE);
+        return 0;
+        
+    case SCSI_SD_BACKEND_RAM:
+        return ramdisk_read_block(dest, _lun->lba + lba);
+        
+    default:
+        return -1;
+    }
+}
+
+int lun_write_block(uint32_t lba, const void *src, uint32_t count) 
+{
+    switch (_lun->config.backend) 
+    {
+    case SCSI_SD_BACKEND_CARD:
+        lba += _lun->lba;
+        if (_lun->config.flags & SCSI_SD_LUN_STAGE) 
+        {
+            return stage_write(lba, src);
+        }
+        /* write through, the stage only ever holds blocks of other luns */
+        zero_map_clear(lba, 1);
+        return session_write(_lun, lba, src, count);
+        
+    case SCSI_SD_BACKEND_RAM:
+        return ramdisk_write_block(_lun->lba + lba, src);
+        
+    default:
+        return -1;
+    }
+}
+
+
+/*--- BACKGROUND WORK --------------------------------------------------------*/
+void scsi_sd_poll(void) 
+{
+    /* the card is in standby without a clock */
+    if (_suspended) { return; }
+    
+    /* short steps, the usb is kept waiting while they run */
+    switch (_card_state) 
+    {
+    case CARD_IDLE:     card_start(); break;
+    case CARD_STARTING: card_step();  break;
+    default:                          break;
+    }
+    
+    if (_stage.count > 0 && 
+            (millis() - _stage.first_ms) > STAGE_TIMEOUT_MS) 
+    {
+        /* with the log full the blocks stay and are tried again */
+        if (stage_flush() < 0 && !ftl_full()) 
+        {
+            set_deferred_sense(_stage.lun,
+                SENSE_KEY_MEDIUM_ERROR, ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+        }
+    }
+    
+    if (_session.open && 
+            (millis() - _session.last_ms) > WRITE_SESSION_TIMEOUT_MS) 
+    {
+        LOGDEBUG("write session idle, closing");
+        if (session_close() < 0) { session_fault(); }
+    }
+    
+    /* after the timeouts, the session they close would hold the probe off */
+    card_probe();
+    
+#ifdef SD_FTL
+    if (_card_state == CARD_READY) { ftl_poll(); }
+#endif
+    
+    /* the benchmark goes to the card directly, so no session may be left open
+       under it. Host WRITEs are slowed down for the length of the run */
+    if (bench_status() == BENCH_RUNNING) 
+    {
+        if (session_close() < 0) { session_fault(); }
+        bench_step();
+    }
+}
+
+int scsi_sd_pending(void) 
+{
+    if (_foreground == NULL) { return 0; }
+    
+    switch (bench_status()) 
+    {
+    case BENCH_RUNNING:
+        return 1;
+        
+    case BENCH_DONE:
+        _foreground = NULL;
+        return 0;
+        
+    default:
+        /* failed or aborted, by a suspend or a card that was pulled */
+        _lun        = _foreground;
+        _foreground = NULL;
+        set_sense(SENSE_KEY_HARDWARE_ERROR, ASC_ASCQ_LUN_FAILED_SELF_TEST);
+        return -1;
+    }
+}
+
+void scsi_sd_reset(void) 
+{
+    /* a foreground self test ends with its command */
+    if (_foreground != NULL) 
+    {
+        bench_abort();
+        _foreground = NULL;
+    }
+    
+    /* zero blocks of an aborted WRITE are dropped like any unwritten data */
+    _zero_run.count = 0;
+    
+    /* the staged blocks belong to WRITEs that already completed */
+    if (stage_flush() < 0 && !ftl_full()) 
+    {
+        LOGERROR("failed to write the staged blocks on reset");
+        set_deferred_sense(_stage.lun,
+            SENSE_KEY_MEDIUM_ERROR, ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+    }
+    if (session_close() < 0) 
+    {
+        LOGERROR("failed to close the write session on reset");
+        session_fault();
+    }
+}
+
+void scsi_sd_suspend(void) 
+{
+    if (_suspended) { return; }
+    
+    /* the host counts the staged blocks as written and may cut the power once
+       the bus is suspended, so they go to the card now. Room is made for them
+       if the log is full, however long that takes */
+    if (stage_flush() < 0 && 
+            (!ftl_full() || ftl_make_room() < 0 || stage_flush() < 0)) 
+    {
+        LOGERROR("failed to write the staged blocks on suspend");
+        set_deferred_sense(_stage.lun,
+            SENSE_KEY_MEDIUM_ERROR, ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+    }
+    if (session_close() < 0) { session_fault(); }
+    bench_abort();
+    
+#ifdef SD_FTL
+    if (_card_state == CARD_READY && ftl_sync() < 0) 
+    {
+        LOGERROR("failed to write the ftl checkpoint on suspend");
+    }
+#endif
+    if (sd_suspend() < 0) { LOGERROR("card write failed before suspend"); }
+    _suspended = 1;
+    LOGINFO("suspended");
+}
+
+void scsi_sd_resume(void) 
+{
+    if (!_suspended) { return; }
+    _suspended = 0;
+    
+    /* a card coming up or not there is left to `scsi_sd_poll` as before */
+    if (sd_resume() < 0 && _card_state == CARD_READY) 
+    {
+        LOGWARN("card lost while suspended");
+        card_removed();
+    }
+    _resume_ms      = millis();
+    _resume_pending = 1;
+    LOGINFO("resumed");
+}
+
+
+/*--- START TRANSACTION ------------------------------------------------------*/
+ssize_t scsi_sd_begin(uint8_t lun, const void *cdb, size_t cdblen) 
+{
+    if (lun >= _lun_count) 
+    {
+        LOGERROR("cdb for lun %u, only %u configured", lun, _lun_count);
+        return -1;
+    }
+    _lun = &_luns[lun];
+    
+    if (!is_valid_cdb(cdb, cdblen)) 
+    {
+        LOGERROR("invalid cdb recieved");
+        sxxd(cdb, cdblen);
+        return -1;
+    }
+    
+    /* initialize all state information */
+    _cdb        = cdb;
+    _lba_offset = 0;
+    _direct.ptr = NULL;
+    io_reset();
+    
+    /* the echo buffer only survives READ BUFFERs */
+    if (_cdb->opcode != READ_BUFFER10_OPCODE) { _echo_length = 0; }
+    
+    if (!in_state_to_complete(cdb)) 
+    {
+        set_not_ready_sense();
+        return -1;
+    }
+    
+    /* nothing may change a read only lun */
+    if (is_lun_write_cdb(cdb) && (_lun->config.flags & SCSI_SD_LUN_READ_ONLY)) 
+    {
+        set_sense(SENSE_KEY_DATA_PROTECT, ASC_ASCQ_WRITE_PROTECTED);
+        return -1;
+    }
+    
+    switch (_cdb->opcode) 
+    {
+    case FORMAT_UNIT_OPCODE:                  return format_unit(cdb);
+    case INQUIRY_OPCODE:                      return inquiry(cdb);
+    case LOAD_UNLOAD_OPCODE:                  return load_unload(cdb);
+    case MODE_SENSE6_OPCODE:                  return mode_sense6(cdb);
+    case PREVENT_ALLOW_MEDIUM_REMOVAL_OPCODE: return prevent_allow_medium_removal(cdb);
+    case READ6_OPCODE:                        return read6(cdb);
+    case READ10_OPCODE:                       return read10(cdb);
+    case READ_BUFFER10_OPCODE:                return read_buffer10(cdb);
+    case READ_CAPACITY10_OPCODE:              return read_capacity10(cdb);
+    case READ_FORMAT_CAPACITIES_OPCODE:       return read_format_capacities(cdb);
+    case RECEIVE_DIAGNOSTIC_RESULTS_OPCODE:   return receive_diagnostic_results(cdb);
+    case REPORT_LUNS_OPCODE:                  return report_luns(cdb);
+    case REQUEST_SENSE_OPCODE:                return request_sense(cdb);
+    case SEND_DIAGNOSTIC_OPCODE:              return send_diagnostic(cdb);
+    case SERVICE_ACTION_IN16_OPCODE:          return service_action_in16(cdb);
+    case SYNCHRONIZE_CACHE10_OPCODE:          return synchronize_cache10(cdb);
+    case TEST_UNIT_READY_OPCODE:              return test_unit_ready(cdb);
+    case UNMAP_OPCODE:                        return unmap(cdb);
+    case WRITE6_OPCODE:                       return write6(cdb); 
+    case WRITE10_OPCODE:                      return write10(cdb);
+    case WRITE_BUFFER_OPCODE:                 return write_buffer(cdb);
+    case WRITE_SAME10_OPCODE:                 return write_same10(cdb);
+    case WRITE_SAME16_OPCODE:                 return write_same16(cdb);
+    
+    default:
+        /* if we get here then the command is not supported */
+        LOGERROR("unsupported SCSI opcode 0x%02x",_cdb->opcode);
+        sxxd(cdb, cdblen);
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
+        return -1;
+    }
+}
+
+ssize_t scsi_sd_begin_blocks(uint8_t lun, int write, uint32_t lba, 
+    uint16_t count) 
+{
+    /* read10_t and write10_t share their layout */
+    memset(&_block_cdb, 0, sizeof(_block_cdb));
+    _block_cdb.read.opcode          = write ? WRITE10_OPCODE : READ10_OPCODE;
+    _block_cdb.read.lba             = htobe32(lba);
+    _block_cdb.read.transfer_length = htobe16(count);
+    return scsi_sd_begin(lun, &_block_cdb, sizeof(_block_cdb));
+}
+
+int scsi_sd_lun_blocks(uint8_t lun, uint32_t *blocks) 
+{
+    if (lun >= _lun_count) { return -1; }
+    _lun = &_luns[lun];
+    
+    if (!lun_ready(_lun)) 
+    {
+        set_not_ready_sense();
+        return -1;
+    }
+    *blocks = _lun->count;
+    return 0;
+}
+
+void scsi_sd_sense(uint8_t lun, uint8_t *sense_key, uint16_t *asc_ascq) 
+{
+    lun_t *l;
+    
+    if (lun >= _lun_count) 
+    {
+        *sense_key = SENSE_KEY_ILLEGAL_REQUEST;
+        *asc_ascq  = ASC_ASCQ_LUN_NOT_SUPPORTED;
+        return;
+    }
+    
+    l = &_luns[lun];
+    *sense_key = l->sense.sense_key & FIXED_FORMAT_SENSE_DATA_SENSE_KEY_MASK;
+    *asc_ascq  = be16toh(l->sense.asc_ascq);
+    l->sense   = FIXED_FORMAT_SENSE_DATA_DEFAULT;
+}
+
+int scsi_sd_is_data_in(void) 
+{
+    return _cdb != NULL && is_data_in_cdb(_cdb);
+}
+
+/* return 1 if cdb is valid, 0 otherwise */
+int is_valid_cdb(const scsi_cdb_t *cdb, size_t cdblen) 
+{
+    if (cdb == NULL) 
+    {
+        LOGERROR("cdb is NULL");
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return 0;
+    }
+    
+    /* windows sets cdblen to 12 for these 6 byte cdbs, just accept */
+    if ((cdb->opcode == REQUEST_SENSE_OPCODE || cdb->opcode == INQUIRY_OPCODE)
+            && cdblen == 12) 
+    {
+        return 1;
+    }
+    
+    /* validate cdb lengths */
+    switch (cdb->opcode & GROUP_CODE_MASK) 
+    {
+    case GROUP_CODE_CDB6:
+        if (cdblen != 6) {
+            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
+            return 0;
+        }
+        break;
+        
+    /* there are 2 group codes for 10 byte CDBs */
+    case GROUP_CODE_CDB10:
+    case GROUP_CODE_CDB10_2:
+        if (cdblen != 10) {
+            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
+            return 0;
+        }
+        break;
+        
+    case GROUP_CODE_CDB12:
+        if (cdblen != 12) {
+            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
+            return 0;
+        }
+        break;
+        
+    case GROUP_CODE_CDB16:
+        if (cdblen != 16) {
+            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
+            return 0;
+        }
+        break;
+        
+    /* we currently don't support any 32|variable length CDBs */
+    default:
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
+        return 0;
+    }
+    
+    /* cdb is valid if we get here */
+    return 1;
+}
+
+int in_state_to_complete(const scsi_cdb_t *cdb) 
+{
+    /* the following commands can be completed even if communication with sd 
+       card is not working */
+    switch (cdb->opcode) 
+    {
+        case INQUIRY_OPCODE:
+        case READ_BUFFER10_OPCODE:
+        case RECEIVE_DIAGNOSTIC_RESULTS_OPCODE:
+        case REPORT_LUNS_OPCODE:
+        case REQUEST_SENSE_OPCODE:
+        case SEND_DIAGNOSTIC_OPCODE:
+        case TEST_UNIT_READY_OPCODE:
+        case WRITE_BUFFER_OPCODE:
+            return 1;
+            
+        default: 
+            return lun_ready(_lun);
+    }
+}
+
+int is_data_in_cdb(const scsi_cdb_t *cdb) 
+{
+    switch (cdb->opcode) 
+    {
+        case SEND_DIAGNOSTIC_OPCODE:
+        case UNMAP_OPCODE:
+        case WRITE6_OPCODE:
+        case WRITE10_OPCODE:
+        case WRITE_BUFFER_OPCODE:
+        case WRITE_SAME10_OPCODE:
+        case WRITE_SAME16_OPCODE:
+            return 1;
+            
+        default:
+            return 0;
+    }
+}
+
+int is_lun_write_cdb(const scsi_cdb_t *cdb) 
+{
+    /* WRITE BUFFER only changes the io buffer and SEND DIAGNOSTIC only the
+       scratch region */
+    switch (cdb->opcode) 
+    {
+        case UNMAP_OPCODE:
+        case WRITE6_OPCODE:
+        case WRITE10_OPCODE:
+        case WRITE_SAME10_OPCODE:
+        case WRITE_SAME16_OPCODE:
+            return 1;
+            
+        default:
+            return 0;
+    }
+}
+
+/*--- SCSI SD DATA OUT -------------------------------------------------------*/
+ssize_t scsi_sd_data_out(void **ptr, size_t maxlen) 
+{
+    ssize_t ret;
+    size_t count;
+    
+    /* if we didn't initialize successfully, and the opcode is not one of the 
+       ones supported in an uninitialized state, error */
+    if (!in_state_to_complete(_cdb)) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LUN_NOT_READY);
+        return -1;
+    }
+    
+    /* if we are dealing with a DATA IN cdb, ERROR */
+    if (is_data_in_cdb(_cdb)) 
+    {
+        LOGCRITICAL("`scsi_sd_data_out` called with IN cdb");
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return -1;
+    }
+    
+    /* the blocks of a ram disk are handed out without a copy */
+    if (_direct.ptr != NULL) 
+    {
+        count = _direct.count < maxlen ? _direct.count : maxlen;
+        *ptr = count == 0 ? NULL : (void *) _direct.ptr;
+        _direct.ptr   += count;
+        _direct.count -= count;
+        return count;
+    }
+    
+    /* the buffer is always filled if there are >= IO_BUFFER_SIZE bytes to 
+       be processed in the data OUT phase. Therefore if the # of valid bytes in
+       the buffer is less than max data OUT is done once we empty the buffer */
+    if (_io.count < IO_BUFFER_SIZE) 
+    {
+        count = io_read(ptr, maxlen);
+        /* no data to read, and the buffer wasn't filled, signal no more bytes*/
+        if (count == 0) { *ptr = NULL; }
+        return count;
+        
+    } else {
+        /* The buffer is full! We must check if there are more bytes to be sent
+           once we hand off all the bytes in the buffer to the caller */
+        if (_io.read_count == 0) 
+        {
+            io_reset(); /* reset the buffer counters to be filled */
+            switch (_cdb->opcode) 
+            {
+                case READ6_OPCODE:  ret = read6(_cdb);  break;
+                case READ10_OPCODE: ret = read10(_cdb); break;
+                default:
+                    LOGCRITICAL("buffer filled by non read opcode: 0x%02hhx",
+                        _cdb->opcode);
+                    set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+                    return -1;
+            }
+            
+            /* make sure refilling the buffer was successfull */
+            if (ret < 0) 
+            {
+                LOGERROR("failed to refill the buffer");
+                return ret;
+            }
+        }
+        count = io_read(ptr, maxlen);
+        
+        /* if there are no more bytes to send set `ptr` to NULL */
+        if (count == 0) { *ptr = NULL; }
+        return count;
+    }
+}
+
+/**** SCSI SD DATA IN *********************************************************/
+int scsi_sd_data_in(const void *src, size_t length) 
+{
+    ssize_t ret;
+    
+    /* validate we are initialized and the cbw opcode is valid */
+    if (!in_state_to_complete(_cdb)) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LUN_NOT_READY);
+        return -1;
+    }
+    
+    if (!is_data_in_cdb(_cdb)) 
+    {
+        LOGCRITICAL("`scsi_sd_data_in` called with an OUT opcode: 0x%02hhx", 
+            _cdb->opcode);
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return -1;
+    }
+    
+    /* we are initialized and it's a write opcode */
+    
+    if (io_write(src, length) != 0) 
+    {
+        LOGCRITICAL("buffer is full??????????");
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return -1;
+    }
+    
+    /* if the buffer is now full flush it, parameter data for the other 
+       opcodes always fits in the buffer and is processed on commit. Unlike a 
+       commit a pending zero run is kept going into the next buffer */
+    if (_io.count == IO_BUFFER_SIZE && 
+            (_cdb->opcode == WRITE6_OPCODE || _cdb->opcode == WRITE10_OPCODE)) 
+    {
+        ret = _cdb->opcode == WRITE6_OPCODE ? write6(_cdb) : write10(_cdb);
+        if (ret < 0) 
+        {
+            LOGERROR("failed to commit full buffer to sd card");
+            /* the blocks after the failed one are dropped, the commit that
+               follows mustn't write them at `_lba_offset` */
+            io_reset();
+            return -1;
+        }
+        io_reset();
+    }
+    return 0;
+}
+
+ssize_t scsi_sd_data_in_commit(void) 
+{
+#define ERROR_BYTES_WRITTEN(c) (-1 * ((c) + 1))
+    ssize_t ret;
+    
+     /* validate we are initialized and the cbw opcode is valid */
+    if (!in_state_to_complete(_cdb)) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LUN_NOT_READY);
+        return ERROR_BYTES_WRITTEN(_lba_offset * SD_BLOCK_SIZE);
+    }
+    
+    switch (_cdb->opcode) 
+    {
+        case WRITE6_OPCODE:  ret = write6(_cdb);  break;
+        case WRITE10_OPCODE: ret = write10(_cdb); break;
+        
+        /* the parameter data of these is all or nothing, return the # of 
+           parameter bytes processed */
+        case SEND_DIAGNOSTIC_OPCODE: ret = scsi_send_diagnostic(); goto done;
+        case UNMAP_OPCODE:           ret = scsi_unmap();           goto done;
+        case WRITE_BUFFER_OPCODE:    ret = scsi_write_buffer();    goto done;
+        case WRITE_SAME10_OPCODE:    ret = write_same10(_cdb);     goto done;
+        case WRITE_SAME16_OPCODE:    ret = write_same16(_cdb);     goto done;
+        
+        default:
+            LOGCRITICAL("`scsi_sd_data_in_commit` called with OUT cdb");
+            set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+            return ERROR_BYTES_WRITTEN(_lba_offset * SD_BLOCK_SIZE);
+    }
+    
+    /* zero blocks held back when the host sent less than the cdb asked for */
+    if (ret >= 0) { ret = zero_run_flush(); }
+    
+    if (ret < 0) 
+    {
+        LOGERROR("write6/10 failed");
+        return ERROR_BYTES_WRITTEN(_lba_offset * SD_BLOCK_SIZE);
+    }
+    
+    /* all possible blocks were written, clear the buffer to allow more data 
+       to be sent in */
+    io_reset();
+    return _lba_offset * SD_BLOCK_SIZE;
+    
+done:
+    io_reset();
+    return ret < 0 ? ERROR_BYTES_WRITTEN(0) : ret;
+#undef ERROR_BYTES_WRITTEN
+}
+
+/******************************************************************************/
+
+ssize_t format_unit(const void *cdbptr) 
+{
+    UNUSED(cdbptr);
+    LOGINFO("SCSI FORMAT UNIT");
+    /* this command is required but is meaningless to us, therefore report a
+       failure to format the medium if the host tries to use this command */
+    /* TODO research the appropriate way to handle this request */
+    set_sense(SENSE_KEY_MEDIUM_ERROR, ASC_ASCQ_FORMAT_COMMAND_FAILED);
+    return -1;
+}
+
+ssize_t inquiry(const void *cdbptr) 
+{
+    const inquiry_t *cdb = cdbptr;
+    LOGINFO("SCSI INQUIRY");
+    
+    if (cdb->evpd & INQUIRY_EVPD_MASK) 
+    {
+        return inquiry_vpd(cdb->page_code, be16toh(cdb->allocation_length));
+    }
+    
+    /* page code is only valid with evpd set, scsi spc 4r37 p257 6.6.1 */
+    if (cdb->page_code != 0) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    /* io_write should not fail since this is called after a io_reset */
+    io_write(&_inquiry_data, sizeof(_inquiry_data));
+    return sizeof(_inquiry_data);
+}
+
+ssize_t inquiry_vpd(uint8_t page_code, uint16_t allocation_length) 
+{
+    vpd_page_header_t header;
+    vpd_block_device_characteristics_t bdc;
+    vpd_logical_block_provisioning_t lbp;
+    vpd_card_interface_t ci;
+    const uint32_t *counter;
+    uint32_t value;
+    size_t i;
+    
+    LOGINFO("SCSI INQUIRY VPD page 0x%02x", page_code);
+    
+    header = (vpd_page_header_t) {
+        .peripheral  = _inquiry_data.peripheral,
+        .page_code   = page_code,
+        .page_length = 0
+    };
+    
+    switch (page_code) 
+    {
+    case VPD_PAGE_SUPPORTED_PAGES:
+        header.page_length = htobe16(sizeof(_vpd_pages));
+        io_write(&header, sizeof(header));
+        io_write(_vpd_pages, sizeof(_vpd_pages));
+        break;
+        
+    case VPD_PAGE_UNIT_SERIAL_NUMBER: vpd_unit_serial_number(header); break;
+    case VPD_PAGE_BLOCK_LIMITS:       vpd_block_limits(header);       break;
+        
+    case VPD_PAGE_BLOCK_DEVICE_CHARACTERISTICS:
+        memset(&bdc, 0, sizeof(bdc));
+        bdc.header = header;
+        bdc.header.page_length = htobe16(VPD_PAGE_LENGTH(sizeof(bdc)));
+        bdc.medium_rotation_rate = htobe16(VPD_BDC_NON_ROTATING_MEDIUM);
+        io_write(&bdc, sizeof(bdc));
+        break;
+        
+    case VPD_PAGE_LOGICAL_BLOCK_PROVISIONING:
+        /* the unaligned ends of an unmapped range are left as is so unmapped
+           blocks can't be reported as reading zeros (LBPRZ) */
+        lbp = (vpd_logical_block_provisioning_t) {
+            .header = header,
+            .threshold_exponent = 0,
+            .flags = 0,
+            .provisioning_type = VPD_LBP_PROVISIONING_TYPE_FULL
+        };
+        lbp.header.page_length = htobe16(VPD_PAGE_LENGTH(sizeof(lbp)));
+        if (lun_erase_group() != 0) 
+        {
+            lbp.flags = VPD_LBP_LBPU | VPD_LBP_LBPWS | VPD_LBP_LBPWS10;
+            lbp.provisioning_type = VPD_LBP_PROVISIONING_TYPE_RESOURCE;
+        }
+        io_write(&lbp, sizeof(lbp));
+        break;
+        
+    case VPD_PAGE_DEVICE_STATISTICS:
+        /* every counter of `stats` as a big endian uint32_t */
+        header.page_length = htobe16(STATS_COUNT * sizeof(uint32_t));
+        io_write(&header, sizeof(header));
+        counter = (const uint32_t *) &stats;
+        for (i = 0; i < STATS_COUNT; i++) 
+        {
+            value = htobe32(counter[i]);
+            io_write(&value, sizeof(value));
+        }
+        break;
+        
+    case VPD_PAGE_CARD_INTERFACE:
+        /* as of the last card init */
+        ci = (vpd_card_interface_t) {
+            .header      = header,
+            .speed_mode  = sd_speed_mode(),
+            ._reserved   = 0,
+            .speed_modes = htobe16(sd_speed_modes()),
+            .spi_hz      = htobe32(sd_spi_hz())
+        };
+        ci.header.page_length = htobe16(VPD_PAGE_LENGTH(sizeof(ci)));
+        io_write(&ci, sizeof(ci));
+        break;
+        
+    default:
+        LOGERROR("unsupported vpd page 0x%02x", page_code);
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    return io_limit(allocation_length);
+}
+
+void vpd_unit_serial_number(vpd_page_header_t header) 
+{
+    static const char hex[] = "0123456789ABCDEF";
+    vpd_unit_serial_number_t usn;
+    uint32_t serial, lun;
+    size_t i;
+    
+    usn.header = header;
+    usn.header.page_length = htobe16(VPD_PAGE_LENGTH(sizeof(usn)));
+    
+    /* the card's serial number, so swapping cards is seen as a new unit, and 
+       the lun so every lun is a unit of its own */
+    serial = _card_state == CARD_READY ? sd_serial_number() : 0;
+    for (i = 0; i < 8; i++) 
+    {
+        usn.serial_number[i] = hex[(serial >> (28 - 4 * i)) & 0xf];
+    }
+    lun = _lun - _luns;
+    usn.serial_number[8] = hex[(lun >> 4) & 0xf];
+    usn.serial_number[9] = hex[lun & 0xf];
+    io_write(&usn, sizeof(usn));
+}
+
+void vpd_block_limits(vpd_page_header_t header) 
+{
+    vpd_block_limits_t bl;
+    uint32_t chunk;
+    
+    memset(&bl, 0, sizeof(bl));
+    bl.header = header;
+    bl.header.page_length = htobe16(VPD_PAGE_LENGTH(sizeof(bl)));
+    
+    /* transfers are limited by the 16 bit READ/WRITE(10) transfer length, they
+       are processed a buffer at a time and are fastest in whole write chunks 
+       of the card */
+    bl.flags = VPD_BL_WSNZ;
+    bl.optimal_transfer_length_granularity = 
+        htobe16(IO_BUFFER_SIZE / SD_BLOCK_SIZE);
+    bl.maximum_transfer_length = htobe32(UINT16_MAX);
+    chunk = _lun->config.backend == SCSI_SD_BACKEND_CARD && lun_ready(_lun) ? 
+        sd_write_chunk() : 0;
+    if (chunk <= UINT16_MAX) 
+    {
+        bl.optimal_transfer_length = htobe32(chunk);
+    }
+    
+    /* only the erase group aligned part of an unmapped range is erased */
+    if (lun_erase_group() != 0) 
+    {
+        bl.maximum_unmap_lba_count = htobe32(UINT32_MAX);
+        bl.maximum_unmap_block_descriptor_count = 
+            htobe32(UNMAP_MAX_DESCRIPTORS);
+        bl.optimal_unmap_granularity = htobe32(lun_erase_group());
+        /* the groups are aligned to the card, not to the start of the lun */
+        bl.unmap_granularity_alignment = htobe32(VPD_BL_UGAVALID | 
+            ((lun_erase_group() - _lun->lba % lun_erase_group()) % 
+                lun_erase_group()));
+    }
+    if (_lun->config.backend == SCSI_SD_BACKEND_CARD) 
+    {
+        bl.maximum_write_same_length = htobe32(WRITE_SAME_MAX_BLOCKS);
+    }
+    
+    io_write(&bl, sizeof(bl));
+}
+
+ssize_t load_unload(const void *cdbptr) 
+{
+    UNUSED(cdbptr);
+    LOGINFO("SCSI LOAD UNLOAD");
+    /* do nothing and return success */
+    return 0;
+}
+
+ssize_t mode_sense6(const void *cdbptr) 
+{
+    const mode_sense6_t *cdb;
+    mode_parameter_header6_t mph6;
+    size_t allocation_length;
+    size_t length;
+    
+    LOGINFO("SCSI MODE SENSE (6)");
+   
+    cdb = cdbptr;
+    allocation_length = cdb->allocation_length;
+    
+    /* return success scsi spc 3r23 p29 4.3.4.6 */
+    if (allocation_length == 0) 
+    {
+        return 0;
+    }
+    
+    /* no matter what this is the base header that will be sent */
+    mph6 = (mode_parameter_header6_t) {
+        .mode_data_length           = 3,
+        .medium_type                = MODE_PARAMETER_MEDIUM_TYPE_DABD,
+        .device_specific_parameter  = 
+            (_lun->config.flags & SCSI_SD_LUN_READ_ONLY) ? 
+                MODE_PARAMETER_DSP_DABD_WP : 0,
+        .block_descriptor_length    = 0
+    };
+    
+    /* build the response, as observed by the kingston dt 101 g2 upon recieving
+       an unsupported page_code just return a empty header */
+    switch (cdb->pc_page_code & MODE_SENSE6_PAGE_CODE_MASK) 
+    {
+    case MODE_SENSE_PAGE_CODE_RETURN_ALL:
+        /* send the header and mode pages, in page code order */
+        length = sizeof(mph6) + sizeof(_lun->fdmp) + sizeof(_lun->cmp);
+        
+        /* scsi spc 3r23 p29 4.3.4.6 */
+        if (length > CDB6_ALLOCATION_LENGTH_MAX) 
+        {
+            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+            return -1;
+        }
+        
+        mph6.mode_data_length = length - sizeof(mph6.mode_data_length);
+        
+        io_write(&mph6,  sizeof(mph6));
+        io_write(&_lun->fdmp, sizeof(_lun->fdmp));
+        io_write(&_lun->cmp, sizeof(_lun->cmp));
+        return io_limit(allocation_length);
+        
+    case MODE_SENSE_PAGE_CODE_CACHING:
+        length = sizeof(mph6) + sizeof(_lun->cmp);
+        mph6.mode_data_length = length - sizeof(mph6.mode_data_length);
+        
+        io_write(&mph6, sizeof(mph6));
+        io_write(&_lun->cmp, sizeof(_lun->cmp));
+        return io_limit(allocation_length);
+        
+    default:
+        LOGERROR("unsupported pagecode/subpage requested 0x%02x/0x02x", 
+            cdb->pc_page_code & MODE_SENSE6_PAGE_CODE_MASK, cdb->subpage_code);
+        io_write(&mph6, sizeof(mph6));
+        return io_limit(allocation_length);
+    }
+}
+
+/* not sure appropriate way to handle, following what other flash drives do */
+ssize_t prevent_allow_medium_removal(const void *cdbptr) 
+{
+    const prevent_allow_medium_removal_t *cdb = cdbptr;
+    LOGINFO("SCSI PREVENT ALLOW MEDIUM REMOVAL ");
+    if (cdb->prevent & PREVENT_ALLOW_MEDIUM_REMOVAL_PREVENT_DTE) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t read6(const void *cdbptr) 
+{
+    const read6_t *cdb;
+    uint32_t lba;
+    uint16_t count;
+    
+    cdb = cdbptr;
+    lba = (be32toh(cdb->lba_transfer_length)&READ6_LBA_MASK)>>READ6_LBA_SHIFT;
+    if ((count = cdb->transfer_length) == 0) 
+    {
+        count = 256; /* scsi-sbc-344r0 p45 5.5 */
+    }
+    
+    /* since we are using an ssize_t to report bytes written instead of a size_t
+       we can only report on 2 billion bytes */
+    if (((uint32_t) count) * SD_BLOCK_SIZE > INT32_MAX - 1) 
+    {
+        LOGCRITICAL("integer overflow, transfer > 2GiB");
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return -1;
+    }
+    
+    if (scsi_read(lba, count) < 0) { return -1; }
+    return count * SD_BLOCK_SIZE;
+}
+
+ssize_t read10(const void *cdbptr) 
+{
+    const read10_t *cdb = cdbptr;
+    uint32_t lba;
+    uint16_t count;
+    
+    cdb = cdbptr;
+    lba = be32toh(cdb->lba);
+    count = be16toh(cdb->transfer_length);
+    
+    /* since we are using an ssize_t to report bytes written instead of a size_t
+       we can only report on 2 billion bytes */
+    if (((uint32_t) count) * SD_BLOCK_SIZE > INT32_MAX - 1) 
+    {
+        LOGCRITICAL("integer overflow, transfer > 2GiB");
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return -1;
+    }
+    
+    if (scsi_read(lba, count) < 0) { return -1; }
+    return count * SD_BLOCK_SIZE;
+}
+
+ssize_t read_buffer10(const void *cdbptr) 
+{
+    const read_buffer10_t *cdb = cdbptr;
+    buffer_descriptor_t bd;
+    echo_buffer_descriptor_t ebd;
+    uint32_t offset, length;
+    uint8_t id;
+    
+    id     = be32toh(cdb->id_offset) >> BUFFER_ID_SHIFT;
+    offset = be32toh(cdb->id_offset) & BUFFER_OFFSET_MASK;
+    length = be32toh(cdb->length_control) >> BUFFER_LENGTH_SHIFT;
+    
+    LOGINFO("SCSI READ BUFFER mode 0x%02x offset 0x%x length 0x%x", 
+        cdb->mode & BUFFER_MODE_MASK, offset, length);
+    
+    /* the io buffer is buffer 0, the only one */
+    switch (cdb->mode & BUFFER_MODE_MASK) 
+    {
+    case BUFFER_MODE_DATA:
+        if (id != 0 || offset > IO_BUFFER_SIZE) { break; }
+        if (length > IO_BUFFER_SIZE - offset) 
+        {
+            length = IO_BUFFER_SIZE - offset;
+        }
+        /* sent in place like the ram disk, see `scsi_sd_data_out` */
+        _direct.ptr   = _io.bytes + offset;
+        _direct.count = length;
+        return length;
+        
+    case BUFFER_MODE_DESCRIPTOR:
+        if (id != 0) { break; }
+        bd = (buffer_descriptor_t) {
+            .offset_boundary = 2, /* word aligned, see `_io` */
+            .capacity = { 
+                (IO_BUFFER_SIZE >> 16) & 0xff, 
+                (IO_BUFFER_SIZE >> 8)  & 0xff, 
+                IO_BUFFER_SIZE         & 0xff 
+            }
+        };
+        io_write(&bd, sizeof(bd));
+        return io_limit(length);
+        
+    case BUFFER_MODE_ECHO:
+        if (_echo_length == 0) 
+        {
+            set_sense(SENSE_KEY_ILLEGAL_REQUEST, 
+                ASC_ASCQ_COMMAND_SEQUENCE_ERROR);
+            return -1;
+        }
+        _direct.ptr   = _io.bytes;
+        _direct.count = length < _echo_length ? length : _echo_length;
+        return _direct.count;
+        
+    case BUFFER_MODE_ECHO_DESCRIPTOR:
+        /* EBOS is 0, the echo buffer is shared by every lun and host */
+        ebd = (echo_buffer_descriptor_t) {
+            .flags     = 0,
+            ._reserved = 0,
+            .capacity  = htobe16(BUFFER_ECHO_CAPACITY_MAX < IO_BUFFER_SIZE ?
+                BUFFER_ECHO_CAPACITY_MAX : IO_BUFFER_SIZE)
+        };
+        io_write(&ebd, sizeof(ebd));
+        return io_limit(length);
+    }
+    
+    set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+    return -1;
+}
+
+ssize_t read_capacity10(const void *cdbptr) 
+{
+    const read_capacity10_t *cdb;
+    read_capacity10_data_t data;
+    
+    LOGINFO("SCSI READ CAPACITY (10)");
+    
+    cdb = cdbptr;
+    
+    if (cdb->pmi & READ_CAPACITY10_PMI_MASK) 
+    {
+        LOGERROR("PMI set, cannot handle");
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    data = (read_capacity10_data_t) {
+        .lba          = htobe32(_lun->count - 1), /* last readable lba */
+        .block_length = htobe32(SD_BLOCK_SIZE)
+    };
+    
+    io_write(&data, sizeof(data));
+    return sizeof(data);
+}
+
+ssize_t read_capacity16(const void *cdbptr) 
+{
+    const read_capacity16_t *cdb;
+    read_capacity16_data_t data;
+    
+    LOGINFO("SCSI READ CAPACITY (16)");
+    
+    cdb = cdbptr;
+    
+    if (cdb->pmi & READ_CAPACITY16_PMI_MASK) 
+    {
+        LOGERROR("PMI set, cannot handle");
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    data = (read_capacity16_data_t) {
+        .lba_high           = 0,
+        .lba                = htobe32(_lun->count - 1), /* last readable lba */
+        .block_length       = htobe32(SD_BLOCK_SIZE),
+        .protection         = 0,
+        .exponents          = 0,
+        .lbp_lowest_aligned = 0,
+        ._reserved          = { 0 }
+    };
+    
+    /* logical block provisioning management, UNMAP and WRITE SAME erase */
+    if (lun_erase_group() != 0) 
+    {
+        data.lbp_lowest_aligned = htobe16(READ_CAPACITY16_DATA_LBPME << 8);
+    }
+    
+    io_write(&data, sizeof(data));
+    return io_limit(be32toh(cdb->allocation_length));
+}
+
+ssize_t read_format_capacities(const void *cdbptr) 
+{
+    const read_format_capacities_t *cdb;
+    capacity_list_header_t header;
+    capacity_descriptor_t cd;
+    uint16_t allocation_length;
+    
+    LOGINFO("SCSI READ FORMAT CAPACITIES");
+    
+    cdb = cdbptr;
+    allocation_length = be16toh(cdb->allocation_length);
+    
+    header = (capacity_list_header_t) { { 0 }, CapacityListLength(1) };
+    cd = (capacity_descriptor_t) {
+        htobe32(_lun->count),
+        htobe32(CapacityDescriptorTypeAndLength(DESCRIPTOR_TYPE_FORMATTED, SD_BLOCK_SIZE))
+    };
+    
+    io_write(&header, sizeof(header));
+    io_write(&cd, sizeof(cd));
+    return io_limit(allocation_length);
+}
+
+ssize_t receive_diagnostic_results(const void *cdbptr) 
+{
+    const receive_diagnostic_results_t *cdb = cdbptr;
+    diagnostic_page_header_t header;
+    uint8_t page_code;
+    
+    /* without PCV the results of the last SEND DIAGNOSTIC are asked for, the
+       benchmark is the only test that has any */
+    page_code = (cdb->pcv & RECEIVE_DIAGNOSTIC_RESULTS_PCV_MASK) ? 
+        cdb->page_code : DIAGNOSTIC_PAGE_BENCH;
+    
+    LOGINFO("SCSI RECEIVE DIAGNOSTIC RESULTS page 0x%02x", page_code);
+    
+    header = (diagnostic_page_header_t) { page_code, 0, 0 };
+    
+    switch (page_code) 
+    {
+    case DIAGNOSTIC_PAGE_SUPPORTED_PAGES:
+        header.page_length = htobe16(sizeof(_diagnostic_pages));
+        io_write(&header, sizeof(header));
+        io_write(_diagnostic_pages, sizeof(_diagnostic_pages));
+        break;
+        
+    case DIAGNOSTIC_PAGE_BENCH:
+        diagnostic_bench_page(header);
+        break;
+        
+    default:
+        LOGERROR("unsupported diagnostic page 0x%02x", page_code);
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    return io_limit(be16toh(cdb->allocation_length));
+}
+
+ssize_t report_luns(const void *cdbptr) 
+{
+    const report_luns_t *cdb;
+    report_luns_parameter_data_t header;
+    uint8_t lun[8];
+    size_t i;
+    
+    LOGINFO("SCSI REPORT LUNS");
+    
+    cdb = cdbptr;
+    header = (report_luns_parameter_data_t) {
+        .lun_list_length = htobe32(_lun_count * sizeof(lun)),
+        ._reserved       = 0
+    };
+    io_write(&header, sizeof(header));
+    
+    /* single level lun structure using peripheral device addressing, sam 5 
+       4.7.3 */
+    memset(lun, 0, sizeof(lun));
+    for (i = 0; i < _lun_count; i++) 
+    {
+        lun[1] = i;
+        io_write(lun, sizeof(lun));
+    }
+    return io_limit(be32toh(cdb->allocation_length));
+}
+
+ssize_t request_sense(const void *cdbptr) 
+{
+    const request_sense_t *cdb;
+    
+    LOGINFO("SCSI REQUEST SENSE");
+    
+    cdb = cdbptr;
+    
+    if (cdb->desc & REQUEST_SENSE_DESC_MASK) 
+    {
+        LOGERROR("descriptor sense data requested, cannot handle");
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    io_write(&_lun->sense, FIXED_FORMAT_SENSE_DATA_LENGTH);
+    
+    /* clear the sense data */
+    _lun->sense = FIXED_FORMAT_SENSE_DATA_DEFAULT;
+    
+    return FIXED_FORMAT_SENSE_DATA_LENGTH;
+}
+
+ssize_t send_diagnostic(const void *cdbptr) 
+{
+    const send_diagnostic_t *cdb = cdbptr;
+    bench_config_t config;
+    uint16_t length;
+    uint8_t code;
+    
+    code   = cdb->self_test_code & SEND_DIAGNOSTIC_SELF_TEST_CODE_MASK;
+    length = be16toh(cdb->parameter_list_length);
+    
+    LOGINFO("SCSI SEND DIAGNOSTIC code 0x%02x length %u", code, length);
+    
+    /* a self test code can't come with a parameter list or the SELFTEST bit */
+    if (code != 0 && (length != 0 || 
+            (cdb->self_test_code & SEND_DIAGNOSTIC_SELF_TEST_MASK))) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    switch (code) 
+    {
+    case 0:
+        /* the default self test, just report success */
+        if (cdb->self_test_code & SEND_DIAGNOSTIC_SELF_TEST_MASK) 
+        {
+            if (length != 0) { break; }
+            return 0;
+        }
+        if (length == 0) { return 0; }
+        /* a bench page, it is parsed once it arrives. See
+           `scsi_send_diagnostic` */
+        if (!(cdb->self_test_code & SEND_DIAGNOSTIC_PAGE_FORMAT_MASK) || 
+                length > IO_BUFFER_SIZE) 
+        {
+            break;
+        }
+        return length;
+        
+    case SEND_DIAGNOSTIC_SELF_TEST_CODE_BG_SHORT:
+    case SEND_DIAGNOSTIC_SELF_TEST_CODE_FG_SHORT:
+        config = (bench_config_t) { 
+            BENCH_SHORT_SEQ_BLOCKS, BENCH_SHORT_RANDOM_OPS, 0 
+        };
+        return diagnostic_bench(&config, 
+            code == SEND_DIAGNOSTIC_SELF_TEST_CODE_FG_SHORT);
+        
+    case SEND_DIAGNOSTIC_SELF_TEST_CODE_BG_EXTENDED:
+    case SEND_DIAGNOSTIC_SELF_TEST_CODE_FG_EXTENDED:
+        config = (bench_config_t) { 
+            BENCH_EXTENDED_SEQ_BLOCKS, BENCH_EXTENDED_RANDOM_OPS, 0 
+        };
+        return diagnostic_bench(&config, 
+            code == SEND_DIAGNOSTIC_SELF_TEST_CODE_FG_EXTENDED);
+        
+    case SEND_DIAGNOSTIC_SELF_TEST_CODE_BG_ABORT:
+        bench_abort();
+        return 0;
+    }
+    
+    set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+    return -1;
+}
+
+ssize_t service_action_in16(const void *cdbptr) 
+{
+    const read_capacity16_t *cdb = cdbptr;
+    
+    switch (cdb->service_action & SERVICE_ACTION_MASK) 
+    {
+    case READ_CAPACITY16_SERVICE_ACTION: return read_capacity16(cdbptr);
+    
+    default:
+        LOGERROR("unsupported SERVICE ACTION IN (16) 0x%02x", 
+            cdb->service_action & SERVICE_ACTION_MASK);
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+}
+
+ssize_t synchronize_cache10(const void *cdbptr) 
+{
+    const synchronize_cache10_t *cdb = cdbptr;
+    uint32_t lba;
+    uint16_t count;
+    
+    LOGINFO("SCSI SYNCHRONIZE CACHE (10)");
+    
+    lba   = be32toh(cdb->lba);
+    count = be16toh(cdb->block_count);
+    if (lba > _lun->count || count > _lun->count - lba) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LBA_OUT_OF_RANGE);
+        return -1;
+    }
+    
+    /* only the card has a cache, the write stage and the open write session.
+       All of it goes to the card whatever the range, IMMED is ignored */
+    if (_lun->config.backend != SCSI_SD_BACKEND_CARD) { return 0; }
+    
+    if (stage_flush() < 0) 
+    {
+        /* the blocks left in the stage go out once the log has room again */
+        if (ftl_full()) 
+        {
+            set_sense(SENSE_KEY_NOT_READY, ASC_ASCQ_LUN_OPERATION_IN_PROGRESS);
+            return -1;
+        }
+        set_deferred_sense(_stage.lun,
+            SENSE_KEY_MEDIUM_ERROR, ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+        if (_stage.lun == _lun) { return -1; }
+    }
+    if (session_close() < 0) 
+    {
+        session_fault();
+        if (_session.lun == _lun) { return -1; }
+    }
+#ifdef SD_FTL
+    if (ftl_sync() < 0) 
+    {
+        set_sense(SENSE_KEY_MEDIUM_ERROR, 
+            ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+ssize_t test_unit_ready(const void *cdbptr) 
+{
+    UNUSED(cdbptr);
+    LOGINFO("SCSI TEST UNIT READY");
+    
+    if (!lun_ready(_lun)) 
+    {
+        set_not_ready_sense();
+        return -1;
+    } 
+    
+    /* if there is a pending sense data we are not ready */
+    if (_lun->sense.asc != SENSE_KEY_NO_SENSE) { return -1; }
+    
+    /* the first time the host could mount the card */
+    if (_lun->config.backend == SCSI_SD_BACKEND_CARD && 
+            stats.card_mountable_ms == 0) 
+    {
+        stats.card_mountable_ms = millis();
+    }
+    return 0;
+}
+
+ssize_t unmap(const void *cdbptr) 
+{
+    const unmap_t *cdb = cdbptr;
+    uint16_t length;
+    
+    LOGINFO("SCSI UNMAP");
+    
+    length = be16toh(cdb->parameter_list_length);
+    
+    if (lun_erase_group() == 0) 
+    {
+        LOGERROR("lun can't be erased");
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
+        return -1;
+    }
+    
+    /* anchored lbas are not supported (ANC_SUP is 0) and the whole parameter
+       list has to fit in the buffer */
+    if ((cdb->anchor & UNMAP_ANCHOR_MASK) || length > IO_BUFFER_SIZE) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    /* the unmapping is done once the parameter list is recieved, see 
+       `scsi_unmap` */
+    return length;
+}
+
+ssize_t write6(const void *cdbptr) 
+{
+    const write6_t *cdb;
+    uint32_t lba;
+    uint16_t count;
+    
+    cdb = cdbptr;
+    lba = (be32toh(cdb->lba_transfer_length) & WRITE6_LBA_MASK) >> WRITE6_LBA_SHIFT;
+    if ((count = cdb->transfer_length) == 0) 
+    {
+        count = 256; /* scsi-sbc-344r0 p77 5.24 */
+    }
+    
+    /* since we are using an ssize_t to report bytes written instead of a size_t
+       we can only report on 2 billion bytes */
+    if (((uint32_t) count) * SD_BLOCK_SIZE > (INT32_MAX - 1)) 
+    {
+        LOGCRITICAL("integer overflow, transfer > 2GiB");
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return -1;
+    }
+    
+    if (scsi_write(lba, count) < 0) { return -1; }
+    return count * SD_BLOCK_SIZE;
+}
+
+ssize_t write10(const void *cdbptr) 
+{
+    const write10_t *cdb = cdbptr;
+    uint32_t lba;
+    uint16_t count;
+    
+    cdb   = cdbptr;
+    lba   = be32toh(cdb->lba);
+    count = be16toh(cdb->transfer_length);
+    
+    /* since we are using an ssize_t to report bytes written instead of a size_t
+       we can only report on 2 billion bytes */
+    if (((uint32_t) count) * SD_BLOCK_SIZE > (INT32_MAX - 1)) 
+    {
+        LOGCRITICAL("integer overflow, transfer > 2GiB");
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return -1;
+    }
+    
+    if (scsi_write(lba, count) < 0) { return -1; }
+    return count * SD_BLOCK_SIZE;
+}
+
+ssize_t write_buffer(const void *cdbptr) 
+{
+    const write_buffer_t *cdb = cdbptr;
+    uint32_t offset, length, capacity;
+    uint8_t id;
+    
+    id     = be32toh(cdb->id_offset) >> BUFFER_ID_SHIFT;
+    offset = be32toh(cdb->id_offset) & BUFFER_OFFSET_MASK;
+    length = be32toh(cdb->length_control) >> BUFFER_LENGTH_SHIFT;
+    
+    LOGINFO("SCSI WRITE BUFFER mode 0x%02x offset 0x%x length 0x%x", 
+        cdb->mode & BUFFER_MODE_MASK, offset, length);
+    
+    switch (cdb->mode & BUFFER_MODE_MASK) 
+    {
+    case BUFFER_MODE_DATA:
+        capacity = IO_BUFFER_SIZE;
+        break;
+        
+    /* the buffer id and offset are ignored */
+    case BUFFER_MODE_ECHO:
+        id       = 0;
+        offset   = 0;
+        capacity = BUFFER_ECHO_CAPACITY_MAX < IO_BUFFER_SIZE ? 
+            BUFFER_ECHO_CAPACITY_MAX : IO_BUFFER_SIZE;
+        break;
+        
+    default:
+        id = 1;
+        capacity = 0;
+        break;
+    }
+    
+    if (id != 0 || offset > capacity || length > capacity - offset) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    /* recieve the data straight into place, see `scsi_write_buffer` */
+    _io.write_ptr   = _io.bytes + offset;
+    _io.write_count = length;
+    return length;
+}
+
+ssize_t write_same10(const void *cdbptr) 
+{
+    const write_same10_t *cdb = cdbptr;
+    
+    if (cdb->flags & WRITE_SAME_ANCHOR_MASK) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    return scsi_write_same(be32toh(cdb->lba), be16toh(cdb->transfer_length),
+        cdb->flags & WRITE_SAME_UNMAP_MASK);
+}
+
+ssize_t write_same16(const void *cdbptr) 
+{
+    const write_same16_t *cdb = cdbptr;
+    
+    if (cdb->flags & (WRITE_SAME_ANCHOR_MASK | WRITE_SAME_NDOB_MASK)) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
+    
+    /* our lbas are 32 bit */
+    if (cdb->lba_high != 0) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LBA_OUT_OF_RANGE);
+        return -1;
+    }
+    
+    return scsi_write_same(be32toh(cdb->lba), be32toh(cdb->transfer_length),
+        cdb->flags & WRITE_SAME_UNMAP_MASK);
+}
+
+/******************************************************************************/
+
+void set_sense(uint8_t sense_key, uint16_t asc_ascq) 
+{
+    fixed_format_sense_data_t *ffsd = &_lun->sense;
+    ffsd->response_code= FixedFormatResponseCode(0,RESPONSE_CODE_CURRENT_FIXED);
+    ffsd->sense_key = FixedFormatSenseKey(0, 0, 0, sense_key);
+    ffsd->asc_ascq = htobe16(asc_ascq);
+}
+
+void set_not_ready_sense(void) 
+{
+    if (_lun->config.backend == SCSI_SD_BACKEND_CARD && 
+            (_card_state == CARD_IDLE || _card_state == CARD_STARTING)) 
+    {
+        set_sense(SENSE_KEY_NOT_READY, ASC_ASCQ_LUN_BECOMING_READY);
+    } else {
+        set_sense(SENSE_KEY_NOT_READY, ASC_ASCQ_MEDIUM_NOT_PRESENT);
+    }
+}
+
+void set_deferred_sense(lun_t *lun, uint8_t sense_key, uint16_t asc_ascq) 
+{
+    fixed_format_sense_data_t *ffsd = &lun->sense;
+    ffsd->response_code=FixedFormatResponseCode(0,RESPONSE_CODE_DEFERRED_FIXED);
+    ffsd->sense_key = FixedFormatSenseKey(0, 0, 0, sense_key);
+    ffsd->asc_ascq = htobe16(asc_ascq);
+}
+
+void set_sense_information(lun_t *lun, uint32_t information) 
+{
+    fixed_format_sense_data_t *ffsd = &lun->sense;
+    ffsd->response_code |= FixedFormatResponseCode(1, 0);
+    ffsd->information = htobe32(information);
+}
+
+int scsi_read(uint32_t lba, size_t block_count) 
+{
+    /* only report the read on the first invocation of scsi_read */
+    if (_lba_offset == 0) 
+    {
+        LOGINFO("SCSI READ  %4hu blocks starting at lba 0x%08x",
+            (uint16_t) block_count, lba); 
+    }
+    
+    if ((lba + block_count) > _lun->count) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LBA_OUT_OF_RANGE);
+        return -1;
+    }
+    
+    /* the card can't be read while it is in a multiple block write, the data
+       written in the session belongs to earlier commands so a failure here is
+       reported as a deferred error */
+    if (_lun->config.backend == SCSI_SD_BACKEND_CARD && session_close() < 0) 
+    {
+        session_fault();
+        if (_session.lun == _lun) { return -1; }
+    }
+ 
+    /* the last call to scsi_read finished reading all the blocks requested */
+    if (_lba_offset == block_count) 
+    {
+        return 0;
+    }
+    
+    /* the ram disk is contiguous memory, `scsi_sd_data_out` sends it as is */
+    if (_lun->config.backend == SCSI_SD_BACKEND_RAM && block_count > 0) 
+    {
+        _direct.ptr   = ramdisk_block(_lun->lba + lba);
+        _direct.count = block_count * SD_BLOCK_SIZE;
+        _lba_offset   = block_count;
+        return 0;
+    }
+ 
+    if (_lba_offset > block_count) 
+    {
+        LOGCRITICAL("_lba_offset > block_count: how did we get here?");
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return -1;
+    }
+    
+    /* while the cdb wants us to read more blocks and we have enough space in
+       the buffer */
+    while (_lba_offset < block_count && _io.write_count >= SD_BLOCK_SIZE) 
+    {
+        if (lun_read_block(_io.write_ptr, lba + _lba_offset)) 
+        {
+            LOGERROR("reading lba 0x%08x", lba + _lba_offset);
+            if (card_lost()) { return -1; }
+            set_sense(SENSE_KEY_MEDIUM_ERROR,ASC_ASCQ_UNRECOVERD_READ_ERROR);
+            return -1;
+        }
+        if (_resume_pending) { resume_io(); }
+
+        /* update counts and write pointer */
+        _io.count       += SD_BLOCK_SIZE;
+        _io.read_count  += SD_BLOCK_SIZE;
+        _io.write_ptr   += SD_BLOCK_SIZE;
+        _io.write_count -= SD_BLOCK_SIZE;
+        _lba_offset++;
+    }
+    return 0;
+}
+
+int scsi_write(uint32_t lba, size_t block_count) 
+{
+    void *next;
+    size_t count;
+    
+    /* if this is the first call to scsi_write for this cdb */
+    if (_lba_offset == 0 && _io.count == 0) 
+    { 
+        LOGINFO("SCSI WRITE %hu blocks starting at lba 0x%08x", 
+            (uint16_t) block_count, lba); 
+    }
+    
+    /* scsi spec requires LBA OUT OF RANGE if the math doesn't make sense */
+    if ((lba + block_count) > _lun->count) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LBA_OUT_OF_RANGE);
+        return -1;
+    }
+    
+    /* we have already written all the expected blocks return success */
+    if (_lba_offset == block_count) 
+    {
+        return 0;
+    }
+ 
+    /* possible situation, serious error would need to happen to get here */
+    if (_lba_offset > block_count) 
+    {
+        LOGCRITICAL("_lba_offset > block_count: how did we get here?");
+        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        return -1;
+    }
+    
+    while (_lba_offset < block_count) 
+    {
+        count = io_read(&next, SD_BLOCK_SIZE);
+        
+        /* there is nothing in the buffer so no work to be done */
+        if (count == 0) { break; }
+        
+        /* buffer contains a partially filled block, assume we are to recieve 
+           more data and we will be called again */
+        if (count != SD_BLOCK_SIZE) 
         {
-            LOGERROR("failed to commit full buffer to sd card");
+            LOGWARN("`io_read` non block size (512B) bytes: %u", count);
+            /* undo the read */
+            _io.read_ptr   -= count;
+            _io.read_count -= count;
+            break;
+        }
+        
+        /* hold zero blocks back, a run of them is erased or skipped */
+        if ((_lun->config.flags & SCSI_SD_LUN_SKIP_ZEROS) && is_zero_block(next))
+        {
+            if (zero_run_add(_lun->lba + lba + _lba_offset) < 0) { return -1; }
+            _lba_offset++;
+            continue;
+        }
+        
+        /* the zeros before this block have to reach the card first */
+        if (zero_run_flush() < 0) { return -1; }
+        
+        if (lun_write_block(lba + _lba_offset, next, 
+                block_count - _lba_offset)) 
+        {
+            LOGERROR("failed to write lba 0x%08x", lba + _lba_offset);
+            if (card_lost() || log_full()) { return -1; }
+            set_sense(SENSE_KEY_MEDIUM_ERROR, ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+            write_fault(lba);
             return -1;
         }
+        if (_resume_pending) { resume_io(); }
+        
+        _lba_offset++;
     }
+    
+    /* the last block of the cdb arrived, nothing left to continue a run */
+    if (_lba_offset == block_count) { return zero_run_flush(); }
+    
     return 0;
 }
 
-ssize_t scsi_sd_data_in_commit(void) 
+
+ssize_t diagnostic_bench(const bench_config_t *config, int foreground) 
 {
-#define ERROR_BYTES_WRITTEN(c) (-1 * ((c) + 1))
-    ssize_t ret;
-    
-     /* validate we are initialized and the cbw opcode is valid */
-    if (!_initialized) 
+    if (_card_state != CARD_READY) 
     {
-        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LUN_NOT_READY);
-        return ERROR_BYTES_WRITTEN(_lba_offset * SD_BLOCK_SIZE);
+        set_sense(SENSE_KEY_NOT_READY, ASC_ASCQ_LUN_NOT_READY);
+        return -1;
     }
     
-    switch (_cdb->opcode) 
+    if (_scratch.count == 0) 
     {
-        case WRITE6_OPCODE:  ret = write6(_cdb);  break;
-        case WRITE10_OPCODE: ret = write10(_cdb); break;
-        default:
-            LOGCRITICAL("`scsi_sd_data_in_commit` called with OUT cdb");
-            set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
-            return ERROR_BYTES_WRITTEN(_lba_offset * SD_BLOCK_SIZE);
+        LOGERROR("no scratch region for the benchmark, see SD_SCRATCH_BLOCKS");
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
     }
     
-    if (ret < 0) 
+    /* the benchmark goes to the card directly. The staged blocks are left as 
+       they are, they can't be in the scratch region */
+    if (session_close() < 0) { session_fault(); }
+    
+    if (bench_start(_scratch.lba, _scratch.count, config) < 0) 
     {
-        LOGERROR("write6/10 failed");
-        return ERROR_BYTES_WRITTEN(_lba_offset * SD_BLOCK_SIZE);
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
     }
     
-    /* all possible blocks were written, clear the buffer to allow more data 
-       to be sent in */
-    io_reset();
-    return _lba_offset * SD_BLOCK_SIZE;
-#undef ERROR_BYTES_WRITTEN
+    /* a foreground run too is stepped from `scsi_sd_poll`, a run of the whole
+       region here would keep the usb interrupt off for seconds */
+    if (foreground) { _foreground = _lun; }
+    return 0;
 }
 
-/******************************************************************************/
-
-ssize_t format_unit(const void *cdbptr) 
+ssize_t scsi_send_diagnostic(void) 
 {
-    UNUSED(cdbptr);
-    LOGINFO("SCSI FORMAT UNIT");
-    /* this command is required but is meaningless to us, therefore report a
-       failure to format the medium if the host tries to use this command */
-    /* TODO research the appropriate way to handle this request */
-    set_sense(SENSE_KEY_MEDIUM_ERROR, ASC_ASCQ_FORMAT_COMMAND_FAILED);
-    return -1;
+    const diagnostic_bench_parameters_t *page;
+    bench_config_t config;
+    
+    page = (const void *) _io.bytes;
+    
+    if (_io.count < sizeof(page->header) || 
+            page->header.page_code != DIAGNOSTIC_PAGE_BENCH) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, 
+            ASC_ASCQ_INVALID_FIELD_IN_PARAMETER_LIST);
+        return -1;
+    }
+    
+    if (_io.count != sizeof(*page) || be16toh(page->header.page_length) != 
+            DIAGNOSTIC_PAGE_LENGTH(sizeof(*page))) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, 
+            ASC_ASCQ_PARAMETER_LIST_LENGTH_ERROR);
+        return -1;
+    }
+    
+    config = (bench_config_t) {
+        .seq_blocks = be32toh(page->seq_blocks),
+        .random_ops = be32toh(page->random_ops),
+        .seed       = be32toh(page->seed)
+    };
+    
+    if (diagnostic_bench(&config, 0) < 0) { return -1; }
+    return _io.count;
 }
 
-ssize_t inquiry(const void *cdbptr) 
+void diagnostic_bench_page(diagnostic_page_header_t header) 
 {
-    UNUSED(cdbptr);
-    LOGINFO("SCSI INQUIRY");
-    /* io_write should not fail since this is called after a io_reset */
-    io_write(&_inquiry_data, sizeof(_inquiry_data));
-    return sizeof(_inquiry_data);
+    const bench_config_t *config = bench_config();
+    const bench_result_t *results = bench_results();
+    diagnostic_bench_page_t page;
+    size_t i;
+    
+    page = (diagnostic_bench_page_t) {
+        .header         = header,
+        .status         = bench_status(),
+        .test           = bench_test(),
+        ._reserved      = 0,
+        .cpu_hz         = htobe32(F_CPU),
+        .scratch_lba    = htobe32(_scratch.lba),
+        .scratch_blocks = htobe32(_scratch.count),
+        .seq_blocks     = htobe32(config->seq_blocks),
+        .random_ops     = htobe32(config->random_ops),
+        .seed           = htobe32(config->seed)
+    };
+    page.header.page_length = htobe16(DIAGNOSTIC_PAGE_LENGTH(sizeof(page)));
+    
+    for (i = 0; i < BENCH_TESTS; i++) 
+    {
+        page.results[i] = (diagnostic_bench_result_t) {
+            .ops         = htobe32(results[i].ops),
+            .blocks      = htobe32(results[i].blocks),
+            .cycles_high = htobe32(results[i].cycles >> 32),
+            .cycles_low  = htobe32(results[i].cycles & 0xffffffff),
+            .min_cycles  = htobe32(results[i].min_cycles),
+            .max_cycles  = htobe32(results[i].max_cycles)
+        };
+    }
+    
+    io_write(&page, sizeof(page));
 }
 
-ssize_t load_unload(const void *cdbptr) 
+ssize_t scsi_write_buffer(void) 
 {
-    UNUSED(cdbptr);
-    LOGINFO("SCSI LOAD UNLOAD");
-    /* do nothing and return success */
-    return 0;
+    const write_buffer_t *cdb = (const void *) _cdb;
+    
+    if ((cdb->mode & BUFFER_MODE_MASK) == BUFFER_MODE_ECHO) 
+    {
+        _echo_length = _io.count;
+    }
+    return _io.count;
 }
 
-ssize_t mode_sense6(const void *cdbptr) 
+ssize_t scsi_unmap(void) 
 {
-    const mode_sense6_t *cdb;
-    mode_parameter_header6_t mph6;
-    size_t allocation_length;
-    size_t length;
+    const unmap_parameter_list_header_t *header;
+    const unmap_block_descriptor_t *desc;
+    extent_t *extents, tmp;
+    size_t count, i, j, n;
+    uint32_t start, end;
     
-    LOGINFO("SCSI MODE SENSE (6)");
-   
-    cdb = cdbptr;
-    allocation_length = cdb->allocation_length;
+    header = (const void *) _io.bytes;
+    desc   = (const void *) (_io.bytes + UNMAP_PARAMETER_LIST_HEADER_LENGTH);
     
-    /* return success scsi spc 3r23 p29 4.3.4.6 */
-    if (allocation_length == 0) 
+    /* a parameter list that is too short to hold the header, sbc 3r25 5.28 */
+    if (_io.count < UNMAP_PARAMETER_LIST_HEADER_LENGTH) 
     {
-        return 0;
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, 
+            ASC_ASCQ_PARAMETER_LIST_LENGTH_ERROR);
+        return -1;
     }
     
-    /* no matter what this is the base header that will be sent */
-    mph6 = (mode_parameter_header6_t) {
-        .mode_data_length           = 3,
-        .medium_type                = MODE_PARAMETER_MEDIUM_TYPE_DABD,
-        .device_specific_parameter  = 0,
-        .block_descriptor_length    = 0
-    };
+    /* only use complete descriptors that were actually sent */
+    count = be16toh(header->block_descriptor_data_length);
+    if (count > _io.count - UNMAP_PARAMETER_LIST_HEADER_LENGTH) 
+    {
+        count = _io.count - UNMAP_PARAMETER_LIST_HEADER_LENGTH;
+    }
+    count /= UNMAP_BLOCK_DESCRIPTOR_LENGTH;
     
-    /* build the response, as observed by the kingston dt 101 g2 upon recieving
-       an unsupported page_code just return a empty header */
-    switch (cdb->pc_page_code & MODE_SENSE6_PAGE_CODE_MASK) 
+    /* convert the descriptors into extents in place, an extent is half the 
+       size of a descriptor so it never overwrites one that wasn't read yet */
+    extents = (void *) (_io.bytes + UNMAP_PARAMETER_LIST_HEADER_LENGTH);
+    for (i = 0, n = 0; i < count; i++) 
     {
-    case MODE_SENSE_PAGE_CODE_RETURN_ALL:
-        /* send the header and mode page */
-        length = sizeof(mph6) + sizeof(_fdmp);
+        tmp = (extent_t) { be32toh(desc[i].lba), be32toh(desc[i].count) };
         
-        /* scsi spc 3r23 p29 4.3.4.6 */
-        if (length > CDB6_ALLOCATION_LENGTH_MAX) 
+        if (desc[i].lba_high != 0 || tmp.lba > _lun->count || 
+                tmp.count > _lun->count - tmp.lba) 
         {
-            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+            LOGERROR("unmap lba 0x%08x (%u blocks) out of range", 
+                tmp.lba, tmp.count);
+            set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LBA_OUT_OF_RANGE);
             return -1;
         }
-        
-        mph6.mode_data_length = length - sizeof(mph6.mode_data_length);
-        
-        io_write(&mph6,  sizeof(mph6));
-        io_write(&_fdmp, sizeof(_fdmp));
-        return io_limit(allocation_length);
-        
-    default:
-        LOGERROR("unsupported pagecode/subpage requested 0x%02x/0x02x", 
-            cdb->pc_page_code & MODE_SENSE6_PAGE_CODE_MASK, cdb->subpage_code);
-        io_write(&mph6, sizeof(mph6));
-        return io_limit(allocation_length);
+        if (tmp.count > 0) { extents[n++] = tmp; }
     }
-}
-
-/* not sure appropriate way to handle, following what other flash drives do */
-ssize_t prevent_allow_medium_removal(const void *cdbptr) 
-{
-    const prevent_allow_medium_removal_t *cdb = cdbptr;
-    LOGINFO("SCSI PREVENT ALLOW MEDIUM REMOVAL ");
-    if (cdb->prevent & PREVENT_ALLOW_MEDIUM_REMOVAL_PREVENT_DTE) 
+    
+    /* sort by lba so neighbouring ranges can be merged into fewer erases */
+    for (i = 1; i < n; i++) 
     {
-        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
-        return -1;
+        tmp = extents[i];
+        for (j = i; j > 0 && extents[j - 1].lba > tmp.lba; j--) 
+        {
+            extents[j] = extents[j - 1];
+        }
+        extents[j] = tmp;
     }
-    return 0;
-}
-
-ssize_t read6(const void *cdbptr) 
-{
-    const read6_t *cdb;
-    uint32_t lba;
-    uint16_t count;
     
-    cdb = cdbptr;
-    lba = (be32toh(cdb->lba_transfer_length)&READ6_LBA_MASK)>>READ6_LBA_SHIFT;
-    if ((count = cdb->transfer_length) == 0) 
+    for (i = 0, j = 0; i < n; i++) 
     {
-        count = 256; /* scsi-sbc-344r0 p45 5.5 */
+        /* overlaps or touches the previous extent, grow that one instead */
+        if (j > 0 && 
+                extents[i].lba <= extents[j-1].lba + extents[j-1].count) 
+        {
+            end = extents[i].lba + extents[i].count;
+            if (end > extents[j-1].lba + extents[j-1].count) 
+            {
+                extents[j-1].count = end - extents[j-1].lba;
+            }
+            continue;
+        }
+        extents[j++] = extents[i];
     }
+    n = j;
     
-    /* since we are using an ssize_t to report bytes written instead of a size_t
-       we can only report on 2 billion bytes */
-    if (((uint32_t) count) * SD_BLOCK_SIZE > INT32_MAX - 1) 
+    for (i = 0; i < n; i++) 
     {
-        LOGCRITICAL("integer overflow, transfer > 2GiB");
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
-        return -1;
+        extents[i].lba += _lun->lba;
+        if (erase_aligned(extents[i].lba, extents[i].count, &start, &end) < 0) 
+        {
+            set_sense(SENSE_KEY_MEDIUM_ERROR, 
+                ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+            return -1;
+        }
     }
     
-    if (scsi_read(lba, count) < 0) { return -1; }
-    return count * SD_BLOCK_SIZE;
+    return _io.count;
 }
 
-ssize_t read10(const void *cdbptr) 
+ssize_t scsi_write_same(uint32_t lba, uint32_t count, int unmap) 
 {
-    const read10_t *cdb = cdbptr;
-    uint32_t lba;
-    uint16_t count;
-    
-    cdb = cdbptr;
-    lba = be32toh(cdb->lba);
-    count = be16toh(cdb->transfer_length);
+    const uint8_t *block;
+    uint32_t start, end;
+    size_t i;
     
-    /* since we are using an ssize_t to report bytes written instead of a size_t
-       we can only report on 2 billion bytes */
-    if (((uint32_t) count) * SD_BLOCK_SIZE > INT32_MAX - 1) 
+    /* the range is written around its erased part through the write session 
+       and the zero map, which are the card's */
+    if (_lun->config.backend != SCSI_SD_BACKEND_CARD) 
     {
-        LOGCRITICAL("integer overflow, transfer > 2GiB");
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_COMMAND);
         return -1;
     }
     
-    if (scsi_read(lba, count) < 0) { return -1; }
-    return count * SD_BLOCK_SIZE;
-}
-
-ssize_t read_capacity10(const void *cdbptr) 
-{
-    const read_capacity10_t *cdb;
-    read_capacity10_data_t data;
+    /* a transfer length of 0 (to the end of the medium) is not supported, 
+       WSNZ in the block limits vpd page */
+    if (count == 0 || count > WRITE_SAME_MAX_BLOCKS) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
+        return -1;
+    }
     
-    LOGINFO("SCSI READ CAPACITY (10)");
+    if (lba > _lun->count || count > _lun->count - lba) 
+    {
+        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LBA_OUT_OF_RANGE);
+        return -1;
+    }
     
-    cdb = cdbptr;
+    /* wait for the single block of data */
+    if (_io.count == 0) 
+    {
+        LOGINFO("SCSI WRITE SAME %u blocks starting at lba 0x%08x%s", 
+            count, lba, unmap ? " (unmap)" : "");
+        return SD_BLOCK_SIZE;
+    }
     
-    if (cdb->pmi & READ_CAPACITY10_PMI_MASK) 
+    if (_io.count != SD_BLOCK_SIZE) 
     {
-        LOGERROR("PMI set, cannot handle");
+        LOGERROR("WRITE SAME recieved %u bytes", _io.count);
         set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
         return -1;
     }
     
-    data = (read_capacity10_data_t) {
-        .lba          = htobe32(_lun->count - 1), /* last readable lba */
-        .block_length = htobe32(SD_BLOCK_SIZE)
-    };
+    block = _io.bytes;
+    lba  += _lun->lba;
+    start = end = lba;
     
-    io_write(&data, sizeof(data));
-    return sizeof(data);
+    /* zeros take the same path as the zero blocks of a WRITE */
+    if ((_lun->config.flags & SCSI_SD_LUN_SKIP_ZEROS) && is_zero_block(block)) 
+    {
+        _zero_run.lba    = lba;
+        _zero_run.count  = count;
+        _zero_run.offset = 0;
+        return zero_run_flush() < 0 ? -1 : SD_BLOCK_SIZE;
+    }
+    
+    /* the erased part of the range has to read back as the block sent */
+    if (unmap && lun_erase_group() != 0) 
+    {
+        for (i = 0; i < SD_BLOCK_SIZE && block[i] == sd_erased_byte(); i++);
+        if (i == SD_BLOCK_SIZE && 
+                erase_aligned(lba, count, &start, &end) < 0) 
+        {
+            set_sense(SENSE_KEY_MEDIUM_ERROR, 
+                ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+            return -1;
+        }
+    }
+    
+    zero_map_clear(lba, count);
+    if (write_around(lba, count, block, start, end) < 0) 
+    {
+        if (log_full()) { return -1; }
+        set_sense(SENSE_KEY_MEDIUM_ERROR, 
+            ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+        return -1;
+    }
+    
+    return SD_BLOCK_SIZE;
 }
 
-ssize_t read_format_capacities(const void *cdbptr) 
+int erase_aligned(uint32_t lba, uint32_t count, uint32_t *start, uint32_t *end) 
 {
-    const read_format_capacities_t *cdb;
-    capacity_list_header_t header;
-    capacity_descriptor_t cd;
-    uint16_t allocation_length;
+    uint32_t group = sd_erase_group();
     
-    LOGINFO("SCSI READ FORMAT CAPACITIES");
+    /* round the start up and the end down to the erase group boundaries */
+    *start = ((lba + group - 1) / group) * group;
+    *end   = ((lba + count) / group) * group;
     
-    cdb = cdbptr;
-    allocation_length = be16toh(cdb->allocation_length);
+    if (*start >= *end) 
+    {
+        *start = *end = lba;
+        return 0;
+    }
+    
+    /* the staged blocks are older than the erase, an open write session would 
+       be aborted by the erase commands */
+    if (stage_flush() < 0 || session_close() < 0) { return -1; }
     
-    header = (capacity_list_header_t) { { 0 }, CapacityListLength(1) };
-    cd = (capacity_descriptor_t) {
-        htobe32(_lun->count),
-        htobe32(CapacityDescriptorTypeAndLength(DESCRIPTOR_TYPE_FORMATTED, SD_BLOCK_SIZE))
-    };
+    LOGDEBUG("erasing lba 0x%08x (%u blocks)", *start, *end - *start);
+    if (sd_erase(*start, *end - *start) != 0) 
+    {
+        /* the erase may have partially happened */
+        zero_map_clear(*start, *end - *start);
+        return -1;
+    }
     
-    io_write(&header, sizeof(header));
-    io_write(&cd, sizeof(cd));
-    return io_limit(allocation_length);
+    if (sd_erased_byte() == 0) { zero_map_add(*start, *end - *start); }
+    else                       { zero_map_clear(*start, *end - *start); }
+    return 0;
 }
 
-ssize_t report_luns(const void *cdbptr) 
+int write_around(uint32_t lba, uint32_t count, const void *block, 
+    uint32_t start, uint32_t end) 
 {
-    const report_luns_t *cdb;
-    uint32_t length;
+    uint32_t b;
     
-    LOGINFO("SCSI REPORT LUNS");
+    /* the staged blocks are older, they must not land on top of these */
+    if (stage_flush() < 0) { return -1; }
     
-    cdb = cdbptr;
-    length = be32toh(cdb->allocation_length);
-    if (length > sizeof(_report_luns_data)) 
+    for (b = lba; b < lba + count; b++) 
     {
-        length = sizeof(_report_luns_data);
+        /* skip over the excluded blocks */
+        if (b == start && start != end) { b = end - 1; continue; }
+        
+        if (session_write(_lun, b, block, lba + count - b)) 
+        {
+            LOGERROR("failed to write lba 0x%08x", b);
+            return -1;
+        }
     }
-    io_write(&_report_luns_data, length);
-    return length;
+    return 0;
 }
 
-ssize_t request_sense(const void *cdbptr) 
+int stage_write(uint32_t lba, const void *src) 
 {
-    const request_sense_t *cdb;
+    uint32_t chunk, segment;
+    size_t i;
     
-    LOGINFO("SCSI REQUEST SENSE");
-    
-    cdb = cdbptr;
+    chunk = sd_write_chunk();
+    segment = lba / (chunk != 0 ? chunk : STAGE_DEFAULT_CHUNK_BLOCKS);
     
-    if (cdb->desc & REQUEST_SENSE_DESC_MASK) 
+    /* a rewrite of a staged block replaces it */
+    for (i = 0; i < _stage.count; i++) 
     {
-        LOGERROR("descriptor sense data requested, cannot handle");
-        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_INVALID_FIELD_IN_CDB);
-        return -1;
+        if (_stage.lbas[i] == lba) 
+        {
+            memcpy(_stage.blocks[i], src, SD_BLOCK_SIZE);
+            stats.stage_blocks++;
+            return 0;
+        }
     }
     
-    io_write(&_ffsd, FIXED_FORMAT_SENSE_DATA_LENGTH);
+    if (_stage.count == STAGE_BLOCKS || (_stage.count > 0 && 
+            (_stage.segment != segment || _stage.lun != _lun))) 
+    {
+        if (stage_flush() < 0) { return -1; }
+    }
     
-    /* clear the sense data */
-    _ffsd = FIXED_FORMAT_SENSE_DATA_DEFAULT;
+    if (_stage.count == 0) 
+    {
+        _stage.segment  = segment;
+        _stage.first_ms = millis();
+        _stage.lun      = _lun;
+    }
+    _stage.lbas[_stage.count] = lba;
+    memcpy(_stage.blocks[_stage.count], src, SD_BLOCK_SIZE);
+    _stage.count++;
     
-    return FIXED_FORMAT_SENSE_DATA_LENGTH;
+    /* the block is as good as written */
+    zero_map_clear(lba, 1);
+    stats.stage_blocks++;
+    return 0;
 }
 
-ssize_t send_diagnostic(const void *cdbptr) 
+int stage_flush(void) 
 {
-    UNUSED(cdbptr);
-    LOGINFO("SCSI SEND DIAGNOSTIC");
-    return 0;   /* just report success */
+    uint8_t order[STAGE_BLOCKS], written[STAGE_BLOCKS], tmp;
+    size_t count, i, j, n;
+    uint32_t lba;
+    
+    if (_stage.count == 0) { return 0; }
+    
+    /* sort the indexes instead of moving the blocks around */
+    count = _stage.count;
+    for (i = 0; i < count; i++) 
+    {
+        tmp = i;
+        for (j = i; j > 0 && _stage.lbas[order[j - 1]] > _stage.lbas[tmp]; j--) 
+        {
+            order[j] = order[j - 1];
+        }
+        order[j] = tmp;
+    }
+    
+    /* emptied first, a failed block is not retried unless the log was full */
+    _stage.count = 0;
+    stats.stage_flushes++;
+    
+    for (i = 0; i < count; i++) 
+    {
+        lba = _stage.lbas[order[i]];
+        if (!_session.open || _session.next_lba != lba) { stats.stage_runs++; }
+        
+        if (session_write(_stage.lun, lba, _stage.blocks[order[i]], 
+                count - i) < 0) 
+        {
+            LOGERROR("failed to write staged lba 0x%08x", lba);
+            break;
+        }
+    }
+    if (i == count) 
+    {
+        stats.stage_merge_ratio = stats.stage_runs == 0 ? 0 :
+            (uint32_t) (((uint64_t) stats.stage_blocks * 100) / 
+                stats.stage_runs);
+        return 0;
+    }
+    
+    /* the log refused the block without writing it, it and the blocks after
+       it are kept in arrival order for the next flush */
+    if (ftl_full()) 
+    {
+        memset(written, 0, sizeof(written));
+        for (j = 0; j < i; j++) { written[order[j]] = 1; }
+        for (j = 0, n = 0; j < count; j++) 
+        {
+            if (written[j]) { continue; }
+            if (n != j) 
+            {
+                _stage.lbas[n] = _stage.lbas[j];
+                memcpy(_stage.blocks[n], _stage.blocks[j], SD_BLOCK_SIZE);
+            }
+            n++;
+        }
+        _stage.count = n;
+    }
+    return -1;
 }
 
-ssize_t test_unit_ready(const void *cdbptr) 
+const void *stage_lookup(uint32_t lba) 
 {
-    UNUSED(cdbptr);
-    LOGINFO("SCSI TEST UNIT READY");
+    size_t i;
     
-    if (!_initialized) 
+    for (i = 0; i < _stage.count; i++) 
     {
-        set_sense(SENSE_KEY_NOT_READY, ASC_ASCQ_MEDIUM_NOT_PRESENT);
-        return -1;
-    } 
-    
-    /* if there is a pending sense data we are not ready */
-    if (_ffsd.asc != SENSE_KEY_NO_SENSE) { return -1; }
-    
-    return 0;
+        if (_stage.lbas[i] == lba) { return _stage.blocks[i]; }
+    }
+    return NULL;
 }
 
-ssize_t write6(const void *cdbptr) 
+int session_write(lun_t *lun, uint32_t lba, const void *src, uint32_t count) 
 {
-    const write6_t *cdb;
-    uint32_t lba;
-    uint16_t count;
+    /* a gap in the lbas, the current session can't be continued */
+    if (_session.open && _session.next_lba != lba) 
+    {
+        if (session_close() < 0) 
+        {
+            /* the failed blocks are of earlier cdbs, this one wasn't sent */
+            session_fault();
+            _session.failed_lba = lba;
+            return -1;
+        }
+    }
     
-    cdb = cdbptr;
-    lba = (be32toh(cdb->lba_transfer_length) & WRITE6_LBA_MASK) >> WRITE6_LBA_SHIFT;
-    if ((count = cdb->transfer_length) == 0) 
+    if (!_session.open) 
     {
-        count = 256; /* scsi-sbc-344r0 p77 5.24 */
+        LOGDEBUG("opening write session at lba 0x%08x", lba);
+        if (sd_write_start(lba, count) != 0) 
+        {
+            _session.failed_lba = lba;
+            return -1;
+        }
+        _session.open     = 1;
+        _session.lba      = lba;
+        _session.next_lba = lba;
+        _session.lun      = lun;
     }
     
-    /* since we are using an ssize_t to report bytes written instead of a size_t
-       we can only report on 2 billion bytes */
-    if (((uint32_t) count) * SD_BLOCK_SIZE > (INT32_MAX - 1)) 
+    if (sd_write_data(src) != 0) 
     {
-        LOGCRITICAL("integer overflow, transfer > 2GiB");
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        /* the card aborts the write on a rejected block, send the stop token 
+           anyway to get it back to the transfer state */
+        if (session_close() == 0) { session_failed(lba); }
         return -1;
     }
     
-    if (scsi_write(lba, count) < 0) { return -1; }
-    return count * SD_BLOCK_SIZE;
+    _session.next_lba = lba + 1;
+    _session.last_ms  = millis();
+    _session.lun      = lun;
+    return 0;
 }
 
-int write10(const void *cdbptr) 
+int session_close(void) 
 {
-    const write10_t *cdb = cdbptr;
-    uint32_t lba;
-    uint16_t count;
-    
-    cdb   = cdbptr;
-    lba   = be32toh(cdb->lba);
-    count = be16toh(cdb->transfer_length);
+    if (!_session.open) { return 0; }
     
-    /* since we are using an ssize_t to report bytes written instead of a size_t
-       we can only report on 2 billion bytes */
-    if (((uint32_t) count) * SD_BLOCK_SIZE > (INT32_MAX - 1)) 
+    _session.open = 0;
+    if (sd_write_stop() != 0) 
     {
-        LOGCRITICAL("integer overflow, transfer > 2GiB");
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
+        session_failed(_session.lba);
+        LOGERROR("write session 0x%08x to 0x%08x failed at lba 0x%08x", 
+            _session.lba, _session.next_lba, _session.failed_lba);
         return -1;
     }
-    
-    if (scsi_write(lba, count) < 0) { return -1; }
-    return count * SD_BLOCK_SIZE;
+    return 0;
 }
 
-/******************************************************************************/
+void session_failed(uint32_t lba) 
+{
+#ifndef SD_FTL
+    uint32_t written;
+    
+    /* the card counts the blocks of the CMD25 it wrote without error, the
+       translation layer's sessions aren't a single CMD25 */
+    if (sd_written_blocks(&written) == 0 && 
+            written < _session.next_lba - _session.lba) 
+    {
+        lba = _session.lba + written;
+    }
+#endif
+    _session.failed_lba = lba;
+}
 
-void set_sense(uint8_t sense_key, uint16_t asc_ascq) 
+void session_fault(void) 
 {
-    _ffsd.response_code= FixedFormatResponseCode(0,RESPONSE_CODE_CURRENT_FIXED);
-    _ffsd.sense_key = FixedFormatSenseKey(0, 0, 0, sense_key);
-    _ffsd.asc_ascq = htobe16(asc_ascq);
+    set_deferred_sense(_session.lun,
+        SENSE_KEY_MEDIUM_ERROR, ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
+    set_sense_information(_session.lun, 
+        _session.failed_lba - _session.lun->lba);
 }
 
-int scsi_read(uint32_t lba, size_t block_count) 
+void write_fault(uint32_t lba) 
 {
-    /* only report the read on the first invocation of scsi_read */
-    if (_lba_offset == 0) 
+    uint32_t failed;
+    
+    /* only a write through goes to the card with the blocks of the cdb */
+    if (_lun->config.backend != SCSI_SD_BACKEND_CARD || 
+            (_lun->config.flags & SCSI_SD_LUN_STAGE)) 
     {
-        LOGINFO("SCSI READ  %4hu blocks starting at lba 0x%08x",
-            (uint16_t) block_count, lba); 
+        return;
     }
     
-    if ((lba + block_count) > _lun->count) 
+    /* blocks are written in order, none after the failed one made it. One of
+       an earlier cdb failing means none of this one did */
+    failed = _session.failed_lba - _lun->lba;
+    if (failed < lba) 
     {
-        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LBA_OUT_OF_RANGE);
-        return -1;
+        _lba_offset = 0;
+    } 
+    else if (failed - lba < _lba_offset) 
+    {
+        _lba_offset = failed - lba;
     }
- 
-    /* the last call to scsi_read finished reading all the blocks requested */
-    if (_lba_offset == block_count) 
+    set_sense_information(_lun, failed);
+}
+
+
+/******************************************************************************/
+
+
+int is_zero_block(const void *block) 
+{
+    const uint32_t *word = block;
+    size_t i;
+    
+    for (i = 0; i < SD_BLOCK_SIZE / sizeof(*word); i++) 
     {
-        return 0;
+        if (word[i] != 0) { return 0; }
     }
- 
-    if (_lba_offset > block_count) 
+    return 1;
+}
+
+int zero_run_add(uint32_t lba) 
+{
+    if (_zero_run.count > 0 && _zero_run.lba + _zero_run.count != lba) 
     {
-        LOGCRITICAL("_lba_offset > block_count: how did we get here?");
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
-        return -1;
+        if (zero_run_flush() < 0) { return -1; }
     }
     
-    /* while the cdb wants us to read more blocks and we have enough space in
-       the buffer */
-    while (_lba_offset < block_count && _io.write_count >= SD_BLOCK_SIZE) 
+    if (_zero_run.count == 0) 
     {
-        if (sd_read_block(_io.write_ptr, lba + _lba_offset)) 
-        {
-            LOGERROR("reading lba 0x%08x", lba + _lba_offset);
-            set_sense(SENSE_KEY_MEDIUM_ERROR,ASC_ASCQ_UNRECOVERD_READ_ERROR);
-            return -1;
-        }
-
-        /* update counts and write pointer */
-        _io.count       += SD_BLOCK_SIZE;
-        _io.read_count  += SD_BLOCK_SIZE;
-        _io.write_ptr   += SD_BLOCK_SIZE;
-        _io.write_count -= SD_BLOCK_SIZE;
-        _lba_offset++;
+        _zero_run.lba    = lba;
+        _zero_run.offset = _lba_offset;
     }
+    _zero_run.count++;
     return 0;
 }
 
-int scsi_write(uint32_t lba, size_t block_count) 
+int zero_run_flush(void) 
 {
-    void *next;
-    size_t count;
+    uint32_t lba, end, next, start, stop, n;
     
-    /* if this is the first call to scsi_write for this cdb */
-    if (_lba_offset == 0 && _io.count == 0) 
-    { 
-        LOGINFO("SCSI WRITE %hu blocks starting at lba 0x%08x", 
-            (uint16_t) block_count, lba); 
+    if (_zero_run.count == 0) { return 0; }
+    
+    lba = _zero_run.lba;
+    end = _zero_run.lba + _zero_run.count;
+    _zero_run.count = 0;
+    
+    LOGDEBUG("zero run lba 0x%08x (%u blocks)", lba, end - lba);
+    
+    while (lba < end) 
+    {
+        /* already zero on the card, nothing to do */
+        if ((n = zero_map_lookup(lba, &next)) > 0) 
+        {
+            lba += n;
+            continue;
+        }
+        if (next > end) { next = end; }
+        
+        /* [lba, next) has unknown contents, erase what can be and write the 
+           zeros to the rest */
+        start = stop = lba;
+        if (sd_erase_group() != 0 && sd_erased_byte() == 0 && 
+                erase_aligned(lba, next - lba, &start, &stop) < 0) 
+        {
+            goto error;
+        }
+        if (write_around(lba, next - lba, _zero_block, start, stop) < 0) 
+        {
+            goto error;
+        }
+        zero_map_add(lba, next - lba);
+        lba = next;
     }
+    return 0;
     
-    /* scsi spec requires LBA OUT OF RANGE if the math doesn't make sense */
-    if ((lba + block_count) > _lun->count) 
+error:
+    /* the blocks of the run can't be reported as written */
+    _lba_offset = _zero_run.offset;
+    if (!log_full()) 
     {
-        set_sense(SENSE_KEY_ILLEGAL_REQUEST, ASC_ASCQ_LBA_OUT_OF_RANGE);
-        return -1;
+        set_sense(SENSE_KEY_MEDIUM_ERROR, 
+            ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
     }
+    return -1;
+}
+
+void zero_map_add(uint32_t lba, uint32_t count) 
+{
+    extent_t *e = _zero_map.extents;
+    size_t i, smallest;
     
-    /* we have already written all the expected blocks return success */
-    if (_lba_offset == block_count) 
+    if (count == 0) { return; }
+    
+    /* overlapping extents are dropped and grown back below */
+    zero_map_clear(lba, count);
+    
+    /* grow the extents touching the new one */
+    for (i = 0; i < _zero_map.count && e[i].lba + e[i].count < lba; i++);
+    if (i < _zero_map.count && e[i].lba + e[i].count == lba) 
     {
-        return 0;
+        e[i].count += count;
+        if (i + 1 < _zero_map.count && e[i].lba + e[i].count == e[i + 1].lba) 
+        {
+            e[i].count += e[i + 1].count;
+            memmove(&e[i + 1], &e[i + 2], 
+                (_zero_map.count - i - 2) * sizeof(*e));
+            _zero_map.count--;
+        }
+        return;
     }
- 
-    /* possible situation, serious error would need to happen to get here */
-    if (_lba_offset > block_count) 
+    if (i < _zero_map.count && lba + count == e[i].lba) 
     {
-        LOGCRITICAL("_lba_offset > block_count: how did we get here?");
-        set_sense(SENSE_KEY_HARDWARE_ERROR, 0x0000);
-        return -1;
+        e[i].lba    = lba;
+        e[i].count += count;
+        return;
     }
     
-    while (_lba_offset < block_count) 
+    /* no room, forget the smallest extent unless the new one is smaller */
+    if (_zero_map.count == ZERO_MAP_EXTENTS) 
     {
-        count = io_read(&next, SD_BLOCK_SIZE);
-        
-        /* there is nothing in the buffer so no work to be done */
-        if (count == 0) { break; }
-        
-        /* buffer contains a partially filled block, assume we are to recieve 
-           more data and we will be called again */
-        if (count != SD_BLOCK_SIZE) 
+        for (smallest = 0, i = 1; i < _zero_map.count; i++) 
         {
-            LOGWARN("`io_read` non block size (512B) bytes: %u", count);
-            /* undo the read */
-            _io.read_ptr   -= count;
-            _io.read_count -= count;
-            break;
+            if (e[i].count < e[smallest].count) { smallest = i; }
         }
+        if (count <= e[smallest].count) { return; }
+        memmove(&e[smallest], &e[smallest + 1], 
+            (_zero_map.count - smallest - 1) * sizeof(*e));
+        _zero_map.count--;
+    }
+    
+    for (i = 0; i < _zero_map.count && e[i].lba < lba; i++);
+    memmove(&e[i + 1], &e[i], (_zero_map.count - i) * sizeof(*e));
+    e[i] = (extent_t) { lba, count };
+    _zero_map.count++;
+}
+
+void zero_map_clear(uint32_t lba, uint32_t count) 
+{
+    extent_t *e = _zero_map.extents;
+    uint32_t end, eend;
+    size_t i;
+    
+    end = lba + count;
+    for (i = 0; i < _zero_map.count; i++) 
+    {
+        eend = e[i].lba + e[i].count;
+        if (eend <= lba || e[i].lba >= end) { continue; }
         
-        if (sd_write_block(lba + _lba_offset, next)) 
+        if (e[i].lba < lba && eend > end) 
         {
-            LOGERROR("failed to write lba 0x%08x", lba + _lba_offset);
-            set_sense(SENSE_KEY_MEDIUM_ERROR, ASC_ASCQ_PERIPHERAL_DEVICE_WRITE_FAULT);
-            return -1;
+            /* cleared from the middle, the extent is split in two. With no 
+               room for the second half the smaller half is forgotten */
+            if (_zero_map.count == ZERO_MAP_EXTENTS) 
+            {
+                if (lba - e[i].lba >= eend - end) 
+                {
+                    e[i].count = lba - e[i].lba;
+                } else {
+                    e[i] = (extent_t) { end, eend - end };
+                }
+                return;
+            }
+            memmove(&e[i + 1], &e[i], (_zero_map.count - i) * sizeof(*e));
+            _zero_map.count++;
+            e[i].count = lba - e[i].lba;
+            e[i + 1]   = (extent_t) { end, eend - end };
+            return;
         }
         
-        _lba_offset++;
+        if (e[i].lba < lba)  { e[i].count = lba - e[i].lba; }
+        else if (eend > end) { e[i] = (extent_t) { end, eend - end }; }
+        else 
+        {
+            memmove(&e[i], &e[i + 1], (_zero_map.count - i - 1) * sizeof(*e));
+            _zero_map.count--;
+            i--;
+        }
     }
+}
+
+uint32_t zero_map_lookup(uint32_t lba, uint32_t *next) 
+{
+    const extent_t *e = _zero_map.extents;
+    size_t i;
     
-    return 0;
+    for (i = 0; i < _zero_map.count && e[i].lba + e[i].count <= lba; i++);
+    
+    if (i == _zero_map.count) 
+    {
+        *next = UINT32_MAX;
+        return 0;
+    }
+    if (e[i].lba > lba) 
+    {
+        *next = e[i].lba;
+        return 0;
+    }
+    return e[i].lba + e[i].count - lba;
 }
 
 
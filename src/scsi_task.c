@@ -0,0 +1,169 @@
+#include <stddef.h>
+#include <string.h> /* memcpy */
+
+#include "scsi_task.h"
+
+
+/******************************************************************************/
+
+
+static struct {
+    scsi_task_t task;
+    int         used;
+    uint32_t    seq;        /* order the tasks came in                        */
+} _slots[SCSI_TASK_QUEUE_DEPTH];
+
+/* the slot of the running task, -1 if none */
+static int _running = -1;
+static uint32_t _seq = 0;
+
+
+/******************************************************************************/
+
+
+static inline int is_head(int slot) 
+{
+    return _slots[slot].task.attribute == SCSI_TASK_HEAD_OF_QUEUE;
+}
+
+
+/******************************************************************************/
+
+
+void scsi_task_init(void) 
+{
+    memset(_slots, 0, sizeof(_slots));
+    _running = -1;
+}
+
+int scsi_task_add(uint16_t tag, uint8_t lun, uint8_t attribute, 
+    const void *cdb, size_t cdblen) 
+{
+    int i, free = -1;
+    
+    if (cdblen > SCSI_TASK_CDB_MAX_LENGTH) 
+    {
+        cdblen = SCSI_TASK_CDB_MAX_LENGTH;
+    }
+    
+    for (i = 0; i < SCSI_TASK_QUEUE_DEPTH; i++) 
+    {
+        if (!_slots[i].used) 
+        {
+            if (free < 0) { free = i; }
+        }
+        else if (_slots[i].task.tag == tag) 
+        {
+            return SCSI_TASK_OVERLAPPED;
+        }
+    }
+    if (free < 0) { return SCSI_TASK_FULL; }
+    
+    _slots[free].used           = 1;
+    _slots[free].seq            = _seq++;
+    _slots[free].task.tag       = tag;
+    _slots[free].task.lun       = lun;
+    _slots[free].task.attribute = attribute;
+    _slots[free].task.cdblen    = (uint8_t) cdblen;
+    memcpy(_slots[free].task.cdb, cdb, cdblen);
+    return SCSI_TASK_ADDED;
+}
+
+const scsi_task_t *scsi_task_start(void) 
+{
+    int i, next = -1;
+    
+    if (_running >= 0) { return NULL; }
+    
+    /* the oldest HEAD OF QUEUE task, otherwise the oldest task, `seq` is
+       compared by difference so it may wrap */
+    for (i = 0; i < SCSI_TASK_QUEUE_DEPTH; i++) 
+    {
+        if (!_slots[i].used) { continue; }
+        if (next < 0 || is_head(i) > is_head(next) || 
+                (is_head(i) == is_head(next) && 
+                (int32_t) (_slots[i].seq - _slots[next].seq) < 0)) 
+        {
+            next = i;
+        }
+    }
+    
+    if (next < 0) { return NULL; }
+    _running = next;
+    return &_slots[next].task;
+}
+
+const scsi_task_t *scsi_task_running(void) 
+{
+    return _running >= 0 ? &_slots[_running].task : NULL;
+}
+
+void scsi_task_done(void) 
+{
+    if (_running < 0) { return; }
+    _slots[_running].used = 0;
+    _running = -1;
+}
+
+int scsi_task_exists(uint16_t tag) 
+{
+    int i;
+    
+    for (i = 0; i < SCSI_TASK_QUEUE_DEPTH; i++) 
+    {
+        if (_slots[i].used && _slots[i].task.tag == tag) { return 1; }
+    }
+    return 0;
+}
+
+int scsi_task_abort(uint16_t tag) 
+{
+    int i;
+    
+    for (i = 0; i < SCSI_TASK_QUEUE_DEPTH; i++) 
+    {
+        if (!_slots[i].used || _slots[i].task.tag != tag) { continue; }
+        
+        /* the transport stops the running task first */
+        if (i == _running) { return 1; }
+        _slots[i].used = 0;
+        return 0;
+    }
+    return -1;
+}
+
+int scsi_task_abort_lun(int lun) 
+{
+    int i, running = 0;
+    
+    for (i = 0; i < SCSI_TASK_QUEUE_DEPTH; i++) 
+    {
+        if (!_slots[i].used || (lun >= 0 && _slots[i].task.lun != lun)) 
+        {
+            continue;
+        }
+        
+        if (i == _running) 
+        {
+            running = 1;
+            continue;
+        }
+        _slots[i].used = 0;
+    }
+    return running;
+}
+
+size_t scsi_task_count(int lun) 
+{
+    size_t count = 0;
+    int i;
+    
+    for (i = 0; i < SCSI_TASK_QUEUE_DEPTH; i++) 
+    {
+        if (_slots[i].used && (lun < 0 || _slots[i].task.lun == lun)) 
+        {
+            count++;
+        }
+    }
+    return count;
+}
@@ -1,34 +1,264 @@
 /* simple c interface for the c++ Sd2Card class */
 
+/* an array of cards takes its place, see sd_array.h */
+#ifndef SD_ARRAY
+
+#include <string.h> /* memset */
 #include <kinetis.h>
 
 #include "sd.h"
+#include "crc.h"
+#include "sd_profile.h"
 #include "Sd2Card.h"
 #include "SPI.h"
+#include "stats.h"
 #include "serialize.h" 
+#include "core_pins.h" /* digitalRead */
 
 #define CHIP_SELECT_PIN 4 /* teensy 3.2 */
 
+/* the socket's card detect switch, closed to ground while a card is in. Set 
+   with -DSD_CARD_DETECT_PIN (see the Makefile), without it the card itself is
+   polled, see `sd_present` */
+#ifdef SD_CARD_DETECT_PIN
+#define SD_CARD_DETECT_PRESENT LOW
+#endif
+
+/* CRC16 of every block written and read, checked by the card and by us. Off
+   with -DSD_CRC=0 */
+#ifndef SD_CRC
+#define SD_CRC (1)
+#endif
+
+/* fastest spi clock tried in each of the card's bus speed modes */
+#define SD_SPI_DEFAULT_SPEED_MAX_HZ (25000000)
+#define SD_SPI_HIGH_SPEED_MAX_HZ    (50000000)
+
+/* CMD6 arguments for function group 1, the other groups are left as they are.
+   sd physical layer simplified spec 4.3.10 */
+#define SD_SWITCH_CHECK (0x00fffff0)
+#define SD_SWITCH_SET   (0x80fffff0)
+/* where group 1 is in the 64 byte switch status, Table 4-11 */
+#define SD_SWITCH_GROUP1_SUPPORT  (12)  /* 16 bits, a bit per function       */
+#define SD_SWITCH_GROUP1_SELECTED (16)  /* low nibble, 0xf if it can't switch */
+/* reads of the tuning region that have to match at a clock before it's used */
+#define SD_TUNE_PASSES (4)
+/* transfer errors in a row before the clock is lowered a step */
+#define SD_DOWNSHIFT_ERRORS (3)
+/* times a block that failed a crc is read again at the same clock */
+#define SD_READ_RETRIES (1)
+/* R1 bit of a command the card dropped for a bad crc, sd physical layer 
+   simplified spec 7.3.2.1. A card that didn't answer at all leaves the top
+   bit set, it is never set in a response */
+#define SD_R1_COM_CRC_ERROR (0x08)
+#define SD_R1_NO_RESPONSE   (0x80)
+
 /* NOTE
  * `sd_init()` needs to be called after hardware intialization. First attempt 
  * called the function right after calling `usb_init()` in pins_teensy.c, this
  * led to a weird bug where Sd2Card.type_ would be reset to 0 the moment 
  * `usb_isr()` was called. The odd thing was this field was the only one 
  * changed. Once `sd_init()` was moved to once the usb driver recieves a 
- * SET CONFIGURATION setup command everything worked fine.
+ * SET CONFIGURATION setup command everything worked fine. The card is now 
+ * brought up a step at a time from the main loop (`sd_init_step`), which only
+ * runs once the hardware is initialized as well.
  */
 
 namespace {
-    Sd2Card _card;
+    Sd2Card  _card;
+    uint32_t _erase_group = 0;      /* blocks per erase group, 0 can't erase */
+    uint8_t  _erased_byte = 0x00;   /* DATA_STAT_AFTER_ERASE                 */
+    uint32_t _au_size     = 0;      /* blocks per allocation unit, 0 unknown */
+    uint32_t _serial      = 0;      /* CID product serial number             */
+    uint8_t  _speed_mode  = SD_SPEED_DEFAULT;
+    uint16_t _speed_modes = 0;      /* group 1 functions the card supports   */
+    const sd_profile_t *_profile;   /* tuning of the card's model            */
+    uint8_t  _cid[16];              /* CID of the card last brought up       */
+    int      _known       = 0;      /* 1 once that card was fully tuned      */
+    
+    /* AU_SIZE in blocks, sd physical layer simplified spec 4.10.2.4 Table 4-44
+       16 KiB ... 64 MiB */
+    const uint32_t _au_blocks[16] = {
+        0, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 24576, 32768, 
+        49152, 65536, 131072
+    };
+    
+    /* spi clocks as dividers of F_BUS the CTAR can make exactly (see the
+       ctar_div_table in SPI.cpp), fastest first. The last one is the safe 
+       clock the others are verified against */
+    const uint8_t _spi_dividers[] = { 2, 3, 4, 5, 6, 8, 12, 24 };
+    const size_t  _spi_safe = sizeof(_spi_dividers) - 1;
+    size_t   _spi_rate    = 0;      /* index of the clock in use             */
+    uint32_t _link_errors = 0;      /* transfer errors since the last success*/
+    int      _unchecked   = 0;      /* written since the last CMD13          */
+    
+    /* where `sd_init_step` is in bringing up the card */
+    enum init_state {
+        INIT_FAILED = 0,
+        INIT_POWER_UP,              /* ACMD41 until the card is ready        */
+        INIT_IDENTIFY,              /* crc, CID, profile and bus speed mode  */
+        INIT_TUNE,                  /* a faster spi clock tried per step     */
+        INIT_REGISTERS,             /* erase group, erased byte and AU       */
+        INIT_DONE
+    } _init = INIT_FAILED;
+    uint32_t _tune_max_hz;          /* fastest clock the card's mode allows  */
+    uint32_t _tune_reference;       /* `tune_read` at the safe clock         */
+    size_t   _tune_next;            /* index of the next clock to try        */
+    
+    uint8_t  _tune_block[SD_BLOCK_SIZE];
+    
+    /* crc checking, the CID and the profile of the card. Returns 1 if it is
+       the card brought up last, its profile and tuning still hold */
+    int      identify(void);
+    /* the erase group, erased byte and allocation unit of the card */
+    void     registers(void);
+    /* switch the card to the fastest bus speed mode it supports */
+    void     speed_switch(void);
+    /* run the spi at `_spi_dividers[index]` */
+    void     spi_rate(size_t index);
+    /* read the reference at the safe clock, `tune_step` then tries one faster
+       clock after the other and keeps the first that reads the same */
+    void     tune_start(void);
+    /* returns 1 while there are clocks left to try, 0 once one is picked */
+    int      tune_step(void);
+    /* hash of the CID, CSD and block 0 as read at the current clock, 0 if a
+       read failed */
+    uint32_t tune_read(void);
+    /* count an error of the last card operation, lowers the clock a step when
+       they repeat. Returns 1 if the clock was lowered */
+    int      link_error(void);
+    /* 1 if the last card operation failed a crc, of a command or of data */
+    int      crc_error(void);
+    /* check the card status of everything written since the last check */
+    int      write_status(void);
 }
 
 int sd_init(void) 
 {
-    if (!_card.init(SPI_FULL_SPEED, CHIP_SELECT_PIN)) 
+    int ret;
+    
+    if (sd_init_start() < 0) { return -1; }
+    while ((ret = sd_init_step()) > 0) { }
+    return ret;
+}
+
+int sd_init_start(void) 
+{
+    _init = INIT_FAILED;
+#ifdef SD_CARD_DETECT_PIN
+    pinMode(SD_CARD_DETECT_PIN, INPUT_PULLUP);
+#endif
+    /* an empty slot would keep `initStart` sending CMD0 for SD_INIT_TIMEOUT */
+    if (!sd_present() || !_card.initStart(SPI_QUARTER_SPEED, CHIP_SELECT_PIN)) 
     {
         LOGERROR("cannot find an sd card");
         return -1;
     }
+    _init = INIT_POWER_UP;
+    return 0;
+}
+
+int sd_init_step(void) 
+{
+    uint8_t ready;
+    
+    switch (_init) 
+    {
+    case INIT_POWER_UP:
+        if (!_card.initPoll(&ready)) 
+        {
+            LOGERROR("sd card failed to power up code: %hu data: %hu", 
+                _card.errorCode(), _card.errorData());
+            _init = INIT_FAILED;
+            return -1;
+        }
+        if (ready) { _init = INIT_IDENTIFY; }
+        return 1;
+        
+    case INIT_IDENTIFY:
+        if (identify()) 
+        {
+            /* the card was put back, only its bus speed mode was lost */
+            speed_switch();
+            spi_rate(_spi_rate);
+            stats.card_fast_inits++;
+            LOGINFO("same card, spi clock %u Hz", stats.sd_spi_hz);
+            _init = INIT_DONE;
+            return 0;
+        }
+        speed_switch();
+        tune_start();
+        _init = INIT_TUNE;
+        return 1;
+        
+    case INIT_TUNE:
+        if (tune_step() == 0) { _init = INIT_REGISTERS; }
+        return 1;
+        
+    case INIT_REGISTERS:
+        registers();
+        _known = 1;
+        _init  = INIT_DONE;
+        return 0;
+        
+    case INIT_DONE:
+        return 0;
+        
+    default:
+        return -1;
+    }
+}
+
+int sd_present(void) 
+{
+#ifdef SD_CARD_DETECT_PIN
+    return digitalRead(SD_CARD_DETECT_PIN) == SD_CARD_DETECT_PRESENT;
+#else
+    uint8_t r1;
+    
+    if (_init != INIT_DONE) { return _card.cardDetect(CHIP_SELECT_PIN); }
+    
+    /* no answer at all is an empty slot, the idle state a card that was
+       powered up again since */
+    r1 = _card.cardStatus() >> 8;
+    if ((r1 & 0x80) || (r1 & R1_IDLE_STATE)) 
+    {
+        _init = INIT_FAILED;
+        return 0;
+    }
+    return 1;
+#endif
+}
+
+int sd_suspend(void) 
+{
+    int ret = 0;
+    
+    /* CMD13 waits out a CMD24 still programming, only then does the card go
+       to standby. The chip select is left high after every command */
+    if (_init == INIT_DONE) { ret = sd_write_check(); }
+    
+    /* `crc16` turns the crc module back on itself */
+    SIM_SCGC6 &= ~(SIM_SCGC6_SPI0 | SIM_SCGC6_CRC);
+    return ret;
+}
+
+int sd_resume(void) 
+{
+    uint8_t r1;
+    
+    SIM_SCGC6 |= SIM_SCGC6_SPI0;
+    if (_init != INIT_DONE) { return 0; }
+    spi_rate(_spi_rate);
+    
+    /* as in `sd_present`, but asked even with a card detect switch since a
+       card swapped while suspended never changes its state */
+    r1 = _card.cardStatus() >> 8;
+    if ((r1 & 0x80) || (r1 & R1_IDLE_STATE)) 
+    {
+        _init = INIT_FAILED;
+        return -1;
+    }
     return 0;
 }
 
@@ -39,12 +269,22 @@ uint32_t sd_max_lba(void)
 
 int sd_read_block(void *dest, uint32_t lba) 
 {
-    if (!_card.readBlock(lba, (uint8_t *) dest)) 
+    int retries = 0;
+    int crc;
+    
+    while (!_card.readBlock(lba, (uint8_t *) dest)) 
     {
         LOGERROR("failed to read block lba 0x%08x code: %hu data: %hu", 
             lba, _card.errorCode(), _card.errorData());
-        return -1;
+        
+        /* reads can be repeated, a crc error may be a one off so the block
+           is read again at the same clock, and again once it was lowered */
+        crc = crc_error();
+        if (link_error()) { continue; }
+        if (!crc || retries++ >= SD_READ_RETRIES) { return -1; }
+        stats.sd_read_retries++;
     }
+    _link_errors = 0;
     return 0;
 }
 
@@ -54,7 +294,425 @@ int sd_write_block(uint32_t lba, const void *src)
     {
         LOGERROR("failed to write block lba 0x%08x code: %hu data: %hu", 
             lba, _card.errorCode(), _card.errorData());
+        link_error();
         return -1;
     }
+    _link_errors = 0;
+    _unchecked   = 1;
     return 0;
 }
+
+int sd_write_check(void) 
+{
+    return _unchecked ? write_status() : 0;
+}
+
+uint32_t sd_erase_group(void) 
+{
+    return _erase_group;
+}
+
+uint8_t sd_erased_byte(void) 
+{
+    return _erased_byte;
+}
+
+int sd_erase(uint32_t lba, uint32_t count) 
+{
+    if (count == 0) { return 0; }
+    if (!_card.erase(lba, lba + count - 1)) 
+    {
+        LOGERROR("failed to erase lba 0x%08x (%u blocks) code: %hu data: %hu", 
+            lba, count, _card.errorCode(), _card.errorData());
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t sd_au_size(void) 
+{
+    return _au_size;
+}
+
+uint32_t sd_write_chunk(void) 
+{
+    return _profile->write_chunk != 0 ? _profile->write_chunk : _au_size;
+}
+
+uint32_t sd_serial_number(void) 
+{
+    return _serial;
+}
+
+uint8_t sd_speed_mode(void) 
+{
+    return _speed_mode;
+}
+
+uint16_t sd_speed_modes(void) 
+{
+    return _speed_modes;
+}
+
+uint32_t sd_spi_hz(void) 
+{
+    return F_BUS / _spi_dividers[_spi_rate];
+}
+
+int sd_write_start(uint32_t lba, uint32_t count) 
+{
+    /* `count` blocks are pre-erased, unless that doesn't pay off on the card */
+    if (!_card.writeStart(lba, _profile->no_pre_erase ? 0 : count)) 
+    {
+        LOGERROR("failed to start write at lba 0x%08x code: %hu data: %hu", 
+            lba, _card.errorCode(), _card.errorData());
+        link_error();
+        return -1;
+    }
+    _link_errors = 0;
+    return 0;
+}
+
+int sd_write_data(const void *src) 
+{
+    if (!_card.writeData((const uint8_t *) src)) 
+    {
+        LOGERROR("failed to write multiple block code: %hu data: %hu", 
+            _card.errorCode(), _card.errorData());
+        link_error();
+        return -1;
+    }
+    _link_errors = 0;
+    return 0;
+}
+
+int sd_write_stop(void) 
+{
+    if (!_card.writeStop()) 
+    {
+        LOGERROR("failed to stop multiple block write code: %hu data: %hu", 
+            _card.errorCode(), _card.errorData());
+        link_error();
+        return -1;
+    }
+    _link_errors = 0;
+    /* the data response of each block only says it was received, one status 
+       check for the lot says whether they were programmed */
+    return write_status();
+}
+
+int sd_written_blocks(uint32_t *count) 
+{
+    if (!_card.writtenBlocks(count)) 
+    {
+        LOGERROR("failed to read the written block count code: %hu data: %hu",
+            _card.errorCode(), _card.errorData());
+        return -1;
+    }
+    return 0;
+}
+
+
+/******************************************************************************/
+
+
+namespace {
+
+int identify(void) 
+{
+    cid_t cid;
+    const uint8_t *raw;
+    
+    /* the status of single block writes is checked in batches, see 
+       `sd_write_check` */
+    _card.writeStatusCheck(0);
+    _unchecked = 0;
+#if SD_CRC
+    /* on before the tuning so a clock that corrupts data fails the crc */
+    if (crc_self_test() < 0) 
+    {
+        LOGCRITICAL("crc engine failed its self test, block crcs are off");
+    } 
+    else if (!_card.enableCRC(SD_CRC_WRITE | SD_CRC_READ)) 
+    {
+        LOGWARN("card refused crc checking code: %hu data: %hu", 
+            _card.errorCode(), _card.errorData());
+    }
+#endif
+    
+    /* cid_t isn't packed, on arm `psn` isn't at byte 9 so pick it out of the
+       raw register. A card whose CID can't be read gets the default profile */
+    raw = reinterpret_cast<const uint8_t *>(&cid);
+    if (!_card.readCID(&cid)) 
+    {
+        memset(&cid, 0, sizeof(cid));
+        _known = 0;
+    } 
+    else if (_known && memcmp(raw, _cid, sizeof(_cid)) == 0) 
+    {
+        /* the timeout went back to the default with the reset */
+        if (_profile->busy_timeout_ms != 0) 
+        {
+            _card.writeTimeout(_profile->busy_timeout_ms);
+        }
+        return 1;
+    }
+    _known = 0;
+    memcpy(_cid, raw, sizeof(_cid));
+    
+    _serial = ((uint32_t) raw[9] << 24) | ((uint32_t) raw[10] << 16) | 
+        ((uint32_t) raw[11] << 8) | raw[12];
+    _profile = sd_profile_lookup(raw);
+    stats.sd_profile = sd_profile_index(_profile);
+    LOGINFO("card profile %s", _profile->name);
+    if (_profile->busy_timeout_ms != 0) 
+    {
+        _card.writeTimeout(_profile->busy_timeout_ms);
+    }
+    return 0;
+}
+
+void registers(void) 
+{
+    csd_t csd;
+    scr_t scr;
+    sd_status_t status;
+    
+    /* the erase group is SECTOR_SIZE + 1 write blocks, the layout of the field
+       is the same in both csd versions */
+    _erase_group = 0;
+    if (_card.readCSD(&csd) && csd.v1.erase_blk_en) 
+    {
+        _erase_group = 
+            ((csd.v1.sector_size_high << 1) | csd.v1.sector_size_low) + 1;
+    }
+    
+    _erased_byte = 0x00;
+    if (_card.readSCR(&scr) && scr.data_stat_after_erase) 
+    {
+        _erased_byte = 0xff;
+    }
+    
+    _au_size = 0;
+    if (_card.readSdStatus(&status)) 
+    {
+        _au_size = _au_blocks[status.au_size];
+    }
+    
+    LOGINFO("erase group %u blocks, erased byte 0x%02x, AU %u blocks", 
+        _erase_group, _erased_byte, _au_size);
+}
+
+void speed_switch(void) 
+{
+    uint8_t status[64];
+    scr_t scr;
+    uint32_t function;
+    
+    _speed_mode  = SD_SPEED_DEFAULT;
+    _speed_modes = 0;
+    
+    /* CMD6 came with version 1.10 of the spec */
+    if (!_card.readSCR(&scr) || scr.sd_spec < 1) { return; }
+    
+    /* the status of a check says which function a switch would select */
+    if (!_card.switchFunction(SD_SWITCH_CHECK | SD_SPEED_HIGH, status)) 
+    {
+        LOGWARN("card can't report its speed modes");
+        return;
+    }
+    _speed_modes = ((uint16_t) status[SD_SWITCH_GROUP1_SUPPORT] << 8) | 
+        status[SD_SWITCH_GROUP1_SUPPORT + 1];
+    function = status[SD_SWITCH_GROUP1_SELECTED] & 0x0f;
+    
+    if ((_speed_modes & (1 << SD_SPEED_HIGH)) && function == SD_SPEED_HIGH) 
+    {
+        if (_card.switchFunction(SD_SWITCH_SET | SD_SPEED_HIGH, status) && 
+                (status[SD_SWITCH_GROUP1_SELECTED] & 0x0f) == SD_SPEED_HIGH) 
+        {
+            _speed_mode = SD_SPEED_HIGH;
+        } else {
+            LOGWARN("switch to high speed failed");
+        }
+    }
+    LOGINFO("speed modes 0x%04x, using %s speed", _speed_modes, 
+        _speed_mode == SD_SPEED_HIGH ? "high" : "default");
+}
+
+void spi_rate(size_t index) 
+{
+    _spi_rate = index;
+    SPI.beginTransaction(
+        SPISettings(F_BUS / _spi_dividers[index], MSBFIRST, SPI_MODE0));
+    SPI.endTransaction();
+    stats.sd_spi_hz = F_BUS / _spi_dividers[index];
+}
+
+void tune_start(void) 
+{
+    _tune_max_hz = _speed_mode == SD_SPEED_HIGH ? 
+        SD_SPI_HIGH_SPEED_MAX_HZ : SD_SPI_DEFAULT_SPEED_MAX_HZ;
+    if (_profile->max_spi_hz != 0 && _profile->max_spi_hz < _tune_max_hz) 
+    {
+        _tune_max_hz = _profile->max_spi_hz;
+    }
+    
+    _link_errors = 0;
+    _tune_next   = 0;
+    spi_rate(_spi_safe);
+    if ((_tune_reference = tune_read()) == 0) 
+    {
+        LOGWARN("can't read the card to tune the spi clock");
+        _tune_next = _spi_safe;
+    }
+}
+
+int tune_step(void) 
+{
+    size_t i, pass;
+    
+    /* the reference couldn't be read, or every faster clock failed */
+    if (_tune_next >= _spi_safe) 
+    {
+        spi_rate(_spi_safe);
+        LOGINFO("spi clock %u Hz", stats.sd_spi_hz);
+        return 0;
+    }
+    
+    i = _tune_next++;
+    if (F_BUS / _spi_dividers[i] > _tune_max_hz) { return 1; }
+    
+    spi_rate(i);
+    for (pass = 0; pass < SD_TUNE_PASSES; pass++) 
+    {
+        if (tune_read() != _tune_reference) { break; }
+    }
+    if (pass == SD_TUNE_PASSES) 
+    {
+        LOGINFO("spi clock %u Hz", stats.sd_spi_hz);
+        return 0;
+    }
+    LOGDEBUG("spi clock %u Hz failed verify", F_BUS / _spi_dividers[i]);
+    return 1;
+}
+
+uint32_t tune_read(void) 
+{
+    cid_t cid;
+    csd_t csd;
+    const uint8_t *raw[3];
+    size_t length[3];
+    uint32_t hash;
+    size_t i, j;
+    
+    if (!_card.readCID(&cid) || !_card.readCSD(&csd) || 
+            !_card.readBlock(0, _tune_block)) 
+    {
+        return 0;
+    }
+    
+    raw[0] = reinterpret_cast<const uint8_t *>(&cid);
+    raw[1] = reinterpret_cast<const uint8_t *>(&csd);
+    raw[2] = _tune_block;
+    length[0] = sizeof(cid);
+    length[1] = sizeof(csd);
+    length[2] = sizeof(_tune_block);
+    
+    /* FNV-1a */
+    hash = 2166136261u;
+    for (i = 0; i < 3; i++) 
+    {
+        for (j = 0; j < length[i]; j++) 
+        {
+            hash = (hash ^ raw[i][j]) * 16777619u;
+        }
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+int link_error(void) 
+{
+    /* only errors of the transfer itself, a card that is busy programming or
+       refuses the command won't do better at a lower clock */
+    switch (_card.errorCode()) 
+    {
+    case SD_CARD_ERROR_CMD17:
+    case SD_CARD_ERROR_CMD24:
+    case SD_CARD_ERROR_CMD25:
+        /* a command the card answered without a crc error it refused */
+        if (!(_card.errorData() & (SD_R1_COM_CRC_ERROR | SD_R1_NO_RESPONSE))) 
+        {
+            return 0;
+        }
+        stats.sd_link_errors++;
+        break;
+        
+    case SD_CARD_ERROR_READ_CRC:
+    case SD_CARD_ERROR_WRITE:
+        stats.sd_link_errors++;
+        break;
+        
+    case SD_CARD_ERROR_READ:
+    case SD_CARD_ERROR_READ_REG:
+    case SD_CARD_ERROR_READ_TIMEOUT:
+    case SD_CARD_ERROR_STOP_TRAN:
+    case SD_CARD_ERROR_WRITE_MULTIPLE:
+        stats.sd_link_errors++;
+        break;
+        
+    default:
+        return 0;
+    }
+    if (crc_error()) { stats.sd_crc_errors++; }
+    
+    if (++_link_errors < SD_DOWNSHIFT_ERRORS || _spi_rate == _spi_safe) 
+    {
+        return 0;
+    }
+    
+    _link_errors = 0;
+    spi_rate(_spi_rate + 1);
+    stats.sd_spi_downshifts++;
+    LOGWARN("repeated card errors, spi clock lowered to %u Hz", 
+        stats.sd_spi_hz);
+    return 1;
+}
+
+int crc_error(void) 
+{
+    switch (_card.errorCode()) 
+    {
+    case SD_CARD_ERROR_CMD17:
+    case SD_CARD_ERROR_CMD24:
+    case SD_CARD_ERROR_CMD25:
+        return (_card.errorData() & 
+            (SD_R1_COM_CRC_ERROR | SD_R1_NO_RESPONSE)) == SD_R1_COM_CRC_ERROR;
+        
+    case SD_CARD_ERROR_READ_CRC:
+        return 1;
+        
+    case SD_CARD_ERROR_WRITE:
+        return (_card.errorData() & DATA_RES_MASK) == DATA_RES_CRC_ERROR;
+        
+    default:
+        return 0;
+    }
+}
+
+int write_status(void) 
+{
+    uint16_t status;
+    
+    _unchecked = 0;
+    stats.sd_status_checks++;
+    if ((status = _card.cardStatus()) != 0) 
+    {
+        LOGERROR("card status after writing 0x%04x", status);
+        return -1;
+    }
+    return 0;
+}
+
+}
+
+#endif
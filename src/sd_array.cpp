@@ -0,0 +1,596 @@
+/* the c interface of sd.h over an array of Sd2Cards, see sd_array.h */
+
+#ifdef SD_ARRAY
+
+#include <string.h> /* memset */
+#include <kinetis.h>
+
+#include "sd.h"
+#include "sd_array.h"
+#include "crc.h"
+#include "Sd2Card.h"
+#include "SPI.h"
+#include "stats.h"
+#include "serialize.h"
+
+/* CRC16 of every block written and read, as in sd.cpp. Off with -DSD_CRC=0 */
+#ifndef SD_CRC
+#define SD_CRC (1)
+#endif
+
+#if SD_ARRAY != SD_ARRAY_STRIPED && SD_ARRAY != SD_ARRAY_MIRRORED
+#error SD_ARRAY must be SD_ARRAY_STRIPED or SD_ARRAY_MIRRORED
+#endif
+
+#if SD_ARRAY_STRIPE_BLOCKS == 0
+#error stripes need at least one block
+#endif
+
+#define UNUSED(var) ((void) (var))
+
+
+/******************************************************************************/
+
+
+namespace {
+    const uint8_t _pins[] = { SD_ARRAY_PINS };
+    const size_t  _count  = sizeof(_pins);
+    
+    Sd2Card  _members[sizeof(_pins)];
+    uint32_t _member_blocks = 0;    /* blocks used of every member           */
+    uint32_t _serial        = 0;    /* the members' serial numbers combined  */
+    uint8_t  _unchecked[sizeof(_pins)]; /* written since their last CMD13    */
+    size_t   _read_member   = 0;    /* mirror member reads go to when idle   */
+    
+    /* where `sd_init_step` is in bringing up the members, one at a time as
+       the spi clock has to stay slow until a card is ready */
+    enum init_state {
+        INIT_FAILED = 0,
+        INIT_POWER_UP,              /* ACMD41 until `_init_member` is ready   */
+        INIT_DONE
+    } _init = INIT_FAILED;
+    size_t   _init_member;
+    
+    /* the open multiple block write */
+    uint32_t _write_lba;            /* array lba the next block goes to      */
+    uint32_t _write_start;          /* and the one the write started at      */
+    uint32_t _write_count;          /* blocks it was started for             */
+    uint8_t  _open[sizeof(_pins)];  /* members with a CMD25 open             */
+    
+    /* crc checking, status checks in batches and the overlapped busy waits */
+    void     setup(Sd2Card *member);
+    /* the product serial number from the CID of `member`, 0 if unreadable */
+    uint32_t member_serial(size_t member);
+#if SD_ARRAY == SD_ARRAY_STRIPED
+    /* the member that holds array block `lba` and the block on it */
+    size_t   member_of(uint32_t lba, uint32_t *member_lba);
+    /* # of the blocks of [lba, lba + count) of the array on `member` */
+    uint32_t member_count(size_t member, uint32_t lba, uint32_t count);
+    /* # of the array blocks before `lba` that are on `member` */
+    uint32_t member_blocks_below(size_t member, uint32_t lba);
+#else
+    /* the mirror member to read from, one that isn't programming if there is
+       one */
+    size_t   read_member(void);
+#endif
+    /* open the CMD25 of `member` for the blocks of the array write on it */
+    int      member_write_start(size_t member, uint32_t member_lba);
+    /* the card status of `member` if it was written since the last check */
+    int      member_status(size_t member);
+}
+
+int sd_init(void) 
+{
+    int ret;
+    
+    if (sd_init_start() < 0) { return -1; }
+    while ((ret = sd_init_step()) > 0) { }
+    return ret;
+}
+
+int sd_init_start(void) 
+{
+    size_t i;
+    
+    _init = INIT_FAILED;
+    /* every member has to be there before any is brought up */
+    for (i = 0; i < _count; i++) 
+    {
+        if (!_members[i].cardDetect(_pins[i])) 
+        {
+            LOGERROR("no card for array member %u (pin %u)", i, _pins[i]);
+            return -1;
+        }
+    }
+    
+    _init_member = 0;
+    if (!_members[0].initStart(SPI_QUARTER_SPEED, _pins[0])) 
+    {
+        LOGERROR("array member 0 failed to start code: %hu data: %hu",
+            _members[0].errorCode(), _members[0].errorData());
+        return -1;
+    }
+    _init = INIT_POWER_UP;
+    return 0;
+}
+
+int sd_init_step(void) 
+{
+    Sd2Card *member;
+    uint32_t blocks;
+    uint8_t ready;
+    size_t i;
+    
+    if (_init == INIT_DONE) { return 0; }
+    if (_init != INIT_POWER_UP) { return -1; }
+    
+    member = &_members[_init_member];
+    if (!member->initPoll(&ready)) 
+    {
+        LOGERROR("array member %u failed to power up code: %hu data: %hu",
+            _init_member, member->errorCode(), member->errorData());
+        _init = INIT_FAILED;
+        return -1;
+    }
+    if (!ready) { return 1; }
+    
+    /* the next member is started at the slow clock again */
+    if (++_init_member < _count) 
+    {
+        member = &_members[_init_member];
+        if (!member->initStart(SPI_QUARTER_SPEED, _pins[_init_member])) 
+        {
+            LOGERROR("array member %u failed to start code: %hu data: %hu",
+                _init_member, member->errorCode(), member->errorData());
+            _init = INIT_FAILED;
+            return -1;
+        }
+        return 1;
+    }
+    
+    /* all of them are up, they share the clock */
+    SPI.beginTransaction(SPISettings(SD_ARRAY_SPI_HZ, MSBFIRST, SPI_MODE0));
+    SPI.endTransaction();
+    stats.sd_spi_hz = SD_ARRAY_SPI_HZ;
+    
+    _member_blocks = UINT32_MAX;
+    _serial        = 0;
+    for (i = 0; i < _count; i++) 
+    {
+        setup(&_members[i]);
+        blocks = _members[i].cardSize();
+        if (blocks < _member_blocks) { _member_blocks = blocks; }
+        _serial ^= member_serial(i);
+        _unchecked[i] = 0;
+        _open[i]      = 0;
+    }
+#if SD_ARRAY == SD_ARRAY_STRIPED
+    /* whole stripes only, so every member holds as many */
+    _member_blocks -= _member_blocks % SD_ARRAY_STRIPE_BLOCKS;
+#endif
+    _read_member = 0;
+    _init = INIT_DONE;
+    
+    LOGINFO("%s array of %u cards, %u blocks each",
+        SD_ARRAY == SD_ARRAY_STRIPED ? "striped" : "mirrored", _count,
+        _member_blocks);
+    return 0;
+}
+
+int sd_present(void) 
+{
+    uint8_t r1;
+    size_t i;
+    
+    for (i = 0; i < _count; i++) 
+    {
+        if (_init != INIT_DONE) 
+        {
+            if (!_members[i].cardDetect(_pins[i])) { return 0; }
+            continue;
+        }
+        /* as in sd.cpp, no answer or one from the idle state is a card that
+           was pulled */
+        r1 = _members[i].cardStatus() >> 8;
+        if ((r1 & 0x80) || (r1 & R1_IDLE_STATE)) 
+        {
+            LOGWARN("array member %u is gone", i);
+            _init = INIT_FAILED;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int sd_suspend(void) 
+{
+    int ret = 0;
+    
+    /* the status checks wait out blocks still programming, as in sd.cpp */
+    if (_init == INIT_DONE) { ret = sd_write_check(); }
+    SIM_SCGC6 &= ~(SIM_SCGC6_SPI0 | SIM_SCGC6_CRC);
+    return ret;
+}
+
+int sd_resume(void) 
+{
+    SIM_SCGC6 |= SIM_SCGC6_SPI0;
+    if (_init != INIT_DONE) { return 0; }
+    SPI.beginTransaction(SPISettings(SD_ARRAY_SPI_HZ, MSBFIRST, SPI_MODE0));
+    SPI.endTransaction();
+    
+    /* every member has to be as it was left */
+    return sd_present() ? 0 : -1;
+}
+
+uint32_t sd_max_lba(void) 
+{
+#if SD_ARRAY == SD_ARRAY_STRIPED
+    return _member_blocks * _count;
+#else
+    return _member_blocks;
+#endif
+}
+
+int sd_read_block(void *dest, uint32_t lba) 
+{
+#if SD_ARRAY == SD_ARRAY_STRIPED
+    uint32_t member_lba;
+    size_t member;
+    
+    member = member_of(lba, &member_lba);
+    if (!_members[member].readBlock(member_lba, (uint8_t *) dest)) 
+    {
+        LOGERROR("failed to read block lba 0x%08x of member %u code: %hu "
+            "data: %hu", member_lba, member, _members[member].errorCode(),
+            _members[member].errorData());
+        return -1;
+    }
+    return 0;
+#else
+    size_t i, member;
+    
+    /* any member has the block, the others are tried when one fails */
+    member = read_member();
+    for (i = 0; i < _count; i++, member = (member + 1) % _count) 
+    {
+        if (_members[member].readBlock(lba, (uint8_t *) dest)) 
+        {
+            if (i > 0) { stats.array_read_retries++; }
+            return 0;
+        }
+        LOGERROR("failed to read block lba 0x%08x of member %u code: %hu "
+            "data: %hu", lba, member, _members[member].errorCode(),
+            _members[member].errorData());
+    }
+    return -1;
+#endif
+}
+
+int sd_write_block(uint32_t lba, const void *src) 
+{
+    uint32_t member_lba;
+    size_t i, first, last;
+    
+#if SD_ARRAY == SD_ARRAY_STRIPED
+    first = member_of(lba, &member_lba);
+    last  = first + 1;
+#else
+    member_lba = lba;
+    first = 0;
+    last  = _count;
+#endif
+    
+    /* each member is left programming while the next one takes the block */
+    for (i = first; i < last; i++) 
+    {
+        if (!_members[i].writeBlock(member_lba, (const uint8_t *) src)) 
+        {
+            LOGERROR("failed to write block lba 0x%08x of member %u code: %hu "
+                "data: %hu", member_lba, i, _members[i].errorCode(),
+                _members[i].errorData());
+            return -1;
+        }
+        _unchecked[i] = 1;
+    }
+    return 0;
+}
+
+int sd_write_check(void) 
+{
+    size_t i;
+    int ret;
+    
+    ret = 0;
+    for (i = 0; i < _count; i++) 
+    {
+        if (member_status(i) < 0) { ret = -1; }
+    }
+    return ret;
+}
+
+uint32_t sd_erase_group(void) 
+{
+    return 0;
+}
+
+uint8_t sd_erased_byte(void) 
+{
+    return 0x00;
+}
+
+int sd_erase(uint32_t lba, uint32_t count) 
+{
+    UNUSED(lba);
+    
+    if (count == 0) { return 0; }
+    LOGERROR("erase of lba 0x%08x (%u blocks) on an array", lba, count);
+    return -1;
+}
+
+uint32_t sd_au_size(void) 
+{
+    return 0;
+}
+
+uint32_t sd_write_chunk(void) 
+{
+#if SD_ARRAY == SD_ARRAY_STRIPED
+    return SD_ARRAY_STRIPE_BLOCKS * _count;
+#else
+    return 0;
+#endif
+}
+
+uint32_t sd_serial_number(void) 
+{
+    return _serial;
+}
+
+uint8_t sd_speed_mode(void) 
+{
+    return SD_SPEED_DEFAULT;
+}
+
+uint16_t sd_speed_modes(void) 
+{
+    return 0;
+}
+
+uint32_t sd_spi_hz(void) 
+{
+    return SD_ARRAY_SPI_HZ;
+}
+
+int sd_write_start(uint32_t lba, uint32_t count) 
+{
+#if SD_ARRAY == SD_ARRAY_MIRRORED
+    size_t i;
+#endif
+    
+    _write_lba   = lba;
+    _write_start = lba;
+    _write_count = count;
+    memset(_open, 0, sizeof(_open));
+    
+#if SD_ARRAY == SD_ARRAY_MIRRORED
+    for (i = 0; i < _count; i++) 
+    {
+        if (member_write_start(i, lba) < 0) 
+        {
+            sd_write_stop();
+            return -1;
+        }
+    }
+#endif
+    /* a striped member's CMD25 is opened by its first block, which may be a
+       stripe away */
+    return 0;
+}
+
+int sd_write_data(const void *src) 
+{
+    size_t i, first, last;
+#if SD_ARRAY == SD_ARRAY_STRIPED
+    uint32_t member_lba;
+#endif
+    
+#if SD_ARRAY == SD_ARRAY_STRIPED
+    first = member_of(_write_lba, &member_lba);
+    last  = first + 1;
+    if (!_open[first] && member_write_start(first, member_lba) < 0) 
+    {
+        return -1;
+    }
+#else
+    first = 0;
+    last  = _count;
+#endif
+    
+    for (i = first; i < last; i++) 
+    {
+        if (!_members[i].writeData((const uint8_t *) src)) 
+        {
+            LOGERROR("failed to write multiple block of member %u code: %hu "
+                "data: %hu", i, _members[i].errorCode(),
+                _members[i].errorData());
+            return -1;
+        }
+    }
+    _write_lba++;
+    return 0;
+}
+
+int sd_write_stop(void) 
+{
+    size_t i;
+    int ret;
+    
+    /* the stop tokens go out first so the members program side by side */
+    ret = 0;
+    for (i = 0; i < _count; i++) 
+    {
+        if (!_open[i]) { continue; }
+        _open[i] = 0;
+        if (!_members[i].writeStop()) 
+        {
+            LOGERROR("failed to stop multiple block write of member %u code: "
+                "%hu data: %hu", i, _members[i].errorCode(),
+                _members[i].errorData());
+            ret = -1;
+        }
+        _unchecked[i] = 1;
+    }
+    if (sd_write_check() < 0) { ret = -1; }
+    return ret;
+}
+
+int sd_written_blocks(uint32_t *count) 
+{
+#if SD_ARRAY == SD_ARRAY_MIRRORED
+    uint32_t written;
+    size_t i;
+    
+    /* the same blocks went to every member, the one that wrote the fewest
+       has the first bad block */
+    *count = _write_lba - _write_start;
+    for (i = 0; i < _count; i++) 
+    {
+        if (!_members[i].writtenBlocks(&written)) { return -1; }
+        if (written < *count) { *count = written; }
+    }
+    return 0;
+#else
+    /* the members' counts don't say which array block failed first */
+    UNUSED(count);
+    return -1;
+#endif
+}
+
+
+
+/******************************************************************************/
+
+
+namespace {
+
+void setup(Sd2Card *member) 
+{
+    member->writeStatusCheck(0);
+    member->overlapBusy(1);
+#if SD_CRC
+    if (crc_self_test() < 0) 
+    {
+        LOGCRITICAL("crc engine failed its self test, block crcs are off");
+    }
+    else if (!member->enableCRC(SD_CRC_WRITE | SD_CRC_READ)) 
+    {
+        LOGWARN("card refused crc checking code: %hu data: %hu",
+            member->errorCode(), member->errorData());
+    }
+#endif
+}
+
+uint32_t member_serial(size_t member) 
+{
+    cid_t cid;
+    const uint8_t *raw;
+    
+    /* cid_t isn't packed, see sd.cpp */
+    raw = reinterpret_cast<const uint8_t *>(&cid);
+    if (!_members[member].readCID(&cid)) { return 0; }
+    return ((uint32_t) raw[9] << 24) | ((uint32_t) raw[10] << 16) |
+        ((uint32_t) raw[11] << 8) | raw[12];
+}
+
+#if SD_ARRAY == SD_ARRAY_STRIPED
+size_t member_of(uint32_t lba, uint32_t *member_lba) 
+{
+    uint32_t stripe;
+    
+    stripe      = lba / SD_ARRAY_STRIPE_BLOCKS;
+    *member_lba = (stripe / _count) * SD_ARRAY_STRIPE_BLOCKS +
+        lba % SD_ARRAY_STRIPE_BLOCKS;
+    return stripe % _count;
+}
+
+uint32_t member_count(size_t member, uint32_t lba, uint32_t count) 
+{
+    return member_blocks_below(member, lba + count) -
+        member_blocks_below(member, lba);
+}
+
+uint32_t member_blocks_below(size_t member, uint32_t lba) 
+{
+    uint32_t row, rest;
+    
+    /* a row is a stripe of every member */
+    row  = SD_ARRAY_STRIPE_BLOCKS * _count;
+    rest = lba % row;
+    rest = rest > member * SD_ARRAY_STRIPE_BLOCKS ?
+        rest - member * SD_ARRAY_STRIPE_BLOCKS : 0;
+    if (rest > SD_ARRAY_STRIPE_BLOCKS) { rest = SD_ARRAY_STRIPE_BLOCKS; }
+    return (lba / row) * SD_ARRAY_STRIPE_BLOCKS + rest;
+}
+
+#else
+size_t read_member(void) 
+{
+    size_t i, member;
+    
+    /* the same member as long as it's idle, a card reads ahead */
+    for (i = 0; i < _count; i++) 
+    {
+        member = (_read_member + i) % _count;
+        if (!_members[member].isBusy()) 
+        {
+            if (i > 0) { stats.array_idle_reads++; }
+            _read_member = member;
+            return member;
+        }
+    }
+    /* all of them are programming, wait for the usual one */
+    return _read_member;
+}
+#endif
+
+int member_write_start(size_t member, uint32_t member_lba) 
+{
+    uint32_t count;
+    
+#if SD_ARRAY == SD_ARRAY_STRIPED
+    /* pre-erase only the member's share of the write */
+    count = member_count(member, _write_start, _write_count);
+#else
+    count = _write_count;
+#endif
+    if (!_members[member].writeStart(member_lba, count)) 
+    {
+        LOGERROR("failed to start write at lba 0x%08x of member %u code: %hu "
+            "data: %hu", member_lba, member, _members[member].errorCode(),
+            _members[member].errorData());
+        return -1;
+    }
+    _open[member] = 1;
+    return 0;
+}
+
+int member_status(size_t member) 
+{
+    uint16_t status;
+    
+    if (!_unchecked[member]) { return 0; }
+    _unchecked[member] = 0;
+    stats.sd_status_checks++;
+    if ((status = _members[member].cardStatus()) != 0) 
+    {
+        LOGERROR("card status of member %u after writing 0x%04x", member,
+            status);
+        return -1;
+    }
+    return 0;
+}
+
+}
+
+#endif
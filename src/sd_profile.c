@@ -0,0 +1,92 @@
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+#include <string.h> /* strlen, memcmp */
+
+#include "sd_profile.h"
+
+
+/******************************************************************************/
+
+
+/* where the fields are in the CID register, sd physical layer simplified spec
+   5.2 Table 5-2 */
+#define CID_MID (0)
+#define CID_OID (1)
+#define CID_PNM (3)
+#define CID_PRV (8)
+
+
+/******************************************************************************/
+
+
+/*--- STATE ------------------------------------------------------------------*/
+/* The model entries below are guesses from vendor datasheets that no card was
+   measured against yet, so only the default is built in. Each stays out until
+   the SEND DIAGNOSTIC bench confirmed it on the model and its UNVERIFIED note
+   is dropped, -DSD_PROFILE_UNVERIFIED builds them in to take those numbers */
+static const sd_profile_t _profiles[] = {
+#ifdef SD_PROFILE_UNVERIFIED
+    /* UNVERIFIED: the ACMD23 pre-erase gains nothing on these, it's a command
+       less per write session without it */
+    { "toshiba", 0x02, "TM", "",      0, 0,        0,   0,    1 },
+    /* UNVERIFIED: programs in 64 KiB pages, a stage flush shouldn't straddle
+       two */
+    { "samsung", 0x1b, "SM", "",      0, 0,        128, 0,    0 },
+    /* UNVERIFIED: garbage collection in the card stalls writes past the
+       default timeout, and the clock has to stay below 25 MHz even in high
+       speed mode */
+    { "phison",  0x27, "PH", "",      0, 24000000, 0,   1000, 0 },
+#endif
+    /* every other card, has to stay last */
+    { "default", 0,    "",   "",      0, 0,        0,   0,    0 }
+};
+
+#define PROFILE_COUNT (sizeof(_profiles) / sizeof(_profiles[0]))
+
+
+/******************************************************************************/
+
+
+/* 1 if `profile` matches the card with `cid` */
+static int matches(const sd_profile_t *profile, const uint8_t *cid);
+
+
+/******************************************************************************/
+
+
+const sd_profile_t *sd_profile_lookup(const uint8_t *cid) 
+{
+    size_t i;
+    
+    /* the default matches any card, so the loop never runs out. Counting to
+       PROFILE_COUNT keeps it valid when the default is the only entry */
+    for (i = 0; i < PROFILE_COUNT; i++) 
+    {
+        if (matches(&_profiles[i], cid)) { return &_profiles[i]; }
+    }
+    return &_profiles[PROFILE_COUNT - 1];
+}
+
+uint32_t sd_profile_index(const sd_profile_t *profile) 
+{
+    return profile - _profiles;
+}
+
+
+/******************************************************************************/
+
+
+int matches(const sd_profile_t *profile, const uint8_t *cid) 
+{
+    size_t oid, pnm;
+    
+    oid = strlen(profile->oid);
+    pnm = strlen(profile->pnm);
+    
+    /* the names are ascii and not terminated in the register, a shorter name
+       in the table matches as a prefix */
+    return (profile->mid == 0 || profile->mid == cid[CID_MID]) &&
+        (oid == 0 || memcmp(profile->oid, &cid[CID_OID], oid) == 0) &&
+        (pnm == 0 || memcmp(profile->pnm, &cid[CID_PNM], pnm) == 0) &&
+        (profile->prv == 0 || profile->prv == cid[CID_PRV]);
+}
@@ -1,9 +1,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include "HardwareSerial.h"
 #include "usb_dev.h"
 #include "kinetis.h"
+#include "usb_cdc.h"
 
 #define PID_OUT     (0x01)
 #define PID_IN      (0x09)
@@ -52,6 +54,21 @@
 
 #if defined(DEBUG)
 
+#ifdef USB_CDC
+/* a LOG record of the line for the trace port, without its newline. The usb
+   interrupt is held off around it unless this already runs from `usb_isr` */
+static void serial_cdc_record(const char *line) {
+    size_t length = strlen(line);
+    int enabled;
+    
+    if (length > 0 && line[length - 1] == '\n') { length--; }
+    enabled = NVIC_IS_ENABLED(IRQ_USBOTG);
+    NVIC_DISABLE_IRQ(IRQ_USBOTG);
+    usb_cdc_record(USB_CDC_RECORD_LOG, line, length);
+    if (enabled) { NVIC_ENABLE_IRQ(IRQ_USBOTG); }
+}
+#endif
+
 void serial_printf(const char *fmt, ...) {
     va_list ap;
     int count;
@@ -65,6 +82,9 @@ void serial_printf(const char *fmt, ...) {
     if (count >= (int) sizeof(fmtd)) {
         serial_print("...");
     }
+#ifdef USB_CDC
+    serial_cdc_record(fmtd);
+#endif
 }
 
 /* print recognizable ASCII characters after each line */
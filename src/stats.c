@@ -0,0 +1,3 @@
+#include "stats.h"
+
+stats_t stats = {0};
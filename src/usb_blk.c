@@ -0,0 +1,502 @@
+/*
+ * usb_blk is the vendor specific block interface of usb_blk.h. It takes the
+ * requests off its RX endpoint, moves their blocks through scsi_sd the way a
+ * READ(10)/WRITE(10) would and queues the completions on its TX endpoint.
+ */
+#ifdef USB_BLK
+
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "usb_bdt.h"
+
+#include "serialize.h"
+#include "usb_dev.h"
+#include "usb_blk.h"
+#include "usb_msd.h" /* usb_msd_busy, usb_msd_resume */
+#include "endian.h"
+#include "scsi_sd.h"
+#include "stats.h"
+
+/******************************************************************************/
+
+/* completions waiting for the TX endpoint, a request is only started once
+   there is room for its own */
+#define COMPLETIONS (4)
+
+/******************************************************************************/
+
+/*--- ENDPOINTS --------------------------------------------------------------*/
+/* buffers for the RX bdt entries of endpoint 3 */
+static uint8_t _ep3_rx[2][EP3_SIZE] __attribute__((aligned(4)));
+
+static int _ep4_data_toggle = DATA0;
+static int _ep4_odd_toggle  = EVEN;
+
+/* what the packet queued on the TX endpoint is, there is one at a time */
+static enum { TX_NONE, TX_DATA, TX_COMPLETION } _tx = TX_NONE;
+
+/* RX bdt entries not given back yet, the host is NAKed until they are */
+static bdt_t *_held[2];
+static size_t _held_count = 0;
+
+/*--- REQUEST STATE ----------------------------------------------------------*/
+/* the request that has the luns */
+static enum { IDLE, RECEIVING, SENDING } _phase = IDLE;
+static struct usb_blk_request _request;
+static size_t   _range;                 /* index of the range being moved     */
+static size_t   _range_bytes;           /* bytes of that range moved so far   */
+static size_t   _bytes;                 /* bytes of all the ranges so far     */
+static size_t   _total;                 /* bytes of all the ranges            */
+static uint32_t _blocks;                /* moved before the first failure     */
+static int      _failed;                /* the rest of the data is dropped    */
+static uint8_t  _sense_key;
+static uint16_t _asc_ascq;
+
+/* the request after it, sent before it completed */
+static struct usb_blk_request _next;
+static size_t _next_length = 0;
+static int    _next_valid  = 0;
+
+/*--- COMPLETIONS ------------------------------------------------------------*/
+static struct {
+    size_t head;
+    size_t count;
+    struct usb_blk_completion items[COMPLETIONS];
+} _done = {0};
+
+
+/******************************************************************************/
+
+/* handlers of the interface's endpoints for `usb_isr`, see usb_dev.c */
+void usb_ep3_handler(bdt_t *bd);
+void usb_ep4_handler(bdt_t *bd);
+
+/* takes a packet from the RX endpoint, returns < 0 if it has to wait */
+static int receive(const void *bytes, size_t length);
+/* starts the next request if the luns and a completion are free */
+static void advance(void);
+/* runs the packets held behind the request that was just started */
+static void release(void);
+
+static int is_valid_request(const struct usb_blk_request *request, 
+    size_t length);
+static void start(void);
+/* `scsi_sd_begin_blocks` of the current range */
+static int  begin_range(void);
+/* the request failed, keeps the sense for its completion */
+static void fail(void);
+/* queues the completion of the request and gives up the luns */
+static void complete(uint8_t status);
+
+/* blocks of a WRITE from the host */
+static void data_in(const void *bytes, size_t length);
+/* queues the next completion or block data if the TX endpoint is free */
+static void transmit_next(void);
+static void ep4_transmit(const void *data, size_t length);
+
+static inline size_t range_bytes(size_t range) 
+{
+    return le16toh(_request.ranges[range].count) * USB_BLK_BLOCK_SIZE;
+}
+
+/******************************************************************************/
+
+void usb_blk_init(void) 
+{
+    LOGINFO("initializing the endpoints of the vendor block interface");
+    
+    USB0_ENDPT3 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPRXEN | USB_ENDPT_EPHSHK;
+    bdt[BDT_INDEX(3, RX, EVEN)].desc = BDT_DESC(EP3_SIZE, DATA0);
+    bdt[BDT_INDEX(3, RX, EVEN)].addr = _ep3_rx[0];
+    bdt[BDT_INDEX(3, RX, ODD)].desc  = BDT_DESC(EP3_SIZE, DATA1);
+    bdt[BDT_INDEX(3, RX, ODD)].addr  = _ep3_rx[1];
+    
+    USB0_ENDPT4 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPTXEN | USB_ENDPT_EPHSHK;
+    _ep4_data_toggle = DATA0;
+    _ep4_odd_toggle  = EVEN;
+    _tx = TX_NONE;
+    
+    _phase      = IDLE;
+    _held_count = 0;
+    _next_valid = 0;
+    _done.count = 0;
+}
+
+void usb_blk_reset(void) 
+{
+    LOGINFO("vendor block interface reset");
+    
+    /* blocks of an unfinished WRITE that were taken in are kept */
+    if (_phase == RECEIVING && !_failed) { scsi_sd_data_in_commit(); }
+    _phase      = IDLE;
+    _next_valid = 0;
+    
+    /* a completion already queued on the endpoint is still sent */
+    _done.count = _tx == TX_COMPLETION ? 1 : 0;
+    
+    while (_held_count > 0) 
+    {
+        _held_count--;
+        _held[_held_count]->desc = BDT_DESC(EP3_SIZE, 
+            BDT_DESC_DATA_TOGGLE(_held[_held_count]->desc));
+    }
+    advance();
+}
+
+int usb_blk_busy(void) 
+{
+    return _phase != IDLE;
+}
+
+void usb_blk_resume(void) 
+{
+    advance();
+}
+
+/**** USB ENDPOINT HANDLERS ***************************************************/
+
+/* handler for USB0_ENDPT3 */
+void usb_ep3_handler(bdt_t *bd) 
+{
+    if (BDT_PID(bd->desc) == PID_OUT) 
+    {
+        /* packets are taken in the order they came */
+        if (_held_count > 0 || 
+                receive(bd->addr, BDT_DESC_LENGTH(bd->desc)) < 0) 
+        {
+            _held[_held_count++] = bd;
+        }
+        else 
+        {
+            bd->desc = BDT_DESC(EP3_SIZE, BDT_DESC_DATA_TOGGLE(bd->desc));
+        }
+        /* the completion of a WRITE that just got its last block */
+        transmit_next();
+        advance();
+    }
+    else 
+    {
+        LOGWARN("unhandled pid 0x%hx", BDT_PID(bd->desc));
+        bd->desc = BDT_DESC(EP3_SIZE, BDT_DESC_DATA_TOGGLE(bd->desc));
+    }
+    USB0_CTL = USB_CTL_USBENSOFEN;
+}
+
+/* handler for USB0_ENDPT4 */
+void usb_ep4_handler(bdt_t *bd) 
+{
+    switch (BDT_PID(bd->desc)) 
+    {
+    case PID_IN:
+        if (_tx == TX_COMPLETION) 
+        {
+            _done.head = (_done.head + 1) % COMPLETIONS;
+            _done.count--;
+        }
+        _tx = TX_NONE;
+        transmit_next();
+        /* room for another completion */
+        advance();
+        break;
+        
+    default:
+        LOGWARN("unhandled pid 0x%hx", BDT_PID(bd->desc));
+        break;
+    }
+    USB0_CTL = USB_CTL_USBENSOFEN;
+}
+
+/******************************************************************************/
+
+int receive(const void *bytes, size_t length) 
+{
+    if (_phase == RECEIVING) 
+    {
+        data_in(bytes, length);
+        return 0;
+    }
+    
+    /* anything after an unstarted request may be its data */
+    if (_next_valid) { return -1; }
+    
+    /* a request, `advance` starts it once the luns are free */
+    memcpy(&_next, bytes, length < sizeof(_next) ? length : sizeof(_next));
+    _next_length = length;
+    _next_valid  = 1;
+    return 0;
+}
+
+void advance(void) 
+{
+    if (_phase != IDLE) { return; }
+    
+    /* a CBW that waited for the last request goes first */
+    usb_msd_resume();
+    
+    while (_phase == IDLE && _next_valid && !usb_msd_busy() && 
+            _done.count < COMPLETIONS) 
+    {
+        _next_valid = 0;
+        start();
+        release();
+        transmit_next();
+    }
+}
+
+void release(void) 
+{
+    /* the data of a WRITE, or the request after it */
+    while (_held_count > 0 && 
+            receive(_held[0]->addr, BDT_DESC_LENGTH(_held[0]->desc)) == 0) 
+    {
+        _held[0]->desc = BDT_DESC(EP3_SIZE, 
+            BDT_DESC_DATA_TOGGLE(_held[0]->desc));
+        _held[0] = _held[1];
+        _held_count--;
+    }
+}
+
+int is_valid_request(const struct usb_blk_request *request, size_t length) 
+{
+    size_t i;
+    
+    if (length < USB_BLK_REQUEST_LENGTH(0) || 
+            le32toh(request->signature) != USB_BLK_REQUEST_SIGNATURE) 
+    {
+        return 0;
+    }
+    
+    switch (request->op) 
+    {
+    case USB_BLK_OP_CAPACITY:
+        return request->range_count == 0 && 
+            length == USB_BLK_REQUEST_LENGTH(0);
+            
+    case USB_BLK_OP_READ:
+    case USB_BLK_OP_WRITE:
+        if (request->range_count == 0 || 
+                request->range_count > USB_BLK_MAX_RANGES || 
+                length != USB_BLK_REQUEST_LENGTH(request->range_count)) 
+        {
+            return 0;
+        }
+        for (i = 0; i < request->range_count; i++) 
+        {
+            if (request->ranges[i].count == 0) { return 0; }
+        }
+        return 1;
+        
+    default:
+        return 0;
+    }
+}
+
+void start(void) 
+{
+    size_t i;
+    uint32_t blocks;
+    
+    _request = _next;
+    _range   = 0;
+    _bytes   = 0;
+    _total   = 0;
+    _blocks  = 0;
+    _failed  = 0;
+    stats.blk_requests++;
+    
+    if (!is_valid_request(&_request, _next_length)) 
+    {
+        LOGERROR("invalid vendor block request");
+        sxxd(&_request, _next_length < sizeof(_request) ? 
+            _next_length : sizeof(_request));
+        complete(USB_BLK_STATUS_INVALID);
+        return;
+    }
+    
+    for (i = 0; i < _request.range_count; i++) { _total += range_bytes(i); }
+    stats.blk_ranges += _request.range_count;
+    
+    switch (_request.op) 
+    {
+    case USB_BLK_OP_CAPACITY:
+        if (scsi_sd_lun_blocks(_request.lun, &blocks) < 0) 
+        {
+            fail();
+            complete(USB_BLK_STATUS_FAILED);
+            return;
+        }
+        _blocks = blocks;
+        complete(USB_BLK_STATUS_GOOD);
+        return;
+        
+    case USB_BLK_OP_READ:
+        /* the data goes out with `transmit_next` */
+        _phase = SENDING;
+        begin_range();
+        return;
+        
+    case USB_BLK_OP_WRITE:
+        _phase = RECEIVING;
+        begin_range();
+        return;
+    }
+}
+
+int begin_range(void) 
+{
+    const struct usb_blk_range *range = &_request.ranges[_range];
+    
+    _range_bytes = 0;
+    if (scsi_sd_begin_blocks(_request.lun, _request.op == USB_BLK_OP_WRITE, 
+            le32toh(range->lba), le16toh(range->count)) < 0) 
+    {
+        LOGERROR("failed to begin range %u of request 0x%08x", _range, 
+            le32toh(_request.tag));
+        fail();
+        return -1;
+    }
+    return 0;
+}
+
+void fail(void) 
+{
+    /* a READ's blocks that went out whole are still good */
+    if (_phase == SENDING) { _blocks = _bytes / USB_BLK_BLOCK_SIZE; }
+    _failed = 1;
+    scsi_sd_sense(_request.lun, &_sense_key, &_asc_ascq);
+}
+
+void complete(uint8_t status) 
+{
+    struct usb_blk_completion *completion;
+    
+    if (status == USB_BLK_STATUS_GOOD && _request.op == USB_BLK_OP_READ) 
+    {
+        _blocks = _total / USB_BLK_BLOCK_SIZE;
+    }
+    if (status != USB_BLK_STATUS_GOOD) { stats.blk_failed++; }
+    
+    /* `advance` only starts a request with room for this */
+    completion = &_done.items[(_done.head + _done.count) % COMPLETIONS];
+    _done.count++;
+    *completion = (struct usb_blk_completion) {
+        .signature = htole32(USB_BLK_COMPLETION_SIGNATURE),
+        .tag       = _request.tag,
+        .blocks    = htole32(_blocks),
+        .status    = status,
+        .sense_key = status == USB_BLK_STATUS_FAILED ? _sense_key : 0,
+        .asc_ascq  = status == USB_BLK_STATUS_FAILED ? htole16(_asc_ascq) : 0
+    };
+    _phase = IDLE;
+}
+
+void data_in(const void *bytes, size_t length) 
+{
+    ssize_t count;
+    int ok;
+    
+    _bytes += length;
+    
+    /* after a failure the rest of the data is taken in and dropped */
+    if (!_failed) 
+    {
+        _range_bytes += length;
+        ok = scsi_sd_data_in(bytes, length) == 0;
+        
+        /* on a failure, what made it to the lun before it */
+        if (!ok || _range_bytes >= range_bytes(_range)) 
+        {
+            count = scsi_sd_data_in_commit();
+            ok    = ok && count >= 0;
+            count = count < 0 ? -1 * (count + 1) : count;
+            _blocks += count / USB_BLK_BLOCK_SIZE;
+            
+            if (!ok) 
+            {
+                LOGERROR("failed to write range %u of request 0x%08x", 
+                    _range, le32toh(_request.tag));
+                fail();
+            }
+            else if (++_range < _request.range_count) 
+            {
+                begin_range();
+            }
+        }
+    }
+    
+    if (_bytes >= _total) 
+    {
+        complete(_failed ? USB_BLK_STATUS_FAILED : USB_BLK_STATUS_GOOD);
+    }
+}
+
+void transmit_next(void) 
+{
+    ssize_t count;
+    void *ptr;
+    
+    if (_tx != TX_NONE) { return; }
+    
+    /* the completions of the earlier requests go before this one's data */
+    if (_done.count > 0) 
+    {
+        _tx = TX_COMPLETION;
+        ep4_transmit(&_done.items[_done.head], USB_BLK_COMPLETION_LENGTH);
+        return;
+    }
+    if (_phase != SENDING) { return; }
+    
+    if (_bytes == _total) 
+    {
+        complete(_failed ? USB_BLK_STATUS_FAILED : USB_BLK_STATUS_GOOD);
+        transmit_next();
+        return;
+    }
+    
+    /* a failed READ ends its data with a zero length packet */
+    if (_failed) 
+    {
+        _bytes = _total;
+        _tx    = TX_DATA;
+        ep4_transmit(NULL, 0);
+        return;
+    }
+    
+    /* the next range is only started once the last packet of the one before
+       went out, it may still have been in the io buffer */
+    if (_range_bytes == range_bytes(_range)) 
+    {
+        _range++;
+        if (begin_range() < 0) 
+        {
+            transmit_next();
+            return;
+        }
+    }
+    
+    if ((count = scsi_sd_data_out(&ptr, EP4_SIZE)) <= 0) 
+    {
+        LOGERROR("failed to read range %u of request 0x%08x", _range, 
+            le32toh(_request.tag));
+        fail();
+        transmit_next();
+        return;
+    }
+    
+    _bytes       += count;
+    _range_bytes += count;
+    _tx = TX_DATA;
+    ep4_transmit(ptr, (size_t) count);
+}
+
+void ep4_transmit(const void *data, size_t length) 
+{
+    bdt[BDT_INDEX(4, TX, _ep4_odd_toggle)].addr = (void *) data;
+    bdt[BDT_INDEX(4, TX, _ep4_odd_toggle)].desc = BDT_DESC(length, _ep4_data_toggle);
+    _ep4_odd_toggle  ^= 1;
+    _ep4_data_toggle ^= 1;
+}
+
+#endif
@@ -0,0 +1,284 @@
+/*
+ * usb_cdc is the CDC-ACM trace port of usb_cdc.h. Records are copied into a
+ * ring buffer as they are made and sent from it a packet at a time, only
+ * while storage doesn't have the bus.
+ */
+#ifdef USB_CDC
+
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "usb_bdt.h"
+
+#include "serialize.h"
+#include "usb_dev.h"
+#include "usb_cdc.h"
+#include "usb_msd.h" /* usb_msd_busy */
+#ifdef USB_BLK
+#include "usb_blk.h" /* usb_blk_busy */
+#endif
+#include "endian.h"
+#include "stats.h"
+#include "core_pins.h" /* millis */
+
+/******************************************************************************/
+
+/*--- ENDPOINTS --------------------------------------------------------------*/
+/* buffers for the RX bdt entries of endpoint 10 */
+static uint8_t _ep10_rx[2][EP10_SIZE] __attribute__((aligned(4)));
+
+static int _ep11_data_toggle = DATA0;
+static int _ep11_odd_toggle  = EVEN;
+
+/* bytes of the packet queued on the TX endpoint, 0 if there is none */
+static size_t _tx_length = 0;
+
+/*--- PORT STATE -------------------------------------------------------------*/
+static int      _open     = 0;          /* DTR, the host has the port open    */
+static uint32_t _stats_ms = 0;          /* millis() of the last STATS record  */
+static uint32_t _dropped  = 0;          /* records since the last DROPPED     */
+
+/* only kept for GET LINE CODING, 115200 8N1 until the host sets one */
+static uint8_t _line_coding[USB_CDC_LINE_CODING_LENGTH] = {
+    0x00, 0xc2, 0x01, 0x00, 0, 0, 8
+};
+
+/*--- RECORDS ----------------------------------------------------------------*/
+/* sent from `head` on, a packet's bytes are only freed once it went out */
+static struct {
+    size_t  head;
+    size_t  count;
+    uint8_t bytes[USB_CDC_BUFFER_SIZE];
+} _buffer = {0};
+
+
+/******************************************************************************/
+
+/* handlers of the port's endpoints for `usb_isr`, see usb_dev.c */
+void usb_ep10_handler(bdt_t *bd);
+void usb_ep11_handler(bdt_t *bd);
+
+/* writes the header of a record of `length` bytes, after a DROPPED record if
+   records were dropped before. Returns < 0 if there is no room for it */
+static int  begin_record(uint8_t type, size_t length);
+static void put(const void *src, size_t length);
+/* every counter of stats.h */
+static void stats_record(void);
+
+/* 1 while storage has the luns, the port sends nothing then */
+static int  storage_busy(void);
+/* queues the next packet of records if the TX endpoint and the bus are free */
+static void transmit_next(void);
+static void ep11_transmit(const void *data, size_t length);
+
+/******************************************************************************/
+
+void usb_cdc_init(void) 
+{
+    LOGINFO("initializing the endpoints of the cdc trace port");
+    
+    /* no notification is ever sent, the host's polls are NAKed */
+    USB0_ENDPT9 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPTXEN | USB_ENDPT_EPHSHK;
+    
+    USB0_ENDPT10 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPRXEN | USB_ENDPT_EPHSHK;
+    bdt[BDT_INDEX(10, RX, EVEN)].desc = BDT_DESC(EP10_SIZE, DATA0);
+    bdt[BDT_INDEX(10, RX, EVEN)].addr = _ep10_rx[0];
+    bdt[BDT_INDEX(10, RX, ODD)].desc  = BDT_DESC(EP10_SIZE, DATA1);
+    bdt[BDT_INDEX(10, RX, ODD)].addr  = _ep10_rx[1];
+    
+    USB0_ENDPT11 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPTXEN | USB_ENDPT_EPHSHK;
+    _ep11_data_toggle = DATA0;
+    _ep11_odd_toggle  = EVEN;
+    _tx_length = 0;
+    
+    _open         = 0;
+    _dropped      = 0;
+    _buffer.head  = 0;
+    _buffer.count = 0;
+}
+
+void usb_cdc_control_line_state(uint16_t state) 
+{
+    if ((state & USB_CDC_CONTROL_LINE_DTR) && !_open) 
+    {
+        /* a snapshot first, the periodic ones follow */
+        _open     = 1;
+        _dropped  = 0;
+        _stats_ms = millis();
+        stats_record();
+        transmit_next();
+    }
+    else if (!(state & USB_CDC_CONTROL_LINE_DTR) && _open) 
+    {
+        /* nobody reads what is left, but the packet queued still goes */
+        _open         = 0;
+        _buffer.count = _tx_length;
+    }
+}
+
+void usb_cdc_line_coding(const void *data, size_t length) 
+{
+    if (length != USB_CDC_LINE_CODING_LENGTH) { return; }
+    memcpy(_line_coding, data, length);
+}
+
+const void *usb_cdc_get_line_coding(void) 
+{
+    return _line_coding;
+}
+
+int usb_cdc_record(uint8_t type, const void *payload, size_t length) 
+{
+    if (!_open) { return 0; }
+    if (begin_record(type, length) < 0) { return -1; }
+    put(payload, length);
+    return 0;
+}
+
+void usb_cdc_poll(void) 
+{
+    if (_open && millis() - _stats_ms >= USB_CDC_STATS_MS) 
+    {
+        _stats_ms = millis();
+        stats_record();
+    }
+    /* storage may have let go of the bus since the last packet */
+    transmit_next();
+}
+
+/**** USB ENDPOINT HANDLERS ***************************************************/
+
+/* handler for USB0_ENDPT10 */
+void usb_ep10_handler(bdt_t *bd) 
+{
+    /* what the host writes to the port is dropped */
+    bd->desc = BDT_DESC(EP10_SIZE, BDT_DESC_DATA_TOGGLE(bd->desc));
+    USB0_CTL = USB_CTL_USBENSOFEN;
+}
+
+/* handler for USB0_ENDPT11 */
+void usb_ep11_handler(bdt_t *bd) 
+{
+    switch (BDT_PID(bd->desc)) 
+    {
+    case PID_IN:
+        _buffer.head   = (_buffer.head + _tx_length) % USB_CDC_BUFFER_SIZE;
+        _buffer.count -= _tx_length;
+        stats.cdc_bytes += _tx_length;
+        _tx_length = 0;
+        transmit_next();
+        break;
+        
+    default:
+        LOGWARN("unhandled pid 0x%hx", BDT_PID(bd->desc));
+        break;
+    }
+    USB0_CTL = USB_CTL_USBENSOFEN;
+}
+
+/******************************************************************************/
+
+int begin_record(uint8_t type, size_t length) 
+{
+    struct usb_cdc_record_header header;
+    size_t needed;
+    uint32_t dropped;
+    
+    needed = sizeof(header) + length;
+    if (_dropped > 0) { needed += sizeof(header) + sizeof(dropped); }
+    if (length > UINT16_MAX || needed > USB_CDC_BUFFER_SIZE - _buffer.count) 
+    {
+        _dropped++;
+        stats.cdc_dropped++;
+        return -1;
+    }
+    
+    header.sync = USB_CDC_RECORD_SYNC;
+    header.ms   = htole32(millis());
+    if (_dropped > 0) 
+    {
+        header.type   = USB_CDC_RECORD_DROPPED;
+        header.length = htole16(sizeof(dropped));
+        dropped       = htole32(_dropped);
+        put(&header, sizeof(header));
+        put(&dropped, sizeof(dropped));
+        _dropped = 0;
+    }
+    header.type   = type;
+    header.length = htole16(length);
+    put(&header, sizeof(header));
+    stats.cdc_records++;
+    return 0;
+}
+
+void put(const void *src, size_t length) 
+{
+    const uint8_t *bytes = src;
+    size_t tail, count;
+    
+    /* in up to two pieces, the end of the buffer and its start */
+    while (length > 0) 
+    {
+        tail  = (_buffer.head + _buffer.count) % USB_CDC_BUFFER_SIZE;
+        count = USB_CDC_BUFFER_SIZE - tail;
+        if (count > length) { count = length; }
+        memcpy(&_buffer.bytes[tail], bytes, count);
+        _buffer.count += count;
+        bytes  += count;
+        length -= count;
+    }
+}
+
+void stats_record(void) 
+{
+    const uint32_t *counter;
+    uint32_t value;
+    size_t i;
+    
+    if (begin_record(USB_CDC_RECORD_STATS, STATS_COUNT * sizeof(uint32_t)) < 0) 
+    {
+        return;
+    }
+    counter = (const uint32_t *) &stats;
+    for (i = 0; i < STATS_COUNT; i++) 
+    {
+        value = htole32(counter[i]);
+        put(&value, sizeof(value));
+    }
+}
+
+int storage_busy(void) 
+{
+#ifdef USB_BLK
+    if (usb_blk_busy()) { return 1; }
+#endif
+    return usb_msd_busy();
+}
+
+void transmit_next(void) 
+{
+    size_t length;
+    
+    if (_tx_length > 0 || _buffer.count == 0 || storage_busy()) { return; }
+    
+    /* up to the end of the buffer, the rest is the next packet */
+    length = _buffer.count;
+    if (length > EP11_SIZE) { length = EP11_SIZE; }
+    if (length > USB_CDC_BUFFER_SIZE - _buffer.head) 
+    {
+        length = USB_CDC_BUFFER_SIZE - _buffer.head;
+    }
+    _tx_length = length;
+    ep11_transmit(&_buffer.bytes[_buffer.head], length);
+}
+
+void ep11_transmit(const void *data, size_t length) 
+{
+    bdt[BDT_INDEX(11, TX, _ep11_odd_toggle)].addr = (void *) data;
+    bdt[BDT_INDEX(11, TX, _ep11_odd_toggle)].desc = BDT_DESC(length, _ep11_data_toggle);
+    _ep11_odd_toggle  ^= 1;
+    _ep11_data_toggle ^= 1;
+}
+
+#endif
@@ -3,6 +3,9 @@
 #define USB_DESC_LIST_DEFINE
 #include <string.h> /* memcpy */
 #include "usb_desc.h"
+#include "usb_blk.h" /* USB_BLK_INTERFACE, USB_BLK_*_ENDPOINT */
+#include "usb_uas.h" /* UAS_* */
+#include "usb_cdc.h" /* USB_CDC_*_INTERFACE, USB_CDC_*_ENDPOINT */
 #include "usb_names.h"
 #include "kinetis.h"
 #include "avr_functions.h"
@@ -23,9 +26,16 @@ static dev_descriptor_t device_descriptor = {
     .bLength            = USB_DESCRIPTOR_DEVICE_LENGTH,
     .bDescriptorType    = USB_DESCRIPTOR_DEVICE_TYPE,
     .bcdUSB             = 0x0200,
+#ifdef USB_CDC
+    // the interface association descriptor of the cdc port needs these
+    .bDeviceClass       = USB_DESCRIPTOR_CLASS_MISC,
+    .bDeviceSubClass    = USB_DESCRIPTOR_SUBCLASS_COMMON,
+    .bDeviceProtocol    = USB_DESCRIPTOR_PROTOCOL_IAD,
+#else
     .bDeviceClass       = 0, // specified at interface 
     .bDeviceSubClass    = 0,
     .bDeviceProtocol    = 0,
+#endif
     .bMaxPacketSize0    = EP0_SIZE,
     .idVendor           = 0x16c0,
     .idProduct          = 0x0484,
@@ -36,56 +46,244 @@ static dev_descriptor_t device_descriptor = {
     .bNumConfigurations = 1
 };
 
-// the config descriptor, 1 interface with 2 endpoints
-#define CONFIG_SIZE (                         \
-    USB_DESCRIPTOR_CONFIGURATION_LENGTH     + \
-    USB_DESCRIPTOR_INTERFACE_LENGTH         + \
-    (2 * USB_DESCRIPTOR_ENDPOINT_LENGTH)      \
-)
-
-static cfg_descriptor_t config_descriptor = {
-    .bLength                = USB_DESCRIPTOR_CONFIGURATION_LENGTH,
-    .bDescriptorType        = USB_DESCRIPTOR_CONFIGURATION_TYPE,
-    .wTotalLength           = CONFIG_SIZE,
-    .bNumInterfaces         = 1,
-    .bConfigurationValue    = 1,
-    .iConfiguration         = 0,
-    .bmAttributes           = 0x80,
-    .bMaxPower              = 50,       // max milliamperes / 2
-    .interfaces = {
-        // Interface USB Mass Storage
-        {
-            .bLength            = USB_DESCRIPTOR_INTERFACE_LENGTH,
-            .bDescriptorType    = USB_DESCRIPTOR_INTERFACE_TYPE,
-            .bInterfaceNumber   = 0,
-            .bAlternateSetting  = 0,
-            .bNumEndpoints      = 2,
-            .bInterfaceClass    = USB_DESCRIPTOR_CLASS_MSD,
-            .bInterfaceSubClass = USB_DESCRIPTOR_INTERFACE_SUBCLASS_SCSI,
-            .bInterfaceProtocol = USB_DESCRIPTOR_INTERFACE_PROTOCOL_BULKONLY,
-            .iInterface         = 0,
-            .endpoints = {
-                // Endpoint 1 - OUT - RX (host to device)
-                {
-                    .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,
-                    .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,
-                    .bEndpointAddress   = USB_DESCRIPTOR_ENDPOINT_ADDRESS_OUT(1),
-                    .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY,
-                    .wMaxPacketSize     = EP1_SIZE,
-                    .bInterval          = 0
-                },
-                // Endpoint 2 - IN - TX (device to host)
-                {
-                    .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,
-                    .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,
-                    .bEndpointAddress   = USB_DESCRIPTOR_ENDPOINT_ADDRESS_IN(2),
-                    .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY,
-                    .wMaxPacketSize     = EP2_SIZE,
-                    .bInterval          = 0
-                }
+// the config descriptor, the mass storage interface with 2 endpoints and its
+// UAS alternate setting with 4, then the vendor block interface and the two
+// interfaces of the cdc port
+#ifdef USB_BLK
+#define NUM_BLK_INTERFACES 1
+#else
+#define NUM_BLK_INTERFACES 0
+#endif
+#ifdef USB_CDC
+#define NUM_CDC_INTERFACES 2
+#else
+#define NUM_CDC_INTERFACES 0
+#endif
+#define NUM_INTERFACES (1 + NUM_BLK_INTERFACES + NUM_CDC_INTERFACES)
+
+#define UAS_ENDPOINT(_address, _size, _pipe)                                   \
+    {                                                                          \
+        .endpoint = {                                                          \
+            .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,              \
+            .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,                \
+            .bEndpointAddress   = _address,                                    \
+            .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY,  \
+            .wMaxPacketSize     = _size,                                       \
+            .bInterval          = 0                                            \
+        },                                                                     \
+        .bLength            = UAS_PIPE_USAGE_LENGTH,                           \
+        .bDescriptorType    = UAS_PIPE_USAGE_TYPE,                             \
+        .bPipeID            = _pipe,                                           \
+        .Reserved           = 0                                                \
+    }
+
+static struct {
+    cfg_descriptor_t        config;
+    int_descriptor_t        msd;
+#ifdef USB_UAS
+    uas_int_descriptor_t    uas;
+#endif
+#ifdef USB_BLK
+    int_descriptor_t        blk;
+#endif
+#ifdef USB_CDC
+    iad_descriptor_t        cdc_iad;
+    cdc_int_descriptor_t    cdc_comm;
+    int_descriptor_t        cdc_data;
+#endif
+} __attribute__((packed)) config_descriptor = {
+    .config = {
+        .bLength                = USB_DESCRIPTOR_CONFIGURATION_LENGTH,
+        .bDescriptorType        = USB_DESCRIPTOR_CONFIGURATION_TYPE,
+        .wTotalLength           = sizeof(config_descriptor),
+        .bNumInterfaces         = NUM_INTERFACES,
+        .bConfigurationValue    = 1,
+        .iConfiguration         = 0,
+        .bmAttributes           = 0x80,
+        .bMaxPower              = 50,       // max milliamperes / 2
+    },
+    // Interface USB Mass Storage
+    .msd = {
+        .bLength            = USB_DESCRIPTOR_INTERFACE_LENGTH,
+        .bDescriptorType    = USB_DESCRIPTOR_INTERFACE_TYPE,
+        .bInterfaceNumber   = 0,
+        .bAlternateSetting  = 0,
+        .bNumEndpoints      = 2,
+        .bInterfaceClass    = USB_DESCRIPTOR_CLASS_MSD,
+        .bInterfaceSubClass = USB_DESCRIPTOR_INTERFACE_SUBCLASS_SCSI,
+        .bInterfaceProtocol = USB_DESCRIPTOR_INTERFACE_PROTOCOL_BULKONLY,
+        .iInterface         = 0,
+        .endpoints = {
+            // Endpoint 1 - OUT - RX (host to device)
+            {
+                .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,
+                .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,
+                .bEndpointAddress   = USB_DESCRIPTOR_ENDPOINT_ADDRESS_OUT(1),
+                .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY,
+                .wMaxPacketSize     = EP1_SIZE,
+                .bInterval          = 0
+            },
+            // Endpoint 2 - IN - TX (device to host)
+            {
+                .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,
+                .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,
+                .bEndpointAddress   = USB_DESCRIPTOR_ENDPOINT_ADDRESS_IN(2),
+                .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY,
+                .wMaxPacketSize     = EP2_SIZE,
+                .bInterval          = 0
             }
         }
-    }
+    },
+#ifdef USB_UAS
+    // Interface USB Mass Storage, alternate setting USB Attached SCSI
+    .uas = {
+        .bLength            = USB_DESCRIPTOR_INTERFACE_LENGTH,
+        .bDescriptorType    = USB_DESCRIPTOR_INTERFACE_TYPE,
+        .bInterfaceNumber   = 0,
+        .bAlternateSetting  = UAS_ALTERNATE_SETTING,
+        .bNumEndpoints      = 4,
+        .bInterfaceClass    = USB_DESCRIPTOR_CLASS_MSD,
+        .bInterfaceSubClass = USB_DESCRIPTOR_INTERFACE_SUBCLASS_SCSI,
+        .bInterfaceProtocol = USB_DESCRIPTOR_INTERFACE_PROTOCOL_UAS,
+        .iInterface         = 0,
+        .endpoints = {
+            UAS_ENDPOINT(USB_DESCRIPTOR_ENDPOINT_ADDRESS_OUT(UAS_COMMAND_ENDPOINT),
+                EP5_SIZE, UAS_PIPE_ID_COMMAND),
+            UAS_ENDPOINT(USB_DESCRIPTOR_ENDPOINT_ADDRESS_IN(UAS_STATUS_ENDPOINT),
+                EP6_SIZE, UAS_PIPE_ID_STATUS),
+            UAS_ENDPOINT(USB_DESCRIPTOR_ENDPOINT_ADDRESS_IN(UAS_DATA_IN_ENDPOINT),
+                EP7_SIZE, UAS_PIPE_ID_DATA_IN),
+            UAS_ENDPOINT(USB_DESCRIPTOR_ENDPOINT_ADDRESS_OUT(UAS_DATA_OUT_ENDPOINT),
+                EP8_SIZE, UAS_PIPE_ID_DATA_OUT)
+        }
+    },
+#endif
+#ifdef USB_BLK
+    // Interface Vendor Block Protocol (usb_blk.h)
+    .blk = {
+        .bLength            = USB_DESCRIPTOR_INTERFACE_LENGTH,
+        .bDescriptorType    = USB_DESCRIPTOR_INTERFACE_TYPE,
+        .bInterfaceNumber   = USB_BLK_INTERFACE,
+        .bAlternateSetting  = 0,
+        .bNumEndpoints      = 2,
+        .bInterfaceClass    = USB_DESCRIPTOR_CLASS_VENDOR,
+        .bInterfaceSubClass = 0,
+        .bInterfaceProtocol = 0,
+        .iInterface         = 0,
+        .endpoints = {
+            // Endpoint 3 - OUT - RX (host to device)
+            {
+                .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,
+                .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,
+                .bEndpointAddress   = USB_DESCRIPTOR_ENDPOINT_ADDRESS_OUT(USB_BLK_RX_ENDPOINT),
+                .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY,
+                .wMaxPacketSize     = EP3_SIZE,
+                .bInterval          = 0
+            },
+            // Endpoint 4 - IN - TX (device to host)
+            {
+                .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,
+                .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,
+                .bEndpointAddress   = USB_DESCRIPTOR_ENDPOINT_ADDRESS_IN(USB_BLK_TX_ENDPOINT),
+                .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY,
+                .wMaxPacketSize     = EP4_SIZE,
+                .bInterval          = 0
+            }
+        }
+    },
+#endif
+#ifdef USB_CDC
+    // Interface Association, CDC-ACM trace port (usb_cdc.h)
+    .cdc_iad = {
+        .bLength            = USB_DESCRIPTOR_INTERFACE_ASSOCIATION_LENGTH,
+        .bDescriptorType    = USB_DESCRIPTOR_INTERFACE_ASSOCIATION_TYPE,
+        .bFirstInterface    = USB_CDC_COMM_INTERFACE,
+        .bInterfaceCount    = 2,
+        .bFunctionClass     = USB_DESCRIPTOR_CLASS_CDC,
+        .bFunctionSubClass  = USB_CDC_SUBCLASS_ACM,
+        .bFunctionProtocol  = 0,
+        .iFunction          = 0
+    },
+    // Interface CDC Communications
+    .cdc_comm = {
+        .bLength            = USB_DESCRIPTOR_INTERFACE_LENGTH,
+        .bDescriptorType    = USB_DESCRIPTOR_INTERFACE_TYPE,
+        .bInterfaceNumber   = USB_CDC_COMM_INTERFACE,
+        .bAlternateSetting  = 0,
+        .bNumEndpoints      = 1,
+        .bInterfaceClass    = USB_DESCRIPTOR_CLASS_CDC,
+        .bInterfaceSubClass = USB_CDC_SUBCLASS_ACM,
+        .bInterfaceProtocol = 0,
+        .iInterface         = 0,
+        .header = {
+            .bFunctionLength    = sizeof(config_descriptor.cdc_comm.header),
+            .bDescriptorType    = USB_CDC_CS_INTERFACE,
+            .bDescriptorSubtype = USB_CDC_SUBTYPE_HEADER,
+            .bcdCDC             = 0x0110
+        },
+        .call_management = {
+            .bFunctionLength    = sizeof(config_descriptor.cdc_comm.call_management),
+            .bDescriptorType    = USB_CDC_CS_INTERFACE,
+            .bDescriptorSubtype = USB_CDC_SUBTYPE_CALL_MANAGEMENT,
+            .bmCapabilities     = 0,
+            .bDataInterface     = USB_CDC_DATA_INTERFACE
+        },
+        .acm = {
+            .bFunctionLength    = sizeof(config_descriptor.cdc_comm.acm),
+            .bDescriptorType    = USB_CDC_CS_INTERFACE,
+            .bDescriptorSubtype = USB_CDC_SUBTYPE_ACM,
+            .bmCapabilities     = USB_CDC_ACM_LINE_CODING
+        },
+        .union_ = {
+            .bFunctionLength    = sizeof(config_descriptor.cdc_comm.union_),
+            .bDescriptorType    = USB_CDC_CS_INTERFACE,
+            .bDescriptorSubtype = USB_CDC_SUBTYPE_UNION,
+            .bMasterInterface   = USB_CDC_COMM_INTERFACE,
+            .bSlaveInterface0   = USB_CDC_DATA_INTERFACE
+        },
+        // Endpoint 9 - IN - notifications, never sent
+        .endpoint = {
+            .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,
+            .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,
+            .bEndpointAddress   = USB_DESCRIPTOR_ENDPOINT_ADDRESS_IN(USB_CDC_NOTIFY_ENDPOINT),
+            .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_INTERRUPT,
+            .wMaxPacketSize     = EP9_SIZE,
+            .bInterval          = 64
+        }
+    },
+    // Interface CDC Data
+    .cdc_data = {
+        .bLength            = USB_DESCRIPTOR_INTERFACE_LENGTH,
+        .bDescriptorType    = USB_DESCRIPTOR_INTERFACE_TYPE,
+        .bInterfaceNumber   = USB_CDC_DATA_INTERFACE,
+        .bAlternateSetting  = 0,
+        .bNumEndpoints      = 2,
+        .bInterfaceClass    = USB_DESCRIPTOR_CLASS_CDC_DATA,
+        .bInterfaceSubClass = 0,
+        .bInterfaceProtocol = 0,
+        .iInterface         = 0,
+        .endpoints = {
+            // Endpoint 10 - OUT - RX (host to device)
+            {
+                .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,
+                .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,
+                .bEndpointAddress   = USB_DESCRIPTOR_ENDPOINT_ADDRESS_OUT(USB_CDC_RX_ENDPOINT),
+                .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY,
+                .wMaxPacketSize     = EP10_SIZE,
+                .bInterval          = 0
+            },
+            // Endpoint 11 - IN - TX (device to host)
+            {
+                .bLength            = USB_DESCRIPTOR_ENDPOINT_LENGTH,
+                .bDescriptorType    = USB_DESCRIPTOR_ENDPOINT_TYPE,
+                .bEndpointAddress   = USB_DESCRIPTOR_ENDPOINT_ADDRESS_IN(USB_CDC_TX_ENDPOINT),
+                .bmAttributes       = USB_DESCRIPTOR_ENDPOINT_ATTRIBUTE_BULKONLY,
+                .wMaxPacketSize     = EP11_SIZE,
+                .bInterval          = 0
+            }
+        }
+    },
+#endif
 };
 
 
@@ -167,7 +365,7 @@ void usb_init_serialnumber(void)
 const usb_descriptor_list_t usb_descriptor_list[] = {
 	//wValue, wIndex, address,          length
 	{0x0100, 0x0000, (void *) &device_descriptor, sizeof(device_descriptor)},
-	{0x0200, 0x0000, (void *) &config_descriptor, CONFIG_SIZE},
+	{0x0200, 0x0000, (void *) &config_descriptor, sizeof(config_descriptor)},
         {0x0300, 0x0000, (const uint8_t *)&string0, 0},
         {0x0301, 0x0409, (const uint8_t *)&usb_string_manufacturer_name, 0},
         {0x0302, 0x0409, (const uint8_t *)&usb_string_product_name, 0},
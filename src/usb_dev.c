@@ -3,8 +3,12 @@
 #include "usb_bdt.h"
 #include "usb_names.h" /* struct usb_string_descriptor_struct */
 #include "usb_msd.h"
+#include "usb_blk.h"
+#include "usb_cdc.h"
+#include "scsi_sd.h" /* scsi_sd_max_lun, scsi_sd_resume */
 #include "kinetis.h"
 #include "serialize.h"
+#include "stats.h"
 
 #include "core_pins.h"
 
@@ -88,6 +92,13 @@ static void ep_nop_handler(bdt_t *bd);
 // handle everything on Endpoint 0
 static void ep0_handler(bdt_t *bd);
 
+// updates the isr counters of stats.h after a run of `usb_isr`
+static void isr_account(uint32_t start, uint32_t tokens);
+
+// the host suspended the bus or resumed it, see `usb_suspended`
+static void suspend(void);
+static void resume(void);
+
 void usb_ep1_handler(bdt_t *)  __attribute__((weak, alias("ep_nop_handler")));
 void usb_ep2_handler(bdt_t *)  __attribute__((weak, alias("ep_nop_handler")));
 void usb_ep3_handler(bdt_t *)  __attribute__((weak, alias("ep_nop_handler")));
@@ -131,6 +142,19 @@ static int ep0_data_toggle = DATA0;
 static const void *ep0_tx_data = NULL;
 static uint16_t ep0_tx_datalen = 0;
 
+/* called on every SOF token, the SOF interrupt is only enabled while set */
+static void (*sof_callback)(void) = NULL;
+
+/* the runs of the isr since `start_ms`, for the per second counters */
+static struct {
+    uint32_t start_ms;
+    uint32_t entries;
+    uint32_t cycles;
+} isr_window = {0};
+
+/* 1 from a SLEEP interrupt until RESUME or a reset */
+static volatile uint8_t suspended = 0;
+
 static void (*handlers[16])(bdt_t *bd) = {
     ep0_handler,
     usb_ep1_handler,
@@ -167,6 +191,11 @@ void usb_init(void)
 	int i;
 	usb_init_serialnumber();
 
+	// the cycle counter is off until the debug blocks are enabled, the isr
+	// counts its cycles with it
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+
 	for (i = 0; i < ((NUM_ENDPOINTS + 1) * 4); i++) {
 		bdt[i].desc = 0;
 		bdt[i].addr = NULL;
@@ -213,15 +242,19 @@ void usb_isr(void) {
     uint8_t status;
 	uint8_t stat;
 	uint8_t endpoint, tx, odd; // values stored in USB0_STAT
+    uint32_t start = ARM_DWT_CYCCNT;
+    uint32_t tokens = 0;
     
-	restart:
 	status = USB0_ISTAT;
     
 	if (status & USB_ISTAT_SOFTOK) {
 		USB0_ISTAT = USB_ISTAT_SOFTOK;
+		if (sof_callback != NULL) { sof_callback(); }
 	}
 	
-	if (status & USB_ISTAT_TOKDNE) {
+	// every token in the stat fifo, clearing TOKDNE brings up the next one so
+	// back to back transactions are handled in one run
+	while (status & USB_ISTAT_TOKDNE) {
 		stat = USB0_STAT;
         /*sput_stat(stat); sprint("\n");*/
 		endpoint = USB_STAT_ENDP(stat);
@@ -230,11 +263,13 @@ void usb_isr(void) {
         odd = USB_STAT_ODD_(stat);
 		handlers[endpoint](&bdt[BDT_INDEX(endpoint, tx, odd)]);
 		USB0_ISTAT = USB_ISTAT_TOKDNE;
-        goto restart; // TODO why?
+        tokens++;
+        status = USB0_ISTAT;
 	}
     
 	if (status & USB_ISTAT_USBRST) {
         reset();
+        isr_account(start, tokens);
         return;
 	}
 
@@ -251,10 +286,87 @@ void usb_isr(void) {
 		USB0_ISTAT = USB_ISTAT_ERROR;
 	}
 
-    // TODO USB Power Management
+	// no SOF for 3 ms, the bus is suspended until the host drives resume or
+	// resets it
 	if (status & USB_ISTAT_SLEEP) {
 		USB0_ISTAT = USB_ISTAT_SLEEP;
+		suspend();
+	}
+	if (status & USB_ISTAT_RESUME) {
+		USB0_ISTAT = USB_ISTAT_RESUME;
+		resume();
 	}
+    
+    isr_account(start, tokens);
+}
+
+void usb_sof_callback(void (*callback)(void)) {
+    __disable_irq();
+    sof_callback = callback;
+    if (callback != NULL) {
+        USB0_ISTAT = USB_ISTAT_SOFTOK;
+        USB0_INTEN |= USB_INTEN_SOFTOKEN;
+    } else {
+        USB0_INTEN &= ~USB_INTEN_SOFTOKEN;
+    }
+    __enable_irq();
+}
+
+int usb_suspended(void) {
+    return suspended;
+}
+
+void suspend(void) {
+    if (suspended) return;
+    suspended = 1;
+    stats.usb_suspends++;
+    
+    // the card and the transceiver are put away by `usb_msd_poll` (see
+    // `usb_sleep`), flushing the card may take seconds and from here it would
+    // keep a resume or a reset waiting
+    USB0_ISTAT = USB_ISTAT_RESUME;
+    USB0_INTEN |= USB_INTEN_RESUMEEN;
+}
+
+void usb_sleep(void) {
+    // the transceiver to low power, only resume signalling wakes it
+    if (suspended) USB0_USBCTRL |= USB_USBCTRL_SUSP;
+}
+
+void resume(void) {
+    if (!suspended) return;
+    USB0_USBCTRL &= ~USB_USBCTRL_SUSP;
+    USB0_INTEN &= ~USB_INTEN_RESUMEEN;
+    suspended = 0;
+    stats.usb_resumes++;
+    
+    scsi_sd_resume();
+}
+
+void isr_account(uint32_t start, uint32_t tokens) {
+    uint32_t cycles = ARM_DWT_CYCCNT - start;
+    uint32_t elapsed;
+    
+    stats.usb_isr_entries++;
+    stats.usb_tokens += tokens;
+    stats.usb_tokens_per_isr = 
+        (uint32_t) ((uint64_t) stats.usb_tokens * 100 / stats.usb_isr_entries);
+    stats.usb_isr_cycles += cycles;
+    if (cycles > stats.usb_isr_max_cycles) {
+        stats.usb_isr_max_cycles = cycles;
+    }
+    
+    isr_window.entries++;
+    isr_window.cycles += cycles;
+    elapsed = millis() - isr_window.start_ms;
+    if (elapsed >= 1000) {
+        stats.usb_isr_per_sec = isr_window.entries * 1000 / elapsed;
+        stats.usb_isr_load = (uint32_t) (((uint64_t) isr_window.cycles * 1000) 
+            / ((uint64_t) (F_CPU / 1000) * elapsed));
+        isr_window.start_ms += elapsed;
+        isr_window.entries = 0;
+        isr_window.cycles = 0;
+    }
 }
 
 void usb_stall_endpoint(uint8_t ep) {
@@ -315,8 +427,15 @@ void ep0_handler(bdt_t *bd) {
         break;
         
     case PID_OUT:
-        // TODO ??
-        // nothing to do here..just give the buffer back
+#ifdef USB_CDC
+        // the data stage of SET LINE CODING, acknowledged with a ZLP
+        if (last_setup.wRequestAndType == WREQUESTANDTYPE(
+                USB_CDC_SET_LINE_CODING, RT_OUT|RT_CLASS|RT_INTERFACE)) {
+            usb_cdc_line_coding(bd->addr, BDT_DESC_LENGTH(bd->desc));
+            ep0_transmit(NULL, 0);
+        }
+#endif
+        // nothing else to do here..just give the buffer back
         bd->desc = BDT_DESC(EP0_SIZE, DATA1);
         break;
         
@@ -330,6 +449,9 @@ void ep0_handler(bdt_t *bd) {
 
 void reset(void) {
     LOGINFO("USB RESET");
+    // a reset also ends a suspend
+    resume();
+    
     // 41.5.14: reset all ping pong fields to 0
 	USB0_CTL = USB_CTL_ODDRST;
 	
@@ -357,8 +479,11 @@ void reset(void) {
 
 	// enable other interrupts
 	USB0_ERREN = 0xff;
-	USB0_INTEN = USB_INTEN_TOKDNEEN | USB_INTEN_SOFTOKEN | USB_INTEN_STALLEN |
-		USB_INTEN_ERROREN |	USB_INTEN_USBRSTEN | USB_INTEN_SLEEPEN;
+	// SOF only for a `usb_sof_callback`, it would otherwise run the isr every
+	// ms for nothing
+	USB0_INTEN = USB_INTEN_TOKDNEEN | USB_INTEN_STALLEN |
+		USB_INTEN_ERROREN |	USB_INTEN_USBRSTEN | USB_INTEN_SLEEPEN |
+		(sof_callback != NULL ? USB_INTEN_SOFTOKEN : 0);
 
     // is this necessary?
     USB0_CTL = USB_CTL_USBENSOFEN;
@@ -369,7 +494,9 @@ void control_setup(setup_t *setup) {
     const uint8_t *data;
     uint8_t datalen;
     uint32_t size;
-    uint8_t buffer[2];
+    /* the controller reads a reply when the IN token comes, after this
+       returns, so it can't be on the stack */
+    static uint8_t buffer[2];
     uint8_t i;
     
     
@@ -409,12 +536,75 @@ void control_setup(setup_t *setup) {
         // TODO wValue == 0????
         if (setup->wValue == 1) {
             usb_msd_init();
+#ifdef USB_BLK
+            usb_blk_init();
+#endif
+#ifdef USB_CDC
+            usb_cdc_init();
+#endif
             usb_active_configuration = 1;
             goto send; // send a ZLP
         }
         usb_stall_endpoint(0);
         return;
         
+    // GET INTERFACE ///////////////////////////////////////////////////////////
+    case WREQUESTANDTYPE(GET_INTERFACE, RT_IN | RT_STANDARD | RT_INTERFACE):
+        if (usb_active_configuration == 1 && setup->wIndex == 0) {
+            buffer[0] = usb_msd_alternate();
+            data = buffer;
+            datalen = 1;
+            goto send;
+        }
+#ifdef USB_BLK
+        if (usb_active_configuration == 1 && 
+                setup->wIndex == USB_BLK_INTERFACE) {
+            buffer[0] = 0;
+            data = buffer;
+            datalen = 1;
+            goto send;
+        }
+#endif
+#ifdef USB_CDC
+        if (usb_active_configuration == 1 && 
+                (setup->wIndex == USB_CDC_COMM_INTERFACE ||
+                 setup->wIndex == USB_CDC_DATA_INTERFACE)) {
+            buffer[0] = 0;
+            data = buffer;
+            datalen = 1;
+            goto send;
+        }
+#endif
+        usb_stall_endpoint(0);
+        return;
+    
+    // SET INTERFACE ///////////////////////////////////////////////////////////
+    case WREQUESTANDTYPE(SET_INTERFACE, RT_OUT | RT_STANDARD | RT_INTERFACE):
+        // bulk only is alternate setting 0 of the msd interface, UAS 1
+        if (usb_active_configuration == 1 && setup->wIndex == 0 && 
+                usb_msd_set_alternate(setup->wValue) == 0) {
+            goto send; // send a ZLP
+        }
+#ifdef USB_BLK
+        // resets the data toggles of the interface's endpoints with the rest
+        if (usb_active_configuration == 1 && 
+                setup->wIndex == USB_BLK_INTERFACE && setup->wValue == 0) {
+            usb_blk_init();
+            goto send; // send a ZLP
+        }
+#endif
+#ifdef USB_CDC
+        // closes the port, the host sets the line state again
+        if (usb_active_configuration == 1 && setup->wValue == 0 && 
+                (setup->wIndex == USB_CDC_COMM_INTERFACE ||
+                 setup->wIndex == USB_CDC_DATA_INTERFACE)) {
+            usb_cdc_init();
+            goto send; // send a ZLP
+        }
+#endif
+        usb_stall_endpoint(0);
+        return;
+        
     // GET STATUS (device) /////////////////////////////////////////////////////
     case WREQUESTANDTYPE(GET_STATUS, RT_IN | RT_STANDARD | RT_DEVICE):
         /* usb2.0 (bit 0: self/bus powered, bit 1: remote wakeup)
@@ -470,7 +660,7 @@ void control_setup(setup_t *setup) {
     
     case WREQUESTANDTYPE(GET_MAX_LUN, RT_IN | RT_CLASS | RT_INTERFACE):
         if (usb_active_configuration == 1) {
-            buffer[0] = MSD_IMPL_MAX_LUN;
+            buffer[0] = scsi_sd_max_lun();
             ep0_transmit(buffer, 1);
         }
         break;
@@ -481,6 +671,52 @@ void control_setup(setup_t *setup) {
         }
         goto send; // send ZLP
     
+#ifdef USB_CDC
+    case WREQUESTANDTYPE(USB_CDC_SET_LINE_CODING, 
+            RT_OUT | RT_CLASS | RT_INTERFACE):
+        // the line coding comes in the data stage, see ep0_handler
+        if (usb_active_configuration == 1 && 
+                setup->wIndex == USB_CDC_COMM_INTERFACE) {
+            return;
+        }
+        usb_stall_endpoint(0);
+        return;
+    
+    case WREQUESTANDTYPE(USB_CDC_GET_LINE_CODING, 
+            RT_IN | RT_CLASS | RT_INTERFACE):
+        if (usb_active_configuration == 1 && 
+                setup->wIndex == USB_CDC_COMM_INTERFACE) {
+            data = usb_cdc_get_line_coding();
+            datalen = USB_CDC_LINE_CODING_LENGTH;
+            goto send;
+        }
+        usb_stall_endpoint(0);
+        return;
+    
+    case WREQUESTANDTYPE(USB_CDC_SET_CONTROL_LINE_STATE, 
+            RT_OUT | RT_CLASS | RT_INTERFACE):
+        if (usb_active_configuration == 1 && 
+                setup->wIndex == USB_CDC_COMM_INTERFACE) {
+            usb_cdc_control_line_state(setup->wValue);
+            goto send; // send ZLP
+        }
+        usb_stall_endpoint(0);
+        return;
+    
+#endif
+    // VENDOR REQUESTS /////////////////////////////////////////////////////////
+    
+#ifdef USB_BLK
+    case WREQUESTANDTYPE(USB_BLK_RESET, RT_OUT | RT_VENDOR | RT_INTERFACE):
+        if (usb_active_configuration == 1 && 
+                setup->wIndex == USB_BLK_INTERFACE) {
+            usb_blk_reset();
+            goto send; // send ZLP
+        }
+        usb_stall_endpoint(0);
+        return;
+#endif
+    
     // UNSUPPORTED /////////////////////////////////////////////////////////////
     default:
         LOGERROR("recieved unsupported setup packet of type: 0x%04hx", 
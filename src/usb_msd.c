@@ -14,6 +14,9 @@
 #include "usb_msd.h"
 #include "endian.h"
 #include "scsi_sd.h"
+#include "usb_blk.h"
+#include "usb_uas.h"
+#include "usb_cdc.h"
 
 /******************************************************************************/
 
@@ -40,9 +43,32 @@ static size_t _bytes_sent      = 0;
 /* # of bytes the SCSI CDB is expecting */
 static size_t _bytes_device    = 0;
 
+/* packets that came while the vendor block interface had the luns, their bdt
+   entries are given back once `usb_msd_resume` runs them */
+static bdt_t *_held[2];
+static size_t _held_count      = 0;
+
+/* data packets armed ahead of a CSW that was staged right behind them */
+static size_t _staged          = 0;
+
+/* alternate setting of the interface, bulk only or UAS (usb_uas.h) */
+static uint8_t _alternate      = 0;
+
+#ifdef USB_CDC
+/* ARM_DWT_CYCCNT when the CBW came, for the trace port's COMMAND records */
+static uint32_t _cbw_cycles    = 0;
+#endif
+
 
 /******************************************************************************/
 
+/* handlers of the msd's endpoints for `usb_isr`, see usb_dev.c */
+void usb_ep1_handler(bdt_t *bd);
+void usb_ep2_handler(bdt_t *bd);
+
+/* sets up the bulk only endpoints, both toggles start at DATA0 */
+static void init_endpoints(void);
+
 static int 
 is_valid_cbw(const struct usb_msd_cbw *cbw, uint16_t length, uint8_t max_lun);
 
@@ -52,6 +78,12 @@ static void msd_tx_success(size_t bytes_sent);
 static void msd_rx_success(void *bytes, size_t count);
 
 static void send_status(uint8_t status, size_t processed);
+/* the CSW of a command whose status scsi_sd held, once it is over */
+static void send_held_status(void);
+#ifdef USB_CDC
+/* a COMMAND record of the command the CSW ends for the trace port */
+static void trace_command(uint8_t status, size_t processed);
+#endif
 
 /* using `scsi_buffer` setup the next block for transmission */
 static void transmit_next(void); 
@@ -76,8 +108,18 @@ void usb_msd_init(void)
 {
     LOGINFO("initializing the endpoints for the microsd back msd");
     
+#ifdef USB_UAS
+    /* a new configuration starts out with bulk only */
+    if (_alternate == UAS_ALTERNATE_SETTING) { usb_uas_reset(); }
+#endif
+    _alternate = 0;
+    
     scsi_sd_init();
+    init_endpoints();
+}
     
+void init_endpoints(void) 
+{
     USB0_ENDPT1 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPRXEN | USB_ENDPT_EPHSHK;
     bdt[BDT_INDEX(1, RX, EVEN)].desc = BDT_DESC(EP1_SIZE, DATA0);
     bdt[BDT_INDEX(1, RX, EVEN)].addr = _ep1_rx[0];
@@ -89,18 +131,143 @@ void usb_msd_init(void)
     _ep2_odd_toggle  = EVEN;
     
     _phase = NONE;
+    _held_count = 0;
+    _staged     = 0;
+}
+
+int usb_msd_set_alternate(uint8_t alternate) 
+{
+    LOGINFO("msd alternate setting %hhu", alternate);
+    
+    switch (alternate) 
+    {
+    case 0:
+#ifdef USB_UAS
+        if (_alternate == UAS_ALTERNATE_SETTING) { usb_uas_reset(); }
+#endif
+        /* like a reset for a bulk only command in progress */
+        if (_alternate == 0) { usb_msd_bulk_only_reset(); }
+        _alternate = 0;
+        init_endpoints();
+#ifdef USB_BLK
+        usb_blk_resume();
+#endif
+        return 0;
+        
+#ifdef USB_UAS
+    case UAS_ALTERNATE_SETTING:
+        if (_alternate == 0) 
+        {
+            /* a command in progress is dropped like on a reset */
+            usb_msd_bulk_only_reset();
+            USB0_ENDPT1 = 0;
+            USB0_ENDPT2 = 0;
+        }
+        else 
+        {
+            usb_uas_reset();
+        }
+        _alternate = UAS_ALTERNATE_SETTING;
+        usb_uas_init();
+        return 0;
+#endif
+        
+    default:
+        return -1;
+    }
+}
+
+uint8_t usb_msd_alternate(void) 
+{
+    return _alternate;
 }
 
 void usb_msd_bulk_only_reset(void) 
 {
+#ifdef USB_UAS
+    /* UAS has task management IUs in place of the class request */
+    if (_alternate == UAS_ALTERNATE_SETTING) { return; }
+#endif
+    
     /* if a SCSI IN is being performed flush any buffered data and reset */
     /* TODO is this needed? if we get a bomsr shouldn't a previous cdb failed */
     if (_phase == DATA_PHASE && !CBW_DIRECTION_IN(_cbw)) 
     {
         scsi_sd_data_in_commit();
     }
+    scsi_sd_reset();
     /* to reset the interface for the next cbw just set phase to NONE*/
-    _phase = NONE;
+    _phase  = NONE;
+    _staged = 0;
+    
+    /* a held CBW is dropped with the rest */
+    while (_held_count > 0) 
+    {
+        _held_count--;
+        _held[_held_count]->desc = BDT_DESC(EP1_SIZE, 
+            BDT_DESC_DATA_TOGGLE(_held[_held_count]->desc));
+    }
+#ifdef USB_BLK
+    usb_blk_resume();
+#endif
+}
+
+void usb_msd_poll(void) 
+{
+    /* scsi_sd is otherwise only run from `usb_isr()`, keep the usb interrupt 
+       from preempting it while it does its background work */
+    NVIC_DISABLE_IRQ(IRQ_USBOTG);
+    
+    /* nothing to do until the host resumes the bus. The card is put away here
+       rather than in the SLEEP interrupt, which a full log would keep busy for
+       seconds, then the transceiver and, until the next interrupt, the core */
+    if (usb_suspended()) 
+    {
+        scsi_sd_suspend();
+        usb_sleep();
+        NVIC_ENABLE_IRQ(IRQ_USBOTG);
+        __asm__ volatile ("wfi");
+        return;
+    }
+    
+    scsi_sd_poll();
+    send_held_status();
+#ifdef USB_CDC
+    usb_cdc_poll();
+#endif
+    NVIC_ENABLE_IRQ(IRQ_USBOTG);
+}
+
+int usb_msd_busy(void) 
+{
+#ifdef USB_UAS
+    if (_alternate == UAS_ALTERNATE_SETTING) { return usb_uas_busy(); }
+#endif
+    return _phase != NONE || _held_count > 0;
+}
+
+void usb_msd_resume(void) 
+{
+    bdt_t *held[2];
+    size_t i, count;
+    
+#ifdef USB_UAS
+    if (_alternate == UAS_ALTERNATE_SETTING) 
+    {
+        usb_uas_resume();
+        return;
+    }
+#endif
+    if (_held_count == 0) { return; }
+#ifdef USB_BLK
+    if (usb_blk_busy()) { return; }
+#endif
+    
+    /* in the order they came, a CBW and maybe its first data packet */
+    count = _held_count;
+    for (i = 0; i < count; i++) { held[i] = _held[i]; }
+    _held_count = 0;
+    for (i = 0; i < count; i++) { usb_ep1_handler(held[i]); }
 }
 
 /**** USB ENDPOINT HANDLERS ***************************************************/
@@ -113,6 +280,16 @@ void usb_ep1_handler(bdt_t *bd)
     
     if (BDT_PID(bd->desc) == PID_OUT) 
     {
+#ifdef USB_BLK
+        /* the vendor block interface has the luns, the host is NAKed until 
+           the bdt entry is given back */
+        if (_held_count > 0 || (_phase == NONE && usb_blk_busy())) 
+        {
+            _held[_held_count++] = bd;
+            USB0_CTL = USB_CTL_USBENSOFEN;
+            return;
+        }
+#endif
         length = BDT_DESC_LENGTH(bd->desc);
         memcpy(buff, bd->addr, length);
         bd->desc = BDT_DESC(EP1_SIZE, BDT_DESC_DATA_TOGGLE(bd->desc));
@@ -158,7 +335,7 @@ void begin_transaction(const void *data, uint16_t length)
 {
     ssize_t count;
 
-    if (!is_valid_cbw(data, length, MSD_IMPL_MAX_LUN)) 
+    if (!is_valid_cbw(data, length, scsi_sd_max_lun())) 
     {
         LOGERROR("invalid cbw");
         sxxd(data, length);
@@ -171,10 +348,14 @@ void begin_transaction(const void *data, uint16_t length)
     
     _phase = COMMAND_PHASE;
     _cbw = *((const struct usb_msd_cbw *) data);
+#ifdef USB_CDC
+    _cbw_cycles = ARM_DWT_CYCCNT;
+#endif
     _bytes_sent     = 0;
     _bytes_recieved = 0;
     
-    count = scsi_sd_begin((const void *) _cbw.CBWCB, _cbw.bCBWCBLength);
+    count = scsi_sd_begin(_cbw.bCBWLUN & CBW_LUN_MASK, 
+        (const void *) _cbw.CBWCB, _cbw.bCBWCBLength);
     LOGDEBUG("bytes in data phase: 0x%x", count);
     
     if (count < 0) 
@@ -224,6 +405,9 @@ void begin_transaction(const void *data, uint16_t length)
     
     if (_bytes_device == 0) 
     {
+        /* a foreground self test, the CSW waits in the command phase until
+           `usb_msd_poll` has run it */
+        if (scsi_sd_pending() > 0) { return; }
         send_status(CSW_SUCCESS, 0);
         return;
     }
@@ -285,8 +469,19 @@ void msd_tx_success(size_t bytes_sent)
         break;
         
     case STATUS_PHASE: 
+        /* the last data packet went out, the CSW behind it is still queued */
+        if (_staged > 0) 
+        {
+            _staged--;
+            _bytes_sent += bytes_sent;
+            break;
+        }
+        
         /* status successfully sent */
         _phase = NONE;
+#ifdef USB_BLK
+        usb_blk_resume();
+#endif
         break;
         
     case COMMAND_PHASE:
@@ -381,8 +576,50 @@ void send_status(uint8_t status, size_t processed)
     };
     _phase = STATUS_PHASE;
     ep2_transmit(&_csw, sizeof(_csw));
+#ifdef USB_CDC
+    trace_command(status, processed);
+#endif
 }
 
+void send_held_status(void) 
+{
+    int pending;
+    
+#ifdef USB_UAS
+    if (_alternate == UAS_ALTERNATE_SETTING) 
+    {
+        usb_uas_poll();
+        return;
+    }
+#endif
+    /* only a held command stays in the command phase */
+    if (_phase != COMMAND_PHASE || (pending = scsi_sd_pending()) > 0) 
+    {
+        return;
+    }
+    send_status(pending == 0 ? CSW_SUCCESS : CSW_FAILED, 0);
+}
+
+#ifdef USB_CDC
+void trace_command(uint8_t status, size_t processed) 
+{
+    struct usb_cdc_command_record record = {0};
+    
+    record.lun        = _cbw.bCBWLUN & CBW_LUN_MASK;
+    record.status     = status;
+    record.cdb_length = _cbw.bCBWCBLength;
+    record.bytes      = htole32(processed);
+    record.us         = htole32((ARM_DWT_CYCCNT - _cbw_cycles) / 
+        (F_CPU / 1000000));
+    if (record.cdb_length > sizeof(record.cdb)) 
+    {
+        record.cdb_length = sizeof(record.cdb);
+    }
+    memcpy(record.cdb, _cbw.CBWCB, record.cdb_length);
+    usb_cdc_record(USB_CDC_RECORD_COMMAND, &record, sizeof(record));
+}
+#endif
+
 
 void transmit_next(void) 
 {
@@ -427,6 +664,16 @@ void transmit_next(void)
     
     /* queue the data for transmission */
     ep2_transmit(ptr, (size_t) count);
+    
+    /* the last packet, a short one or the last the host expects. The CSW goes
+       in the other ping pong bdt entry so the host has it on its next IN
+       instead of one after the TOKDNE of this packet */
+    if (count < EP2_SIZE || 
+            _bytes_sent + count == _cbw.dCBWDataTransferLength) 
+    {
+        _staged = 1;
+        send_status(CSW_SUCCESS, _bytes_sent + count);
+    }
 }
 
 
@@ -0,0 +1,688 @@
+/*
+ * usb_uas is the USB Attached SCSI alternate setting of usb_uas.h. Command and
+ * task management IUs come in on the command pipe and go into the task set of
+ * scsi_task.h, the running task moves its data through scsi_sd like a CDB of
+ * bulk only does and every IU for the host is queued on the status pipe.
+ */
+#ifdef USB_UAS
+
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "usb_bdt.h"
+
+#include "serialize.h"
+#include "usb_dev.h"
+#include "usb_uas.h"
+#ifdef USB_BLK
+#include "usb_blk.h" /* usb_blk_busy, usb_blk_resume */
+#endif
+#include "endian.h"
+#include "scsi_sd.h"
+#include "scsi_task.h"
+#include "stats.h"
+
+/******************************************************************************/
+
+/* IUs waiting for the status pipe, a task is only started once there is room
+   for its READY and SENSE IU */
+#define STATUS_IUS (4)
+
+/******************************************************************************/
+
+/*--- ENDPOINTS --------------------------------------------------------------*/
+/* buffers for the RX bdt entries of the command and data out pipes */
+static uint8_t _ep5_rx[2][EP5_SIZE] __attribute__((aligned(4)));
+static uint8_t _ep8_rx[2][EP8_SIZE] __attribute__((aligned(4)));
+
+static int _ep6_data_toggle = DATA0;
+static int _ep6_odd_toggle  = EVEN;
+static int _ep7_data_toggle = DATA0;
+static int _ep7_odd_toggle  = EVEN;
+
+/* command pipe bdt entries not given back yet, the host is NAKed until they
+   are */
+static bdt_t *_held[2];
+static size_t _held_count = 0;
+
+/*--- RUNNING TASK -----------------------------------------------------------*/
+static enum { IDLE, DATA_IN, DATA_OUT, PENDING } _phase = IDLE;
+static const scsi_task_t *_task;
+static size_t _bytes;                   /* bytes of the data moved so far     */
+static size_t _total;                   /* bytes the CDB moves                */
+static size_t _last;                    /* length of the packet sent last     */
+static int    _failed;                  /* the rest of the data is dropped    */
+static int    _data_busy = 0;           /* a packet is queued on the data in  */
+
+/*--- STATUS PIPE ------------------------------------------------------------*/
+static struct {
+    size_t head;
+    size_t count;
+    int    busy;                        /* the head is queued on the endpoint */
+    struct {
+        union {
+            struct uas_sense_iu    sense;
+            struct uas_response_iu response;
+            struct uas_ready_iu    ready;
+        } iu;
+        size_t length;
+    } items[STATUS_IUS];
+} _status = {0};
+
+
+/******************************************************************************/
+
+/* handlers of the interface's endpoints for `usb_isr`, see usb_dev.c */
+void usb_ep5_handler(bdt_t *bd);
+void usb_ep6_handler(bdt_t *bd);
+void usb_ep7_handler(bdt_t *bd);
+void usb_ep8_handler(bdt_t *bd);
+
+/* takes an IU from the command pipe, returns < 0 if it has to wait */
+static int receive(const void *bytes, size_t length);
+static void command(const struct uas_command_iu *iu, size_t length);
+static void task_management(const struct uas_task_management_iu *iu, 
+    size_t length);
+/* runs the IUs held while the status pipe was full */
+static void release(void);
+
+/* starts the next task while there is room for its IUs */
+static void advance(void);
+static void start(void);
+/* queues the SENSE IU of the running task and takes it out of the set */
+static void finish(uint8_t status);
+/* ends the running task without a status, it was aborted */
+static void stop(void);
+
+/* data of a WRITE from the host */
+static void data_in(const void *bytes, size_t length);
+/* queues the next packet of a READ if the data in pipe is free */
+static void transmit_data(void);
+static void ep7_transmit(const void *data, size_t length);
+
+/* queues an IU on the status pipe, the room for it was checked before */
+static void *queue_status(uint8_t iu_id, uint16_t tag, size_t length);
+static void respond(uint16_t tag, uint8_t response_code);
+static void transmit_status(void);
+static void ep6_transmit(const void *data, size_t length);
+
+/* IUs a new command or task management IU may need */
+static inline size_t status_room(void) 
+{
+    size_t used = _status.count + (_phase != IDLE ? 1 : 0);
+    return used < STATUS_IUS ? STATUS_IUS - used : 0;
+}
+
+/* length of a CDB by its group code, the command IU has room for 16 bytes */
+static inline size_t cdb_length(uint8_t opcode) 
+{
+    switch (opcode & 0xe0) 
+    {
+    case 0x00:  return 6;
+    case 0x20:
+    case 0x40:  return 10;
+    case 0x80:  return 16;
+    case 0xa0:  return 12;
+    default:    return SCSI_TASK_CDB_MAX_LENGTH;
+    }
+}
+
+/******************************************************************************/
+
+void usb_uas_init(void) 
+{
+    LOGINFO("initializing the endpoints of the uas alternate setting");
+    
+    USB0_ENDPT5 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPRXEN | USB_ENDPT_EPHSHK;
+    bdt[BDT_INDEX(5, RX, EVEN)].desc = BDT_DESC(EP5_SIZE, DATA0);
+    bdt[BDT_INDEX(5, RX, EVEN)].addr = _ep5_rx[0];
+    bdt[BDT_INDEX(5, RX, ODD)].desc  = BDT_DESC(EP5_SIZE, DATA1);
+    bdt[BDT_INDEX(5, RX, ODD)].addr  = _ep5_rx[1];
+    
+    USB0_ENDPT6 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPTXEN | USB_ENDPT_EPHSHK;
+    _ep6_data_toggle = DATA0;
+    _ep6_odd_toggle  = EVEN;
+    
+    USB0_ENDPT7 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPTXEN | USB_ENDPT_EPHSHK;
+    _ep7_data_toggle = DATA0;
+    _ep7_odd_toggle  = EVEN;
+    
+    USB0_ENDPT8 = USB_ENDPT_EPCTLDIS | USB_ENDPT_EPRXEN | USB_ENDPT_EPHSHK;
+    bdt[BDT_INDEX(8, RX, EVEN)].desc = BDT_DESC(EP8_SIZE, DATA0);
+    bdt[BDT_INDEX(8, RX, EVEN)].addr = _ep8_rx[0];
+    bdt[BDT_INDEX(8, RX, ODD)].desc  = BDT_DESC(EP8_SIZE, DATA1);
+    bdt[BDT_INDEX(8, RX, ODD)].addr  = _ep8_rx[1];
+    
+    scsi_task_init();
+    _phase        = IDLE;
+    _data_busy    = 0;
+    _held_count   = 0;
+    _status.count = 0;
+    _status.busy  = 0;
+}
+
+void usb_uas_reset(void) 
+{
+    LOGINFO("uas alternate setting reset");
+    
+    stop();
+    scsi_task_init();
+    _held_count   = 0;
+    _status.count = 0;
+    _status.busy  = 0;
+    
+    USB0_ENDPT5 = 0;
+    USB0_ENDPT6 = 0;
+    USB0_ENDPT7 = 0;
+    USB0_ENDPT8 = 0;
+}
+
+int usb_uas_busy(void) 
+{
+    return scsi_task_count(-1) > 0;
+}
+
+void usb_uas_resume(void) 
+{
+    advance();
+}
+
+void usb_uas_poll(void) 
+{
+    int pending;
+    
+    if (_phase != PENDING || (pending = scsi_sd_pending()) > 0) { return; }
+    finish(pending == 0 ? UAS_STATUS_GOOD : UAS_STATUS_CHECK_CONDITION);
+    advance();
+}
+
+/**** USB ENDPOINT HANDLERS ***************************************************/
+
+/* handler for USB0_ENDPT5, the command pipe */
+void usb_ep5_handler(bdt_t *bd) 
+{
+    if (BDT_PID(bd->desc) == PID_OUT) 
+    {
+        /* IUs are taken in the order they came */
+        if (_held_count > 0 || 
+                receive(bd->addr, BDT_DESC_LENGTH(bd->desc)) < 0) 
+        {
+            _held[_held_count++] = bd;
+        }
+        else 
+        {
+            bd->desc = BDT_DESC(EP5_SIZE, BDT_DESC_DATA_TOGGLE(bd->desc));
+        }
+        advance();
+    }
+    else 
+    {
+        LOGWARN("unhandled pid 0x%hx", BDT_PID(bd->desc));
+        bd->desc = BDT_DESC(EP5_SIZE, BDT_DESC_DATA_TOGGLE(bd->desc));
+    }
+    USB0_CTL = USB_CTL_USBENSOFEN;
+}
+
+/* handler for USB0_ENDPT6, the status pipe */
+void usb_ep6_handler(bdt_t *bd) 
+{
+    switch (BDT_PID(bd->desc)) 
+    {
+    case PID_IN:
+        _status.head = (_status.head + 1) % STATUS_IUS;
+        _status.count--;
+        _status.busy = 0;
+        transmit_status();
+        /* room for the IUs that waited and the next task */
+        release();
+        advance();
+#ifdef USB_BLK
+        /* the vendor block interface waits until the task set is empty */
+        if (scsi_task_count(-1) == 0) { usb_blk_resume(); }
+#endif
+        break;
+        
+    default:
+        LOGWARN("unhandled pid 0x%hx", BDT_PID(bd->desc));
+        break;
+    }
+    USB0_CTL = USB_CTL_USBENSOFEN;
+}
+
+/* handler for USB0_ENDPT7, the data in pipe */
+void usb_ep7_handler(bdt_t *bd) 
+{
+    switch (BDT_PID(bd->desc)) 
+    {
+    case PID_IN:
+        _data_busy = 0;
+        if (_phase == DATA_IN) { transmit_data(); }
+        advance();
+        break;
+        
+    default:
+        LOGWARN("unhandled pid 0x%hx", BDT_PID(bd->desc));
+        break;
+    }
+    USB0_CTL = USB_CTL_USBENSOFEN;
+}
+
+/* handler for USB0_ENDPT8, the data out pipe */
+void usb_ep8_handler(bdt_t *bd) 
+{
+    if (BDT_PID(bd->desc) == PID_OUT) 
+    {
+        if (_phase == DATA_OUT) 
+        {
+            data_in(bd->addr, BDT_DESC_LENGTH(bd->desc));
+        }
+        else 
+        {
+            LOGERROR("data out without a WRITE READY, dropped");
+        }
+        bd->desc = BDT_DESC(EP8_SIZE, BDT_DESC_DATA_TOGGLE(bd->desc));
+        advance();
+    }
+    else 
+    {
+        LOGWARN("unhandled pid 0x%hx", BDT_PID(bd->desc));
+        bd->desc = BDT_DESC(EP8_SIZE, BDT_DESC_DATA_TOGGLE(bd->desc));
+    }
+    USB0_CTL = USB_CTL_USBENSOFEN;
+}
+
+/******************************************************************************/
+
+int receive(const void *bytes, size_t length) 
+{
+    /* whatever the IU is, its answer may need the status pipe */
+    if (status_room() < 1) { return -1; }
+    
+    switch (length > 0 ? *(const uint8_t *) bytes : 0) 
+    {
+    case UAS_IU_COMMAND:
+        command(bytes, length);
+        break;
+        
+    case UAS_IU_TASK_MANAGEMENT:
+        task_management(bytes, length);
+        break;
+        
+    default:
+        LOGERROR("invalid IU");
+        sxxd(bytes, length);
+        respond(length >= 4 ? be16toh(((const struct uas_ready_iu *)
+            bytes)->tag) : 0, UAS_RC_INVALID_IU);
+        break;
+    }
+    return 0;
+}
+
+void command(const struct uas_command_iu *iu, size_t length) 
+{
+    struct uas_sense_iu *sense;
+    uint16_t tag = be16toh(iu->tag);
+    size_t count;
+    
+    stats.uas_commands++;
+    
+    /* only the 16 bytes of the CDB field, no additional CDB bytes */
+    if (length != UAS_COMMAND_IU_LENGTH || iu->additional_cdb_length != 0) 
+    {
+        LOGERROR("invalid command IU");
+        sxxd(iu, length);
+        respond(tag, UAS_RC_INVALID_IU);
+        return;
+    }
+    
+    if (iu->lun[1] > scsi_sd_max_lun()) 
+    {
+        respond(tag, UAS_RC_INCORRECT_LUN);
+        return;
+    }
+    
+    switch (scsi_task_add(tag, iu->lun[1], 
+            iu->attribute & UAS_COMMAND_IU_ATTRIBUTE_MASK, iu->cdb, 
+            cdb_length(iu->cdb[0]))) 
+    {
+    case SCSI_TASK_ADDED:
+        count = scsi_task_count(-1);
+        if (count > stats.uas_max_queued) { stats.uas_max_queued = count; }
+        break;
+        
+    case SCSI_TASK_FULL:
+        LOGWARN("task set full, tag 0x%04x", tag);
+        stats.uas_task_set_full++;
+        sense = queue_status(UAS_IU_SENSE, tag, UAS_SENSE_IU_HEADER_LENGTH);
+        sense->status = UAS_STATUS_TASK_SET_FULL;
+        transmit_status();
+        break;
+        
+    case SCSI_TASK_OVERLAPPED:
+        LOGERROR("overlapped tag 0x%04x", tag);
+        respond(tag, UAS_RC_OVERLAPPED_TAG);
+        break;
+    }
+}
+
+void task_management(const struct uas_task_management_iu *iu, size_t length) 
+{
+    uint16_t tag = be16toh(iu->tag);
+    uint8_t lun = iu->lun[1];
+    
+    stats.uas_task_management++;
+    
+    if (length != UAS_TASK_MANAGEMENT_IU_LENGTH) 
+    {
+        LOGERROR("invalid task management IU");
+        sxxd(iu, length);
+        respond(tag, UAS_RC_INVALID_IU);
+        return;
+    }
+    
+    /* the tag of a task management function is one of the task set's */
+    if (scsi_task_exists(tag)) 
+    {
+        respond(tag, UAS_RC_OVERLAPPED_TAG);
+        return;
+    }
+    
+    if (lun > scsi_sd_max_lun() && iu->function != UAS_TMF_I_T_NEXUS_RESET) 
+    {
+        respond(tag, UAS_RC_INCORRECT_LUN);
+        return;
+    }
+    
+    LOGINFO("task management function 0x%02x, lun %d", iu->function, lun);
+    
+    switch (iu->function) 
+    {
+    case UAS_TMF_ABORT_TASK:
+        if (scsi_task_abort(be16toh(iu->task_tag)) > 0) { stop(); }
+        respond(tag, UAS_RC_COMPLETE);
+        break;
+        
+    case UAS_TMF_ABORT_TASK_SET:
+    case UAS_TMF_CLEAR_TASK_SET:
+        if (scsi_task_abort_lun(lun) > 0) { stop(); }
+        respond(tag, UAS_RC_COMPLETE);
+        break;
+        
+    case UAS_TMF_LOGICAL_UNIT_RESET:
+        if (scsi_task_abort_lun(lun) > 0) { stop(); }
+        scsi_sd_reset();
+        respond(tag, UAS_RC_COMPLETE);
+        break;
+        
+    case UAS_TMF_I_T_NEXUS_RESET:
+        if (scsi_task_abort_lun(-1) > 0) { stop(); }
+        scsi_sd_reset();
+        respond(tag, UAS_RC_COMPLETE);
+        break;
+        
+    case UAS_TMF_QUERY_TASK:
+        respond(tag, scsi_task_exists(be16toh(iu->task_tag)) ? 
+            UAS_RC_SUCCEEDED : UAS_RC_COMPLETE);
+        break;
+        
+    case UAS_TMF_QUERY_TASK_SET:
+        respond(tag, scsi_task_count(lun) > 0 ? 
+            UAS_RC_SUCCEEDED : UAS_RC_COMPLETE);
+        break;
+        
+    default:
+        respond(tag, UAS_RC_NOT_SUPPORTED);
+        break;
+    }
+}
+
+void release(void) 
+{
+    while (_held_count > 0 && 
+            receive(_held[0]->addr, BDT_DESC_LENGTH(_held[0]->desc)) == 0) 
+    {
+        _held[0]->desc = BDT_DESC(EP5_SIZE, 
+            BDT_DESC_DATA_TOGGLE(_held[0]->desc));
+        _held[0] = _held[1];
+        _held_count--;
+    }
+}
+
+void advance(void) 
+{
+    /* an IU that waited for the status pipe goes before the next task */
+    while (_phase == IDLE && _held_count == 0 && 
+            STATUS_IUS - _status.count >= 2 && 
+#ifdef USB_BLK
+            !usb_blk_busy() && 
+#endif
+            (_task = scsi_task_start()) != NULL) 
+    {
+        start();
+    }
+}
+
+void start(void) 
+{
+    struct uas_ready_iu *ready;
+    ssize_t count;
+    
+    _bytes  = 0;
+    _last   = 0;
+    _failed = 0;
+    
+    count = scsi_sd_begin(_task->lun, _task->cdb, _task->cdblen);
+    LOGDEBUG("tag 0x%04x, bytes in data phase: 0x%x", _task->tag, count);
+    
+    /* a foreground self test, its SENSE IU waits for `usb_uas_poll` */
+    if (count == 0 && scsi_sd_pending() > 0) 
+    {
+        _phase = PENDING;
+        return;
+    }
+    if (count <= 0) 
+    {
+        finish(count < 0 ? UAS_STATUS_CHECK_CONDITION : UAS_STATUS_GOOD);
+        return;
+    }
+    _total = (size_t) count;
+    
+    /* the host sends the data once it has the WRITE READY, the data of a
+       READ is queued right after its READ READY */
+    if (scsi_sd_is_data_in()) 
+    {
+        _phase = DATA_OUT;
+        ready  = queue_status(UAS_IU_WRITE_READY, _task->tag, sizeof(*ready));
+        transmit_status();
+    }
+    else 
+    {
+        _phase = DATA_IN;
+        ready  = queue_status(UAS_IU_READ_READY, _task->tag, sizeof(*ready));
+        transmit_status();
+        transmit_data();
+    }
+}
+
+void finish(uint8_t status) 
+{
+    struct uas_sense_iu *sense;
+    uint8_t sense_key;
+    uint16_t asc_ascq;
+    
+    sense = queue_status(UAS_IU_SENSE, _task->tag, 
+        status == UAS_STATUS_CHECK_CONDITION ? sizeof(*sense) :
+        UAS_SENSE_IU_HEADER_LENGTH);
+    sense->status = status;
+    
+    /* autosense, fixed format */
+    if (status == UAS_STATUS_CHECK_CONDITION) 
+    {
+        scsi_sd_sense(_task->lun, &sense_key, &asc_ascq);
+        sense->length    = htobe16(sizeof(sense->sense));
+        sense->sense[0]  = 0x70;
+        sense->sense[2]  = sense_key;
+        sense->sense[7]  = sizeof(sense->sense) - 8;
+        sense->sense[12] = asc_ascq >> 8;
+        sense->sense[13] = asc_ascq & 0xff;
+    }
+    transmit_status();
+    
+    _phase = IDLE;
+    scsi_task_done();
+}
+
+void stop(void) 
+{
+    bdt_t *bd;
+    
+    if (scsi_task_running() == NULL) { return; }
+    
+    switch (_phase) 
+    {
+    case DATA_OUT:
+        /* data that was taken in is kept */
+        if (!_failed) { scsi_sd_data_in_commit(); }
+        break;
+        
+    case DATA_IN:
+        /* take back the packet the host hasn't read yet */
+        bd = &bdt[BDT_INDEX(7, TX, _ep7_odd_toggle ^ 1)];
+        if (_data_busy && (bd->desc & BDT_OWN)) 
+        {
+            bd->desc = 0;
+            _ep7_odd_toggle  ^= 1;
+            _ep7_data_toggle ^= 1;
+            _data_busy = 0;
+        }
+        break;
+        
+    case PENDING:
+        /* the self test ends with its task */
+        scsi_sd_reset();
+        break;
+        
+    case IDLE:
+        break;
+    }
+    
+    _phase = IDLE;
+    scsi_task_done();
+}
+
+void data_in(const void *bytes, size_t length) 
+{
+    ssize_t count;
+    
+    _bytes += length;
+    
+    /* after a failure the rest of the data is taken in and dropped */
+    if (!_failed && scsi_sd_data_in(bytes, length) != 0) 
+    {
+        LOGERROR("writing bytes to scsi_sd IN");
+        scsi_sd_data_in_commit();
+        _failed = 1;
+    }
+    
+    if (_bytes < _total && length == EP8_SIZE) { return; }
+    
+    /* all the data or a short packet */
+    if (_failed) 
+    {
+        finish(UAS_STATUS_CHECK_CONDITION);
+        return;
+    }
+    count = scsi_sd_data_in_commit();
+    if (count < 0) { LOGERROR("failed to commit scsi_sd DATA IN"); }
+    finish(count < 0 ? UAS_STATUS_CHECK_CONDITION : UAS_STATUS_GOOD);
+}
+
+void transmit_data(void) 
+{
+    ssize_t count;
+    void *ptr;
+    
+    if (_data_busy) { return; }
+    
+    /* the last packet went out, a short one or the last of the CDB's data */
+    if (_bytes == _total || (_bytes > 0 && _last < EP7_SIZE)) 
+    {
+        finish(_failed ? UAS_STATUS_CHECK_CONDITION : UAS_STATUS_GOOD);
+        return;
+    }
+    
+    if ((count = scsi_sd_data_out(&ptr, EP7_SIZE)) < 0) 
+    {
+        LOGERROR("DATA OUT phase");
+        _failed = 1;
+    }
+    
+    /* no more data and the host would wait for the rest after the last full
+       packet, it is told with a zero length packet */
+    if (count <= 0) 
+    {
+        _total = _bytes;
+        _last  = 0;
+        ep7_transmit(NULL, 0);
+        return;
+    }
+    
+    if ((size_t) count > _total - _bytes) 
+    {
+        LOGINFO("scsi_sd returned more data than the CDB expected");
+        count = _total - _bytes;
+    }
+    _bytes += count;
+    _last   = count;
+    ep7_transmit(ptr, (size_t) count);
+}
+
+void ep7_transmit(const void *data, size_t length) 
+{
+    _data_busy = 1;
+    bdt[BDT_INDEX(7, TX, _ep7_odd_toggle)].addr = (void *) data;
+    bdt[BDT_INDEX(7, TX, _ep7_odd_toggle)].desc = BDT_DESC(length, _ep7_data_toggle);
+    _ep7_odd_toggle  ^= 1;
+    _ep7_data_toggle ^= 1;
+}
+
+void *queue_status(uint8_t iu_id, uint16_t tag, size_t length) 
+{
+    size_t i = (_status.head + _status.count) % STATUS_IUS;
+    
+    _status.count++;
+    memset(&_status.items[i].iu, 0, sizeof(_status.items[i].iu));
+    _status.items[i].iu.ready.iu_id = iu_id;
+    _status.items[i].iu.ready.tag   = htobe16(tag);
+    _status.items[i].length = length;
+    return &_status.items[i].iu;
+}
+
+void respond(uint16_t tag, uint8_t response_code) 
+{
+    struct uas_response_iu *response;
+    
+    response = queue_status(UAS_IU_RESPONSE, tag, sizeof(*response));
+    response->response_code = response_code;
+    transmit_status();
+}
+
+void transmit_status(void) 
+{
+    if (_status.busy || _status.count == 0) { return; }
+    
+    _status.busy = 1;
+    ep6_transmit(&_status.items[_status.head].iu, 
+        _status.items[_status.head].length);
+}
+
+void ep6_transmit(const void *data, size_t length) 
+{
+    bdt[BDT_INDEX(6, TX, _ep6_odd_toggle)].addr = (void *) data;
+    bdt[BDT_INDEX(6, TX, _ep6_odd_toggle)].desc = BDT_DESC(length, _ep6_data_toggle);
+    _ep6_odd_toggle  ^= 1;
+    _ep6_data_toggle ^= 1;
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef _arraycheck_Sd2Card_h_
+#define _arraycheck_Sd2Card_h_
+
+/*
+ * A simulated array member in place of the vendored Sd2Card.h, to run
+ * src/sd_array.cpp on the host. The members share a bus clock in
+ * microseconds, `sim_bus_us`: a block moved over the bus takes
+ * `sim_transfer_us`, and a member programs a block it took for its own
+ * `program_us`. A member that was told to overlap its busy time is left
+ * programming while the bus goes on to the next member, any command it gets
+ * waits for it first.
+ *
+ * Members register in `sim_members` as they are constructed, so index i is
+ * sd_array.cpp's member i. Their state is public for the checks to set up
+ * faults and look at what each card holds.
+ */
+
+#include <stdint.h>
+
+/* cid_t and the R1 bits of the real card */
+#include "SdInfo.h"
+
+/* blocks of a member unless a check sets `blocks` before `sd_init` */
+#define SIM_MEMBER_BLOCKS   (4096)
+#define SIM_MEMBERS_MAX     (8)
+
+uint8_t const SPI_QUARTER_SPEED = 2;
+uint8_t const SD_CRC_WRITE      = 1;
+uint8_t const SD_CRC_READ       = 2;
+
+class Sd2Card {
+public:
+    Sd2Card(void);
+    
+    /*--- what sd_array.cpp calls, as in the vendored Sd2Card.h ---*/
+    uint8_t  cardDetect(uint8_t chipSelectPin);
+    uint8_t  initStart(uint8_t sckRateID, uint8_t chipSelectPin);
+    uint8_t  initPoll(uint8_t *ready);
+    uint8_t  isBusy(void);
+    uint16_t cardStatus(void);
+    uint32_t cardSize(void) { return blocks; }
+    uint8_t  enableCRC(uint8_t mode);
+    uint8_t  errorCode(void) const { return 0; }
+    uint8_t  errorData(void) const { return 0; }
+    void     writeStatusCheck(uint8_t value) { (void) value; }
+    void     overlapBusy(uint8_t value) { overlap = value; }
+    uint8_t  readCID(cid_t *cid);
+    uint8_t  readBlock(uint32_t block, uint8_t *dst);
+    uint8_t  writeBlock(uint32_t block, const uint8_t *src);
+    uint8_t  writeStart(uint32_t block, uint32_t eraseCount);
+    uint8_t  writeData(const uint8_t *src);
+    uint8_t  writeStop(void);
+    uint8_t  writtenBlocks(uint32_t *count);
+    
+    /*--- the simulated card ---*/
+    uint8_t  data[SIM_MEMBER_BLOCKS][512];
+    uint32_t blocks;
+    uint32_t serial;                    /* CID product serial number          */
+    int      present;
+    uint32_t program_us;                /* time it programs a block for       */
+    uint64_t busy_until;                /* bus time it is done programming    */
+    int      overlap;                   /* left programming deselected        */
+    int      bad_read;                  /* block whose reads fail, -1 none    */
+    
+    /*--- what it saw ---*/
+    int      open;                      /* a CMD25 is open                    */
+    uint32_t write_lba;                 /* where its next block goes          */
+    uint32_t written;                   /* blocks of the last CMD25           */
+    uint32_t writes;                    /* blocks written in all              */
+    uint32_t wrong_state;               /* commands other than CMD25 data and
+                                           stop while it was open             */
+                                           
+private:
+    uint32_t polls_;
+    /* waits out programming, then moves a block over the bus */
+    void     wait(void);
+    void     transfer(void);
+    /* programs the block it took, the bus waits unless it overlaps */
+    void     program(void);
+};
+
+/* the bus clock and the members on it */
+extern uint64_t sim_bus_us;
+extern uint32_t sim_transfer_us;
+/* 0 makes members ignore `overlapBusy`, as the Sd2Card before it did */
+extern int      sim_overlap;
+extern Sd2Card *sim_members[SIM_MEMBERS_MAX];
+extern size_t   sim_member_count;
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * arraycheck runs src/sd_array.cpp, built for the host, on the simulated
+ * members of Sd2Card.h and checks where the blocks of the array end up, the
+ * reads of a mirror and that a member programming doesn't hold up the bus.
+ * It is built once per layout (see the Makefile):
+ *
+ *   ./stripecheck      -DSD_ARRAY=SD_ARRAY_STRIPED
+ *   ./mirrorcheck      -DSD_ARRAY=SD_ARRAY_MIRRORED
+ *
+ * Each check starts from blank members on a bus at time 0, brought up with
+ * `sd_init`, and zeroed stats.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "SPI.h"
+#include "sd.h"
+#include "sd_array.h"
+#include "stats.h"
+#include "Sd2Card.h"
+
+/* fails the check it is in with the line of the condition that wasn't met */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            printf("  line %d: %s\n", __LINE__, #cond); \
+            return -1; \
+        } \
+    } while (0)
+
+typedef struct {
+    const char *name;
+    int (*run)(void);
+} check_t;
+
+/******************************************************************************/
+
+SPIClass SPI;
+
+static uint8_t _block[SD_BLOCK_SIZE];
+static uint8_t _read[SD_BLOCK_SIZE];
+
+/******************************************************************************/
+
+/* blank members of `blocks` blocks each, the last one `last_blocks` */
+static void reset(uint32_t blocks, uint32_t last_blocks);
+static void pattern(uint8_t *block, uint32_t lba);
+/* writes `count` blocks of the pattern at `lba` as one multiple block write,
+   the bus time it took or 0 if it failed */
+static uint64_t write_run(uint32_t lba, uint32_t count);
+/* 1 if no member was sent a command while its CMD25 was open */
+static int no_wrong_state(void);
+
+#if SD_ARRAY == SD_ARRAY_STRIPED
+static int check_stripe_layout(void);
+static int check_stripe_single(void);
+static int check_stripe_overlap(void);
+static int check_stripe_pulled(void);
+
+static const check_t _checks[] = {
+    { "stripe_layout",  check_stripe_layout  }, 
+    { "stripe_single",  check_stripe_single  }, 
+    { "stripe_overlap", check_stripe_overlap }, 
+    { "stripe_pulled",  check_stripe_pulled  }, 
+};
+#else
+static int check_mirror_layout(void);
+static int check_mirror_idle_read(void);
+static int check_mirror_fail_over(void);
+static int check_mirror_overlap(void);
+
+static const check_t _checks[] = {
+    { "mirror_layout",    check_mirror_layout    }, 
+    { "mirror_idle_read", check_mirror_idle_read }, 
+    { "mirror_fail_over", check_mirror_fail_over }, 
+    { "mirror_overlap",   check_mirror_overlap   }, 
+};
+#endif
+
+#define CHECK_COUNT (sizeof(_checks) / sizeof(_checks[0]))
+
+/******************************************************************************/
+
+int main(int argc, char **argv) 
+{
+    const char *only = argc > 1 ? argv[1] : "";
+    int failed = 0;
+    size_t i;
+    
+    if (sim_member_count < 2) 
+    {
+        printf("the array has %u members, not at least 2\n", 
+            (unsigned) sim_member_count);
+        return 1;
+    }
+    
+    for (i = 0; i < CHECK_COUNT; i++) 
+    {
+        if (strncmp(_checks[i].name, only, strlen(only)) != 0) { continue; }
+        if (_checks[i].run() < 0) 
+        {
+            printf("%-20s FAILED\n", _checks[i].name);
+            failed++;
+            continue;
+        }
+        printf("%-20s ok\n", _checks[i].name);
+    }
+    return failed ? 1 : 0;
+}
+
+/******************************************************************************/
+
+void reset(uint32_t blocks, uint32_t last_blocks) 
+{
+    Sd2Card *member;
+    size_t i;
+    
+    for (i = 0; i < sim_member_count; i++) 
+    {
+        member = sim_members[i];
+        memset(member->data, 0, sizeof(member->data));
+        member->blocks      = i + 1 < sim_member_count ? blocks : last_blocks;
+        member->serial      = 0x11111111u * (uint32_t) (i + 1);
+        member->present     = 1;
+        member->program_us  = 1000;
+        member->busy_until  = 0;
+        member->bad_read    = -1;
+        member->writes      = 0;
+        member->wrong_state = 0;
+    }
+    sim_bus_us  = 0;
+    sim_overlap = 1;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void pattern(uint8_t *block, uint32_t lba) 
+{
+    size_t i;
+    
+    for (i = 0; i < SD_BLOCK_SIZE; i++) 
+    {
+        block[i] = (uint8_t) (lba * 7 + i + (i >> 8));
+    }
+}
+
+uint64_t write_run(uint32_t lba, uint32_t count) 
+{
+    uint64_t start = sim_bus_us;
+    uint32_t i;
+    
+    if (sd_write_start(lba, count) < 0) { return 0; }
+    for (i = 0; i < count; i++) 
+    {
+        pattern(_block, lba + i);
+        if (sd_write_data(_block) < 0) { return 0; }
+    }
+    if (sd_write_stop() < 0) { return 0; }
+    return sim_bus_us - start;
+}
+
+int no_wrong_state(void) 
+{
+    size_t i;
+    
+    for (i = 0; i < sim_member_count; i++) 
+    {
+        if (sim_members[i]->wrong_state != 0) { return 0; }
+    }
+    return 1;
+}
+
+#if SD_ARRAY == SD_ARRAY_STRIPED
+/*--- STRIPED ----------------------------------------------------------------*/
+int check_stripe_layout(void) 
+{
+    const uint32_t stripe = SD_ARRAY_STRIPE_BLOCKS;
+    const uint32_t count  = (uint32_t) sim_member_count;
+    uint32_t member_blocks, lba, row, share;
+    uint32_t serial = 0;
+    size_t i, member;
+    
+    /* whole stripes of the smallest member */
+    reset(SIM_MEMBER_BLOCKS, 4000);
+    CHECK(sd_init() == 0);
+    member_blocks = 4000 - 4000 % stripe;
+    CHECK(sd_max_lba() == member_blocks * count);
+    for (i = 0; i < sim_member_count; i++) 
+    {
+        serial ^= sim_members[i]->serial;
+    }
+    CHECK(sd_serial_number() == serial);
+    CHECK(sd_write_chunk() == stripe * count);
+    
+    /* stripe k goes to member k % count, row k / count of it */
+    CHECK(write_run(5, 100) != 0);
+    for (lba = 5; lba < 105; lba++) 
+    {
+        row    = lba / stripe / count;
+        member = lba / stripe % count;
+        pattern(_block, lba);
+        CHECK(memcmp(sim_members[member]->data[row * stripe + lba % stripe], 
+            _block, SD_BLOCK_SIZE) == 0);
+        CHECK(sd_read_block(_read, lba) == 0);
+        CHECK(memcmp(_read, _block, SD_BLOCK_SIZE) == 0);
+    }
+    
+    /* each member took its share in its one CMD25 */
+    for (i = 0; i < sim_member_count; i++) 
+    {
+        for (share = 0, lba = 5; lba < 105; lba++) 
+        {
+            if (lba / stripe % count == i) { share++; }
+        }
+        CHECK(sim_members[i]->written == share);
+    }
+    CHECK(no_wrong_state());
+    return 0;
+}
+
+int check_stripe_single(void) 
+{
+    const uint32_t stripe = SD_ARRAY_STRIPE_BLOCKS;
+    uint32_t lba;
+    
+    reset(SIM_MEMBER_BLOCKS, SIM_MEMBER_BLOCKS);
+    CHECK(sd_init() == 0);
+    for (lba = 3000; lba < 3000 + 2 * stripe * sim_member_count; lba++) 
+    {
+        pattern(_block, lba);
+        CHECK(sd_write_block(lba, _block) == 0);
+    }
+    CHECK(sd_write_check() == 0);
+    for (lba = 3000; lba < 3000 + 2 * stripe * sim_member_count; lba++) 
+    {
+        pattern(_block, lba);
+        CHECK(sd_read_block(_read, lba) == 0);
+        CHECK(memcmp(_read, _block, SD_BLOCK_SIZE) == 0);
+    }
+    CHECK(no_wrong_state());
+    return 0;
+}
+
+int check_stripe_overlap(void) 
+{
+    uint64_t serial_us, overlap_us;
+    
+    /* one member programs slower than the other, the bus moves the next
+       stripe to the other while it does */
+    reset(SIM_MEMBER_BLOCKS, SIM_MEMBER_BLOCKS);
+    CHECK(sd_init() == 0);
+    sim_members[0]->program_us = 1500;
+    sim_members[1]->program_us = 500;
+    
+    sim_overlap = 0;
+    CHECK((serial_us = write_run(1024, 256)) != 0);
+    sim_overlap = 1;
+    CHECK((overlap_us = write_run(1024, 256)) != 0);
+    printf("  stripe of %u: %llu us in turn, %llu us overlapped\n", 
+        (unsigned) SD_ARRAY_STRIPE_BLOCKS, (unsigned long long) serial_us, 
+        (unsigned long long) overlap_us);
+    CHECK(overlap_us < serial_us);
+    CHECK(no_wrong_state());
+    return 0;
+}
+
+int check_stripe_pulled(void) 
+{
+    reset(SIM_MEMBER_BLOCKS, SIM_MEMBER_BLOCKS);
+    CHECK(sd_init() == 0);
+    CHECK(sd_present());
+    
+    /* any member gone is the array gone */
+    sim_members[1]->present = 0;
+    CHECK(!sd_present());
+    CHECK(sd_init() < 0);
+    sim_members[1]->present = 1;
+    CHECK(sd_init() == 0);
+    return 0;
+}
+
+#else
+/*--- MIRRORED ---------------------------------------------------------------*/
+int check_mirror_layout(void) 
+{
+    uint32_t lba, count;
+    size_t i;
+    
+    /* the size of the smallest member */
+    reset(SIM_MEMBER_BLOCKS, 3000);
+    CHECK(sd_init() == 0);
+    CHECK(sd_max_lba() == 3000);
+    CHECK(sd_write_chunk() == 0);
+    
+    CHECK(write_run(10, 50) != 0);
+    for (lba = 10; lba < 60; lba++) 
+    {
+        pattern(_block, lba);
+        for (i = 0; i < sim_member_count; i++) 
+        {
+            CHECK(memcmp(sim_members[i]->data[lba], _block, 
+                SD_BLOCK_SIZE) == 0);
+        }
+    }
+    CHECK(sd_written_blocks(&count) == 0 && count == 50);
+    CHECK(no_wrong_state());
+    return 0;
+}
+
+int check_mirror_idle_read(void) 
+{
+    uint64_t start;
+    
+    /* member 0 is still programming the block when it is read back, the
+       read goes to member 1 without waiting */
+    reset(SIM_MEMBER_BLOCKS, SIM_MEMBER_BLOCKS);
+    CHECK(sd_init() == 0);
+    sim_members[0]->program_us = 5000;
+    sim_members[1]->program_us = 100;
+    pattern(_block, 8);
+    CHECK(sd_write_block(8, _block) == 0);
+    sim_bus_us += 300;
+    CHECK(sim_members[0]->isBusy() && !sim_members[1]->isBusy());
+    
+    start = sim_bus_us;
+    CHECK(sd_read_block(_read, 8) == 0);
+    CHECK(memcmp(_read, _block, SD_BLOCK_SIZE) == 0);
+    CHECK(stats.array_idle_reads == 1);
+    CHECK(sim_bus_us - start <= sim_transfer_us);
+    CHECK(sd_write_check() == 0);
+    return 0;
+}
+
+int check_mirror_fail_over(void) 
+{
+    reset(SIM_MEMBER_BLOCKS, SIM_MEMBER_BLOCKS);
+    CHECK(sd_init() == 0);
+    pattern(_block, 20);
+    CHECK(sd_write_block(20, _block) == 0);
+    CHECK(sd_write_check() == 0);
+    
+    /* a block one member can't read comes from another */
+    sim_members[0]->bad_read = 20;
+    CHECK(sd_read_block(_read, 20) == 0);
+    CHECK(memcmp(_read, _block, SD_BLOCK_SIZE) == 0);
+    sim_members[0]->bad_read = -1;
+    sim_members[1]->bad_read = 20;
+    CHECK(sd_read_block(_read, 20) == 0);
+    CHECK(memcmp(_read, _block, SD_BLOCK_SIZE) == 0);
+    CHECK(stats.array_read_retries >= 1);
+    
+    /* none of them can */
+    sim_members[0]->bad_read = 20;
+    CHECK(sd_read_block(_read, 20) < 0);
+    CHECK(no_wrong_state());
+    return 0;
+}
+
+int check_mirror_overlap(void) 
+{
+    uint64_t serial_us, overlap_us;
+    
+    /* the next member takes the block while the first programs it */
+    reset(SIM_MEMBER_BLOCKS, SIM_MEMBER_BLOCKS);
+    CHECK(sd_init() == 0);
+    
+    sim_overlap = 0;
+    CHECK((serial_us = write_run(100, 128)) != 0);
+    sim_overlap = 1;
+    CHECK((overlap_us = write_run(100, 128)) != 0);
+    printf("  mirror: %llu us in turn, %llu us overlapped\n", 
+        (unsigned long long) serial_us, (unsigned long long) overlap_us);
+    CHECK(overlap_us < serial_us);
+    CHECK(no_wrong_state());
+    return 0;
+}
+#endif
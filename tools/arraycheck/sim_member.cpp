@@ -0,0 +1,174 @@
+/*
+ * sim_member implements the simulated array member of Sd2Card.h.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Sd2Card.h"
+
+/* polls of initPoll before a member is ready, ACMD41 takes a while */
+#define SIM_INIT_POLLS  (2)
+/* bus time of a command without data */
+#define SIM_COMMAND_US  (2)
+
+/******************************************************************************/
+
+uint64_t sim_bus_us       = 0;
+uint32_t sim_transfer_us  = 200;
+int      sim_overlap      = 1;
+Sd2Card *sim_members[SIM_MEMBERS_MAX];
+size_t   sim_member_count = 0;
+
+/******************************************************************************/
+
+Sd2Card::Sd2Card(void) 
+    : blocks(SIM_MEMBER_BLOCKS), serial(0), present(1), program_us(1000), 
+    busy_until(0), overlap(0), bad_read(-1), open(0), write_lba(0), 
+    written(0), writes(0), wrong_state(0), polls_(0) 
+{
+    memset(data, 0, sizeof(data));
+    if (sim_member_count < SIM_MEMBERS_MAX) 
+    {
+        sim_members[sim_member_count++] = this;
+    }
+}
+
+uint8_t Sd2Card::cardDetect(uint8_t chipSelectPin) 
+{
+    (void) chipSelectPin;
+    
+    return present;
+}
+
+uint8_t Sd2Card::initStart(uint8_t sckRateID, uint8_t chipSelectPin) 
+{
+    (void) sckRateID;
+    (void) chipSelectPin;
+    
+    polls_  = 0;
+    overlap = 0;
+    open    = 0;
+    return present;
+}
+
+uint8_t Sd2Card::initPoll(uint8_t *ready) 
+{
+    *ready = ++polls_ >= SIM_INIT_POLLS;
+    return present;
+}
+
+uint8_t Sd2Card::isBusy(void) 
+{
+    return sim_bus_us < busy_until;
+}
+
+uint16_t Sd2Card::cardStatus(void) 
+{
+    if (open) { wrong_state++; }
+    wait();
+    sim_bus_us += SIM_COMMAND_US;
+    
+    /* no answer from a pulled card reads as 0xff */
+    return present ? 0 : 0xff00;
+}
+
+uint8_t Sd2Card::enableCRC(uint8_t mode) 
+{
+    (void) mode;
+    
+    return 1;
+}
+
+uint8_t Sd2Card::readCID(cid_t *cid) 
+{
+    uint8_t *raw = reinterpret_cast<uint8_t *>(cid);
+    
+    memset(raw, 0, sizeof(*cid));
+    raw[9]  = serial >> 24;
+    raw[10] = serial >> 16;
+    raw[11] = serial >> 8;
+    raw[12] = serial;
+    return present;
+}
+
+uint8_t Sd2Card::readBlock(uint32_t block, uint8_t *dst) 
+{
+    if (open) { wrong_state++; }
+    transfer();
+    if (!present || block >= blocks || (int) block == bad_read) { return 0; }
+    memcpy(dst, data[block], 512);
+    return 1;
+}
+
+uint8_t Sd2Card::writeBlock(uint32_t block, const uint8_t *src) 
+{
+    if (open) { wrong_state++; }
+    transfer();
+    if (!present || block >= blocks) { return 0; }
+    memcpy(data[block], src, 512);
+    writes++;
+    program();
+    return 1;
+}
+
+uint8_t Sd2Card::writeStart(uint32_t block, uint32_t eraseCount) 
+{
+    (void) eraseCount;
+    
+    if (open) { wrong_state++; }
+    wait();
+    sim_bus_us += SIM_COMMAND_US;
+    if (!present || block >= blocks) { return 0; }
+    open      = 1;
+    write_lba = block;
+    written   = 0;
+    return 1;
+}
+
+uint8_t Sd2Card::writeData(const uint8_t *src) 
+{
+    if (!open) { wrong_state++; }
+    transfer();
+    if (!present || write_lba >= blocks) { return 0; }
+    memcpy(data[write_lba++], src, 512);
+    written++;
+    writes++;
+    program();
+    return 1;
+}
+
+uint8_t Sd2Card::writeStop(void) 
+{
+    if (!open) { wrong_state++; }
+    wait();
+    sim_bus_us += SIM_COMMAND_US;
+    open = 0;
+    program();
+    return present;
+}
+
+uint8_t Sd2Card::writtenBlocks(uint32_t *count) 
+{
+    *count = written;
+    return present;
+}
+
+/******************************************************************************/
+
+void Sd2Card::wait(void) 
+{
+    if (sim_bus_us < busy_until) { sim_bus_us = busy_until; }
+}
+
+void Sd2Card::transfer(void) 
+{
+    wait();
+    sim_bus_us += sim_transfer_us;
+}
+
+void Sd2Card::program(void) 
+{
+    busy_until = sim_bus_us + program_us;
+    if (!(overlap && sim_overlap)) { wait(); }
+}
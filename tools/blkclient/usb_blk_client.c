@@ -0,0 +1,290 @@
+/*
+ * usb_blk_client is the host side of include/usb_blk.h on libusb-1.0, see
+ * usb_blk_client.h. The wire format is little endian like the host.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <libusb.h>
+
+#include "usb_blk_client.h"
+
+#define RX_ENDPOINT (LIBUSB_ENDPOINT_OUT | USB_BLK_RX_ENDPOINT)
+#define TX_ENDPOINT (LIBUSB_ENDPOINT_IN | USB_BLK_TX_ENDPOINT)
+
+/* a request sent and not completed yet */
+struct inflight {
+    uint32_t tag;
+    uint8_t  op;
+    void    *data;
+    size_t   length;
+};
+
+struct usb_blk_client {
+    libusb_context       *context;
+    libusb_device_handle *handle;
+    uint32_t              tag;
+    size_t                head;
+    size_t                count;
+    struct inflight       inflight[USB_BLK_CLIENT_DEPTH];
+};
+
+/******************************************************************************/
+
+static int bulk(usb_blk_client_t *client, unsigned char endpoint, void *data, 
+    size_t length, int timeout);
+/* sends the request and the data of a WRITE */
+static int send_request(usb_blk_client_t *client, uint8_t op, uint8_t lun, 
+    const struct usb_blk_range *ranges, size_t count, void *data);
+/* 1 if `op` can't be sent before the requests in flight complete */
+static int must_wait(const usb_blk_client_t *client, uint8_t op);
+/* waits for all the requests in flight */
+static int finish(usb_blk_client_t *client);
+/* a READ or WRITE and its completion */
+static int run(usb_blk_client_t *client, uint8_t op, uint8_t lun, 
+    const struct usb_blk_range *ranges, size_t count, void *data, 
+    struct usb_blk_completion *completion);
+
+/******************************************************************************/
+
+usb_blk_client_t *usb_blk_client_open(uint16_t vendor_id, uint16_t product_id) 
+{
+    usb_blk_client_t *client;
+    
+    if ((client = calloc(1, sizeof(*client))) == NULL) { return NULL; }
+    if (libusb_init(&client->context) != 0) 
+    {
+        free(client);
+        return NULL;
+    }
+    
+    client->handle = libusb_open_device_with_vid_pid(client->context, 
+        vendor_id, product_id);
+    if (client->handle == NULL) 
+    {
+        libusb_exit(client->context);
+        free(client);
+        return NULL;
+    }
+    
+    libusb_set_auto_detach_kernel_driver(client->handle, 1);
+    if (libusb_claim_interface(client->handle, USB_BLK_INTERFACE) != 0) 
+    {
+        libusb_close(client->handle);
+        libusb_exit(client->context);
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+void usb_blk_client_close(usb_blk_client_t *client) 
+{
+    if (client == NULL) { return; }
+    libusb_release_interface(client->handle, USB_BLK_INTERFACE);
+    libusb_close(client->handle);
+    libusb_exit(client->context);
+    free(client);
+}
+
+int usb_blk_client_reset(usb_blk_client_t *client) 
+{
+    uint8_t packet[USB_BLK_PACKET_SIZE];
+    
+    if (libusb_control_transfer(client->handle, 
+            LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR |
+            LIBUSB_RECIPIENT_INTERFACE, USB_BLK_RESET, 0, USB_BLK_INTERFACE, 
+            NULL, 0, USB_BLK_CLIENT_TIMEOUT) < 0) 
+    {
+        return -1;
+    }
+    client->count = 0;
+    
+    /* a completion already queued on the endpoint is still sent */
+    while (bulk(client, TX_ENDPOINT, packet, sizeof(packet), 100) >= 0) { }
+    return 0;
+}
+
+int usb_blk_client_capacity(usb_blk_client_t *client, uint8_t lun, 
+    uint32_t *blocks) 
+{
+    struct usb_blk_completion completion;
+    int status;
+    
+    if (finish(client) < 0 || 
+            send_request(client, USB_BLK_OP_CAPACITY, lun, NULL, 0, 
+            NULL) < 0 || 
+            (status = usb_blk_client_wait(client, &completion)) < 0) 
+    {
+        return -1;
+    }
+    *blocks = le32toh(completion.blocks);
+    return status;
+}
+
+int usb_blk_client_read(usb_blk_client_t *client, uint8_t lun, 
+    const struct usb_blk_range *ranges, size_t count, void *data, 
+    struct usb_blk_completion *completion) 
+{
+    return run(client, USB_BLK_OP_READ, lun, ranges, count, data, completion);
+}
+
+int usb_blk_client_write(usb_blk_client_t *client, uint8_t lun, 
+    const struct usb_blk_range *ranges, size_t count, const void *data, 
+    struct usb_blk_completion *completion) 
+{
+    return run(client, USB_BLK_OP_WRITE, lun, ranges, count, (void *) data, 
+        completion);
+}
+
+int64_t usb_blk_client_submit(usb_blk_client_t *client, uint8_t op, 
+    uint8_t lun, const struct usb_blk_range *ranges, size_t count, 
+    void *data) 
+{
+    struct usb_blk_completion completion;
+    
+    if ((op != USB_BLK_OP_READ && op != USB_BLK_OP_WRITE) || count == 0 || 
+            count > USB_BLK_MAX_RANGES) 
+    {
+        return -1;
+    }
+    
+    while (must_wait(client, op)) 
+    {
+        if (usb_blk_client_wait(client, &completion) < 0) { return -1; }
+    }
+    if (send_request(client, op, lun, ranges, count, data) < 0) { return -1; }
+    return client->tag;
+}
+
+int usb_blk_client_wait(usb_blk_client_t *client, 
+    struct usb_blk_completion *completion) 
+{
+    struct inflight *request;
+    int length;
+    
+    if (client->count == 0) { return 0; }
+    request = &client->inflight[client->head];
+    client->head = (client->head + 1) % USB_BLK_CLIENT_DEPTH;
+    client->count--;
+    
+    /* a failed READ ends its data early with a short or zero length packet */
+    if (request->op == USB_BLK_OP_READ && 
+            bulk(client, TX_ENDPOINT, request->data, request->length, 
+            USB_BLK_CLIENT_TIMEOUT) < 0) 
+    {
+        return -1;
+    }
+    
+    length = bulk(client, TX_ENDPOINT, completion, sizeof(*completion), 
+        USB_BLK_CLIENT_TIMEOUT);
+    if (length != USB_BLK_COMPLETION_LENGTH || 
+            le32toh(completion->signature) != USB_BLK_COMPLETION_SIGNATURE || 
+            le32toh(completion->tag) != request->tag) 
+    {
+        return -1;
+    }
+    return completion->status;
+}
+
+/******************************************************************************/
+
+int bulk(usb_blk_client_t *client, unsigned char endpoint, void *data, 
+    size_t length, int timeout) 
+{
+    int transferred = 0;
+    
+    if (libusb_bulk_transfer(client->handle, endpoint, data, (int) length, 
+            &transferred, timeout) != 0) 
+    {
+        return -1;
+    }
+    return transferred;
+}
+
+int send_request(usb_blk_client_t *client, uint8_t op, uint8_t lun, 
+    const struct usb_blk_range *ranges, size_t count, void *data) 
+{
+    struct usb_blk_request request;
+    struct inflight *inflight;
+    size_t i, length = 0;
+    
+    memset(&request, 0, sizeof(request));
+    request.signature   = htole32(USB_BLK_REQUEST_SIGNATURE);
+    request.tag         = htole32(++client->tag);
+    request.op          = op;
+    request.lun         = lun;
+    request.range_count = (uint8_t) count;
+    for (i = 0; i < count; i++) 
+    {
+        request.ranges[i].lba   = htole32(ranges[i].lba);
+        request.ranges[i].count = htole16(ranges[i].count);
+        length += ranges[i].count * USB_BLK_BLOCK_SIZE;
+    }
+    
+    if (bulk(client, RX_ENDPOINT, &request, USB_BLK_REQUEST_LENGTH(count), 
+            USB_BLK_CLIENT_TIMEOUT) < 0) 
+    {
+        return -1;
+    }
+    if (op == USB_BLK_OP_WRITE && bulk(client, RX_ENDPOINT, data, length, 
+            USB_BLK_CLIENT_TIMEOUT) < 0) 
+    {
+        return -1;
+    }
+    
+    inflight = &client->inflight[(client->head + client->count) %
+        USB_BLK_CLIENT_DEPTH];
+    client->count++;
+    *inflight = (struct inflight) {
+        .tag    = client->tag, 
+        .op     = op, 
+        .data   = data, 
+        .length = length
+    };
+    return 0;
+}
+
+int must_wait(const usb_blk_client_t *client, uint8_t op) 
+{
+    size_t i;
+    
+    if (client->count >= USB_BLK_CLIENT_DEPTH) { return 1; }
+    
+    /* the device takes a single request past a READ whose data wasn't read, 
+       anything more, like the data of a WRITE, is NAKed until it is */
+    for (i = 0; i < client->count; i++) 
+    {
+        if (client->inflight[(client->head + i) % USB_BLK_CLIENT_DEPTH].op == 
+                USB_BLK_OP_READ) 
+        {
+            return op == USB_BLK_OP_WRITE || i + 1 < client->count;
+        }
+    }
+    return 0;
+}
+
+int finish(usb_blk_client_t *client) 
+{
+    struct usb_blk_completion completion;
+    
+    while (client->count > 0) 
+    {
+        if (usb_blk_client_wait(client, &completion) < 0) { return -1; }
+    }
+    return 0;
+}
+
+int run(usb_blk_client_t *client, uint8_t op, uint8_t lun, 
+    const struct usb_blk_range *ranges, size_t count, void *data, 
+    struct usb_blk_completion *completion) 
+{
+    struct usb_blk_completion c;
+    
+    if (finish(client) < 0 || 
+            usb_blk_client_submit(client, op, lun, ranges, count, data) < 0) 
+    {
+        return -1;
+    }
+    return usb_blk_client_wait(client, completion ? completion : &c);
+}
@@ -0,0 +1,64 @@
+#ifndef _usb_blk_client_h_
+#define _usb_blk_client_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "usb_blk.h"
+
+/*
+ * A libusb client of the device's vendor block interface (include/usb_blk.h), 
+ * for firmware built with -DUSB_BLK. The calls block until the device answers
+ * or USB_BLK_CLIENT_TIMEOUT ms pass, all return < 0 on a transfer error.
+ *
+ * `usb_blk_client_submit` sends a request without waiting for it and
+ * `usb_blk_client_wait` returns the completions in the order of the requests, 
+ * up to USB_BLK_CLIENT_DEPTH can be in flight. The data of a READ is taken in
+ * by the `usb_blk_client_wait` of its completion.
+ */
+
+#define USB_BLK_CLIENT_VENDOR_ID  (0x16c0)
+#define USB_BLK_CLIENT_PRODUCT_ID (0x0484)
+
+/* the device keeps as many completions for the host */
+#define USB_BLK_CLIENT_DEPTH      (4)
+#define USB_BLK_CLIENT_TIMEOUT    (5000)
+
+typedef struct usb_blk_client usb_blk_client_t;
+
+/* opens the first device with the ids and claims its interface, NULL if none */
+usb_blk_client_t *usb_blk_client_open(uint16_t vendor_id, uint16_t product_id);
+void usb_blk_client_close(usb_blk_client_t *client);
+
+/* drops the requests in flight, after a failed transfer or an INVALID one */
+int usb_blk_client_reset(usb_blk_client_t *client);
+
+/* `blocks` of the lun, returns the status of the completion */
+int usb_blk_client_capacity(usb_blk_client_t *client, uint8_t lun, 
+    uint32_t *blocks);
+
+/*
+ * moves the blocks of `count` ranges from or to `data`, the blocks of all the
+ * ranges back to back. Returns the status of the completion, `completion` is
+ * set if not NULL.
+ */
+int usb_blk_client_read(usb_blk_client_t *client, uint8_t lun, 
+    const struct usb_blk_range *ranges, size_t count, void *data, 
+    struct usb_blk_completion *completion);
+int usb_blk_client_write(usb_blk_client_t *client, uint8_t lun, 
+    const struct usb_blk_range *ranges, size_t count, const void *data, 
+    struct usb_blk_completion *completion);
+
+/*
+ * sends a READ or WRITE like above without waiting for its completion, `data`
+ * has to stay valid until then. Waits for the earlier requests when the device
+ * can't take it yet. Returns the tag of the request.
+ */
+int64_t usb_blk_client_submit(usb_blk_client_t *client, uint8_t op, 
+    uint8_t lun, const struct usb_blk_range *ranges, size_t count, 
+    void *data);
+
+/* the completion of the oldest request in flight, returns 0 if there is none */
+int usb_blk_client_wait(usb_blk_client_t *client, 
+    struct usb_blk_completion *completion);
+
+#endif
@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# Measures the usb/bulk only transport path without the sd card by looping 
+# WRITE BUFFER and READ BUFFER (10) through the device's io buffer. Needs
+# sg3_utils (sg_read_buffer, sg_write_buffer) and access to the sg device.
+#
+#   usage: buffer_loopback.sh /dev/sgN [iterations] [data|echo]
+#
+
+DEV=${1:?usage: $0 /dev/sgN [iterations] [data|echo]}
+COUNT=${2:-1000}
+MODE=${3:-data}
+
+case "$MODE" in
+    data) DESC=desc ;;
+    echo) DESC=echo_desc ;;
+    *)    echo "mode is data or echo" >&2; exit 1 ;;
+esac
+
+# the buffer capacity is the last 3 (data) or 2 (echo) bytes of the descriptor
+SIZE=$(sg_read_buffer --mode=$DESC --length=4 --raw "$DEV" | od -An -tu1 | 
+    awk -v mode="$MODE" '{ 
+        if (mode == "data") { print $2 * 65536 + $3 * 256 + $4 } 
+        else                { print ($3 % 32) * 256 + $4 } }')
+if [ -z "$SIZE" ] || [ "$SIZE" -eq 0 ]; then
+    echo "$DEV: no $MODE buffer" >&2
+    exit 1
+fi
+
+PATTERN=$(mktemp)
+READBACK=$(mktemp)
+trap 'rm -f "$PATTERN" "$READBACK"' EXIT
+head -c "$SIZE" /dev/urandom > "$PATTERN"
+
+echo "$DEV: $MODE buffer of $SIZE bytes, $COUNT iterations"
+
+# one round trip first to check the data comes back intact
+sg_write_buffer --mode=$MODE --in="$PATTERN" --length="$SIZE" "$DEV" || exit 1
+sg_read_buffer --mode=$MODE --length="$SIZE" --raw "$DEV" > "$READBACK" || exit 1
+if ! cmp -s "$PATTERN" "$READBACK"; then
+    echo "$DEV: read back data differs" >&2
+    exit 1
+fi
+
+now() { date +%s%N; }
+
+START=$(now)
+i=0
+while [ $i -lt "$COUNT" ]; do
+    sg_write_buffer --mode=$MODE --in="$PATTERN" --length="$SIZE" "$DEV" || exit 1
+    i=$((i + 1))
+done
+WRITE_NS=$(($(now) - START))
+
+START=$(now)
+i=0
+while [ $i -lt "$COUNT" ]; do
+    sg_read_buffer --mode=$MODE --length="$SIZE" --raw "$DEV" > /dev/null || exit 1
+    i=$((i + 1))
+done
+READ_NS=$(($(now) - START))
+
+# the times include starting the sg_* processes, compare runs of the same size
+awk -v n="$COUNT" -v size="$SIZE" -v w="$WRITE_NS" -v r="$READ_NS" 'BEGIN {
+    printf "WRITE BUFFER %8.1f us/cmd %8.1f KiB/s\n", w / n / 1000, n * size / 1024 / (w / 1e9);
+    printf "READ BUFFER  %8.1f us/cmd %8.1f KiB/s\n", r / n / 1000, n * size / 1024 / (r / 1e9);
+}'
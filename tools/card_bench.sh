@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Runs the device's card self benchmark (SEND DIAGNOSTIC, see include/bench.h)
+# and prints the results of the RECEIVE DIAGNOSTIC RESULTS bench page. The
+# firmware has to be built with a scratch region (SD_SCRATCH_BLOCKS in the 
+# Makefile). Needs sg3_utils (sg_raw) and access to the sg device.
+#
+#   usage: card_bench.sh /dev/sgN [short|extended|SEQ_BLOCKS RANDOM_OPS [SEED]]
+#
+
+DEV=${1:?usage: $0 /dev/sgN [short|extended|SEQ_BLOCKS RANDOM_OPS [SEED]]}
+RUN=${2:-short}
+
+be32() { printf '%02x %02x %02x %02x' $(($1 >> 24 & 255)) $(($1 >> 16 & 255)) \
+    $(($1 >> 8 & 255)) $(($1 & 255)); }
+
+case "$RUN" in
+    # background self test codes, the run is stepped between commands
+    short)    sg_raw "$DEV" 1d 20 00 00 00 00 || exit 1 ;;
+    extended) sg_raw "$DEV" 1d 40 00 00 00 00 || exit 1 ;;
+    *)
+        PAGE=$(mktemp)
+        trap 'rm -f "$PAGE"' EXIT
+        # the bench page: header then seq blocks, random ops and seed
+        for b in 80 00 00 0c $(be32 "$RUN") $(be32 "${3:?random ops}") \
+                $(be32 "${4:-0}"); do
+            printf "\\$(printf '%03o' 0x$b)"
+        done > "$PAGE"
+        sg_raw -s 16 -i "$PAGE" "$DEV" 1d 10 00 00 10 00 || exit 1
+        ;;
+esac
+
+page() { sg_raw -r 128 -b "$DEV" 1c 01 80 00 80 00 2>/dev/null | od -An -tu1 -v; }
+
+# status 1 is running
+while [ "$(page | awk '{ print $5; exit }')" = 1 ]; do sleep 1; done
+
+page | tr -s ' \n' '\n\n' | awk 'NF { b[n++] = $1 } 
+function u32(o) { return ((b[o] * 256 + b[o + 1]) * 256 + b[o + 2]) * 256 + b[o + 3] }
+END {
+    split("done failed aborted", names, " ");
+    if (b[4] < 2) { print "no results"; exit 1 }
+    hz = u32(8);
+    printf "%s, scratch 0x%x (%u blocks), seq %u blocks, random %u ops\n", 
+        names[b[4] - 1], u32(12), u32(16), u32(20), u32(24);
+    split("seq-read seq-write rand-read rand-write", tests, " ");
+    for (t = 0; t < 4; t++) {
+        o = 32 + t * 24;
+        ops = u32(o); if (ops == 0) { continue }
+        s = (u32(o + 8) * 4294967296 + u32(o + 12)) / hz;
+        printf "%-10s %8.1f KiB/s %8.1f IOPS  us/op avg %8.1f min %8.1f max %8.1f\n",
+            tests[t + 1], u32(o + 4) * 512 / 1024 / s, ops / s, s / ops * 1e6,
+            u32(o + 16) / hz * 1e6, u32(o + 20) / hz * 1e6;
+    }
+}'
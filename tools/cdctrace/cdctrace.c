@@ -0,0 +1,146 @@
+/*
+ * cdctrace reads the records of the trace port of include/usb_cdc.h from its
+ * tty and prints one line for each. Bytes up to the next sync byte are
+ * skipped, after a record that was cut off by the port closing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "usb_cdc.h"
+
+/* the largest payload the device's buffer can hold */
+#define MAX_PAYLOAD (USB_CDC_BUFFER_SIZE)
+
+/******************************************************************************/
+
+/* reads exactly `length` bytes, < 0 on an error or the end of the port */
+static int read_all(int fd, void *dest, size_t length);
+static void print_stats(const uint8_t *payload, size_t length);
+static void print_command(const uint8_t *payload, size_t length);
+
+/******************************************************************************/
+
+int main(int argc, char **argv) 
+{
+    struct usb_cdc_record_header header;
+    struct termios tio;
+    static uint8_t payload[MAX_PAYLOAD + 1];
+    uint16_t length;
+    uint32_t dropped;
+    int fd;
+    
+    if (argc != 2) 
+    {
+        fprintf(stderr, "usage: %s /dev/ttyACMn\n", argv[0]);
+        return 2;
+    }
+    if ((fd = open(argv[1], O_RDONLY | O_NOCTTY)) < 0) 
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    /* raw, opening the tty set DTR which opens the port */
+    if (tcgetattr(fd, &tio) == 0) 
+    {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    
+    for (;;) 
+    {
+        if (read_all(fd, &header.sync, 1) < 0) { break; }
+        if (header.sync != USB_CDC_RECORD_SYNC) { continue; }
+        if (read_all(fd, &header.type, sizeof(header) - 1) < 0) { break; }
+        
+        length = le16toh(header.length);
+        if (length > MAX_PAYLOAD) { continue; }
+        if (read_all(fd, payload, length) < 0) { break; }
+        
+        printf("%10u ", le32toh(header.ms));
+        switch (header.type) 
+        {
+        case USB_CDC_RECORD_STATS:
+            print_stats(payload, length);
+            break;
+            
+        case USB_CDC_RECORD_COMMAND:
+            print_command(payload, length);
+            break;
+            
+        case USB_CDC_RECORD_LOG:
+            payload[length] = '\0';
+            printf("log %s\n", (const char *) payload);
+            break;
+            
+        case USB_CDC_RECORD_DROPPED:
+            if (length < sizeof(dropped)) { break; }
+            memcpy(&dropped, payload, sizeof(dropped));
+            printf("dropped %u records\n", le32toh(dropped));
+            break;
+            
+        default:
+            printf("unknown record 0x%02x of %u bytes\n", header.type, length);
+            break;
+        }
+        fflush(stdout);
+    }
+    close(fd);
+    return 0;
+}
+
+/******************************************************************************/
+
+int read_all(int fd, void *dest, size_t length) 
+{
+    uint8_t *bytes = dest;
+    ssize_t count;
+    
+    while (length > 0) 
+    {
+        if ((count = read(fd, bytes, length)) <= 0) { return -1; }
+        bytes  += count;
+        length -= (size_t) count;
+    }
+    return 0;
+}
+
+void print_stats(const uint8_t *payload, size_t length) 
+{
+    uint32_t value;
+    size_t i;
+    
+    /* by index, the order of the counters in stats.h */
+    printf("stats");
+    for (i = 0; i + sizeof(value) <= length; i += sizeof(value)) 
+    {
+        memcpy(&value, &payload[i], sizeof(value));
+        printf(" %zu=%u", i / sizeof(value), le32toh(value));
+    }
+    printf("\n");
+}
+
+void print_command(const uint8_t *payload, size_t length) 
+{
+    struct usb_cdc_command_record record;
+    size_t i;
+    
+    if (length < sizeof(record)) 
+    {
+        printf("short command record\n");
+        return;
+    }
+    memcpy(&record, payload, sizeof(record));
+    
+    printf("lun %u status %u bytes %u us %u cdb", record.lun, record.status, 
+        le32toh(record.bytes), le32toh(record.us));
+    for (i = 0; i < record.cdb_length && i < sizeof(record.cdb); i++) 
+    {
+        printf(" %02x", record.cdb[i]);
+    }
+    printf("\n");
+}
@@ -0,0 +1,449 @@
+/*
+ * ftlbench runs the same host workloads on the card of sim_card.h twice, as
+ * scsi_sd.c would without the log (a multiple block write per request to its
+ * home location) and through the translation layer (src/ftl.c, -DSD_FTL),
+ * and prints what each took on the simulated clock, e.g.
+ *
+ *   ./ftlbench -n 2000
+ *   ./ftlbench -w rand4k -a 20000 -o 1
+ *
+ * Requests are issued one at a time and the main loop gets to run between
+ * them: `ftl_poll` is called at least once and for as long as the host waits
+ * before its next request (-g). The latency of a request is the card time of
+ * its write, or of its reads, including the polls and retries of a write the
+ * log refused. Every block written carries its lba and a version, and all of
+ * the span is read back and checked at the end of a run.
+ *
+ * The numbers are only as good as the model of sim_card.h, whose parameters
+ * are assumptions that can be set from the command line. Time the firmware
+ * spends on the cpu isn't counted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sd.h"
+#include "ftl.h"
+#include "stats.h"
+#include "sim_card.h"
+
+/* polls a refused write is given before the run fails */
+#define RETRY_POLLS         (100000)
+/* blocks of the largest request */
+#define MAX_REQUEST_BLOCKS  (128)
+
+/*--- WORKLOADS --------------------------------------------------------------*/
+typedef struct {
+    const char *name;
+    int         write;                  /* 0 for reads                        */
+    int         random;                 /* 0 for sequential requests          */
+    uint32_t    blocks;                 /* blocks per request                 */
+} workload_t;
+
+static const workload_t _workloads[] = {
+    { "rand4k",   1, 1, 8   }, 
+    { "rand512",  1, 1, 1   }, 
+    { "seq64k",   1, 0, 128 }, 
+    /* reads of what the rand4k writes of the same seed left */
+    { "randread", 0, 1, 8   }, 
+};
+
+#define WORKLOAD_COUNT (sizeof(_workloads) / sizeof(_workloads[0]))
+
+/* what a run measured */
+typedef struct {
+    uint64_t us;                        /* card time of the whole run         */
+    uint64_t latency_us;                /* sum of the request latencies       */
+    uint64_t max_latency_us;
+    uint32_t host_blocks;               /* blocks written or read by the host */
+    uint32_t card_blocks;               /* and by the card                    */
+    uint32_t gc_blocks;                 /* copied home by the log             */
+    uint32_t refusals;                  /* writes the log refused             */
+    uint32_t rmws;
+    uint32_t au_switches;
+} result_t;
+
+/******************************************************************************/
+
+static uint32_t  _requests = 2000;
+static uint32_t  _span_mb  = 64;
+static uint32_t  _gap_us   = 0;
+static uint32_t  _seed     = 1;
+
+/* the version last written to each block of the span, 0 if never */
+static uint32_t *_versions = NULL;
+static uint32_t  _span     = 0;
+static uint32_t  _rng      = 0;
+static uint8_t   _buffer[MAX_REQUEST_BLOCKS * SD_BLOCK_SIZE];
+
+/******************************************************************************/
+
+static void usage(const char *name);
+/* runs `w` on a new card, through the log if `ftl`. Returns < 0 if it failed
+   or read back anything else than was written */
+static int run(const workload_t *w, int ftl, result_t *r);
+static void print_result(const workload_t *w, int ftl, const result_t *r);
+/* the requests of `w`, each followed by the main loop's polling */
+static int issue(const workload_t *w, int ftl, result_t *r);
+static int write_request(uint32_t lba, uint32_t count, int ftl, result_t *r);
+static int read_request(uint32_t lba, uint32_t count, int ftl);
+/* checks every block of the span against its version */
+static int verify(int ftl);
+/* lets the main loop run for `us`, `ftl_poll` at least once */
+static void main_loop(int ftl, uint64_t us);
+
+/* the content of version `version` of block `lba` */
+static void fill_block(uint8_t *block, uint32_t lba, uint32_t version);
+static int check_block(const uint8_t *block, uint32_t lba, uint32_t version);
+static uint32_t next_random(void);
+
+/******************************************************************************/
+
+int main(int argc, char **argv) 
+{
+    sim_card_model_t *m = &sim_card_model;
+    const char *only = NULL;
+    result_t r;
+    uint32_t i;
+    int opt, ftl, found = 0;
+    
+    while ((opt = getopt(argc, argv, "n:S:g:r:w:b:u:c:x:R:P:m:a:o:e:")) != -1) 
+    {
+        switch (opt) 
+        {
+        case 'n': _requests       = strtoul(optarg, NULL, 0);        break;
+        case 'S': _span_mb        = strtoul(optarg, NULL, 0);        break;
+        case 'g': _gap_us         = strtoul(optarg, NULL, 0);        break;
+        case 'r': _seed           = strtoul(optarg, NULL, 0);        break;
+        case 'w': only            = optarg;                          break;
+        case 'b': m->blocks       = strtoul(optarg, NULL, 0) * 2048; break;
+        case 'u': m->au_blocks    = strtoul(optarg, NULL, 0) * 2;    break;
+        case 'c': m->cmd_us       = strtoul(optarg, NULL, 0);        break;
+        case 'x': m->xfer_us      = strtoul(optarg, NULL, 0);        break;
+        case 'R': m->read_us      = strtoul(optarg, NULL, 0);        break;
+        case 'P': m->prog_us      = strtoul(optarg, NULL, 0);        break;
+        case 'm': m->rmw_us       = strtoul(optarg, NULL, 0);        break;
+        case 'a': m->au_switch_us = strtoul(optarg, NULL, 0);        break;
+        case 'o': m->open_aus     = strtoul(optarg, NULL, 0);        break;
+        case 'e': m->erase_us     = strtoul(optarg, NULL, 0);        break;
+        default:  usage(argv[0]);                                    return 2;
+        }
+    }
+    if (optind != argc || _requests == 0 || _span_mb == 0 || 
+            m->au_blocks == 0 || m->blocks == 0) 
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    
+    printf("model (assumed, not measured): %u MiB card, %u KiB units, "
+        "%u open\n", m->blocks / 2048, m->au_blocks / 2, m->open_aus);
+    printf("  us: command %u, block transfer %u, read access %u, "
+        "program %u,\n", m->cmd_us, m->xfer_us, m->read_us, m->prog_us);
+    printf("      out of order block %u, unit switch %u, erase %u\n", 
+        m->rmw_us, m->au_switch_us, m->erase_us);
+    printf("%u requests over %u MiB, %u us between them, seed %u\n\n", 
+        _requests, _span_mb, _gap_us, _seed);
+    printf("%-9s %-6s %8s %9s %9s %7s %8s %8s %6s %6s\n", 
+        "workload", "path", "MB/s", "mean us", "max us", "w.amp", 
+        "gc blks", "refused", "rmws", "aus");
+        
+    for (i = 0; i < WORKLOAD_COUNT; i++) 
+    {
+        if (only != NULL && strcmp(only, _workloads[i].name) != 0) 
+        {
+            continue;
+        }
+        found = 1;
+        
+        for (ftl = 0; ftl <= 1; ftl++) 
+        {
+            if (run(&_workloads[i], ftl, &r) < 0) { return 1; }
+            print_result(&_workloads[i], ftl, &r);
+        }
+    }
+    if (!found) 
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    return 0;
+}
+
+void usage(const char *name) 
+{
+    fprintf(stderr, 
+        "usage: %s [-n requests] [-S span MiB] [-g us] [-r seed] "
+        "[-w workload]\n"
+        "          [model options]\n"
+        "  -n  requests per run\n"
+        "  -S  MiB at the start of the card the requests go to\n"
+        "  -g  us the host waits between requests, the main loop polls\n"
+        "  -r  seed of the random lbas\n"
+        "  -w  only run rand4k, rand512, seq64k or randread\n"
+        "model options, see sim_card.h:\n"
+        "  -b  MiB of the card        -u  KiB of an allocation unit\n"
+        "  -c  us of a command        -x  us of a block transfer\n"
+        "  -R  us of read access      -P  us to program a block\n"
+        "  -m  us of an out of order block\n"
+        "  -a  us to switch to a unit that isn't open\n"
+        "  -o  units the card keeps open\n"
+        "  -e  us of an erase\n", 
+        name);
+}
+
+int run(const workload_t *w, int ftl, result_t *r) 
+{
+    uint32_t max_lba;
+    uint64_t start;
+    sim_card_stats_t before;
+    
+    memset(r, 0, sizeof(*r));
+    memset(&stats, 0, sizeof(stats));
+    if (sim_card_reset() < 0) 
+    {
+        fprintf(stderr, "no memory for the card\n");
+        return -1;
+    }
+    if (ftl && ftl_init() != 0) 
+    {
+        fprintf(stderr, "the log doesn't fit on the card\n");
+        return -1;
+    }
+    
+    max_lba = ftl ? ftl_max_lba() : sd_max_lba();
+    _span   = _span_mb * 2048;
+    if (_span > max_lba) { _span = max_lba; }
+    if (_span < MAX_REQUEST_BLOCKS) 
+    {
+        fprintf(stderr, "the span is too small\n");
+        return -1;
+    }
+    
+    free(_versions);
+    if ((_versions = calloc(_span, sizeof(uint32_t))) == NULL) { return -1; }
+    _rng = _seed;
+    
+    /* the reads are of what random writes left, unmeasured */
+    if (!w->write && issue(&_workloads[0], ftl, r) < 0) { return -1; }
+    
+    memset(r, 0, sizeof(*r));
+    before = sim_card_stats;
+    start  = sim_card_now_us();
+    stats.ftl_gc_blocks = 0;
+    
+    if (issue(w, ftl, r) < 0) { return -1; }
+    
+    r->us          = sim_card_now_us() - start;
+    r->card_blocks = w->write ? 
+        sim_card_stats.blocks_written - before.blocks_written :
+        sim_card_stats.blocks_read - before.blocks_read;
+    r->gc_blocks   = stats.ftl_gc_blocks;
+    r->rmws        = sim_card_stats.rmws - before.rmws;
+    r->au_switches = sim_card_stats.au_switches - before.au_switches;
+    
+    if (verify(ftl) < 0) 
+    {
+        fprintf(stderr, "%s: data read back differs\n", w->name);
+        return -1;
+    }
+    return 0;
+}
+
+void print_result(const workload_t *w, int ftl, const result_t *r) 
+{
+    double mb = (double) r->host_blocks * SD_BLOCK_SIZE / 1e6;
+    
+    printf("%-9s %-6s %8.3f %9.0f %9llu %7.2f %8u %8u %6u %6u\n", 
+        w->name, ftl ? "ftl" : "direct", 
+        r->us ? mb / ((double) r->us / 1e6) : 0.0, 
+        (double) r->latency_us / _requests, 
+        (unsigned long long) r->max_latency_us, 
+        r->host_blocks ? (double) r->card_blocks / r->host_blocks : 0.0, 
+        r->gc_blocks, r->refusals, r->rmws, r->au_switches);
+}
+
+int issue(const workload_t *w, int ftl, result_t *r) 
+{
+    uint32_t i, lba, slots, cursor = 0;
+    uint64_t start, latency;
+    
+    slots = _span / w->blocks;
+    
+    for (i = 0; i < _requests; i++) 
+    {
+        if (w->random) 
+        {
+            lba = (next_random() % slots) * w->blocks;
+        }
+        else 
+        {
+            lba    = cursor;
+            cursor = (cursor + w->blocks) % (slots * w->blocks);
+        }
+        
+        start = sim_card_now_us();
+        if (w->write) 
+        {
+            if (write_request(lba, w->blocks, ftl, r) < 0) { return -1; }
+        }
+        else 
+        {
+            if (read_request(lba, w->blocks, ftl) < 0) { return -1; }
+        }
+        latency = sim_card_now_us() - start;
+        
+        r->latency_us += latency;
+        if (latency > r->max_latency_us) { r->max_latency_us = latency; }
+        r->host_blocks += w->blocks;
+        
+        main_loop(ftl, _gap_us);
+    }
+    return 0;
+}
+
+int write_request(uint32_t lba, uint32_t count, int ftl, result_t *r) 
+{
+    uint32_t i, polls = 0;
+    int failed;
+    
+    for (i = 0; i < count; i++) 
+    {
+        _versions[lba + i]++;
+        fill_block(&_buffer[i * SD_BLOCK_SIZE], lba + i, _versions[lba + i]);
+    }
+    
+    if (!ftl) 
+    {
+        if (sd_write_start(lba, count) != 0) { return -1; }
+        for (i = 0; i < count; i++) 
+        {
+            if (sd_write_data(&_buffer[i * SD_BLOCK_SIZE]) != 0) 
+            {
+                sd_write_stop();
+                return -1;
+            }
+        }
+        return sd_write_stop() != 0 ? -1 : 0;
+    }
+    
+    /* a write the log refused is retried once the main loop collected, like
+       the host retries it after the NOT READY sense */
+    for (;;) 
+    {
+        failed = ftl_write_start(lba, count) != 0;
+        for (i = 0; i < count && !failed; i++) 
+        {
+            failed = ftl_write_data(&_buffer[i * SD_BLOCK_SIZE]) != 0;
+        }
+        if (ftl_write_stop() != 0) { failed = 1; }
+        
+        if (!failed) { return 0; }
+        if (!ftl_full() || polls++ >= RETRY_POLLS) 
+        {
+            fprintf(stderr, "write of 0x%08x failed\n", lba);
+            return -1;
+        }
+        r->refusals++;
+        main_loop(ftl, 0);
+    }
+}
+
+int read_request(uint32_t lba, uint32_t count, int ftl) 
+{
+    uint32_t i;
+    int result;
+    
+    for (i = 0; i < count; i++) 
+    {
+        result = ftl ? ftl_read_block(_buffer, lba + i) :
+            sd_read_block(_buffer, lba + i);
+        if (result != 0 || check_block(_buffer, lba + i, _versions[lba + i])) 
+        {
+            fprintf(stderr, "read of 0x%08x failed\n", lba + i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int verify(int ftl) 
+{
+    uint32_t lba;
+    int result;
+    
+    for (lba = 0; lba < _span; lba++) 
+    {
+        result = ftl ? ftl_read_block(_buffer, lba) :
+            sd_read_block(_buffer, lba);
+        if (result != 0 || check_block(_buffer, lba, _versions[lba]) != 0) 
+        {
+            fprintf(stderr, "block 0x%08x isn't version %u\n", lba, 
+                _versions[lba]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void main_loop(int ftl, uint64_t us) 
+{
+    uint64_t until = sim_card_now_us() + us;
+    uint64_t before;
+    
+    if (!ftl) 
+    {
+        sim_card_wait_us(us);
+        return;
+    }
+    
+    do 
+    {
+        before = sim_card_now_us();
+        ftl_poll();
+        
+        /* nothing to do, the loop idles until the host comes back */
+        if (sim_card_now_us() == before && before < until) 
+        {
+            sim_card_wait_us(until - before);
+        }
+    } while (sim_card_now_us() < until);
+}
+
+void fill_block(uint8_t *block, uint32_t lba, uint32_t version) 
+{
+    uint32_t i, x = lba * 2654435761u + version;
+    
+    if (version == 0) 
+    {
+        memset(block, 0, SD_BLOCK_SIZE);
+        return;
+    }
+    for (i = 0; i < SD_BLOCK_SIZE; i += 4) 
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        memcpy(&block[i], &x, 4);
+    }
+    memcpy(&block[0], &lba, 4);
+    memcpy(&block[4], &version, 4);
+}
+
+int check_block(const uint8_t *block, uint32_t lba, uint32_t version) 
+{
+    static uint8_t expected[SD_BLOCK_SIZE];
+    
+    fill_block(expected, lba, version);
+    return memcmp(block, expected, SD_BLOCK_SIZE) != 0 ? -1 : 0;
+}
+
+uint32_t next_random(void) 
+{
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return _rng;
+}
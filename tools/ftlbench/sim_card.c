@@ -0,0 +1,240 @@
+/*
+ * sim_card implements sd.h in memory with the timing of sim_card.h. The card
+ * is always present and up, erased blocks read as 0x00.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sd.h"
+#include "host.h"
+#include "sim_card.h"
+
+/******************************************************************************/
+
+sim_card_model_t sim_card_model = SIM_CARD_MODEL_DEFAULT;
+sim_card_stats_t sim_card_stats = {0};
+
+static uint8_t  *_data   = NULL;
+static uint32_t  _blocks = 0;
+static uint64_t  _now_us = 0;
+
+/* the units the card has open, most recently used first, and the block each
+   of them expects next */
+#define SIM_CARD_MAX_OPEN (16)
+static struct {
+    uint32_t au;
+    uint32_t next;
+} _open[SIM_CARD_MAX_OPEN];
+static uint32_t _open_count = 0;
+
+/* the multiple block write that is open */
+static struct {
+    int      open;
+    uint32_t lba;
+    uint32_t count;                     /* blocks written so far              */
+} _write = {0};
+
+/******************************************************************************/
+
+/* the clock millis() runs off */
+static uint64_t clock_ns(void);
+/* moves the clock for programming `lba`, the unit it is in becomes the most
+   recently used open one */
+static void program(uint32_t lba);
+
+/******************************************************************************/
+
+int sim_card_reset(void) 
+{
+    free(_data);
+    
+    _blocks = sim_card_model.blocks;
+    if ((_data = calloc(_blocks, SD_BLOCK_SIZE)) == NULL) { return -1; }
+    
+    if (sim_card_model.open_aus == 0) { sim_card_model.open_aus = 1; }
+    if (sim_card_model.open_aus > SIM_CARD_MAX_OPEN) 
+    {
+        sim_card_model.open_aus = SIM_CARD_MAX_OPEN;
+    }
+    _open_count   = 0;
+    _write.open   = 0;
+    _now_us       = 0;
+    host_clock_ns = clock_ns;
+    memset(&sim_card_stats, 0, sizeof(sim_card_stats));
+    return 0;
+}
+
+uint64_t sim_card_now_us(void) 
+{
+    return _now_us;
+}
+
+void sim_card_wait_us(uint64_t us) 
+{
+    _now_us += us;
+}
+
+/*--- sd.h -------------------------------------------------------------------*/
+int sd_init(void)       { return _data == NULL ? -1 : 0; }
+int sd_init_start(void) { return _data == NULL ? -1 : 0; }
+int sd_init_step(void)  { return 0; }
+int sd_present(void)    { return _data != NULL; }
+int sd_suspend(void)    { return 0; }
+int sd_resume(void)     { return 0; }
+
+uint32_t sd_max_lba(void) 
+{
+    return _blocks;
+}
+
+int sd_read_block(void *dest, uint32_t lba) 
+{
+    if (lba >= _blocks) { return -1; }
+    
+    sim_card_stats.commands++;
+    sim_card_stats.blocks_read++;
+    _now_us += sim_card_model.cmd_us + sim_card_model.read_us + 
+        sim_card_model.xfer_us;
+    memcpy(dest, _data + (size_t) lba * SD_BLOCK_SIZE, SD_BLOCK_SIZE);
+    return 0;
+}
+
+int sd_write_block(uint32_t lba, const void *src) 
+{
+    if (lba >= _blocks) { return -1; }
+    
+    sim_card_stats.commands++;
+    _now_us += sim_card_model.cmd_us;
+    program(lba);
+    memcpy(_data + (size_t) lba * SD_BLOCK_SIZE, src, SD_BLOCK_SIZE);
+    return 0;
+}
+
+int sd_write_check(void) 
+{
+    sim_card_stats.commands++;
+    _now_us += sim_card_model.cmd_us;
+    return 0;
+}
+
+int sd_write_start(uint32_t lba, uint32_t count) 
+{
+    (void) count;
+    
+    /* ACMD23 and CMD25 */
+    sim_card_stats.commands += 2;
+    _now_us += 2 * sim_card_model.cmd_us;
+    
+    _write.open  = 1;
+    _write.lba   = lba;
+    _write.count = 0;
+    return 0;
+}
+
+int sd_write_data(const void *src) 
+{
+    uint32_t lba = _write.lba + _write.count;
+    
+    if (!_write.open || lba >= _blocks) { return -1; }
+    
+    program(lba);
+    memcpy(_data + (size_t) lba * SD_BLOCK_SIZE, src, SD_BLOCK_SIZE);
+    _write.count++;
+    return 0;
+}
+
+int sd_write_stop(void) 
+{
+    /* the stop token and the CMD13 checking the blocks */
+    sim_card_stats.commands++;
+    _now_us += 2 * sim_card_model.cmd_us;
+    _write.open = 0;
+    return 0;
+}
+
+int sd_written_blocks(uint32_t *count) 
+{
+    *count = _write.count;
+    return 0;
+}
+
+uint32_t sd_erase_group(void) 
+{
+    return sim_card_model.au_blocks;
+}
+
+uint8_t sd_erased_byte(void) 
+{
+    return 0x00;
+}
+
+int sd_erase(uint32_t lba, uint32_t count) 
+{
+    if (lba > _blocks || count > _blocks - lba) { return -1; }
+    
+    /* CMD32, CMD33 and CMD38 */
+    sim_card_stats.commands += 3;
+    sim_card_stats.erases++;
+    _now_us += 3 * sim_card_model.cmd_us + sim_card_model.erase_us;
+    memset(_data + (size_t) lba * SD_BLOCK_SIZE, 0, 
+        (size_t) count * SD_BLOCK_SIZE);
+    return 0;
+}
+
+uint32_t sd_au_size(void)       { return sim_card_model.au_blocks; }
+uint32_t sd_write_chunk(void)   { return sim_card_model.au_blocks; }
+uint32_t sd_serial_number(void) { return 0x51ca4d00; }
+uint8_t sd_speed_mode(void)     { return SD_SPEED_HIGH; }
+
+uint16_t sd_speed_modes(void) 
+{
+    return (1 << SD_SPEED_DEFAULT) | (1 << SD_SPEED_HIGH);
+}
+
+uint32_t sd_spi_hz(void) 
+{
+    return 24000000;
+}
+
+/******************************************************************************/
+
+uint64_t clock_ns(void) 
+{
+    return _now_us * 1000;
+}
+
+void program(uint32_t lba) 
+{
+    uint32_t au = lba / sim_card_model.au_blocks;
+    uint32_t i;
+    uint32_t next;
+    
+    sim_card_stats.blocks_written++;
+    _now_us += sim_card_model.xfer_us + sim_card_model.prog_us;
+    
+    for (i = 0; i < _open_count && _open[i].au != au; i++) {}
+    if (i == _open_count) 
+    {
+        /* the least recently used unit is closed for this one */
+        sim_card_stats.au_switches++;
+        _now_us += sim_card_model.au_switch_us;
+        if (_open_count < sim_card_model.open_aus) { _open_count++; }
+        i    = _open_count - 1;
+        next = lba;
+    }
+    else 
+    {
+        next = _open[i].next;
+    }
+    if (lba != next) 
+    {
+        sim_card_stats.rmws++;
+        _now_us += sim_card_model.rmw_us;
+    }
+    
+    /* move it to the front */
+    memmove(&_open[1], &_open[0], i * sizeof(_open[0]));
+    _open[0].au   = au;
+    _open[0].next = lba + 1;
+}
@@ -0,0 +1,63 @@
+#ifndef _sim_card_h_
+#define _sim_card_h_
+
+/*
+ * sim_card is the card of sd.h in memory, with a model of how long a card in
+ * spi mode takes for each operation. The time is simulated: every sd_* call
+ * moves the clock the model says it took and millis() runs off that clock
+ * (host_clock_ns), so what the firmware does in between costs nothing.
+ *
+ * The model is a rough one of a cheap card and its defaults are assumptions,
+ * not measurements: a block takes `xfer_us` over the bus and `prog_us` to
+ * program when it follows the last block written to one of the `open_aus`
+ * allocation units the card keeps open. Writing anywhere else in an open unit
+ * costs `rmw_us` more and writing to a unit that isn't open costs 
+ * `au_switch_us` more, for closing the least recently used one.
+ */
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t blocks;                    /* size of the card                   */
+    uint32_t au_blocks;                 /* blocks of an allocation unit       */
+    uint32_t cmd_us;                    /* a command and its response         */
+    uint32_t xfer_us;                   /* a data block over the bus          */
+    uint32_t read_us;                   /* access time before a read block    */
+    uint32_t prog_us;                   /* programming a sequential block     */
+    uint32_t rmw_us;                    /* extra for an out of order block    */
+    uint32_t au_switch_us;              /* extra for a unit that isn't open   */
+    uint32_t open_aus;                  /* units the card keeps open          */
+    uint32_t erase_us;                  /* an erase, besides its commands     */
+} sim_card_model_t;
+
+/* what the card does, totals since `sim_card_reset` */
+typedef struct {
+    uint32_t commands;
+    uint32_t blocks_read;
+    uint32_t blocks_written;
+    uint32_t rmws;                      /* out of order blocks                */
+    uint32_t au_switches;
+    uint32_t erases;
+} sim_card_stats_t;
+
+/* the model in use, set before `sim_card_reset` */
+extern sim_card_model_t sim_card_model;
+extern sim_card_stats_t sim_card_stats;
+
+/* defaults of the model, a 256 MiB card with 4 MiB units on a 24 MHz bus */
+#define SIM_CARD_MODEL_DEFAULT                                                 \
+    {                                                                          \
+        .blocks = 524288, .au_blocks = 8192, .cmd_us = 20, .xfer_us = 172,     \
+        .read_us = 150, .prog_us = 30, .rmw_us = 1500, .au_switch_us = 5000,   \
+        .open_aus = 2, .erase_us = 2000                                        \
+    }
+
+/* a new card of the model, erased and with nothing open, at time 0. Returns
+   < 0 if the memory for it can't be had */
+int sim_card_reset(void);
+/* the simulated time */
+uint64_t sim_card_now_us(void);
+/* lets the clock run, time the host or the firmware spends outside the card */
+void sim_card_wait_us(uint64_t us);
+
+#endif
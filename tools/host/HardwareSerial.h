@@ -0,0 +1,18 @@
+#ifndef _host_HardwareSerial_h_
+#define _host_HardwareSerial_h_
+
+/* serialize.h includes it for the serial_* routines of the teensy core, the
+   host build only has the serial_print, serial_printf and serial_xxd of
+   host.c */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void serial_print(const char *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
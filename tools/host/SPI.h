@@ -0,0 +1,43 @@
+#ifndef _host_SPI_h_
+#define _host_SPI_h_
+
+/*
+ * The parts of the SPI library (depends/spi-master-20150403) sd.cpp and the
+ * vendored Sd2Card.cpp use, every byte goes to `host_spi_transfer` and the
+ * clock they ask for is kept in `host_spi_hz` (see host.h).
+ */
+
+#include <stdint.h>
+
+#include "host.h"
+#include "kinetis.h"
+
+#define MSBFIRST                (1)
+#define SPI_MODE0               (0x00)
+
+class SPISettings {
+public:
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) 
+        : clock(clock) 
+    {
+        (void) bitOrder;
+        (void) dataMode;
+    }
+    uint32_t clock;
+};
+
+class SPIClass {
+public:
+    void begin(void) {}
+    void beginTransaction(SPISettings settings) 
+    {
+        host_spi_hz = settings.clock;
+    }
+    void endTransaction(void) {}
+    void setClockDivider(uint8_t divider) { host_spi_hz = F_BUS / divider; }
+    uint8_t transfer(uint8_t out) { return host_spi_transfer(out); }
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _host_avr_functions_h_
+#define _host_avr_functions_h_
+
+/* ultoa of the teensy core's avr_functions.h, for `usb_init_serialnumber` */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+char *ultoa(unsigned long val, char *buf, int radix);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
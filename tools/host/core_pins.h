@@ -0,0 +1,32 @@
+#ifndef _host_core_pins_h_
+#define _host_core_pins_h_
+
+/* millis() of the teensy core's core_pins.h, from the host's monotonic clock,
+   and its digital pins as levels in memory */
+
+#include <stdint.h>
+
+#include "kinetis.h"
+#include "pins_arduino.h"
+
+#define HIGH                    (1)
+#define LOW                     (0)
+#define INPUT                   (0)
+#define OUTPUT                  (1)
+#define INPUT_PULLUP            (2)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t millis(void);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+uint8_t digitalRead(uint8_t pin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * host is what the firmware sources get from the teensy core and serialize.c,
+ * for the host builds of tools/. The LOG* macros go to stderr when built with
+ * -DDEBUG.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "host.h"
+#include "kinetis.h"
+#include "core_pins.h"
+#include "avr_functions.h"
+#include "serialize.h"
+
+/******************************************************************************/
+
+/* nanoseconds of the monotonic clock */
+static uint64_t monotonic_ns(void);
+
+/******************************************************************************/
+
+uint32_t host_demcr     = 0;
+uint32_t host_dwt_ctrl  = 0;
+uint32_t host_sim_scgc4 = 0;
+uint32_t host_sim_scgc6 = 0;
+uint32_t host_spi_hz    = 0;
+uint8_t  host_pins[HOST_PINS];
+
+uint64_t (*host_clock_ns)(void) = monotonic_ns;
+
+/******************************************************************************/
+
+uint32_t host_cycles(void) 
+{
+    return (uint32_t) (host_clock_ns() * (F_CPU / 1000000) / 1000);
+}
+
+uint32_t millis(void) 
+{
+    return (uint32_t) (host_clock_ns() / 1000000);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) 
+{
+    /* an input pulled up reads high until something drives it */
+    if (pin < HOST_PINS && mode == INPUT_PULLUP) { host_pins[pin] = HIGH; }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) 
+{
+    if (pin < HOST_PINS) { host_pins[pin] = value ? HIGH : LOW; }
+}
+
+uint8_t digitalRead(uint8_t pin) 
+{
+    return pin < HOST_PINS ? host_pins[pin] : LOW;
+}
+
+void serial_print(const char *p) 
+{
+    fputs(p, stderr);
+}
+
+void serial_printf(const char *fmt, ...) 
+{
+    va_list ap;
+    
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+void serial_xxd(const void *bytes, uint32_t length) 
+{
+    const uint8_t *byte = bytes;
+    uint32_t i;
+    
+    for (i = 0; i < length; i++) 
+    {
+        fprintf(stderr, "%02x%s", byte[i], 
+            (i % 16) == 15 || i == length - 1 ? "\n" : " ");
+    }
+}
+
+void sput_pid(uint16_t pid) 
+{
+    fprintf(stderr, "PID 0x%x", pid);
+}
+
+char *ultoa(unsigned long val, char *buf, int radix) 
+{
+    char digits[sizeof(val) * 8];
+    int i = 0, j = 0;
+    
+    do 
+    {
+        digits[i++] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[val % radix];
+        val /= radix;
+    } while (val != 0);
+    while (i > 0) { buf[j++] = digits[--i]; }
+    buf[j] = '\0';
+    return buf;
+}
+
+/******************************************************************************/
+
+uint64_t monotonic_ns(void) 
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
@@ -0,0 +1,36 @@
+#ifndef _host_h_
+#define _host_h_
+
+/*
+ * tools/host holds what the firmware sources need from the teensy core to be
+ * built for the host: shims of its headers and host.c. A tool adds this
+ * directory to its include path ahead of ../../include.
+ */
+
+#include <stdint.h>
+
+#include "pins_arduino.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the nanoseconds millis() and the cycle counter run off, the host's
+   monotonic clock unless a simulation sets a clock of its own */
+extern uint64_t (*host_clock_ns)(void);
+
+/* levels of the digital pins, as the firmware wrote them or as a simulated
+   board drives its inputs */
+extern uint8_t host_pins[HOST_PINS];
+
+/* the spi clock last set through SPI.h and the exchange of a byte on the bus,
+   which a tool that builds the card driver implements with what it puts on
+   the bus */
+extern uint32_t host_spi_hz;
+uint8_t host_spi_transfer(uint8_t out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
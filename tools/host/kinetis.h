@@ -0,0 +1,150 @@
+#ifndef _host_kinetis_h_
+#define _host_kinetis_h_
+
+/* the registers of the teensy core's kinetis.h the firmware sources use, the
+   cycle counter runs off the host's monotonic clock at F_CPU */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern uint32_t host_demcr;
+extern uint32_t host_dwt_ctrl;
+extern uint32_t host_sim_scgc4;
+extern uint32_t host_sim_scgc6;
+uint32_t host_cycles(void);
+
+/* the registers of the USB-FS controller, kept by the tool that simulates
+   the bus (tools/usbipd/usb_fs.c). ISTAT has TOKDNE up while a token waits
+   in STAT, reading STAT takes it */
+extern uint8_t host_usb_endpt[16 * 4];
+extern uint8_t host_usb_addr;
+extern uint8_t host_usb_bdtpage[3];
+extern uint8_t host_usb_control;
+extern uint8_t host_usb_ctl;
+extern uint8_t host_usb_erren;
+extern uint8_t host_usb_errstat;
+extern uint8_t host_usb_inten;
+extern uint8_t host_usb_otgistat;
+extern uint8_t host_usb_usbctrl;
+uint8_t *host_usb_istat(void);
+uint8_t *host_usb_stat(void);
+
+/* the flash command registers, `usb_init_serialnumber` reads the serial
+   number with them */
+extern uint8_t host_ftfl_fstat;
+extern uint8_t host_ftfl_fccob[12];
+
+#ifdef __cplusplus
+}
+#endif
+
+/* the bus clock of a teensy 3.2 at 48 MHz, the spi runs off it */
+#ifndef F_BUS
+#define F_BUS                   (48000000)
+#endif
+
+#define SIM_SCGC6               host_sim_scgc6
+#define SIM_SCGC6_SPI0          ((uint32_t) 0x00001000)
+#define SIM_SCGC6_CRC           ((uint32_t) 0x00040000)
+
+#define SIM_SCGC4               host_sim_scgc4
+#define SIM_SCGC4_USBOTG        ((uint32_t) 0x00040000)
+
+#define __disable_irq()
+#define __enable_irq()
+
+/* the usb interrupt only runs when the simulated bus calls `usb_isr` */
+#define IRQ_USBOTG              (35)
+#define NVIC_ENABLE_IRQ(n)
+#define NVIC_DISABLE_IRQ(n)
+#define NVIC_SET_PRIORITY(n, priority)
+
+/* the wfi of `usb_msd_poll` while the bus is suspended, the host has no such
+   instruction */
+__asm__(".macro wfi\n.endm");
+
+#define USB0_BDTPAGE1           host_usb_bdtpage[0]
+#define USB0_BDTPAGE2           host_usb_bdtpage[1]
+#define USB0_BDTPAGE3           host_usb_bdtpage[2]
+#define USB0_ISTAT              (*host_usb_istat())
+#define USB0_STAT               (*host_usb_stat())
+#define USB0_ADDR               host_usb_addr
+#define USB0_CONTROL            host_usb_control
+#define USB0_CTL                host_usb_ctl
+#define USB0_ERREN              host_usb_erren
+#define USB0_ERRSTAT            host_usb_errstat
+#define USB0_INTEN              host_usb_inten
+#define USB0_OTGISTAT           host_usb_otgistat
+#define USB0_USBCTRL            host_usb_usbctrl
+/* 4 bytes apart like the controller's, usb_dev.c indexes them that way */
+#define USB0_ENDPT0             host_usb_endpt[0 * 4]
+#define USB0_ENDPT1             host_usb_endpt[1 * 4]
+#define USB0_ENDPT2             host_usb_endpt[2 * 4]
+#define USB0_ENDPT3             host_usb_endpt[3 * 4]
+#define USB0_ENDPT4             host_usb_endpt[4 * 4]
+#define USB0_ENDPT5             host_usb_endpt[5 * 4]
+#define USB0_ENDPT6             host_usb_endpt[6 * 4]
+#define USB0_ENDPT7             host_usb_endpt[7 * 4]
+#define USB0_ENDPT8             host_usb_endpt[8 * 4]
+#define USB0_ENDPT9             host_usb_endpt[9 * 4]
+#define USB0_ENDPT10            host_usb_endpt[10 * 4]
+#define USB0_ENDPT11            host_usb_endpt[11 * 4]
+#define USB0_ENDPT12            host_usb_endpt[12 * 4]
+#define USB0_ENDPT13            host_usb_endpt[13 * 4]
+#define USB0_ENDPT14            host_usb_endpt[14 * 4]
+#define USB0_ENDPT15            host_usb_endpt[15 * 4]
+
+#define USB_ISTAT_STALL         ((uint8_t) 0x80)
+#define USB_ISTAT_ATTACH        ((uint8_t) 0x40)
+#define USB_ISTAT_RESUME        ((uint8_t) 0x20)
+#define USB_ISTAT_SLEEP         ((uint8_t) 0x10)
+#define USB_ISTAT_TOKDNE        ((uint8_t) 0x08)
+#define USB_ISTAT_SOFTOK        ((uint8_t) 0x04)
+#define USB_ISTAT_ERROR         ((uint8_t) 0x02)
+#define USB_ISTAT_USBRST        ((uint8_t) 0x01)
+#define USB_INTEN_STALLEN       ((uint8_t) 0x80)
+#define USB_INTEN_ATTACHEN      ((uint8_t) 0x40)
+#define USB_INTEN_RESUMEEN      ((uint8_t) 0x20)
+#define USB_INTEN_SLEEPEN       ((uint8_t) 0x10)
+#define USB_INTEN_TOKDNEEN      ((uint8_t) 0x08)
+#define USB_INTEN_SOFTOKEN      ((uint8_t) 0x04)
+#define USB_INTEN_ERROREN       ((uint8_t) 0x02)
+#define USB_INTEN_USBRSTEN      ((uint8_t) 0x01)
+#define USB_STAT_TX             ((uint8_t) 0x08)
+#define USB_STAT_ODD            ((uint8_t) 0x04)
+#define USB_STAT_ENDP(n)        ((uint8_t) ((n) >> 4))
+#define USB_CTL_ODDRST          ((uint8_t) 0x02)
+#define USB_CTL_USBENSOFEN      ((uint8_t) 0x01)
+#define USB_ENDPT_EPCTLDIS      ((uint8_t) 0x10)
+#define USB_ENDPT_EPRXEN        ((uint8_t) 0x08)
+#define USB_ENDPT_EPTXEN        ((uint8_t) 0x04)
+#define USB_ENDPT_EPSTALL       ((uint8_t) 0x02)
+#define USB_ENDPT_EPHSHK        ((uint8_t) 0x01)
+#define USB_USBCTRL_SUSP        ((uint8_t) 0x80)
+#define USB_CONTROL_DPPULLUPNONOTG ((uint8_t) 0x10)
+
+/* in the order of the controller's, FCCOB7..4 read as one word */
+#define FTFL_FSTAT              host_ftfl_fstat
+#define FTFL_FCCOB3             host_ftfl_fccob[0]
+#define FTFL_FCCOB2             host_ftfl_fccob[1]
+#define FTFL_FCCOB1             host_ftfl_fccob[2]
+#define FTFL_FCCOB0             host_ftfl_fccob[3]
+#define FTFL_FCCOB7             host_ftfl_fccob[4]
+#define FTFL_FCCOB6             host_ftfl_fccob[5]
+#define FTFL_FCCOB5             host_ftfl_fccob[6]
+#define FTFL_FCCOB4             host_ftfl_fccob[7]
+#define FTFL_FSTAT_CCIF         ((uint8_t) 0x80)
+#define FTFL_FSTAT_RDCOLERR     ((uint8_t) 0x40)
+#define FTFL_FSTAT_ACCERR       ((uint8_t) 0x20)
+#define FTFL_FSTAT_FPVIOL       ((uint8_t) 0x10)
+
+#define ARM_DEMCR               host_demcr
+#define ARM_DEMCR_TRCENA        (1 << 24)
+#define ARM_DWT_CTRL            host_dwt_ctrl
+#define ARM_DWT_CTRL_CYCCNTENA  (1)
+#define ARM_DWT_CYCCNT          host_cycles()
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _host_pins_arduino_h_
+#define _host_pins_arduino_h_
+
+/* the spi pins of a teensy 3.2 from the teensy core's pins_arduino.h, and the
+   port access the vendored Sd2Card.cpp compiles in for its bit banged spi. It
+   is never used, there are no ports on the host */
+
+#include <stdint.h>
+
+#define SS                      (10)
+#define MOSI                    (11)
+#define MISO                    (12)
+#define SCK                     (13)
+
+/* pins of the host, levels `digitalWrite` set and `digitalRead` returns */
+#define HOST_PINS               (34)
+
+#define digitalPinToPort(pin)     (pin)
+#define digitalPinToBitMask(pin)  (0)
+#define portOutputRegister(port)  ((volatile uint8_t *) 0)
+#define portInputRegister(port)   ((volatile uint8_t *) 0)
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * file_sd implements sd.h on the image of file_sd.h. The card is up whenever
+ * it is in the slot, a multiple block write is a run of pwrites. A card put
+ * back has to be brought up with `sd_init_start` again, as a real one
+ * answering from its idle state would.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sd.h"
+#include "file_sd.h"
+
+/******************************************************************************/
+
+static int      _fd     = -1;
+static uint32_t _blocks = 0;
+static uint32_t _serial = 0;
+
+/* set by `file_sd_remove`, possibly from a signal handler */
+static volatile sig_atomic_t _removed = 0;
+/* the card is in its idle state, put back or never brought up */
+static volatile sig_atomic_t _idle    = 1;
+/* `sd_init_start` brought it up, for `sd_present` to tell a card put back */
+static int      _up     = 0;
+
+/* the multiple block write that is open */
+static struct {
+    int      open;
+    uint32_t lba;
+    uint32_t count;                     /* blocks written so far              */
+} _write = {0};
+
+/******************************************************************************/
+
+/* 1 if the card is in the slot and up */
+static int ready(void);
+/* writes zero blocks over the range, where holes can't be punched */
+static int write_zeros(uint32_t lba, uint32_t count);
+
+/******************************************************************************/
+
+int file_sd_open(const char *path) 
+{
+    struct stat st;
+    
+    if ((_fd = open(path, O_RDWR)) < 0) { return -1; }
+    if (fstat(_fd, &st) != 0 || st.st_size < SD_BLOCK_SIZE) 
+    {
+        close(_fd);
+        _fd = -1;
+        return -1;
+    }
+    
+    _blocks = (uint32_t) (st.st_size / SD_BLOCK_SIZE);
+    _serial = (uint32_t) st.st_ino;
+    return 0;
+}
+
+int file_sd_sync(void) 
+{
+    return fdatasync(_fd) == 0 ? 0 : -1;
+}
+
+void file_sd_remove(void) 
+{
+    _removed = 1;
+}
+
+void file_sd_insert(void) 
+{
+    _idle    = 1;
+    _removed = 0;
+}
+
+/*--- sd.h -------------------------------------------------------------------*/
+int sd_init(void) 
+{
+    return sd_init_start();
+}
+
+int sd_init_start(void) 
+{
+    if (_fd < 0 || _removed) { return -1; }
+    _idle       = 0;
+    _up         = 1;
+    _write.open = 0;
+    return 0;
+}
+
+int sd_init_step(void)  { return ready() ? 0 : -1; }
+int sd_suspend(void)    { return 0; }
+int sd_resume(void)     { return ready() ? 0 : -1; }
+
+int sd_present(void) 
+{
+    if (_fd < 0 || _removed) { return 0; }
+    
+    /* like sd.cpp, a card that was up and answers from its idle state was
+       put back and reads as gone once, so it is brought up again */
+    if (_up && _idle) 
+    {
+        _up = 0;
+        return 0;
+    }
+    return 1;
+}
+
+uint32_t sd_max_lba(void) 
+{
+    return _blocks;
+}
+
+int sd_read_block(void *dest, uint32_t lba) 
+{
+    if (!ready() || lba >= _blocks) { return -1; }
+    if (pread(_fd, dest, SD_BLOCK_SIZE, (off_t) lba * SD_BLOCK_SIZE) != 
+            SD_BLOCK_SIZE) 
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int sd_write_block(uint32_t lba, const void *src) 
+{
+    if (!ready() || lba >= _blocks) { return -1; }
+    if (pwrite(_fd, src, SD_BLOCK_SIZE, (off_t) lba * SD_BLOCK_SIZE) != 
+            SD_BLOCK_SIZE) 
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int sd_write_check(void) 
+{
+    return ready() ? 0 : -1;
+}
+
+int sd_write_start(uint32_t lba, uint32_t count) 
+{
+    (void) count;
+    
+    if (!ready()) { return -1; }
+    _write.open  = 1;
+    _write.lba   = lba;
+    _write.count = 0;
+    return 0;
+}
+
+int sd_write_data(const void *src) 
+{
+    if (!_write.open || sd_write_block(_write.lba + _write.count, src) < 0) 
+    {
+        return -1;
+    }
+    _write.count++;
+    return 0;
+}
+
+int sd_write_stop(void) 
+{
+    _write.open = 0;
+    return ready() ? 0 : -1;
+}
+
+int sd_written_blocks(uint32_t *count) 
+{
+    *count = _write.count;
+    return 0;
+}
+
+uint32_t sd_erase_group(void) 
+{
+    return FILE_SD_ERASE_GROUP;
+}
+
+uint8_t sd_erased_byte(void) 
+{
+    return 0x00;
+}
+
+int sd_erase(uint32_t lba, uint32_t count) 
+{
+    if (!ready()) { return -1; }
+    if (lba > _blocks || count > _blocks - lba) { return -1; }
+    if (fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 
+            (off_t) lba * SD_BLOCK_SIZE, (off_t) count * SD_BLOCK_SIZE) == 0) 
+    {
+        return 0;
+    }
+    return errno == EOPNOTSUPP ? write_zeros(lba, count) : -1;
+}
+
+uint32_t sd_au_size(void)       { return FILE_SD_AU_SIZE; }
+uint32_t sd_write_chunk(void)   { return FILE_SD_AU_SIZE; }
+uint32_t sd_serial_number(void) { return _serial; }
+uint8_t sd_speed_mode(void)     { return SD_SPEED_HIGH; }
+
+uint16_t sd_speed_modes(void) 
+{
+    return (1 << SD_SPEED_DEFAULT) | (1 << SD_SPEED_HIGH);
+}
+
+uint32_t sd_spi_hz(void) 
+{
+    return 24000000;
+}
+
+/******************************************************************************/
+
+int ready(void) 
+{
+    return _fd >= 0 && !_removed && !_idle;
+}
+
+int write_zeros(uint32_t lba, uint32_t count) 
+{
+    static const uint8_t zeros[SD_BLOCK_SIZE] = {0};
+    
+    while (count-- > 0) 
+    {
+        if (sd_write_block(lba++, zeros) < 0) { return -1; }
+    }
+    return 0;
+}
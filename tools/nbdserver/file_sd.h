@@ -0,0 +1,29 @@
+#ifndef _file_sd_h_
+#define _file_sd_h_
+
+/*
+ * file_sd is the card of sd.h on a host file, for the host build of the SCSI
+ * engine. Every block of the file is a block of the card, erases punch holes
+ * in it (or write zeros where that isn't supported) so an erased block reads
+ * as 0x00 like on most cards. It can be pulled and put back to exercise the
+ * engine's hot plug handling.
+ */
+
+/* blocks in the card's erase group, 4 KiB like a filesystem's holes */
+#define FILE_SD_ERASE_GROUP (8)
+/* blocks in the card's allocation unit, 4 MiB */
+#define FILE_SD_AU_SIZE     (8192)
+
+/* opens the image the card is made of, < 0 if it can't or holds no block */
+int file_sd_open(const char *path);
+/* what was written to the card goes to the file's storage */
+int file_sd_sync(void);
+
+/* pulls the card out of the slot: sd_present reads 0 and every other call
+   fails until `file_sd_insert` puts it back, as the same card in its idle
+   state. Both only set a flag, they may be called from a signal handler to
+   pull the card in the middle of a command */
+void file_sd_remove(void);
+void file_sd_insert(void);
+
+#endif
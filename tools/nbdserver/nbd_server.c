@@ -0,0 +1,739 @@
+/*
+ * nbdserver serves lun 0 of the SCSI engine (src/scsi_sd.c), on the card of
+ * file_sd.h, as an NBD export on a UNIX or TCP socket. Each NBD request is
+ * run as the CDBs a usb host would send for it, READ(10), WRITE(10),
+ * SYNCHRONIZE CACHE(10) or UNMAP, with the data moved through
+ * `scsi_sd_data_out`/`scsi_sd_data_in` a usb packet at a time. So fio, mkfs or
+ * a filesystem on /dev/nbdN exercise the firmware's command handling and
+ * its write stage, write sessions and zero map, e.g.
+ *
+ *   ./nbdserver -u /tmp/sd.sock -s card.img
+ *   nbd-client -unix /tmp/sd.sock /dev/nbd0 -b 4096
+ *
+ * One client is served at a time, with the fixed newstyle handshake and
+ * simple replies.
+ *
+ * SIGUSR1 pulls the card out of the slot and SIGUSR2 puts it back, at any
+ * point of a command, to exercise the engine's hot plug handling:
+ *
+ *   kill -USR1 $(pidof nbdserver)
+ *
+ * Leave a moment between the two, signals pending together may be handled in
+ * either order. Requests fail with EIO while the lun reads MEDIUM NOT
+ * PRESENT. Once the card is back and brought up they are served again, the
+ * UNIT ATTENTION of the new medium is retried like a host does.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "scsi_sd.h"
+#include "sd.h"
+#include "file_sd.h"
+
+/* bytes handed to or taken from the engine per call, a usb packet */
+#define PACKET_SIZE         (64)
+/* blocks per READ(10)/WRITE(10), the 64 KiB usb hosts transfer at most */
+#define MAX_CDB_BLOCKS      (128)
+/* the largest request a client may send */
+#define MAX_REQUEST         (32 * 1024 * 1024)
+/* how often `scsi_sd_poll` runs while no request comes */
+#define POLL_MS             (10)
+/* polls a command asked to be retried is given before it fails with EIO */
+#define RETRY_POLLS         (100000)
+
+/*--- NBD PROTOCOL -----------------------------------------------------------*/
+#define NBD_MAGIC               (0x4e42444d41474943ull) /* "NBDMAGIC"         */
+#define NBD_IHAVEOPT            (0x49484156454f5054ull) /* "IHAVEOPT"         */
+#define NBD_REPLY_MAGIC         (0x0003e889045565a9ull)
+#define NBD_REQUEST_MAGIC       (0x25609513)
+#define NBD_SIMPLE_REPLY_MAGIC  (0x67446698)
+
+/* handshake flags of the server and the client */
+#define NBD_FLAG_FIXED_NEWSTYLE (0x0001)
+#define NBD_FLAG_NO_ZEROES      (0x0002)
+
+/* transmission flags */
+#define NBD_FLAG_HAS_FLAGS      (0x0001)
+#define NBD_FLAG_READ_ONLY      (0x0002)
+#define NBD_FLAG_SEND_FLUSH     (0x0004)
+#define NBD_FLAG_SEND_FUA       (0x0008)
+#define NBD_FLAG_SEND_TRIM      (0x0020)
+
+#define NBD_OPT_EXPORT_NAME     (1)
+#define NBD_OPT_ABORT           (2)
+#define NBD_OPT_LIST            (3)
+#define NBD_OPT_INFO            (6)
+#define NBD_OPT_GO              (7)
+
+#define NBD_REP_ACK             (1)
+#define NBD_REP_SERVER          (2)
+#define NBD_REP_INFO            (3)
+#define NBD_REP_ERR_UNSUP       (0x80000001)
+
+#define NBD_INFO_EXPORT         (0)
+#define NBD_INFO_BLOCK_SIZE     (3)
+
+#define NBD_CMD_READ            (0)
+#define NBD_CMD_WRITE           (1)
+#define NBD_CMD_DISC            (2)
+#define NBD_CMD_FLUSH           (3)
+#define NBD_CMD_TRIM            (4)
+#define NBD_CMD_FLAG_FUA        (0x0001)
+
+/* the lun and what the client knows of it */
+static uint64_t _size  = 0;
+static uint16_t _flags = 0;
+static uint8_t *_data  = NULL;
+
+/******************************************************************************/
+
+static void usage(const char *name);
+/* SIGUSR1 and SIGUSR2 pull and insert the card */
+static void hot_plug(int sig);
+/* a listening socket on `path`, or on localhost:`port` without it */
+static int listen_on(const char *path, int port);
+
+/* brings up the card under the engine and clears its UNIT ATTENTION */
+static int lun_start(void);
+/* the size of the lun and if it takes UNMAP, from READ CAPACITY (16) like the
+   host's sd driver */
+static int read_capacity(uint64_t *size, int *unmap);
+/* runs a CDB with `length` bytes of data from/to `data`, 0 or an errno. A
+   NOT READY, OPERATION IN PROGRESS is retried after a poll like a host does,
+   the translation layer answers writes with it while its log is full */
+static int run(const void *cdb, size_t cdblen, void *data, size_t length, 
+    int write);
+static int run_once(const void *cdb, size_t cdblen, void *data, 
+    size_t length, int write);
+/* the errno of the lun's sense, which is cleared. EAGAIN if the command is to
+   be retried, while the card is brought up and for the UNIT ATTENTION after */
+static int sense_errno(void);
+
+/* READ(10)/WRITE(10) of the range in MAX_CDB_BLOCKS pieces */
+static int rw(int write, uint64_t offset, uint32_t length);
+static int synchronize_cache(void);
+static int unmap(uint64_t offset, uint32_t length);
+
+/* the handshake, 1 once in transmission, 0 if the client left */
+static int negotiate(int fd);
+static int option_reply(int fd, uint32_t option, uint32_t type, 
+    const void *data, uint32_t length);
+static int info_reply(int fd, uint32_t option, uint16_t info);
+/* requests until the client disconnects */
+static void transmission(int fd);
+static int simple_reply(int fd, uint32_t error, const uint8_t *handle, 
+    const void *data, uint32_t length);
+
+static int read_all(int fd, void *dest, size_t length);
+static int write_all(int fd, const void *src, size_t length);
+static int discard(int fd, size_t length);
+
+/* big endian fields of the wire format */
+static uint16_t get16(const uint8_t *src);
+static uint32_t get32(const uint8_t *src);
+static uint64_t get64(const uint8_t *src);
+static void     put16(uint8_t *dest, uint16_t value);
+static void     put32(uint8_t *dest, uint32_t value);
+static void     put64(uint8_t *dest, uint64_t value);
+
+/******************************************************************************/
+
+int main(int argc, char **argv) 
+{
+    scsi_sd_lun_config_t config = { SCSI_SD_BACKEND_CARD, 0, 0, 0, NULL };
+    const char *path = NULL;
+    int port = 0, trim = 0;
+    int opt, server, client;
+    
+    while ((opt = getopt(argc, argv, "u:p:rsz")) != -1) 
+    {
+        switch (opt) 
+        {
+        case 'u': path = optarg;                                break;
+        case 'p': port = atoi(optarg);                          break;
+        case 'r': config.flags |= SCSI_SD_LUN_READ_ONLY;        break;
+        case 's': config.flags |= SCSI_SD_LUN_STAGE;            break;
+        case 'z': config.flags |= SCSI_SD_LUN_SKIP_ZEROS;       break;
+        default:  usage(argv[0]);                               return 2;
+        }
+    }
+    if (optind != argc - 1 || (path == NULL) == (port == 0)) 
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    
+    if (file_sd_open(argv[optind]) < 0) 
+    {
+        fprintf(stderr, "%s: not an image of whole blocks\n", argv[optind]);
+        return 1;
+    }
+    if (scsi_sd_configure(&config, 1) < 0 || lun_start() < 0 || 
+            read_capacity(&_size, &trim) != 0) 
+    {
+        fprintf(stderr, "the lun didn't come up\n");
+        return 1;
+    }
+    _flags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA |
+        (trim ? NBD_FLAG_SEND_TRIM : 0) |
+        ((config.flags & SCSI_SD_LUN_READ_ONLY) ? NBD_FLAG_READ_ONLY : 0);
+        
+    if ((_data = malloc(MAX_REQUEST)) == NULL) { return 1; }
+    if ((server = listen_on(path, port)) < 0) 
+    {
+        perror("listen");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, hot_plug);
+    signal(SIGUSR2, hot_plug);
+    
+    for (;;) 
+    {
+        if ((client = accept(server, NULL, NULL)) < 0) 
+        {
+            if (errno == EINTR) { continue; }
+            perror("accept");
+            return 1;
+        }
+        if (negotiate(client) == 1) { transmission(client); }
+        close(client);
+        
+        /* what the client left in the write stage goes to the file */
+        if (synchronize_cache() != 0) 
+        {
+            fprintf(stderr, "writing the cache failed\n");
+        }
+    }
+}
+
+void usage(const char *name) 
+{
+    fprintf(stderr, 
+        "usage: %s (-u socket | -p port) [-r] [-s] [-z] image\n"
+        "  -u  listen on a UNIX socket\n"
+        "  -p  listen on a TCP port of localhost\n"
+        "  -r  read only lun\n"
+        "  -s  gather writes in the write stage (SCSI_SD_LUN_STAGE)\n"
+        "  -z  erase or skip zero filled blocks (SCSI_SD_LUN_SKIP_ZEROS)\n", 
+        name);
+}
+
+void hot_plug(int sig) 
+{
+    if (sig == SIGUSR1) { file_sd_remove(); }
+    else                { file_sd_insert(); }
+}
+
+int listen_on(const char *path, int port) 
+{
+    struct sockaddr_un un;
+    struct sockaddr_in in;
+    int fd, one = 1;
+    
+    if (path != NULL) 
+    {
+        if (strlen(path) >= sizeof(un.sun_path)) { return -1; }
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) { return -1; }
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, path);
+        unlink(path);
+        if (bind(fd, (struct sockaddr *) &un, sizeof(un)) < 0) 
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else 
+    {
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) { return -1; }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        memset(&in, 0, sizeof(in));
+        in.sin_family      = AF_INET;
+        in.sin_port        = htons(port);
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr *) &in, sizeof(in)) < 0) 
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    
+    if (listen(fd, 1) < 0) 
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*--- SCSI -------------------------------------------------------------------*/
+int lun_start(void) 
+{
+    uint8_t tur[6] = {0};
+    int i;
+    
+    if (scsi_sd_init() != 0) { return -1; }
+    
+    /* the bring up is a step per poll, then the lun reports the UNIT
+       ATTENTION of a new medium once */
+    for (i = 0; i < 1000; i++) 
+    {
+        scsi_sd_poll();
+        if (run(tur, sizeof(tur), NULL, 0, 0) == 0) { return 0; }
+    }
+    return -1;
+}
+
+int read_capacity(uint64_t *size, int *unmap) 
+{
+    uint8_t cdb[16] = { SERVICE_ACTION_IN16_OPCODE, 
+        READ_CAPACITY16_SERVICE_ACTION };
+    read_capacity16_data_t data;
+    int error;
+    
+    put32(&cdb[10], sizeof(data));
+    if ((error = run(cdb, sizeof(cdb), &data, sizeof(data), 0)) != 0) 
+    {
+        return error;
+    }
+    
+    *size  = (get64((const uint8_t *) &data) + 1) * 
+        get32((const uint8_t *) &data.block_length);
+    *unmap = (get16((const uint8_t *) &data.lbp_lowest_aligned) >> 8) & 
+        READ_CAPACITY16_DATA_LBPME;
+    return 0;
+}
+
+int run(const void *cdb, size_t cdblen, void *data, size_t length, int write) 
+{
+    int error, polls;
+    
+    for (polls = 0; polls < RETRY_POLLS; polls++) 
+    {
+        error = run_once(cdb, cdblen, data, length, write);
+        if (error != EAGAIN) { return error; }
+        scsi_sd_poll();
+    }
+    return EIO;
+}
+
+int run_once(const void *cdb, size_t cdblen, void *data, size_t length, 
+    int write) 
+{
+    uint8_t *bytes = data;
+    ssize_t count;
+    size_t done;
+    void *ptr;
+    
+    if ((count = scsi_sd_begin(0, cdb, cdblen)) < 0) { return sense_errno(); }
+    if ((size_t) count != length) { return EIO; }
+    
+    for (done = 0; done < length; done += (size_t) count) 
+    {
+        if (write) 
+        {
+            count = length - done < PACKET_SIZE ? length - done : PACKET_SIZE;
+            if (scsi_sd_data_in(&bytes[done], count) != 0) 
+            {
+                scsi_sd_data_in_commit();
+                return sense_errno();
+            }
+        }
+        else 
+        {
+            count = scsi_sd_data_out(&ptr, PACKET_SIZE);
+            if (count < 0) { return sense_errno(); }
+            if (count == 0 || ptr == NULL) { return EIO; }
+            memcpy(&bytes[done], ptr, count);
+        }
+    }
+    
+    if (write && length > 0 && scsi_sd_data_in_commit() < 0) 
+    {
+        return sense_errno();
+    }
+    return 0;
+}
+
+int sense_errno(void) 
+{
+    uint8_t key;
+    uint16_t asc_ascq;
+    
+    scsi_sd_sense(0, &key, &asc_ascq);
+    switch (key) 
+    {
+    case SENSE_KEY_NO_SENSE:        return EIO; /* failed without a reason */
+    case SENSE_KEY_DATA_PROTECT:    return EPERM;
+    case SENSE_KEY_ILLEGAL_REQUEST: return EINVAL;
+    case SENSE_KEY_UNIT_ATTENTION:  return EAGAIN;
+    case SENSE_KEY_NOT_READY:
+        return asc_ascq == ASC_ASCQ_LUN_OPERATION_IN_PROGRESS || 
+            asc_ascq == ASC_ASCQ_LUN_BECOMING_READY ? EAGAIN : EIO;
+    default:                        return EIO;
+    }
+}
+
+int rw(int write, uint64_t offset, uint32_t length) 
+{
+    uint8_t cdb[10] = {0};
+    uint32_t lba, count, blocks;
+    uint32_t done;
+    int error;
+    
+    if (offset % SD_BLOCK_SIZE || length % SD_BLOCK_SIZE) { return EINVAL; }
+    if (offset > _size || length > _size - offset) { return EINVAL; }
+    
+    lba    = (uint32_t) (offset / SD_BLOCK_SIZE);
+    blocks = length / SD_BLOCK_SIZE;
+    for (done = 0; done < blocks; done += count) 
+    {
+        count = blocks - done < MAX_CDB_BLOCKS ? blocks - done : MAX_CDB_BLOCKS;
+        
+        cdb[0] = write ? WRITE10_OPCODE : READ10_OPCODE;
+        put32(&cdb[2], lba + done);
+        put16(&cdb[7], (uint16_t) count);
+        error = run(cdb, sizeof(cdb), &_data[(size_t) done * SD_BLOCK_SIZE], 
+            (size_t) count * SD_BLOCK_SIZE, write);
+        if (error != 0) { return error; }
+    }
+    return 0;
+}
+
+int synchronize_cache(void) 
+{
+    uint8_t cdb[10] = { SYNCHRONIZE_CACHE10_OPCODE };
+    int error;
+    
+    if ((error = run(cdb, sizeof(cdb), NULL, 0, 0)) != 0) { return error; }
+    return file_sd_sync() < 0 ? EIO : 0;
+}
+
+int unmap(uint64_t offset, uint32_t length) 
+{
+    uint8_t cdb[10] = { UNMAP_OPCODE };
+    uint8_t list[UNMAP_PARAMETER_LIST_HEADER_LENGTH +
+        UNMAP_BLOCK_DESCRIPTOR_LENGTH] = {0};
+    uint64_t start, end;
+    
+    if (offset > _size || length > _size - offset) { return EINVAL; }
+    
+    /* the whole blocks of the range, partial ones are left alone */
+    start = (offset + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE;
+    end   = (offset + length) / SD_BLOCK_SIZE;
+    if (end <= start) { return 0; }
+    
+    put16(&cdb[7], sizeof(list));
+    put16(&list[0], sizeof(list) - 2);
+    put16(&list[2], UNMAP_BLOCK_DESCRIPTOR_LENGTH);
+    put64(&list[UNMAP_PARAMETER_LIST_HEADER_LENGTH], start);
+    put32(&list[UNMAP_PARAMETER_LIST_HEADER_LENGTH + 8], 
+        (uint32_t) (end - start));
+    return run(cdb, sizeof(cdb), list, sizeof(list), 1);
+}
+
+/*--- NBD --------------------------------------------------------------------*/
+int negotiate(int fd) 
+{
+    uint8_t header[18], option[16];
+    uint32_t client_flags, type, length;
+    uint16_t count, info, i;
+    uint8_t *data = _data;
+    
+    put64(&header[0], NBD_MAGIC);
+    put64(&header[8], NBD_IHAVEOPT);
+    put16(&header[16], NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    if (write_all(fd, header, 18) < 0 || read_all(fd, header, 4) < 0) 
+    {
+        return 0;
+    }
+    client_flags = get32(header);
+    
+    for (;;) 
+    {
+        if (read_all(fd, option, 16) < 0 || get64(option) != NBD_IHAVEOPT) 
+        {
+            return 0;
+        }
+        type   = get32(&option[8]);
+        length = get32(&option[12]);
+        if (length > MAX_REQUEST || read_all(fd, data, length) < 0) 
+        {
+            return 0;
+        }
+        
+        switch (type) 
+        {
+        case NBD_OPT_EXPORT_NAME:
+            /* there is one export, whatever its name */
+            memset(header, 0, sizeof(header));
+            put64(&header[0], _size);
+            put16(&header[8], _flags);
+            if (write_all(fd, header, 10) < 0) { return 0; }
+            if (!(client_flags & NBD_FLAG_NO_ZEROES)) 
+            {
+                memset(data, 0, 124);
+                if (write_all(fd, data, 124) < 0) { return 0; }
+            }
+            return 1;
+            
+        case NBD_OPT_ABORT:
+            option_reply(fd, type, NBD_REP_ACK, NULL, 0);
+            return 0;
+            
+        case NBD_OPT_LIST:
+            put32(header, 0); /* an empty name */
+            if (option_reply(fd, type, NBD_REP_SERVER, header, 4) < 0 || 
+                    option_reply(fd, type, NBD_REP_ACK, NULL, 0) < 0) 
+            {
+                return 0;
+            }
+            break;
+            
+        case NBD_OPT_INFO:
+        case NBD_OPT_GO:
+            /* the name, then the information requests */
+            if (length < 6 || get32(data) > length - 6) { return 0; }
+            count = get16(&data[4 + get32(data)]);
+            if (6 + get32(data) + 2 * (uint32_t) count > length) { return 0; }
+            if (info_reply(fd, type, NBD_INFO_EXPORT) < 0) { return 0; }
+            for (i = 0; i < count; i++) 
+            {
+                info = get16(&data[6 + get32(data) + 2 * i]);
+                if (info == NBD_INFO_BLOCK_SIZE && 
+                        info_reply(fd, type, info) < 0) 
+                {
+                    return 0;
+                }
+            }
+            if (option_reply(fd, type, NBD_REP_ACK, NULL, 0) < 0) { return 0; }
+            if (type == NBD_OPT_GO) { return 1; }
+            break;
+            
+        default:
+            if (option_reply(fd, type, NBD_REP_ERR_UNSUP, NULL, 0) < 0) 
+            {
+                return 0;
+            }
+            break;
+        }
+    }
+}
+
+int option_reply(int fd, uint32_t option, uint32_t type, const void *data, 
+    uint32_t length) 
+{
+    uint8_t header[20];
+    
+    put64(&header[0], NBD_REPLY_MAGIC);
+    put32(&header[8], option);
+    put32(&header[12], type);
+    put32(&header[16], length);
+    if (write_all(fd, header, sizeof(header)) < 0) { return -1; }
+    return write_all(fd, data, length);
+}
+
+int info_reply(int fd, uint32_t option, uint16_t info) 
+{
+    uint8_t data[14];
+    
+    put16(&data[0], info);
+    if (info == NBD_INFO_EXPORT) 
+    {
+        put64(&data[2], _size);
+        put16(&data[10], _flags);
+        return option_reply(fd, option, NBD_REP_INFO, data, 12);
+    }
+    
+    /* whole blocks only, at most a request's worth */
+    put32(&data[2], SD_BLOCK_SIZE);
+    put32(&data[6], 4096);
+    put32(&data[10], MAX_REQUEST);
+    return option_reply(fd, option, NBD_REP_INFO, data, 14);
+}
+
+void transmission(int fd) 
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    uint8_t request[28];
+    uint16_t flags, type;
+    uint64_t offset;
+    uint32_t length;
+    int error;
+    
+    for (;;) 
+    {
+        /* the stage and session timeouts run while the client is idle */
+        scsi_sd_poll();
+        if (poll(&pfd, 1, POLL_MS) <= 0) { continue; }
+        
+        if (read_all(fd, request, sizeof(request)) < 0 || 
+                get32(request) != NBD_REQUEST_MAGIC) 
+        {
+            return;
+        }
+        flags  = get16(&request[4]);
+        type   = get16(&request[6]);
+        offset = get64(&request[16]);
+        length = get32(&request[24]);
+        
+        switch (type) 
+        {
+        case NBD_CMD_READ:
+            error = length > MAX_REQUEST ? EINVAL : rw(0, offset, length);
+            if (simple_reply(fd, error, &request[8], _data, 
+                    error ? 0 : length) < 0) 
+            {
+                return;
+            }
+            break;
+            
+        case NBD_CMD_WRITE:
+            if (length > MAX_REQUEST) 
+            {
+                if (discard(fd, length) < 0) { return; }
+                error = EINVAL;
+            }
+            else 
+            {
+                if (read_all(fd, _data, length) < 0) { return; }
+                error = rw(1, offset, length);
+                if (!error && (flags & NBD_CMD_FLAG_FUA)) 
+                {
+                    error = synchronize_cache();
+                }
+            }
+            if (simple_reply(fd, error, &request[8], NULL, 0) < 0) { return; }
+            break;
+            
+        case NBD_CMD_FLUSH:
+            error = synchronize_cache();
+            if (simple_reply(fd, error, &request[8], NULL, 0) < 0) { return; }
+            break;
+            
+        case NBD_CMD_TRIM:
+            error = unmap(offset, length);
+            if (!error && (flags & NBD_CMD_FLAG_FUA)) 
+            {
+                error = synchronize_cache();
+            }
+            if (simple_reply(fd, error, &request[8], NULL, 0) < 0) { return; }
+            break;
+            
+        case NBD_CMD_DISC:
+            return;
+            
+        default:
+            if (simple_reply(fd, EINVAL, &request[8], NULL, 0) < 0) { return; }
+            break;
+        }
+    }
+}
+
+int simple_reply(int fd, uint32_t error, const uint8_t *handle, 
+    const void *data, uint32_t length) 
+{
+    uint8_t reply[16];
+    
+    put32(&reply[0], NBD_SIMPLE_REPLY_MAGIC);
+    put32(&reply[4], error);
+    memcpy(&reply[8], handle, 8);
+    if (write_all(fd, reply, sizeof(reply)) < 0) { return -1; }
+    return write_all(fd, data, length);
+}
+
+/******************************************************************************/
+
+int read_all(int fd, void *dest, size_t length) 
+{
+    uint8_t *bytes = dest;
+    ssize_t count;
+    
+    while (length > 0) 
+    {
+        if ((count = read(fd, bytes, length)) <= 0) 
+        {
+            if (count < 0 && errno == EINTR) { continue; }
+            return -1;
+        }
+        bytes  += count;
+        length -= (size_t) count;
+    }
+    return 0;
+}
+
+int write_all(int fd, const void *src, size_t length) 
+{
+    const uint8_t *bytes = src;
+    ssize_t count;
+    
+    while (length > 0) 
+    {
+        if ((count = write(fd, bytes, length)) < 0) 
+        {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+        bytes  += count;
+        length -= (size_t) count;
+    }
+    return 0;
+}
+
+int discard(int fd, size_t length) 
+{
+    size_t count;
+    
+    while (length > 0) 
+    {
+        count = length < MAX_REQUEST ? length : MAX_REQUEST;
+        if (read_all(fd, _data, count) < 0) { return -1; }
+        length -= count;
+    }
+    return 0;
+}
+
+uint16_t get16(const uint8_t *src) 
+{
+    return (uint16_t) (src[0] << 8 | src[1]);
+}
+
+uint32_t get32(const uint8_t *src) 
+{
+    return (uint32_t) get16(src) << 16 | get16(&src[2]);
+}
+
+uint64_t get64(const uint8_t *src) 
+{
+    return (uint64_t) get32(src) << 32 | get32(&src[4]);
+}
+
+void put16(uint8_t *dest, uint16_t value) 
+{
+    dest[0] = value >> 8;
+    dest[1] = value;
+}
+
+void put32(uint8_t *dest, uint32_t value) 
+{
+    put16(dest, value >> 16);
+    put16(&dest[2], value);
+}
+
+void put64(uint8_t *dest, uint64_t value) 
+{
+    put32(dest, value >> 32);
+    put32(&dest[4], value);
+}
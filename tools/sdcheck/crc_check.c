@@ -0,0 +1,228 @@
+/*
+ * crccheck checks src/crc.c, as built for the host (the slice by 4 tables),
+ * against known answers and a bit serial reference and times it against the
+ * reference and the byte wise CRC16 the vendored Sd2Card.cpp had before, e.g.
+ *
+ *   ./crccheck -n 100000
+ *
+ * The Kinetis CRC module path can only be checked on the board, where
+ * `crc_self_test` runs at boot.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc.h"
+
+/* random blocks checked against the reference */
+#define RANDOM_BLOCKS (2000)
+
+/******************************************************************************/
+
+static uint32_t _blocks = 100000;
+static uint32_t _rng    = 1;
+static uint8_t  _block[512];
+
+/******************************************************************************/
+
+/* CRC16-CCITT a bit at a time, straight from the polynomial */
+static uint16_t crc16_bitwise(const uint8_t *buf, size_t length);
+/* the CRC16 of a 512 byte block of Sd2Card.cpp before src/crc.c, after
+   www.dattalo.com/technical/software/pic/crc_1021.asm */
+static uint16_t crc16_dattalo(const uint8_t *buf);
+/* the known answers of sd physical layer simplified spec 4.5 and of a block
+   of 0xff, returns -1 if one is wrong */
+static int known_answers(void);
+/* random blocks and splits of them against `crc16_bitwise` */
+static int random_blocks(void);
+/* ns per 512 byte block of each */
+static void benchmark(void);
+static uint32_t rng(void);
+static uint64_t now_ns(void);
+static void usage(const char *name);
+
+/******************************************************************************/
+
+int main(int argc, char **argv) 
+{
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "n:s:h")) != -1) 
+    {
+        switch (opt) 
+        {
+        case 'n': _blocks = strtoul(optarg, NULL, 0); break;
+        case 's': _rng    = strtoul(optarg, NULL, 0); break;
+        default:  usage(argv[0]);                     return 1;
+        }
+    }
+    /* xorshift never leaves 0 */
+    if (_rng == 0) { _rng = 1; }
+    
+    if (known_answers() < 0 || random_blocks() < 0) 
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("known answers and %u random blocks ok\n", RANDOM_BLOCKS);
+    
+    if (_blocks > 0) { benchmark(); }
+    return 0;
+}
+
+/******************************************************************************/
+
+uint16_t crc16_bitwise(const uint8_t *buf, size_t length) 
+{
+    uint16_t crc = 0;
+    size_t i;
+    int bit;
+    
+    for (i = 0; i < length; i++) 
+    {
+        crc ^= (uint16_t) buf[i] << 8;
+        for (bit = 0; bit < 8; bit++) 
+        {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+uint16_t crc16_dattalo(const uint8_t *buf) 
+{
+    uint16_t crc = 0;
+    uint16_t x;
+    size_t i;
+    
+    for (i = 0; i < 512; i++) 
+    {
+        x = ((crc >> 8) ^ buf[i]) & 0xff;
+        x ^= x >> 4;
+        crc = (crc << 8) ^ (x << 12) ^ (x << 5) ^ x;
+    }
+    return crc;
+}
+
+int known_answers(void) 
+{
+    static const uint8_t cmd0[5] = { 0x40, 0x00, 0x00, 0x00, 0x00 };
+    static const uint8_t cmd8[5] = { 0x48, 0x00, 0x00, 0x01, 0xaa };
+    int result = 0;
+    
+    if (crc_self_test() < 0) 
+    {
+        printf("crc_self_test failed\n");
+        result = -1;
+    }
+    if (crc7(cmd0, 5) != 0x95) 
+    {
+        printf("CMD0 crc 0x%02x, not 0x95\n", crc7(cmd0, 5));
+        result = -1;
+    }
+    if (crc7(cmd8, 5) != 0x87) 
+    {
+        printf("CMD8 crc 0x%02x, not 0x87\n", crc7(cmd8, 5));
+        result = -1;
+    }
+    memset(_block, 0xff, sizeof(_block));
+    if (crc16(0, _block, sizeof(_block)) != 0x7fa1) 
+    {
+        printf("0xff block crc 0x%04x, not 0x7fa1\n", 
+            crc16(0, _block, sizeof(_block)));
+        result = -1;
+    }
+    return result;
+}
+
+int random_blocks(void) 
+{
+    uint16_t crc;
+    size_t i, split;
+    uint32_t n;
+    
+    for (n = 0; n < RANDOM_BLOCKS; n++) 
+    {
+        for (i = 0; i < sizeof(_block); i++) { _block[i] = rng(); }
+        
+        /* whole blocks, and any length continued from any split */
+        crc = crc16(0, _block, sizeof(_block));
+        if (crc != crc16_bitwise(_block, sizeof(_block)) || 
+                crc != crc16_dattalo(_block)) 
+        {
+            printf("block %u crc 0x%04x, not 0x%04x\n", n, crc, 
+                crc16_bitwise(_block, sizeof(_block)));
+            return -1;
+        }
+        split = rng() % sizeof(_block);
+        i     = split + rng() % (sizeof(_block) - split + 1);
+        crc   = crc16(crc16(0, _block, split), _block + split, i - split);
+        if (crc != crc16_bitwise(_block, i)) 
+        {
+            printf("block %u split at %u of %u bytes 0x%04x, not 0x%04x\n", 
+                n, (unsigned) split, (unsigned) i, crc, 
+                crc16_bitwise(_block, i));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void benchmark(void) 
+{
+    static const char *names[3] = { "crc16", "dattalo", "bitwise" };
+    volatile uint16_t sink = 0;
+    uint64_t start, ns[3];
+    uint32_t n;
+    int which;
+    
+    for (which = 0; which < 3; which++) 
+    {
+        start = now_ns();
+        for (n = 0; n < _blocks; n++) 
+        {
+            _block[0] = n;
+            switch (which) 
+            {
+            case 0:  sink += crc16(0, _block, sizeof(_block));         break;
+            case 1:  sink += crc16_dattalo(_block);                     break;
+            default: sink += crc16_bitwise(_block, sizeof(_block));     break;
+            }
+        }
+        ns[which] = now_ns() - start;
+    }
+    (void) sink;
+    
+    for (which = 0; which < 3; which++) 
+    {
+        printf("%-8s %8.1f ns/block %6.2fx\n", names[which], 
+            (double) ns[which] / _blocks, (double) ns[which] / ns[0]);
+    }
+}
+
+uint32_t rng(void) 
+{
+    /* xorshift32 */
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return _rng;
+}
+
+uint64_t now_ns(void) 
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void usage(const char *name) 
+{
+    printf("usage: %s [-n blocks] [-s seed]\n"
+        "  -n  blocks of each crc timed, 0 to only check (100000)\n"
+        "  -s  seed of the random blocks (1)\n", name);
+}
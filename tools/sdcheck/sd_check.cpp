@@ -0,0 +1,348 @@
+/*
+ * sdcheck runs src/sd.cpp and the vendored Sd2Card.cpp, built for the host,
+ * against the card of spi_card.h and checks how they handle the faults it can
+ * be set up with: crc errors of data blocks and of commands, commands the
+ * card refuses, a card too slow for the clock and one pulled and put back.
+ * Each check starts from a new card brought up with `sd_init` and zeroed
+ * stats.
+ *
+ *   ./sdcheck          all of them
+ *   ./sdcheck retry    the checks whose name starts with `retry`
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "SPI.h"
+#include "sd.h"
+#include "crc.h"
+#include "stats.h"
+#include "spi_card.h"
+
+/* blocks of the card, 8 MiB */
+#define CARD_BLOCKS (16384)
+/* SD_DOWNSHIFT_ERRORS of sd.cpp */
+#define SD_DOWNSHIFT_CHECK_ERRORS (3)
+
+/* fails the check it is in with the line of the condition that wasn't met */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            printf("  line %d: %s\n", __LINE__, #cond); \
+            return -1; \
+        } \
+    } while (0)
+
+typedef struct {
+    const char *name;
+    int (*run)(void);
+} check_t;
+
+/******************************************************************************/
+
+SPIClass SPI;
+
+static uint8_t _block[SD_BLOCK_SIZE];
+
+/******************************************************************************/
+
+/* a new card with a pattern of its lba in every block, brought up */
+static int card(void);
+static void pattern(uint8_t *block, uint32_t lba);
+
+static int check_init(void);
+static int check_round_trip(void);
+static int check_multiple(void);
+static int check_erase(void);
+static int check_retry_read_crc(void);
+static int check_retry_command_crc(void);
+static int check_refused(void);
+static int check_write_crc(void);
+static int check_downshift(void);
+static int check_tune(void);
+static int check_hot_plug(void);
+
+static const check_t _checks[] = {
+    { "init",              check_init              }, 
+    { "round_trip",        check_round_trip        }, 
+    { "multiple",          check_multiple          }, 
+    { "erase",             check_erase             }, 
+    { "retry_read_crc",    check_retry_read_crc    }, 
+    { "retry_command_crc", check_retry_command_crc }, 
+    { "refused",           check_refused           }, 
+    { "write_crc",         check_write_crc         }, 
+    { "downshift",         check_downshift         }, 
+    { "tune",              check_tune              }, 
+    { "hot_plug",          check_hot_plug          }, 
+};
+
+#define CHECK_COUNT (sizeof(_checks) / sizeof(_checks[0]))
+
+/******************************************************************************/
+
+int main(int argc, char **argv) 
+{
+    const char *only = argc > 1 ? argv[1] : "";
+    int failed = 0;
+    size_t i;
+    
+    if (crc_self_test() < 0) { return 1; }
+    
+    for (i = 0; i < CHECK_COUNT; i++) 
+    {
+        if (strncmp(_checks[i].name, only, strlen(only)) != 0) { continue; }
+        if (_checks[i].run() < 0) 
+        {
+            printf("%-20s FAILED\n", _checks[i].name);
+            failed++;
+            continue;
+        }
+        printf("%-20s ok\n", _checks[i].name);
+    }
+    return failed ? 1 : 0;
+}
+
+/******************************************************************************/
+
+int card(void) 
+{
+    uint32_t lba;
+    
+    if (spi_card_reset(CARD_BLOCKS) < 0) { return -1; }
+    for (lba = 0; lba < CARD_BLOCKS; lba++) 
+    {
+        pattern(spi_card_block(lba), lba);
+    }
+    
+    memset(&stats, 0, sizeof(stats));
+    return sd_init();
+}
+
+void pattern(uint8_t *block, uint32_t lba) 
+{
+    size_t i;
+    
+    for (i = 0; i < SD_BLOCK_SIZE; i++) 
+    {
+        block[i] = (uint8_t) (lba * 7 + i + (i >> 8));
+    }
+}
+
+/*--- BRING UP ---------------------------------------------------------------*/
+int check_init(void) 
+{
+    CHECK(card() == 0);
+    CHECK(spi_card.crc_on);
+    CHECK(sd_max_lba() == CARD_BLOCKS);
+    CHECK(sd_speed_mode() == SD_SPEED_HIGH);
+    CHECK(sd_speed_modes() == ((1 << SD_SPEED_DEFAULT) | (1 << SD_SPEED_HIGH)));
+    CHECK(sd_spi_hz() == F_BUS / 2);
+    CHECK(sd_erase_group() == SPI_CARD_ERASE_GROUP);
+    CHECK(sd_erased_byte() == 0x00);
+    CHECK(sd_au_size() == 8192);
+    CHECK(spi_card.bad_command_crcs == 0 && spi_card.bad_block_crcs == 0);
+    CHECK(stats.sd_link_errors == 0);
+    return 0;
+}
+
+/*--- TRANSFERS --------------------------------------------------------------*/
+int check_round_trip(void) 
+{
+    uint8_t expect[SD_BLOCK_SIZE];
+    
+    CHECK(card() == 0);
+    CHECK(sd_read_block(_block, 5) == 0);
+    pattern(expect, 5);
+    CHECK(memcmp(_block, expect, SD_BLOCK_SIZE) == 0);
+    
+    pattern(_block, 1000);
+    CHECK(sd_write_block(9, _block) == 0);
+    CHECK(sd_write_check() == 0);
+    CHECK(memcmp(spi_card_block(9), _block, SD_BLOCK_SIZE) == 0);
+    CHECK(sd_read_block(expect, 9) == 0);
+    CHECK(memcmp(expect, _block, SD_BLOCK_SIZE) == 0);
+    CHECK(stats.sd_link_errors == 0 && spi_card.bad_block_crcs == 0);
+    return 0;
+}
+
+int check_multiple(void) 
+{
+    uint32_t count, i;
+    
+    CHECK(card() == 0);
+    CHECK(sd_write_start(100, 4) == 0);
+    for (i = 0; i < 4; i++) 
+    {
+        pattern(_block, 2000 + i);
+        CHECK(sd_write_data(_block) == 0);
+    }
+    CHECK(sd_write_stop() == 0);
+    CHECK(sd_written_blocks(&count) == 0 && count == 4);
+    
+    for (i = 0; i < 4; i++) 
+    {
+        pattern(_block, 2000 + i);
+        CHECK(memcmp(spi_card_block(100 + i), _block, SD_BLOCK_SIZE) == 0);
+    }
+    return 0;
+}
+
+int check_erase(void) 
+{
+    uint8_t zero[SD_BLOCK_SIZE] = { 0 };
+    
+    CHECK(card() == 0);
+    CHECK(sd_erase(SPI_CARD_ERASE_GROUP, SPI_CARD_ERASE_GROUP) == 0);
+    CHECK(spi_card.erases == 1);
+    CHECK(sd_read_block(_block, SPI_CARD_ERASE_GROUP) == 0);
+    CHECK(memcmp(_block, zero, SD_BLOCK_SIZE) == 0);
+    CHECK(sd_read_block(_block, 2 * SPI_CARD_ERASE_GROUP - 1) == 0);
+    CHECK(memcmp(_block, zero, SD_BLOCK_SIZE) == 0);
+    CHECK(sd_read_block(_block, 2 * SPI_CARD_ERASE_GROUP) == 0);
+    CHECK(memcmp(_block, zero, SD_BLOCK_SIZE) != 0);
+    return 0;
+}
+
+/*--- FAULTS -----------------------------------------------------------------*/
+int check_retry_read_crc(void) 
+{
+    uint8_t expect[SD_BLOCK_SIZE];
+    uint32_t hz;
+    
+    /* a block that arrives corrupted once is read again at the same clock */
+    CHECK(card() == 0);
+    hz = sd_spi_hz();
+    spi_card.corrupt_reads = 1;
+    CHECK(sd_read_block(_block, 7) == 0);
+    pattern(expect, 7);
+    CHECK(memcmp(_block, expect, SD_BLOCK_SIZE) == 0);
+    CHECK(spi_card.blocks_read >= 2);
+    CHECK(stats.sd_crc_errors == 1);
+    CHECK(stats.sd_link_errors == 1);
+    CHECK(stats.sd_read_retries == 1);
+    CHECK(stats.sd_spi_downshifts == 0 && sd_spi_hz() == hz);
+    return 0;
+}
+
+int check_retry_command_crc(void) 
+{
+    uint8_t expect[SD_BLOCK_SIZE];
+    
+    /* a CMD17 the card dropped for its crc (R1 COM_CRC) is a crc error too */
+    CHECK(card() == 0);
+    spi_card.corrupt_commands = 1;
+    CHECK(sd_read_block(_block, 8) == 0);
+    pattern(expect, 8);
+    CHECK(memcmp(_block, expect, SD_BLOCK_SIZE) == 0);
+    CHECK(spi_card.bad_command_crcs == 1);
+    CHECK(stats.sd_crc_errors == 1);
+    CHECK(stats.sd_link_errors == 1);
+    CHECK(stats.sd_read_retries == 1);
+    return 0;
+}
+
+int check_refused(void) 
+{
+    /* an address out of range is refused by a card that heard it right, it's
+       neither retried nor a link or crc error */
+    CHECK(card() == 0);
+    CHECK(sd_read_block(_block, CARD_BLOCKS + 10) < 0);
+    CHECK(sd_write_block(CARD_BLOCKS + 10, _block) < 0);
+    CHECK(stats.sd_link_errors == 0);
+    CHECK(stats.sd_crc_errors == 0);
+    CHECK(stats.sd_read_retries == 0);
+    return 0;
+}
+
+int check_write_crc(void) 
+{
+    uint8_t before[SD_BLOCK_SIZE];
+    
+    /* the card rejects the block with a crc error data response, the write
+       fails and the caller writes it again */
+    CHECK(card() == 0);
+    memcpy(before, spi_card_block(11), SD_BLOCK_SIZE);
+    pattern(_block, 3000);
+    spi_card.corrupt_writes = 1;
+    CHECK(sd_write_block(11, _block) < 0);
+    CHECK(spi_card.bad_block_crcs == 1);
+    CHECK(memcmp(spi_card_block(11), before, SD_BLOCK_SIZE) == 0);
+    CHECK(stats.sd_crc_errors == 1);
+    CHECK(stats.sd_link_errors == 1);
+    
+    CHECK(sd_write_block(11, _block) == 0);
+    CHECK(sd_write_check() == 0);
+    CHECK(memcmp(spi_card_block(11), _block, SD_BLOCK_SIZE) == 0);
+    return 0;
+}
+
+int check_downshift(void) 
+{
+    uint8_t expect[SD_BLOCK_SIZE];
+    uint32_t hz;
+    
+    /* a read failing its crc twice is given up, the third error in a row
+       lowers the clock and the block is read again at the new one */
+    CHECK(card() == 0);
+    hz = sd_spi_hz();
+    spi_card.corrupt_reads = SD_DOWNSHIFT_CHECK_ERRORS;
+    CHECK(sd_read_block(_block, 12) < 0);
+    CHECK(stats.sd_read_retries == 1);
+    CHECK(stats.sd_spi_downshifts == 0);
+    
+    CHECK(sd_read_block(_block, 12) == 0);
+    pattern(expect, 12);
+    CHECK(memcmp(_block, expect, SD_BLOCK_SIZE) == 0);
+    CHECK(stats.sd_spi_downshifts == 1);
+    CHECK(sd_spi_hz() < hz);
+    CHECK(stats.sd_crc_errors == SD_DOWNSHIFT_CHECK_ERRORS);
+    return 0;
+}
+
+int check_tune(void) 
+{
+    /* a card that corrupts blocks above 13 MHz is run at the 12 MHz below */
+    if (spi_card_reset(CARD_BLOCKS) < 0) { return -1; }
+    memset(&stats, 0, sizeof(stats));
+    spi_card.max_hz = 13000000;
+    CHECK(sd_init() == 0);
+    CHECK(sd_spi_hz() == F_BUS / 4);
+    CHECK(stats.sd_link_errors == 0);
+    CHECK(sd_read_block(_block, 0) == 0);
+    return 0;
+}
+
+/*--- HOT PLUG ---------------------------------------------------------------*/
+int check_hot_plug(void) 
+{
+    uint8_t expect[SD_BLOCK_SIZE];
+    
+    /* a pulled card doesn't answer and can't be brought up */
+    CHECK(card() == 0);
+    spi_card.absent = 1;
+    CHECK(!sd_present());
+    CHECK(sd_read_block(_block, 1) < 0);
+    CHECK(sd_init_start() < 0);
+    
+    /* put back it is the card that was up, its tuning is kept */
+    spi_card_insert();
+    CHECK(sd_present());
+    CHECK(sd_init() == 0);
+    CHECK(stats.card_fast_inits == 1);
+    CHECK(sd_read_block(_block, 1) == 0);
+    pattern(expect, 1);
+    CHECK(memcmp(_block, expect, SD_BLOCK_SIZE) == 0);
+    
+    /* pulled and put back between two looks, it answers from its idle state
+       and reads as gone once */
+    spi_card_insert();
+    CHECK(!sd_present());
+    CHECK(sd_present());
+    CHECK(sd_init() == 0);
+    CHECK(stats.card_fast_inits == 2);
+    CHECK(spi_card.crc_on);
+    CHECK(sd_read_block(_block, 1) == 0);
+    return 0;
+}
@@ -0,0 +1,485 @@
+/*
+ * spi_card implements the card of spi_card.h. Responses and data blocks are
+ * queued as the command comes in and clocked out by the bytes the host sends
+ * after it, a write block is taken in as it is clocked in.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "core_pins.h"
+#include "sd.h"
+#include "crc.h"
+#include "spi_card.h"
+
+/* clock of the bytes before the driver set one, the init clock */
+#define SPI_CARD_INIT_HZ   (400000)
+/* bytes a write keeps the card busy for */
+#define SPI_CARD_BUSY      (4)
+/* the data tokens and responses, sd physical layer simplified spec 7.3.3 */
+#define TOKEN_START_BLOCK  (0xfe)
+#define TOKEN_START_MULTI  (0xfc)
+#define TOKEN_STOP_TRAN    (0xfd)
+#define DATA_ACCEPTED      (0x05)
+#define DATA_CRC_ERROR     (0x0b)
+
+/******************************************************************************/
+
+spi_card_t spi_card;
+
+static uint8_t  *_blocks = NULL;
+static uint32_t  _count  = 0;
+static uint64_t  _now_ns = 0;
+static uint32_t  _serial = 0;           /* PSN, every reset is a new card    */
+
+static int      _selected = 0;
+static int      _idle     = 1;
+static int      _app      = 0;          /* the next command is an ACMD       */
+static uint32_t _erase_start, _erase_end;
+
+/* the command coming in */
+static uint8_t  _cmd[6];
+static size_t   _cmd_length = 0;
+
+/* what goes out, a response and up to a block with its token and crc */
+static uint8_t  _out[8 + SD_BLOCK_SIZE + 8];
+static size_t   _out_length = 0;
+static size_t   _out_next   = 0;
+
+/* the block write coming in, `length` < 0 while waiting for its token */
+static struct {
+    int      open;
+    int      multiple;
+    int      length;
+    uint32_t lba;
+    uint32_t written;                   /* blocks of the last CMD25 (ACMD22) */
+    uint8_t  data[SD_BLOCK_SIZE + 2];
+} _write;
+
+/******************************************************************************/
+
+/* the clock millis() runs off */
+static uint64_t clock_ns(void);
+/* the command in `_cmd` is complete */
+static void command(void);
+static void acommand(uint8_t index, uint32_t arg);
+/* the byte clocked in while a block write is open */
+static void write_byte(uint8_t in);
+static void queue(uint8_t byte);
+static void queue_r1(uint8_t r1);
+/* a data block of `length` bytes after the response, with its crc */
+static void queue_block(const uint8_t *data, size_t length, int corruptible);
+static void registers_cid(uint8_t *cid);
+static void registers_csd(uint8_t *csd);
+
+/******************************************************************************/
+
+int spi_card_reset(uint32_t blocks) 
+{
+    free(_blocks);
+    if ((_blocks = calloc(blocks, SD_BLOCK_SIZE)) == NULL) { return -1; }
+    _count = blocks;
+    
+    memset(&spi_card, 0, sizeof(spi_card));
+    memset(&_write, 0, sizeof(_write));
+    _now_ns       = 0;
+    _serial++;
+    host_clock_ns = clock_ns;
+    spi_card_insert();
+    return 0;
+}
+
+uint8_t *spi_card_block(uint32_t lba) 
+{
+    return lba < _count ? _blocks + (size_t) lba * SD_BLOCK_SIZE : NULL;
+}
+
+void spi_card_insert(void) 
+{
+    spi_card.absent = 0;
+    spi_card.crc_on = 0;
+    _idle       = 1;
+    _app        = 0;
+    _write.open = 0;
+    _cmd_length = 0;
+    _out_length = _out_next = 0;
+}
+
+/*--- host.h -----------------------------------------------------------------*/
+uint8_t host_spi_transfer(uint8_t in) 
+{
+    uint8_t out;
+    
+    _now_ns += 8000000000ull / (host_spi_hz ? host_spi_hz : SPI_CARD_INIT_HZ);
+    
+    /* deselecting drops what was left to send and a partial command */
+    if (host_pins[SPI_CARD_CS_PIN] != LOW || spi_card.absent) 
+    {
+        if (_selected) 
+        {
+            _selected   = 0;
+            _cmd_length = 0;
+            _out_length = _out_next = 0;
+        }
+        return 0xff;
+    }
+    _selected = 1;
+    
+    if (_out_next < _out_length) 
+    {
+        out = _out[_out_next++];
+        if (_out_next == _out_length) { _out_length = _out_next = 0; }
+        return out;
+    }
+    
+    if (_write.open) 
+    {
+        write_byte(in);
+        return 0xff;
+    }
+    
+    /* a command starts with a 0 start bit and a 1 transmission bit */
+    if (_cmd_length == 0 && (in & 0xc0) != 0x40) { return 0xff; }
+    _cmd[_cmd_length++] = in;
+    if (_cmd_length == sizeof(_cmd)) 
+    {
+        _cmd_length = 0;
+        command();
+    }
+    return 0xff;
+}
+
+/******************************************************************************/
+
+uint64_t clock_ns(void) 
+{
+    return _now_ns;
+}
+
+void command(void) 
+{
+    uint8_t index = _cmd[0] & 0x3f;
+    uint32_t arg  = ((uint32_t) _cmd[1] << 24) | ((uint32_t) _cmd[2] << 16) |
+        ((uint32_t) _cmd[3] << 8) | _cmd[4];
+    uint8_t reg[64];
+    int bad_crc;
+    
+    spi_card.commands++;
+    
+    /* CMD0 and CMD8 are always checked, the others once CMD59 said so */
+    bad_crc = crc7(_cmd, 5) != _cmd[5];
+    if (spi_card.corrupt_commands > 0) 
+    {
+        spi_card.corrupt_commands--;
+        bad_crc = 1;
+    }
+    if (bad_crc && (spi_card.crc_on || index == 0 || index == 8)) 
+    {
+        spi_card.bad_command_crcs++;
+        _app = 0;
+        queue_r1(SPI_CARD_R1_COM_CRC);
+        return;
+    }
+    
+    if (_app) 
+    {
+        _app = 0;
+        acommand(index, arg);
+        return;
+    }
+    
+    switch (index) 
+    {
+    case 0:
+        spi_card_insert();
+        queue_r1(0);
+        break;
+        
+    case 8:
+        queue_r1(0);
+        queue(0x00);
+        queue(0x00);
+        queue((arg >> 8) & 0x0f);
+        queue(arg & 0xff);
+        break;
+        
+    case 55:
+        _app = 1;
+        queue_r1(0);
+        break;
+        
+    case 58:
+        /* powered up and high capacity */
+        queue_r1(0);
+        queue(0xc0);
+        queue(0xff);
+        queue(0x80);
+        queue(0x00);
+        break;
+        
+    case 59:
+        spi_card.crc_on = arg & 1;
+        queue_r1(0);
+        break;
+        
+    case 6:
+        /* function group 1 supports default and high speed, a check or a
+           switch to either selects it */
+        memset(reg, 0, 64);
+        reg[13] = (1 << 0) | (1 << 1);
+        reg[16] = (arg & 0x0f) <= 1 ? (arg & 0x0f) : 0x0f;
+        queue_r1(0);
+        queue_block(reg, 64, 1);
+        break;
+        
+    case 9:
+        registers_csd(reg);
+        queue_r1(0);
+        queue_block(reg, 16, 1);
+        break;
+        
+    case 10:
+        registers_cid(reg);
+        queue_r1(0);
+        queue_block(reg, 16, 1);
+        break;
+        
+    case 13:
+        queue_r1(0);
+        queue(0x00);
+        break;
+        
+    case 17:
+        if (arg >= _count) 
+        {
+            queue_r1(SPI_CARD_R1_ADDRESS);
+            break;
+        }
+        spi_card.blocks_read++;
+        queue_r1(0);
+        queue_block(spi_card_block(arg), SD_BLOCK_SIZE, 1);
+        break;
+        
+    case 24:
+    case 25:
+        if (arg >= _count) 
+        {
+            queue_r1(SPI_CARD_R1_ADDRESS);
+            break;
+        }
+        _write.open     = 1;
+        _write.multiple = index == 25;
+        _write.length   = -1;
+        _write.lba      = arg;
+        if (_write.multiple) { _write.written = 0; }
+        queue_r1(0);
+        break;
+        
+    case 32:
+        _erase_start = arg;
+        queue_r1(0);
+        break;
+        
+    case 33:
+        _erase_end = arg;
+        queue_r1(0);
+        break;
+        
+    case 38:
+        if (_erase_start > _erase_end || _erase_end >= _count) 
+        {
+            queue_r1(SPI_CARD_R1_ADDRESS);
+            break;
+        }
+        memset(spi_card_block(_erase_start), 0, 
+            (size_t) (_erase_end - _erase_start + 1) * SD_BLOCK_SIZE);
+        spi_card.erases++;
+        queue_r1(0);
+        for (size_t i = 0; i < SPI_CARD_BUSY; i++) { queue(0x00); }
+        break;
+        
+    default:
+        queue_r1(SPI_CARD_R1_ILLEGAL);
+        break;
+    }
+}
+
+void acommand(uint8_t index, uint32_t arg) 
+{
+    uint8_t reg[64];
+    
+    (void) arg;
+    
+    switch (index) 
+    {
+    case 41:
+        _idle = 0;
+        queue_r1(0);
+        break;
+        
+    case 13:
+        /* the SD Status, R2 and then the register */
+        memset(reg, 0, 64);
+        reg[10] = SPI_CARD_AU_SIZE << 4;
+        queue_r1(0);
+        queue(0x00);
+        queue_block(reg, 64, 1);
+        break;
+        
+    case 22:
+        reg[0] = _write.written >> 24;
+        reg[1] = _write.written >> 16;
+        reg[2] = _write.written >> 8;
+        reg[3] = _write.written;
+        queue_r1(0);
+        queue_block(reg, 4, 1);
+        break;
+        
+    case 23:
+        queue_r1(0);
+        break;
+        
+    case 51:
+        /* SCR, version 2.00 and erased blocks read as 0x00 */
+        memset(reg, 0, 8);
+        reg[0] = 0x02;
+        reg[1] = 0x05;
+        queue_r1(0);
+        queue_block(reg, 8, 1);
+        break;
+        
+    default:
+        queue_r1(SPI_CARD_R1_ILLEGAL);
+        break;
+    }
+}
+
+void write_byte(uint8_t in) 
+{
+    uint16_t crc;
+    int bad_crc;
+    
+    if (_write.length < 0) 
+    {
+        if (in == TOKEN_START_BLOCK || 
+                (_write.multiple && in == TOKEN_START_MULTI)) 
+        {
+            _write.length = 0;
+        }
+        else if (_write.multiple && in == TOKEN_STOP_TRAN) 
+        {
+            _write.open = 0;
+            queue(0xff);
+            for (size_t i = 0; i < SPI_CARD_BUSY; i++) { queue(0x00); }
+        }
+        return;
+    }
+    
+    _write.data[_write.length++] = in;
+    if (_write.length < (int) sizeof(_write.data)) { return; }
+    
+    _write.length = -1;
+    if (!_write.multiple) { _write.open = 0; }
+    
+    crc = ((uint16_t) _write.data[SD_BLOCK_SIZE] << 8) |
+        _write.data[SD_BLOCK_SIZE + 1];
+    bad_crc = spi_card.crc_on && crc != crc16(0, _write.data, SD_BLOCK_SIZE);
+    if (spi_card.corrupt_writes > 0) 
+    {
+        spi_card.corrupt_writes--;
+        bad_crc = 1;
+    }
+    if (bad_crc) 
+    {
+        spi_card.bad_block_crcs++;
+        queue(DATA_CRC_ERROR);
+        return;
+    }
+    if (_write.lba >= _count) 
+    {
+        _write.open = 0;
+        queue(0x0d);
+        return;
+    }
+    
+    memcpy(spi_card_block(_write.lba++), _write.data, SD_BLOCK_SIZE);
+    spi_card.blocks_written++;
+    _write.written++;
+    queue(DATA_ACCEPTED);
+    for (size_t i = 0; i < SPI_CARD_BUSY; i++) { queue(0x00); }
+}
+
+void queue(uint8_t byte) 
+{
+    if (_out_length < sizeof(_out)) { _out[_out_length++] = byte; }
+}
+
+void queue_r1(uint8_t r1) 
+{
+    /* a byte of Ncr before it */
+    queue(0xff);
+    queue(r1 | (_idle ? SPI_CARD_R1_IDLE : 0));
+}
+
+void queue_block(const uint8_t *data, size_t length, int corruptible) 
+{
+    uint16_t crc = crc16(0, data, length);
+    size_t i, flip = length;
+    
+    if (corruptible && spi_card.corrupt_reads > 0) 
+    {
+        spi_card.corrupt_reads--;
+        flip = length / 2;
+    }
+    if (corruptible && spi_card.max_hz != 0 && host_spi_hz > spi_card.max_hz) 
+    {
+        flip = length / 3;
+    }
+    
+    queue(0xff);
+    queue(TOKEN_START_BLOCK);
+    for (i = 0; i < length; i++) 
+    {
+        queue(data[i] ^ (i == flip ? 0x10 : 0x00));
+    }
+    queue(crc >> 8);
+    queue(crc & 0xff);
+}
+
+void registers_cid(uint8_t *cid) 
+{
+    static const uint8_t raw[15] = {
+        0x03, 'S', 'D', 'S', 'P', 'I', 'C', 'D', 0x10,  /* MID OID PNM PRV */
+        0x00, 0x00, 0x00, 0x00, 0x01, 0x4a              /* PSN MDT         */
+    };
+    
+    memcpy(cid, raw, sizeof(raw));
+    cid[9]  = _serial >> 24;
+    cid[10] = _serial >> 16;
+    cid[11] = _serial >> 8;
+    cid[12] = _serial;
+    cid[15] = crc7(cid, 15);
+}
+
+void registers_csd(uint8_t *csd) 
+{
+    uint32_t c_size = _count / 1024 - 1;
+    uint32_t sector_size = SPI_CARD_ERASE_GROUP - 1;
+    
+    /* CSD version 2.0, sd physical layer simplified spec 5.3.3 */
+    memset(csd, 0, 16);
+    csd[0]  = 0x40;
+    csd[1]  = 0x0e;
+    csd[3]  = 0x32;
+    csd[4]  = 0x5b;
+    csd[5]  = 0x59;
+    csd[7]  = (c_size >> 16) & 0x3f;
+    csd[8]  = c_size >> 8;
+    csd[9]  = c_size;
+    csd[10] = 0x40 | (sector_size >> 1);
+    csd[11] = (sector_size & 1) << 7;
+    csd[12] = 0x0a;
+    csd[13] = 0x40;
+    csd[15] = crc7(csd, 15);
+}
@@ -0,0 +1,68 @@
+#ifndef _spi_card_h_
+#define _spi_card_h_
+
+/*
+ * spi_card is an sd card on the spi bus of tools/host, for running sd.cpp and
+ * the vendored Sd2Card.cpp on the host. It answers the commands they send a
+ * byte at a time, checks the crcs once CMD59 turned them on and sends its own
+ * with every data block. An SDHC card of `blocks` blocks held in memory, with
+ * high speed mode, erase groups and an allocation unit.
+ *
+ * Faults are set up in `spi_card` before the operation they should hit. The
+ * time of millis() is that of the bytes clocked at `host_spi_hz`.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* the pin sd.cpp selects the card with */
+#define SPI_CARD_CS_PIN      (4)
+/* blocks of the card's erase group and allocation unit, AU_SIZE 9 is 4 MiB */
+#define SPI_CARD_ERASE_GROUP (128)
+#define SPI_CARD_AU_SIZE     (9)
+
+/* R1 bits of sd physical layer simplified spec 7.3.2.1 */
+#define SPI_CARD_R1_IDLE     (0x01)
+#define SPI_CARD_R1_ILLEGAL  (0x04)
+#define SPI_CARD_R1_COM_CRC  (0x08)
+#define SPI_CARD_R1_ADDRESS  (0x20)
+
+typedef struct {
+    /*--- faults, each counts down as it hits ---*/
+    uint32_t corrupt_reads;             /* data blocks sent with a bit flipped*/
+    uint32_t corrupt_commands;          /* commands received with a bad crc   */
+    uint32_t corrupt_writes;            /* blocks received with a bad crc     */
+    uint32_t max_hz;                    /* faster clocks flip a bit of every
+                                           data block sent, 0 for none        */
+    int      absent;                    /* pulled, nothing answers            */
+    
+    /*--- what the card saw ---*/
+    int      crc_on;                    /* CMD59 turned crc checking on       */
+    uint32_t commands;
+    uint32_t bad_command_crcs;
+    uint32_t bad_block_crcs;
+    uint32_t blocks_read;
+    uint32_t blocks_written;
+    uint32_t erases;
+} spi_card_t;
+
+extern spi_card_t spi_card;
+
+/* a new card of `blocks` zeroed blocks in its idle state, with no faults and
+   a serial number of its own. `blocks` is a multiple of 1024. Returns < 0 if
+   the memory can't be had */
+int spi_card_reset(uint32_t blocks);
+/* the card's copy of block `lba` */
+uint8_t *spi_card_block(uint32_t lba);
+/* the card comes back from being pulled in its idle state, as if powered up
+   again */
+void spi_card_insert(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
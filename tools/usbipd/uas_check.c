@@ -0,0 +1,1078 @@
+/*
+ * uascheck is a USB/IP client of usbipd that does with the device what
+ * vhci-hcd and the Linux uas driver do: it imports it, enumerates it, sets
+ * the UAS alternate setting and runs tagged commands the way uas.c does on a
+ * USB 2.0 device without streams. Each command has a status URB waiting when
+ * it is sent, the IUs that come are matched to their task by tag, and the
+ * data URB of a task goes out once its READ READY or WRITE READY is in, e.g.
+ *
+ *   ./usbipd -p 13240 card.img &
+ *   ./uascheck -p 13240 card.img
+ *
+ * The image is only read, to check that the written blocks reached it, which
+ * with -f (a firmware built with SD_FTL) is left to the reads. The
+ * checks run in order on one import and stop at the first that fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "usb_uas.h"
+#include "scsi_task.h"
+#include "bench.h"
+#include "scsi/send_diagnostic.h"
+#include "scsi/receive_diagnostic_results.h"
+#include "scsi/diagnostic_page.h"
+
+/* fails the check it is in with the line of the condition that wasn't met */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            printf("  line %d: %s\n", __LINE__, #cond); \
+            return -1; \
+        } \
+    } while (0)
+
+/* URBs in flight at once */
+#define MAX_URBS            (64)
+/* tasks of a queue, one over the task set */
+#define MAX_TASKS           (SCSI_TASK_QUEUE_DEPTH + 1)
+/* the transfer buffer uas.c gives a status URB, a sense IU with 96 bytes of
+   sense data */
+#define STATUS_URB_LENGTH   (112)
+/* blocks of each WRITE of the queued writes */
+#define WRITE_BLOCKS        (16)
+#define BLOCK_SIZE          (512)
+
+/*--- USB/IP PROTOCOL --------------------------------------------------------*/
+#define USBIP_VERSION           (0x0111)
+#define OP_REQ_DEVLIST          (0x8005)
+#define OP_REP_DEVLIST          (0x0005)
+#define OP_REQ_IMPORT           (0x8003)
+#define OP_REP_IMPORT           (0x0003)
+#define USBIP_CMD_SUBMIT        (1)
+#define USBIP_CMD_UNLINK        (2)
+#define USBIP_RET_SUBMIT        (3)
+#define USBIP_RET_UNLINK        (4)
+#define USBIP_DIR_OUT           (0)
+#define USBIP_DIR_IN            (1)
+#define USBIP_HEADER_LENGTH     (48)
+#define USBIP_DEVICE_LENGTH     (312)
+#define USBIP_BUSID             "1-1"
+
+/* SCSI */
+#define TEST_UNIT_READY         (0x00)
+#define INQUIRY                 (0x12)
+#define READ_CAPACITY10         (0x25)
+#define READ10                  (0x28)
+#define WRITE10                 (0x2a)
+#define SYNCHRONIZE_CACHE10     (0x35)
+#define SENSE_NOT_READY         (0x02)
+#define SENSE_ILLEGAL_REQUEST   (0x05)
+#define SENSE_UNIT_ATTENTION    (0x06)
+
+/* bulk only */
+#define CBW_SIGNATURE           (0x43425355)
+#define CSW_SIGNATURE           (0x53425355)
+
+typedef struct task task_t;
+
+typedef struct {
+    int         used;
+    uint32_t    seqnum;
+    enum { CONTROL, COMMAND, STATUS, DATA, BULK } kind;
+    int         dir;
+    uint8_t    *data;
+    uint32_t    length;
+    int         done;
+    int32_t     status;
+    uint32_t    actual;
+    task_t     *task;                   /* of a COMMAND or DATA URB           */
+    uint8_t     iu[STATUS_URB_LENGTH];  /* of a STATUS URB                    */
+} urb_t;
+
+/* a command or task management function, with what came back for it */
+struct task {
+    uint16_t    tag;
+    uint8_t     attribute;
+    uint8_t     cdb[16];
+    uint8_t     function;               /* of a task management IU, else 0    */
+    uint16_t    task_tag;
+    uint8_t    *data;
+    uint32_t    length;
+    int         write;
+    
+    int         done;
+    int         ready;                  /* position of its READY IU, from 1   */
+    int         sensed;                 /* position of its SENSE IU, from 1   */
+    uint8_t     status;                 /* or the response code of a TMF      */
+    uint8_t     sense_key;
+    uint8_t     asc;
+};
+
+typedef struct {
+    const char *name;
+    int (*run)(void);
+} check_t;
+
+/******************************************************************************/
+
+static int      _fd      = -1;
+static int      _port    = 3240;
+static int      _image   = -1;
+/* the blocks aren't at their lba in the image, the firmware has the FTL */
+static int      _translated = 0;
+static uint32_t _seqnum  = 0;
+static urb_t    _urbs[MAX_URBS];
+
+/* of the device's config descriptor */
+static uint8_t  _ep_command, _ep_status, _ep_data_in, _ep_data_out;
+static uint8_t  _ep_bulk_in, _ep_bulk_out;
+static uint32_t _blocks;
+
+/* what the IUs came as since `queue` */
+static int      _readies;
+static int      _senses;
+static int      _commands_before_sense;
+static int      _commands_done;
+
+static uint32_t _rng = 1;
+static uint8_t  _written[8 * WRITE_BLOCKS * BLOCK_SIZE];
+static uint8_t  _read[8 * WRITE_BLOCKS * BLOCK_SIZE];
+
+/******************************************************************************/
+
+static int check_devlist(void);
+static int check_enumerate(void);
+static int check_unit_attention(void);
+static int check_inquiry(void);
+static int check_capacity(void);
+static int check_queued_writes(void);
+static int check_head_of_queue(void);
+static int check_abort(void);
+static int check_task_set_full(void);
+static int check_out_of_range(void);
+static int check_image(void);
+static int check_self_test(void);
+static int check_bulk_only(void);
+
+static const check_t _checks[] = {
+    { "devlist",        check_devlist        }, 
+    { "enumerate",      check_enumerate      }, 
+    { "unit_attention", check_unit_attention }, 
+    { "inquiry",        check_inquiry        }, 
+    { "capacity",       check_capacity       }, 
+    { "queued_writes",  check_queued_writes  }, 
+    { "head_of_queue",  check_head_of_queue  }, 
+    { "abort",          check_abort          }, 
+    { "task_set_full",  check_task_set_full  }, 
+    { "out_of_range",   check_out_of_range   }, 
+    { "image",          check_image          }, 
+    { "self_test",      check_self_test      }, 
+    { "bulk_only",      check_bulk_only      }, 
+};
+
+#define CHECK_COUNT (sizeof(_checks) / sizeof(_checks[0]))
+
+static void usage(const char *name);
+static int connect_server(void);
+/* an operation request, its reply header's status or -1 */
+static int operation(uint16_t code, const void *busid, uint16_t reply_code);
+
+/* sends CMD_SUBMIT, the URB is tracked until its RET_SUBMIT */
+static urb_t *submit(int kind, uint8_t ep, int dir, void *data, 
+    uint32_t length, const uint8_t *setup);
+static int unlink_urb(urb_t *urb);
+/* reads the next reply, NULL on a RET_UNLINK or if the server is gone */
+static urb_t *reap(void);
+static int wait_urb(urb_t *urb);
+static void release(urb_t *urb);
+/* a control transfer, the bytes of its data stage or < 0 */
+static int control(uint8_t type, uint8_t request, uint16_t value, 
+    uint16_t index, void *data, uint16_t length);
+
+/* sends the tasks, each with a status URB waiting for it */
+static int queue(task_t *tasks, size_t count);
+/* takes IUs in until every task is done */
+static int complete(task_t *tasks, size_t count);
+static int status_iu(urb_t *urb, task_t *tasks, size_t count);
+/* a task of its own, its SCSI status or < 0 */
+static int run(uint16_t tag, const uint8_t *cdb, size_t cdblen, void *data, 
+    uint32_t length, int write, task_t *task);
+static void rw_cdb(uint8_t *cdb, uint8_t opcode, uint32_t lba, 
+    uint16_t blocks);
+/* the status of the bench page of RECEIVE DIAGNOSTIC RESULTS, or < 0 */
+static int bench_page(uint16_t tag, task_t *task);
+/* a bulk only command with data in, the CSW's status or < 0 */
+static int bulk_only(uint8_t tag, const uint8_t *cdb, size_t cdblen, 
+    void *data, uint32_t length);
+
+static uint32_t rng(void);
+static void put16(uint8_t *dest, uint16_t value);
+static void put32(uint8_t *dest, uint32_t value);
+static uint16_t get16(const uint8_t *src);
+static uint32_t get32(const uint8_t *src);
+static uint16_t le16(const uint8_t *src);
+static int read_all(void *dest, size_t length);
+static int write_all(const void *src, size_t length);
+
+/******************************************************************************/
+
+int main(int argc, char **argv) 
+{
+    size_t i;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "fp:")) != -1) 
+    {
+        switch (opt) 
+        {
+        case 'f': _translated = 1;                              break;
+        case 'p': _port = atoi(optarg);                         break;
+        default:  usage(argv[0]);                               return 2;
+        }
+    }
+    if (optind != argc - 1) 
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if ((_image = open(argv[optind], O_RDONLY)) < 0) 
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    
+    for (i = 0; i < CHECK_COUNT; i++) 
+    {
+        if (_checks[i].run() < 0) 
+        {
+            printf("%-20s FAILED\n", _checks[i].name);
+            return 1;
+        }
+        printf("%-20s ok\n", _checks[i].name);
+    }
+    return 0;
+}
+
+void usage(const char *name) 
+{
+    fprintf(stderr, 
+        "usage: %s [-f] [-p port] image\n"
+        "  -f  the firmware is built with SD_FTL, written blocks aren't "
+        "compared\n"
+        "  -p  the TCP port of localhost usbipd listens on (3240)\n", 
+        name);
+}
+
+/*--- CHECKS -----------------------------------------------------------------*/
+int check_devlist(void) 
+{
+    uint8_t device[USBIP_DEVICE_LENGTH], interface[4];
+    uint8_t count[4];
+    
+    /* one full speed device on 1-1, mass storage bulk only */
+    CHECK(connect_server() == 0);
+    CHECK(operation(OP_REQ_DEVLIST, NULL, OP_REP_DEVLIST) == 0);
+    CHECK(read_all(count, 4) == 0 && get32(count) == 1);
+    CHECK(read_all(device, sizeof(device)) == 0);
+    CHECK(strcmp((const char *) &device[256], USBIP_BUSID) == 0);
+    CHECK(get32(&device[296]) == 2);
+    CHECK(device[311] >= 1);
+    CHECK(read_all(interface, sizeof(interface)) == 0);
+    CHECK(interface[0] == 0x08 && interface[1] == 0x06 && 
+        interface[2] == 0x50);
+    close(_fd);
+    return 0;
+}
+
+int check_enumerate(void) 
+{
+    uint8_t busid[32] = USBIP_BUSID;
+    uint8_t device[18], config[USBIP_DEVICE_LENGTH], alternate;
+    int length, i, setting = -1, pipes = 0;
+    uint8_t ep = 0;
+    
+    CHECK(connect_server() == 0);
+    CHECK(operation(OP_REQ_IMPORT, busid, OP_REP_IMPORT) == 0);
+    CHECK(read_all(config, USBIP_DEVICE_LENGTH) == 0);
+    
+    CHECK(control(0x80, 0x06, 0x0100, 0, device, 18) == 18);
+    CHECK(device[1] == 0x01 && device[7] == 64);
+    length = control(0x80, 0x06, 0x0200, 0, config, sizeof(config));
+    CHECK(length >= 9 && le16(&config[2]) == length);
+    
+    /* the UAS alternate setting of interface 0 and its pipes, the pipe usage
+       descriptor follows each endpoint */
+    for (i = 0; i + 2 <= length && config[i] >= 2; i += config[i]) 
+    {
+        if (config[i + 1] == 0x04 && config[i + 2] == 0) 
+        {
+            setting = config[i + 3];
+            if (setting == UAS_ALTERNATE_SETTING) 
+            {
+                CHECK(config[i + 5] == 0x08 && config[i + 6] == 0x06 && 
+                    config[i + 7] == 0x62 && config[i + 4] == 4);
+            }
+        }
+        if (config[i + 1] == 0x05) 
+        {
+            ep = config[i + 2];
+            if (setting == 0) 
+            {
+                if (ep & 0x80) { _ep_bulk_in  = ep & 0x0f; }
+                else           { _ep_bulk_out = ep & 0x0f; }
+            }
+        }
+        if (config[i + 1] == UAS_PIPE_USAGE_TYPE && 
+                setting == UAS_ALTERNATE_SETTING) 
+        {
+            switch (config[i + 2]) 
+            {
+            case UAS_PIPE_ID_COMMAND:  _ep_command  = ep & 0x0f; break;
+            case UAS_PIPE_ID_STATUS:   _ep_status   = ep & 0x0f; break;
+            case UAS_PIPE_ID_DATA_IN:  _ep_data_in  = ep & 0x0f; break;
+            case UAS_PIPE_ID_DATA_OUT: _ep_data_out = ep & 0x0f; break;
+            }
+            pipes++;
+        }
+    }
+    CHECK(pipes == 4 && _ep_command && _ep_status && _ep_data_in && 
+        _ep_data_out && _ep_bulk_in && _ep_bulk_out);
+        
+    CHECK(control(0x00, 0x09, 1, 0, NULL, 0) == 0);
+    CHECK(control(0x81, 0x0a, 0, 0, &alternate, 1) == 1 && alternate == 0);
+    CHECK(control(0x01, 0x0b, UAS_ALTERNATE_SETTING, 0, NULL, 0) == 0);
+    CHECK(control(0x81, 0x0a, 0, 0, &alternate, 1) == 1 && 
+        alternate == UAS_ALTERNATE_SETTING);
+    /* there is no alternate setting 2 */
+    CHECK(control(0x01, 0x0b, 2, 0, NULL, 0) == -EPIPE);
+    return 0;
+}
+
+int check_unit_attention(void) 
+{
+    uint8_t cdb[6] = { TEST_UNIT_READY };
+    task_t task;
+    int i, attention = 0, status = -1;
+    
+    /* the card comes up, then the new medium is reported once */
+    for (i = 0; i < 100 && status != UAS_STATUS_GOOD; i++) 
+    {
+        status = run(1, cdb, sizeof(cdb), NULL, 0, 0, &task);
+        CHECK(status >= 0);
+        if (status == UAS_STATUS_CHECK_CONDITION) 
+        {
+            CHECK(task.sense_key == SENSE_UNIT_ATTENTION || 
+                task.sense_key == SENSE_NOT_READY);
+            if (task.sense_key == SENSE_UNIT_ATTENTION) { attention++; }
+            usleep(10000);
+        }
+    }
+    CHECK(status == UAS_STATUS_GOOD && attention == 1);
+    return 0;
+}
+
+int check_inquiry(void) 
+{
+    uint8_t cdb[6] = { INQUIRY, 0, 0, 0, 36, 0 };
+    uint8_t data[36];
+    task_t task;
+    
+    CHECK(run(2, cdb, sizeof(cdb), data, sizeof(data), 0, &task) == 0);
+    CHECK(task.ready == 1);
+    CHECK((data[0] & 0x1f) == 0x00 && data[4] + 5 >= 36);
+    return 0;
+}
+
+int check_capacity(void) 
+{
+    uint8_t cdb[10] = { READ_CAPACITY10 };
+    uint8_t data[8];
+    task_t task;
+    off_t size = lseek(_image, 0, SEEK_END);
+    
+    CHECK(run(3, cdb, sizeof(cdb), data, sizeof(data), 0, &task) == 0);
+    _blocks = get32(data) + 1;
+    CHECK(get32(&data[4]) == BLOCK_SIZE);
+    /* built with SD_FTL the map keeps blocks of the card for itself */
+    CHECK((off_t) _blocks * BLOCK_SIZE <= size);
+    CHECK(_blocks >= 1024);
+    return 0;
+}
+
+int check_queued_writes(void) 
+{
+    const size_t length = WRITE_BLOCKS * BLOCK_SIZE;
+    task_t tasks[8];
+    size_t i;
+    
+    for (i = 0; i < sizeof(_written); i++) { _written[i] = rng(); }
+    
+    /* all of them are sent before any data, each waits for its WRITE READY
+       in the task set */
+    memset(tasks, 0, sizeof(tasks));
+    for (i = 0; i < 8; i++) 
+    {
+        tasks[i].tag    = 0x10 + i;
+        tasks[i].data   = &_written[i * length];
+        tasks[i].length = length;
+        tasks[i].write  = 1;
+        rw_cdb(tasks[i].cdb, WRITE10, 64 * i, WRITE_BLOCKS);
+    }
+    CHECK(queue(tasks, 8) == 0);
+    CHECK(complete(tasks, 8) == 0);
+    for (i = 0; i < 8; i++) 
+    {
+        CHECK(tasks[i].status == UAS_STATUS_GOOD);
+        CHECK(tasks[i].ready == (int) i + 1);
+    }
+    CHECK(_commands_before_sense == 8);
+    return 0;
+}
+
+int check_head_of_queue(void) 
+{
+    const size_t length = WRITE_BLOCKS * BLOCK_SIZE;
+    static const int order[5] = { 1, 3, 4, 5, 2 };
+    task_t tasks[5];
+    size_t i;
+    
+    /* the first one starts right away, the last one jumps the others */
+    memset(tasks, 0, sizeof(tasks));
+    memset(_read, 0, sizeof(_read));
+    for (i = 0; i < 5; i++) 
+    {
+        tasks[i].tag    = 0x20 + i;
+        tasks[i].data   = &_read[i * length];
+        tasks[i].length = length;
+        rw_cdb(tasks[i].cdb, READ10, 64 * i, WRITE_BLOCKS);
+    }
+    tasks[4].attribute = SCSI_TASK_HEAD_OF_QUEUE;
+    CHECK(queue(tasks, 5) == 0);
+    CHECK(complete(tasks, 5) == 0);
+    for (i = 0; i < 5; i++) 
+    {
+        CHECK(tasks[i].status == UAS_STATUS_GOOD);
+        CHECK(tasks[i].ready == order[i]);
+    }
+    CHECK(memcmp(_read, _written, 5 * length) == 0);
+    return 0;
+}
+
+int check_abort(void) 
+{
+    task_t tasks[5];
+    urb_t *status, done;
+    size_t i;
+    
+    /* 0x31 is aborted before it runs and no IU comes for it, the status URB
+       sent for it is unlinked like uas.c does */
+    memset(tasks, 0, sizeof(tasks));
+    memset(_read, 0, sizeof(_read));
+    for (i = 0; i < 3; i++) 
+    {
+        tasks[i].tag    = 0x30 + i;
+        tasks[i].data   = &_read[i * BLOCK_SIZE];
+        tasks[i].length = BLOCK_SIZE;
+        rw_cdb(tasks[i].cdb, READ10, 64 * i, 1);
+    }
+    tasks[3].tag      = 0x40;
+    tasks[3].function = UAS_TMF_ABORT_TASK;
+    tasks[3].task_tag = 0x31;
+    tasks[4].tag      = 0x41;
+    tasks[4].function = UAS_TMF_QUERY_TASK;
+    tasks[4].task_tag = 0x31;
+    
+    CHECK(queue(tasks, 5) == 0);
+    tasks[1].done = 1;
+    CHECK(complete(tasks, 5) == 0);
+    CHECK(tasks[0].status == UAS_STATUS_GOOD && 
+        tasks[2].status == UAS_STATUS_GOOD);
+    CHECK(tasks[1].ready == 0);
+    CHECK(tasks[3].status == UAS_RC_COMPLETE);
+    CHECK(tasks[4].status == UAS_RC_COMPLETE);
+    CHECK(memcmp(&_read[0], &_written[0], BLOCK_SIZE) == 0);
+    CHECK(memcmp(&_read[2 * BLOCK_SIZE], 
+        &_written[2 * WRITE_BLOCKS * BLOCK_SIZE], BLOCK_SIZE) == 0);
+        
+    /* the one status URB left over */
+    for (i = 0, status = NULL; i < MAX_URBS; i++) 
+    {
+        if (_urbs[i].used && _urbs[i].kind == STATUS) 
+        {
+            CHECK(status == NULL);
+            status = &_urbs[i];
+        }
+    }
+    CHECK(status != NULL);
+    CHECK(unlink_urb(status) == -ECONNRESET);
+    
+    /* one that was given back already, the first control URB, isn't found */
+    memset(&done, 0, sizeof(done));
+    done.seqnum = 1;
+    CHECK(unlink_urb(&done) == 0);
+    return 0;
+}
+
+int check_task_set_full(void) 
+{
+    task_t tasks[MAX_TASKS];
+    size_t i, full = 0;
+    
+    memset(tasks, 0, sizeof(tasks));
+    for (i = 0; i < MAX_TASKS; i++) 
+    {
+        tasks[i].tag    = 0x50 + i;
+        tasks[i].data   = &_read[i * BLOCK_SIZE];
+        tasks[i].length = BLOCK_SIZE;
+        rw_cdb(tasks[i].cdb, READ10, i, 1);
+    }
+    CHECK(queue(tasks, MAX_TASKS) == 0);
+    CHECK(complete(tasks, MAX_TASKS) == 0);
+    for (i = 0; i < MAX_TASKS; i++) 
+    {
+        if (tasks[i].status == UAS_STATUS_TASK_SET_FULL) { full++; }
+        else { CHECK(tasks[i].status == UAS_STATUS_GOOD); }
+    }
+    CHECK(full == 1 && tasks[MAX_TASKS - 1].status == 
+        UAS_STATUS_TASK_SET_FULL);
+    return 0;
+}
+
+int check_out_of_range(void) 
+{
+    uint8_t cdb[10];
+    task_t task;
+    
+    rw_cdb(cdb, READ10, _blocks, 1);
+    CHECK(run(0x60, cdb, sizeof(cdb), _read, BLOCK_SIZE, 0, &task) == 
+        UAS_STATUS_CHECK_CONDITION);
+    CHECK(task.sense_key == SENSE_ILLEGAL_REQUEST && task.asc == 0x21);
+    CHECK(task.ready == 0);
+    return 0;
+}
+
+int check_image(void) 
+{
+    const size_t length = WRITE_BLOCKS * BLOCK_SIZE;
+    uint8_t cdb[10] = { SYNCHRONIZE_CACHE10 };
+    task_t task;
+    size_t i;
+    
+    /* what the writes left in the firmware's stage is on the card after
+       SYNCHRONIZE CACHE */
+    CHECK(run(0x61, cdb, sizeof(cdb), NULL, 0, 0, &task) == UAS_STATUS_GOOD);
+    /* the blocks are where the FTL mapped them, the reads compared them */
+    if (_translated) { return 0; }
+    for (i = 0; i < 8; i++) 
+    {
+        CHECK(pread(_image, _read, length, (off_t) 64 * i * BLOCK_SIZE) == 
+            (ssize_t) length);
+        CHECK(memcmp(_read, &_written[i * length], length) == 0);
+    }
+    return 0;
+}
+
+int check_self_test(void) 
+{
+    uint8_t diagnostic[6] = { 
+        SEND_DIAGNOSTIC_OPCODE, SEND_DIAGNOSTIC_SELF_TEST_CODE_FG_SHORT 
+    };
+    task_t tasks[2], task;
+    
+    /* the SENSE IU of a foreground run is held until it is over, the command
+       behind it waits */
+    memset(tasks, 0, sizeof(tasks));
+    tasks[0].tag = 0x70;
+    tasks[1].tag = 0x71;
+    memcpy(tasks[0].cdb, diagnostic, sizeof(diagnostic));
+    tasks[1].cdb[0] = TEST_UNIT_READY;
+    CHECK(queue(tasks, 2) == 0);
+    CHECK(complete(tasks, 2) == 0);
+    CHECK(tasks[0].status == UAS_STATUS_GOOD && tasks[0].sensed == 1);
+    CHECK(tasks[1].status == UAS_STATUS_GOOD && tasks[1].sensed == 2);
+    CHECK(bench_page(0x72, &task) == BENCH_DONE);
+    return 0;
+}
+
+int check_bulk_only(void) 
+{
+    uint8_t inquiry[6] = { INQUIRY, 0, 0, 0, 36, 0 };
+    uint8_t diagnostic[6] = { 
+        SEND_DIAGNOSTIC_OPCODE, SEND_DIAGNOSTIC_SELF_TEST_CODE_FG_SHORT 
+    };
+    uint8_t data[36];
+    
+    /* alternate setting 0 is bulk only as before */
+    CHECK(control(0x01, 0x0b, 0, 0, NULL, 0) == 0);
+    CHECK(bulk_only(0x5a, inquiry, sizeof(inquiry), data, sizeof(data)) == 0);
+    
+    /* its CSW too waits for the foreground run */
+    CHECK(bulk_only(0x5b, diagnostic, sizeof(diagnostic), NULL, 0) == 0);
+    return 0;
+}
+
+/*--- USB/IP -----------------------------------------------------------------*/
+int connect_server(void) 
+{
+    struct sockaddr_in in;
+    
+    if ((_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) { return -1; }
+    memset(&in, 0, sizeof(in));
+    in.sin_family      = AF_INET;
+    in.sin_port        = htons(_port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(_fd, (struct sockaddr *) &in, sizeof(in)) < 0) 
+    {
+        close(_fd);
+        return -1;
+    }
+    return 0;
+}
+
+int operation(uint16_t code, const void *busid, uint16_t reply_code) 
+{
+    uint8_t request[8 + 32], reply[8];
+    size_t length = 8;
+    
+    memset(request, 0, sizeof(request));
+    put16(request, USBIP_VERSION);
+    put16(&request[2], code);
+    if (busid != NULL) 
+    {
+        memcpy(&request[8], busid, 32);
+        length += 32;
+    }
+    if (write_all(request, length) < 0 || read_all(reply, 8) < 0 || 
+            get16(&reply[2]) != reply_code) 
+    {
+        return -1;
+    }
+    return (int) get32(&reply[4]);
+}
+
+urb_t *submit(int kind, uint8_t ep, int dir, void *data, uint32_t length, 
+    const uint8_t *setup) 
+{
+    uint8_t header[USBIP_HEADER_LENGTH];
+    urb_t *urb = NULL;
+    size_t i;
+    
+    for (i = 0; i < MAX_URBS && urb == NULL; i++) 
+    {
+        if (!_urbs[i].used) { urb = &_urbs[i]; }
+    }
+    if (urb == NULL) { return NULL; }
+    
+    memset(urb, 0, sizeof(*urb));
+    urb->used   = 1;
+    urb->seqnum = ++_seqnum;
+    urb->kind   = kind;
+    urb->dir    = dir;
+    urb->data   = kind == STATUS ? urb->iu : data;
+    urb->length = kind == STATUS ? STATUS_URB_LENGTH : length;
+    
+    memset(header, 0, sizeof(header));
+    put32(header, USBIP_CMD_SUBMIT);
+    put32(&header[4], urb->seqnum);
+    put32(&header[8], 1 << 16 | 2);
+    put32(&header[12], dir);
+    put32(&header[16], ep);
+    put32(&header[24], urb->length);
+    if (setup != NULL) { memcpy(&header[40], setup, 8); }
+    if (write_all(header, sizeof(header)) < 0 || 
+            (dir == USBIP_DIR_OUT && write_all(urb->data, urb->length) < 0)) 
+    {
+        return NULL;
+    }
+    return urb;
+}
+
+int unlink_urb(urb_t *urb) 
+{
+    uint8_t header[USBIP_HEADER_LENGTH];
+    uint32_t seqnum = ++_seqnum;
+    
+    memset(header, 0, sizeof(header));
+    put32(header, USBIP_CMD_UNLINK);
+    put32(&header[4], seqnum);
+    put32(&header[20], urb->seqnum);
+    /* nothing else is in flight, its reply is the next one */
+    if (write_all(header, sizeof(header)) < 0 || 
+            read_all(header, sizeof(header)) < 0 || 
+            get32(header) != USBIP_RET_UNLINK || get32(&header[4]) != seqnum) 
+    {
+        return -1;
+    }
+    release(urb);
+    return (int32_t) get32(&header[20]);
+}
+
+urb_t *reap(void) 
+{
+    uint8_t header[USBIP_HEADER_LENGTH];
+    urb_t *urb = NULL;
+    size_t i;
+    
+    if (read_all(header, sizeof(header)) < 0 || 
+            get32(header) != USBIP_RET_SUBMIT) 
+    {
+        return NULL;
+    }
+    for (i = 0; i < MAX_URBS && urb == NULL; i++) 
+    {
+        if (_urbs[i].used && _urbs[i].seqnum == get32(&header[4])) 
+        {
+            urb = &_urbs[i];
+        }
+    }
+    if (urb == NULL) { return NULL; }
+    
+    urb->done   = 1;
+    urb->status = (int32_t) get32(&header[20]);
+    urb->actual = get32(&header[24]);
+    if (urb->dir == USBIP_DIR_IN && (urb->actual > urb->length || 
+            read_all(urb->data, urb->actual) < 0)) 
+    {
+        return NULL;
+    }
+    return urb;
+}
+
+int wait_urb(urb_t *urb) 
+{
+    while (!urb->done) 
+    {
+        if (reap() == NULL) { return -1; }
+    }
+    return urb->status;
+}
+
+void release(urb_t *urb) 
+{
+    urb->used = 0;
+}
+
+int control(uint8_t type, uint8_t request, uint16_t value, uint16_t index, 
+    void *data, uint16_t length) 
+{
+    uint8_t setup[8] = { type, request, value & 0xff, value >> 8, 
+        index & 0xff, index >> 8, length & 0xff, length >> 8 };
+    urb_t *urb;
+    int status;
+    
+    if ((urb = submit(CONTROL, 0, (type & 0x80) ? USBIP_DIR_IN :
+            USBIP_DIR_OUT, data, length, setup)) == NULL) 
+    {
+        return -1;
+    }
+    status = wait_urb(urb);
+    release(urb);
+    return status < 0 ? status : (int) urb->actual;
+}
+
+/*--- UAS --------------------------------------------------------------------*/
+int queue(task_t *tasks, size_t count) 
+{
+    struct uas_command_iu command;
+    struct uas_task_management_iu management;
+    urb_t *urb;
+    size_t i;
+    
+    _readies = 0;
+    _senses  = 0;
+    _commands_done = 0;
+    _commands_before_sense = -1;
+    
+    for (i = 0; i < count; i++) 
+    {
+        if (submit(STATUS, _ep_status, USBIP_DIR_IN, NULL, 0, NULL) == NULL) 
+        {
+            return -1;
+        }
+        if (tasks[i].function != 0) 
+        {
+            memset(&management, 0, sizeof(management));
+            management.iu_id    = UAS_IU_TASK_MANAGEMENT;
+            management.function = tasks[i].function;
+            put16((uint8_t *) &management.tag, tasks[i].tag);
+            put16((uint8_t *) &management.task_tag, tasks[i].task_tag);
+            urb = submit(COMMAND, _ep_command, USBIP_DIR_OUT, &management, 
+                sizeof(management), NULL);
+        }
+        else 
+        {
+            memset(&command, 0, sizeof(command));
+            command.iu_id     = UAS_IU_COMMAND;
+            command.attribute = tasks[i].attribute;
+            put16((uint8_t *) &command.tag, tasks[i].tag);
+            memcpy(command.cdb, tasks[i].cdb, sizeof(command.cdb));
+            urb = submit(COMMAND, _ep_command, USBIP_DIR_OUT, &command, 
+                sizeof(command), NULL);
+        }
+        if (urb == NULL) { return -1; }
+        urb->task = &tasks[i];
+    }
+    return 0;
+}
+
+int complete(task_t *tasks, size_t count) 
+{
+    urb_t *urb;
+    size_t i;
+    
+    for (;;) 
+    {
+        for (i = 0; i < count && tasks[i].done; i++) { }
+        if (i == count) { return 0; }
+        
+        if ((urb = reap()) == NULL) { return -1; }
+        if (urb->status != 0) 
+        {
+            printf("  urb %u of kind %d: status %d\n", urb->seqnum, urb->kind, 
+                urb->status);
+            return -1;
+        }
+        
+        switch (urb->kind) 
+        {
+        case COMMAND:
+            _commands_done++;
+            break;
+            
+        case STATUS:
+            if (status_iu(urb, tasks, count) < 0) { return -1; }
+            break;
+            
+        case DATA:
+            if (urb->actual != urb->length) { return -1; }
+            break;
+            
+        default:
+            return -1;
+        }
+        release(urb);
+    }
+}
+
+int status_iu(urb_t *urb, task_t *tasks, size_t count) 
+{
+    const struct uas_sense_iu *sense = (const void *) urb->iu;
+    uint16_t tag = get16(&urb->iu[2]);
+    task_t *task = NULL;
+    urb_t *data;
+    size_t i;
+    
+    for (i = 0; i < count && task == NULL; i++) 
+    {
+        if (tasks[i].tag == tag && !tasks[i].done) { task = &tasks[i]; }
+    }
+    if (urb->actual < 4 || task == NULL) 
+    {
+        printf("  IU 0x%02x of tag 0x%04x, no such task\n", urb->iu[0], tag);
+        return -1;
+    }
+    
+    switch (urb->iu[0]) 
+    {
+    case UAS_IU_READ_READY:
+    case UAS_IU_WRITE_READY:
+        /* the data URB and a status URB for the SENSE IU after it */
+        if ((urb->iu[0] == UAS_IU_WRITE_READY) != task->write) { return -1; }
+        task->ready = ++_readies;
+        data = submit(DATA, task->write ? _ep_data_out : _ep_data_in, 
+            task->write ? USBIP_DIR_OUT : USBIP_DIR_IN, task->data, 
+            task->length, NULL);
+        if (data == NULL || submit(STATUS, _ep_status, USBIP_DIR_IN, NULL, 
+                0, NULL) == NULL) 
+        {
+            return -1;
+        }
+        data->task = task;
+        return 0;
+        
+    case UAS_IU_SENSE:
+        if (_senses == 0) { _commands_before_sense = _commands_done; }
+        task->sensed = ++_senses;
+        task->done   = 1;
+        task->status = sense->status;
+        if (sense->status == UAS_STATUS_CHECK_CONDITION && 
+                get16((const uint8_t *) &sense->length) >= 14) 
+        {
+            task->sense_key = sense->sense[2] & 0x0f;
+            task->asc       = sense->sense[12];
+        }
+        return 0;
+        
+    case UAS_IU_RESPONSE:
+        task->done   = 1;
+        task->status = urb->iu[7];
+        return 0;
+        
+    default:
+        return -1;
+    }
+}
+
+int run(uint16_t tag, const uint8_t *cdb, size_t cdblen, void *data, 
+    uint32_t length, int write, task_t *task) 
+{
+    memset(task, 0, sizeof(*task));
+    task->tag    = tag;
+    task->data   = data;
+    task->length = length;
+    task->write  = write;
+    memcpy(task->cdb, cdb, cdblen);
+    if (queue(task, 1) < 0 || complete(task, 1) < 0) { return -1; }
+    return task->status;
+}
+
+void rw_cdb(uint8_t *cdb, uint8_t opcode, uint32_t lba, uint16_t blocks) 
+{
+    memset(cdb, 0, 10);
+    cdb[0] = opcode;
+    put32(&cdb[2], lba);
+    put16(&cdb[7], blocks);
+}
+
+int bench_page(uint16_t tag, task_t *task) 
+{
+    uint8_t cdb[6] = { 
+        RECEIVE_DIAGNOSTIC_RESULTS_OPCODE, RECEIVE_DIAGNOSTIC_RESULTS_PCV_MASK, 
+        DIAGNOSTIC_PAGE_BENCH, 0, sizeof(diagnostic_bench_page_t), 0 
+    };
+    diagnostic_bench_page_t page;
+    
+    if (run(tag, cdb, sizeof(cdb), &page, sizeof(page), 0, task) != 
+            UAS_STATUS_GOOD || page.header.page_code != DIAGNOSTIC_PAGE_BENCH) 
+    {
+        return -1;
+    }
+    return page.status;
+}
+
+int bulk_only(uint8_t tag, const uint8_t *cdb, size_t cdblen, void *data, 
+    uint32_t length) 
+{
+    uint8_t cbw[31], csw[13];
+    urb_t *urb;
+    
+    memset(cbw, 0, sizeof(cbw));
+    cbw[0]  = CBW_SIGNATURE & 0xff;
+    cbw[1]  = (CBW_SIGNATURE >> 8) & 0xff;
+    cbw[2]  = (CBW_SIGNATURE >> 16) & 0xff;
+    cbw[3]  = CBW_SIGNATURE >> 24;
+    cbw[4]  = tag;
+    cbw[8]  = length & 0xff;
+    cbw[9]  = length >> 8;
+    cbw[12] = 0x80;
+    cbw[14] = cdblen;
+    memcpy(&cbw[15], cdb, cdblen);
+    
+    if ((urb = submit(BULK, _ep_bulk_out, USBIP_DIR_OUT, cbw, sizeof(cbw), 
+            NULL)) == NULL || wait_urb(urb) != 0) 
+    {
+        return -1;
+    }
+    release(urb);
+    if (length > 0) 
+    {
+        if ((urb = submit(BULK, _ep_bulk_in, USBIP_DIR_IN, data, length, 
+                NULL)) == NULL || wait_urb(urb) != 0 || urb->actual != length) 
+        {
+            return -1;
+        }
+        release(urb);
+    }
+    if ((urb = submit(BULK, _ep_bulk_in, USBIP_DIR_IN, csw, sizeof(csw), 
+            NULL)) == NULL || wait_urb(urb) != 0 || urb->actual != sizeof(csw)) 
+    {
+        return -1;
+    }
+    release(urb);
+    if (le16(csw) != (CSW_SIGNATURE & 0xffff) || csw[4] != tag) { return -1; }
+    return csw[12];
+}
+
+/******************************************************************************/
+
+uint32_t rng(void) 
+{
+    /* xorshift32 */
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return _rng;
+}
+
+void put16(uint8_t *dest, uint16_t value) 
+{
+    dest[0] = value >> 8;
+    dest[1] = value;
+}
+
+void put32(uint8_t *dest, uint32_t value) 
+{
+    put16(dest, value >> 16);
+    put16(&dest[2], value);
+}
+
+uint16_t get16(const uint8_t *src) 
+{
+    return (uint16_t) (src[0] << 8 | src[1]);
+}
+
+uint32_t get32(const uint8_t *src) 
+{
+    return (uint32_t) get16(src) << 16 | get16(&src[2]);
+}
+
+uint16_t le16(const uint8_t *src) 
+{
+    return (uint16_t) (src[1] << 8 | src[0]);
+}
+
+int read_all(void *dest, size_t length) 
+{
+    uint8_t *bytes = dest;
+    ssize_t count;
+    
+    while (length > 0) 
+    {
+        if ((count = read(_fd, bytes, length)) <= 0) 
+        {
+            if (count < 0 && errno == EINTR) { continue; }
+            return -1;
+        }
+        bytes  += count;
+        length -= (size_t) count;
+    }
+    return 0;
+}
+
+int write_all(const void *src, size_t length) 
+{
+    const uint8_t *bytes = src;
+    ssize_t count;
+    
+    while (length > 0) 
+    {
+        if ((count = write(_fd, bytes, length)) < 0) 
+        {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+        bytes  += count;
+        length -= (size_t) count;
+    }
+    return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * usb_fs is the host and the controller of usb_fs.h. A transaction finds the
+ * buffer descriptor the controller's ping pong state points at, NAKs if the
+ * firmware hasn't handed it to the controller, moves the data, writes the
+ * token's PID back into the descriptor and runs `usb_isr` with TOKDNE up.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "kinetis.h"
+#include "usb_dev.h"
+#include "usb_bdt.h"
+#include "usb_fs.h"
+
+/******************************************************************************/
+
+/* the registers of tools/host/kinetis.h */
+uint8_t host_usb_endpt[16 * 4];
+uint8_t host_usb_addr;
+uint8_t host_usb_bdtpage[3];
+uint8_t host_usb_control;
+uint8_t host_usb_ctl;
+uint8_t host_usb_erren;
+uint8_t host_usb_errstat;
+uint8_t host_usb_inten;
+uint8_t host_usb_otgistat;
+uint8_t host_usb_usbctrl;
+uint8_t host_ftfl_fstat;
+uint8_t host_ftfl_fccob[12];
+
+uint32_t usb_fs_toggle_errors = 0;
+
+static uint8_t _istat = 0;
+static uint8_t _stat  = 0;
+/* a token is in STAT until the firmware reads it */
+static int     _token = 0;
+
+/* the controller's ping pong bit and the host's data toggle of each endpoint
+   and direction */
+static uint8_t _odd[16][2];
+static uint8_t _toggle[16][2];
+
+/******************************************************************************/
+
+/* the buffer descriptor of the next transaction, NULL if the firmware still
+   owns it */
+static bdt_t *descriptor(uint8_t ep, int tx);
+/* hands `bd` back to the firmware with `pid` and runs the isr on the token */
+static void complete(bdt_t *bd, uint8_t ep, int tx, uint8_t pid, 
+    size_t length, uint32_t data1);
+/* runs the isr on the events in ISTAT, they are taken once it returns */
+static void interrupt(uint8_t events);
+/* NAK, STALL or nothing if the endpoint can't take the transaction */
+static int endpoint_state(uint8_t ep, uint8_t enable);
+
+/******************************************************************************/
+
+uint8_t *host_usb_istat(void) 
+{
+    _istat = (_istat & ~USB_ISTAT_TOKDNE) | (_token ? USB_ISTAT_TOKDNE : 0);
+    return &_istat;
+}
+
+uint8_t *host_usb_stat(void) 
+{
+    _token = 0;
+    return &_stat;
+}
+
+void usb_fs_attach(uint32_t serial) 
+{
+    /* the word of the program once field `usb_init_serialnumber` reads */
+    memcpy(&host_ftfl_fccob[4], &serial, sizeof(serial));
+    host_ftfl_fstat = FTFL_FSTAT_CCIF;
+    
+    usb_init();
+    usb_fs_reset();
+}
+
+void usb_fs_reset(void) 
+{
+    memset(_odd, 0, sizeof(_odd));
+    memset(_toggle, 0, sizeof(_toggle));
+    interrupt(USB_ISTAT_USBRST);
+}
+
+int usb_fs_setup(const void *setup) 
+{
+    bdt_t *bd;
+    int result;
+    
+    if ((result = endpoint_state(0, USB_ENDPT_EPRXEN)) != USB_FS_ACK) 
+    {
+        /* a control endpoint takes a SETUP even while it is stalled */
+        if (result != USB_FS_STALL) { return result; }
+    }
+    if ((bd = descriptor(0, RX)) == NULL) { return USB_FS_NAK; }
+    
+    memcpy(bd->addr, setup, 8);
+    _toggle[0][USB_FS_DIR_OUT] = 1;
+    _toggle[0][USB_FS_DIR_IN]  = 1;
+    complete(bd, 0, RX, PID_SETUP, 8, 0);
+    return USB_FS_ACK;
+}
+
+int usb_fs_out(uint8_t ep, const void *data, size_t length) 
+{
+    uint8_t *toggle = &_toggle[ep][USB_FS_DIR_OUT];
+    bdt_t *bd;
+    int result;
+    
+    if ((result = endpoint_state(ep, USB_ENDPT_EPRXEN)) != USB_FS_ACK) 
+    {
+        return result;
+    }
+    if ((bd = descriptor(ep, RX)) == NULL) { return USB_FS_NAK; }
+    if (length > BDT_DESC_LENGTH(bd->desc)) 
+    {
+        fprintf(stderr, "usb_fs: %u bytes to endpoint %u, its buffer has %u\n", 
+            (unsigned) length, ep, (unsigned) BDT_DESC_LENGTH(bd->desc));
+        return USB_FS_STALL;
+    }
+    
+    /* with DTS set the controller checks the toggle the firmware expects.
+       Endpoint 0 is left out: after a reset both its buffers say DATA0 and
+       the status stage comes as DATA1, as with the teensy core it is from */
+    if (ep != 0 && (bd->desc & BDT_DTS) && 
+            !!(bd->desc & BDT_DATA1) != *toggle) 
+    {
+        fprintf(stderr, 
+            "usb_fs: endpoint %u OUT expects DATA%u, sent DATA%u\n", ep, 
+            !!(bd->desc & BDT_DATA1), *toggle);
+        usb_fs_toggle_errors++;
+    }
+    if (length > 0) { memcpy(bd->addr, data, length); }
+    complete(bd, ep, RX, PID_OUT, length, *toggle ? BDT_DATA1 : 0);
+    *toggle ^= 1;
+    return USB_FS_ACK;
+}
+
+int usb_fs_in(uint8_t ep, void *data, size_t max, size_t *length) 
+{
+    uint8_t *toggle = &_toggle[ep][USB_FS_DIR_IN];
+    bdt_t *bd;
+    uint32_t desc;
+    int result;
+    
+    *length = 0;
+    if ((result = endpoint_state(ep, USB_ENDPT_EPTXEN)) != USB_FS_ACK) 
+    {
+        return result;
+    }
+    if ((bd = descriptor(ep, TX)) == NULL) { return USB_FS_NAK; }
+    
+    desc = bd->desc;
+    if (!!(desc & BDT_DATA1) != *toggle) 
+    {
+        fprintf(stderr, 
+            "usb_fs: endpoint %u IN sent DATA%u, expected DATA%u\n", ep, 
+            !!(desc & BDT_DATA1), *toggle);
+        usb_fs_toggle_errors++;
+    }
+    *length = BDT_DESC_LENGTH(desc);
+    if (*length > max) 
+    {
+        complete(bd, ep, TX, PID_IN, *length, desc & BDT_DATA1);
+        *toggle ^= 1;
+        return USB_FS_BABBLE;
+    }
+    if (*length > 0) { memcpy(data, bd->addr, *length); }
+    complete(bd, ep, TX, PID_IN, *length, desc & BDT_DATA1);
+    *toggle ^= 1;
+    return USB_FS_ACK;
+}
+
+void usb_fs_clear_toggle(uint8_t ep, int dir) 
+{
+    _toggle[ep & 0x0f][dir] = 0;
+}
+
+/******************************************************************************/
+
+bdt_t *descriptor(uint8_t ep, int tx) 
+{
+    bdt_t *bd = &bdt[BDT_INDEX(ep, tx, _odd[ep][tx])];
+    
+    return (bd->desc & BDT_OWN) ? bd : NULL;
+}
+
+void complete(bdt_t *bd, uint8_t ep, int tx, uint8_t pid, size_t length, 
+    uint32_t data1) 
+{
+    uint8_t odd = _odd[ep][tx];
+    
+    bd->desc = ((uint32_t) length << 16) | data1 | ((uint32_t) pid << 2);
+    _odd[ep][tx] ^= 1;
+    
+    _stat  = (uint8_t) ((ep << 4) | (tx ? USB_STAT_TX : 0) | 
+        (odd ? USB_STAT_ODD : 0));
+    _token = 1;
+    interrupt(0);
+}
+
+void interrupt(uint8_t events) 
+{
+    _istat |= events;
+    usb_isr();
+    _istat = 0;
+}
+
+int endpoint_state(uint8_t ep, uint8_t enable) 
+{
+    uint8_t endpt = host_usb_endpt[(ep & 0x0f) * 4];
+    
+    if (!(endpt & enable)) { return USB_FS_TIMEOUT; }
+    if (endpt & USB_ENDPT_EPSTALL) 
+    {
+        /* the controller raises STALL when it sent one */
+        interrupt(USB_ISTAT_STALL);
+        return USB_FS_STALL;
+    }
+    return USB_FS_ACK;
+}
@@ -0,0 +1,50 @@
+#ifndef _usb_fs_h_
+#define _usb_fs_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * usb_fs is the host's side of the bus to the firmware's USB-FS controller.
+ * It moves one packet at a time through the buffer descriptor table like the
+ * controller does and calls `usb_isr` with the token in USB0_STAT, so
+ * usb_dev.c and the interfaces behind it run as they would on the board. It
+ * keeps the host's data toggles and counts packets whose toggle isn't the
+ * one the host expected.
+ */
+
+/* outcomes of a transaction */
+#define USB_FS_ACK          (0)
+#define USB_FS_NAK          (-1)
+#define USB_FS_STALL        (-2)
+#define USB_FS_TIMEOUT      (-3) /* the endpoint isn't enabled              */
+#define USB_FS_BABBLE       (-4) /* more data than the host asked for       */
+
+#define USB_FS_DIR_OUT      (0)
+#define USB_FS_DIR_IN       (1)
+
+/* max packet size of every endpoint of the firmware */
+#define USB_FS_PACKET_SIZE  (64)
+
+/* packets with the wrong data toggle since `usb_fs_attach` */
+extern uint32_t usb_fs_toggle_errors;
+
+/* runs `usb_init` with `serial` as the chip's serial number and resets the
+   bus */
+void usb_fs_attach(uint32_t serial);
+/* a bus reset, the device is back at address 0 and unconfigured */
+void usb_fs_reset(void);
+
+/* the 8 bytes of a SETUP to endpoint 0, the data toggle of both directions of
+   endpoint 0 goes to DATA1 */
+int usb_fs_setup(const void *setup);
+/* an OUT packet of up to USB_FS_PACKET_SIZE bytes */
+int usb_fs_out(uint8_t ep, const void *data, size_t length);
+/* an IN packet of up to `max` bytes, its length in `length` */
+int usb_fs_in(uint8_t ep, void *data, size_t max, size_t *length);
+
+/* the next packet of `ep` in direction `dir` is DATA0 on both sides, after
+   SET CONFIGURATION, SET INTERFACE or a CLEAR FEATURE of a halt */
+void usb_fs_clear_toggle(uint8_t ep, int dir);
+
+#endif
@@ -0,0 +1,808 @@
+/*
+ * usbipd exports the firmware, built for the host with its USB stack
+ * (usb_dev.c, usb_msd.c, usb_uas.c and scsi_sd.c) on the card of file_sd.h,
+ * as a USB/IP device. The host's URBs go through the simulated controller
+ * of usb_fs.h a packet at a time, so the host's usb-storage or uas driver
+ * talks to the firmware's bulk only and UAS alternate settings as it would
+ * over the wire, e.g.
+ *
+ *   truncate -s 1G card.img
+ *   ./usbipd card.img
+ *   modprobe vhci-hcd
+ *   usbip attach -r 127.0.0.1 -b 1-1
+ *
+ * The device is full speed on bus 1, port 1. One client is served at a time,
+ * a new one finds the device after a bus reset. uascheck is such a client,
+ * see its header.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "usb_dev.h"
+#include "usb_msd.h"
+#include "scsi_sd.h"
+#include "file_sd.h"
+#include "usb_fs.h"
+
+/* the port usbip clients connect to */
+#define USBIP_PORT          (3240)
+/* the largest transfer buffer of an URB */
+#define MAX_URB             (16 * 1024 * 1024)
+/* how often the firmware's main loop runs while no URB comes, and while URBs
+   wait on the device */
+#define POLL_MS             (10)
+#define BUSY_POLL_MS        (1)
+/* the serial number the chip's program once field reads */
+#define SERIAL_NUMBER       (0x00c0ffee)
+
+/*--- USB/IP PROTOCOL --------------------------------------------------------*/
+#define USBIP_VERSION           (0x0111)
+#define OP_REQ_DEVLIST          (0x8005)
+#define OP_REP_DEVLIST          (0x0005)
+#define OP_REQ_IMPORT           (0x8003)
+#define OP_REP_IMPORT           (0x0003)
+
+#define USBIP_CMD_SUBMIT        (1)
+#define USBIP_CMD_UNLINK        (2)
+#define USBIP_RET_SUBMIT        (3)
+#define USBIP_RET_UNLINK        (4)
+#define USBIP_DIR_OUT           (0)
+#define USBIP_DIR_IN            (1)
+/* the header of every command and reply */
+#define USBIP_HEADER_LENGTH     (48)
+
+/* of the exported device */
+#define USBIP_BUSID             "1-1"
+#define USBIP_PATH              "/sys/devices/platform/teensy/usb1/1-1"
+#define USBIP_BUSNUM            (1)
+#define USBIP_DEVNUM            (2)
+#define USBIP_DEVICE_LENGTH     (312)
+#define USB_SPEED_FULL          (2)
+
+/* transfer flags of an URB */
+#define URB_ZERO_PACKET         (0x0040)
+
+/* requests of endpoint 0 that also reset the host's side */
+#define USB_REQ_SET_FEATURE     (0x03)
+#define USB_REQ_CLEAR_FEATURE   (0x01)
+#define USB_REQ_SET_CONFIGURATION (0x09)
+#define USB_REQ_SET_INTERFACE   (0x0b)
+#define USB_REQ_GET_DESCRIPTOR  (0x06)
+#define USB_RT_PORT             (0x23)
+#define USB_RT_ENDPOINT         (0x02)
+#define USB_RT_INTERFACE        (0x01)
+#define USB_PORT_FEAT_RESET     (4)
+
+/*--- URBS -------------------------------------------------------------------*/
+typedef struct urb {
+    struct urb *next;
+    uint32_t    seqnum;
+    uint8_t     ep;
+    int         dir;
+    uint32_t    flags;
+    uint32_t    length;                 /* of the transfer buffer             */
+    uint32_t    actual;                 /* bytes moved so far                 */
+    uint8_t     setup[8];
+    enum { SETUP, DATA, STATUS, ZERO_PACKET } stage;
+    uint8_t    *data;
+} urb_t;
+
+/* the URBs of each endpoint and direction in the order they came, the first
+   one is on the bus. Those of endpoint 0 are all in [0][USBIP_DIR_OUT] */
+static urb_t *_urbs[16][2];
+
+/* the device and config descriptor, for the device list */
+static uint8_t _device[18];
+static uint8_t _config[256];
+/* the interface each endpoint and direction is in, -1 for none */
+static int     _interface[16][2];
+
+/******************************************************************************/
+
+static void usage(const char *name);
+static int listen_on(int port);
+
+/* a control transfer of the server's own before a client comes, the data
+   stage in `data`. Returns its length or -1 */
+static int control(uint8_t type, uint8_t request, uint16_t value, 
+    uint16_t index, void *data, uint16_t length);
+/* reads the descriptors of the device for the device list */
+static int describe(void);
+
+/* OP_REQ_DEVLIST or OP_REQ_IMPORT, 1 if the client imported the device */
+static int operation(int fd);
+static int device_record(uint8_t *dest);
+/* URBs until the client disconnects */
+static void transmission(int fd);
+static int submit(int fd, const uint8_t *header);
+static int unlink_urb(int fd, const uint8_t *header);
+
+/* moves the URBs on the bus as far as the device lets them, the ones that
+   complete are given back */
+static int service(int fd);
+/* 1 once the URB is done, with its status in `status`, 0 if the device NAKs */
+static int step(urb_t *urb, int *status, int *progress);
+static int step_control(urb_t *urb, int *status, int *progress);
+static int step_bulk(urb_t *urb, int *status, int *progress);
+/* the status of an URB for the outcome of a transaction */
+static int urb_status(int result);
+/* resets the host's data toggles a completed request resets on the device */
+static void reset_toggles(const uint8_t *setup);
+static int give_back(int fd, urb_t *urb, int status);
+static void free_urbs(void);
+
+static int read_all(int fd, void *dest, size_t length);
+static int write_all(int fd, const void *src, size_t length);
+static int discard(int fd, size_t length);
+
+/* big endian fields of the wire format, little endian ones of usb */
+static uint16_t get16(const uint8_t *src);
+static uint32_t get32(const uint8_t *src);
+static void     put16(uint8_t *dest, uint16_t value);
+static void     put32(uint8_t *dest, uint32_t value);
+static uint16_t le16(const uint8_t *src);
+
+/******************************************************************************/
+
+int main(int argc, char **argv) 
+{
+    scsi_sd_lun_config_t config = { SCSI_SD_BACKEND_CARD, 0, 0, 0, NULL };
+    int port = USBIP_PORT;
+    int opt, server, client;
+    
+    while ((opt = getopt(argc, argv, "p:rsz")) != -1) 
+    {
+        switch (opt) 
+        {
+        case 'p': port = atoi(optarg);                          break;
+        case 'r': config.flags |= SCSI_SD_LUN_READ_ONLY;        break;
+        case 's': config.flags |= SCSI_SD_LUN_STAGE;            break;
+        case 'z': config.flags |= SCSI_SD_LUN_SKIP_ZEROS;       break;
+        default:  usage(argv[0]);                               return 2;
+        }
+    }
+    if (optind != argc - 1) 
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    
+    if (file_sd_open(argv[optind]) < 0) 
+    {
+        fprintf(stderr, "%s: not an image of whole blocks\n", argv[optind]);
+        return 1;
+    }
+    if (scsi_sd_configure(&config, 1) < 0) 
+    {
+        fprintf(stderr, "the lun can't be configured\n");
+        return 1;
+    }
+    
+    usb_fs_attach(SERIAL_NUMBER);
+    if (describe() < 0) 
+    {
+        fprintf(stderr, "the device didn't enumerate\n");
+        return 1;
+    }
+    
+    if ((server = listen_on(port)) < 0) 
+    {
+        perror("listen");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    
+    for (;;) 
+    {
+        if ((client = accept(server, NULL, NULL)) < 0) 
+        {
+            if (errno == EINTR) { continue; }
+            perror("accept");
+            return 1;
+        }
+        
+        /* each client finds the device as it was plugged in */
+        if (operation(client) == 1) 
+        {
+            usb_fs_reset();
+            transmission(client);
+            free_urbs();
+            usb_fs_reset();
+        }
+        close(client);
+        
+        if (usb_fs_toggle_errors > 0) 
+        {
+            fprintf(stderr, "%u packets with the wrong data toggle\n", 
+                usb_fs_toggle_errors);
+        }
+    }
+}
+
+void usage(const char *name) 
+{
+    fprintf(stderr, 
+        "usage: %s [-p port] [-r] [-s] [-z] image\n"
+        "  -p  listen on this TCP port of localhost (3240)\n"
+        "  -r  read only lun\n"
+        "  -s  gather writes in the write stage (SCSI_SD_LUN_STAGE)\n"
+        "  -z  erase or skip zero filled blocks (SCSI_SD_LUN_SKIP_ZEROS)\n", 
+        name);
+}
+
+int listen_on(int port) 
+{
+    struct sockaddr_in in;
+    int fd, one = 1;
+    
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) { return -1; }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&in, 0, sizeof(in));
+    in.sin_family      = AF_INET;
+    in.sin_port        = htons(port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *) &in, sizeof(in)) < 0 || 
+            listen(fd, 1) < 0) 
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*--- DEVICE -----------------------------------------------------------------*/
+int control(uint8_t type, uint8_t request, uint16_t value, uint16_t index, 
+    void *data, uint16_t length) 
+{
+    urb_t urb;
+    int status, progress, polls;
+    
+    memset(&urb, 0, sizeof(urb));
+    urb.dir      = (type & 0x80) ? USBIP_DIR_IN : USBIP_DIR_OUT;
+    urb.length   = length;
+    urb.data     = data;
+    urb.setup[0] = type;
+    urb.setup[1] = request;
+    urb.setup[2] = value & 0xff;
+    urb.setup[3] = value >> 8;
+    urb.setup[4] = index & 0xff;
+    urb.setup[5] = index >> 8;
+    urb.setup[6] = length & 0xff;
+    urb.setup[7] = length >> 8;
+    
+    for (polls = 0; polls < 1000; polls++) 
+    {
+        if (step(&urb, &status, &progress)) 
+        {
+            return status == 0 ? (int) urb.actual : -1;
+        }
+        usb_msd_poll();
+    }
+    return -1;
+}
+
+int describe(void) 
+{
+    int length, i, interface = -1;
+    uint8_t ep;
+    
+    memset(_interface, 0xff, sizeof(_interface));
+    if (control(0x80, USB_REQ_GET_DESCRIPTOR, 0x0100, 0, _device, 
+            sizeof(_device)) != sizeof(_device)) 
+    {
+        return -1;
+    }
+    length = control(0x80, USB_REQ_GET_DESCRIPTOR, 0x0200, 0, _config, 
+        sizeof(_config));
+    if (length < 9 || le16(&_config[2]) != length) { return -1; }
+    
+    /* which interface each endpoint is in, for SET INTERFACE */
+    for (i = 0; i + 2 <= length && _config[i] >= 2; i += _config[i]) 
+    {
+        if (_config[i + 1] == 4) { interface = _config[i + 2]; }
+        if (_config[i + 1] == 5) 
+        {
+            ep = _config[i + 2];
+            _interface[ep & 0x0f][ep & 0x80 ? USBIP_DIR_IN : USBIP_DIR_OUT] = 
+                interface;
+        }
+    }
+    return 0;
+}
+
+/*--- USB/IP -----------------------------------------------------------------*/
+int operation(int fd) 
+{
+    uint8_t request[8 + 32], reply[8 + USBIP_DEVICE_LENGTH + 4 * 8];
+    size_t length = 8;
+    uint8_t *interfaces;
+    int i, count;
+    
+    if (read_all(fd, request, 8) < 0 || get16(request) != USBIP_VERSION) 
+    {
+        return -1;
+    }
+    memset(reply, 0, sizeof(reply));
+    put16(reply, USBIP_VERSION);
+    
+    switch (get16(&request[2])) 
+    {
+    case OP_REQ_DEVLIST:
+        /* the device and its interfaces of alternate setting 0 */
+        put16(&reply[2], OP_REP_DEVLIST);
+        put32(&reply[8], 1);
+        device_record(&reply[12]);
+        interfaces = &reply[12 + USBIP_DEVICE_LENGTH];
+        for (i = 0, count = 0; i + 2 <= le16(&_config[2]); i += _config[i]) 
+        {
+            if (_config[i + 1] == 4 && _config[i + 3] == 0 && count < 8) 
+            {
+                memcpy(&interfaces[4 * count++], &_config[i + 5], 3);
+            }
+        }
+        length = 12 + USBIP_DEVICE_LENGTH + 4 * count;
+        write_all(fd, reply, length);
+        return 0;
+        
+    case OP_REQ_IMPORT:
+        if (read_all(fd, &request[8], 32) < 0) { return -1; }
+        put16(&reply[2], OP_REP_IMPORT);
+        if (strncmp((const char *) &request[8], USBIP_BUSID, 32) != 0) 
+        {
+            put32(&reply[4], 1);
+            write_all(fd, reply, 8);
+            return 0;
+        }
+        device_record(&reply[8]);
+        if (write_all(fd, reply, 8 + USBIP_DEVICE_LENGTH) < 0) { return -1; }
+        return 1;
+        
+    default:
+        fprintf(stderr, "unknown operation 0x%04x\n", get16(&request[2]));
+        return -1;
+    }
+}
+
+int device_record(uint8_t *dest) 
+{
+    memset(dest, 0, USBIP_DEVICE_LENGTH);
+    strcpy((char *) dest, USBIP_PATH);
+    strcpy((char *) &dest[256], USBIP_BUSID);
+    put32(&dest[288], USBIP_BUSNUM);
+    put32(&dest[292], USBIP_DEVNUM);
+    put32(&dest[296], USB_SPEED_FULL);
+    put16(&dest[300], le16(&_device[8]));   /* idVendor             */
+    put16(&dest[302], le16(&_device[10]));  /* idProduct            */
+    put16(&dest[304], le16(&_device[12]));  /* bcdDevice            */
+    dest[306] = _device[4];                 /* bDeviceClass         */
+    dest[307] = _device[5];
+    dest[308] = _device[6];
+    dest[309] = usb_active_configuration;
+    dest[310] = _device[17];                /* bNumConfigurations   */
+    dest[311] = _config[4];                 /* bNumInterfaces       */
+    return 0;
+}
+
+void transmission(int fd) 
+{
+    uint8_t header[USBIP_HEADER_LENGTH];
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int busy = 0, result;
+    
+    for (;;) 
+    {
+        result = poll(&pfd, 1, busy ? BUSY_POLL_MS : POLL_MS);
+        if (result < 0 && errno != EINTR) { return; }
+        if (result > 0) 
+        {
+            if (read_all(fd, header, sizeof(header)) < 0) { return; }
+            switch (get32(header)) 
+            {
+            case USBIP_CMD_SUBMIT:
+                if (submit(fd, header) < 0) { return; }
+                break;
+                
+            case USBIP_CMD_UNLINK:
+                if (unlink_urb(fd, header) < 0) { return; }
+                break;
+                
+            default:
+                fprintf(stderr, "unknown command %u\n", get32(header));
+                return;
+            }
+        }
+        
+        /* the firmware's main loop, then whatever it let through */
+        usb_msd_poll();
+        if ((busy = service(fd)) < 0) { return; }
+    }
+}
+
+int submit(int fd, const uint8_t *header) 
+{
+    int32_t packets = (int32_t) get32(&header[36]);
+    urb_t *urb, **tail;
+    
+    if ((urb = calloc(1, sizeof(*urb))) == NULL) { return -1; }
+    urb->seqnum = get32(&header[4]);
+    urb->dir    = get32(&header[12]) == USBIP_DIR_IN;
+    urb->ep     = get32(&header[16]) & 0x0f;
+    urb->flags  = get32(&header[20]);
+    urb->length = get32(&header[24]);
+    memcpy(urb->setup, &header[40], 8);
+    
+    if (urb->length > MAX_URB || 
+            (urb->length > 0 && (urb->data = malloc(urb->length)) == NULL)) 
+    {
+        free(urb);
+        return -1;
+    }
+    if (urb->dir == USBIP_DIR_OUT && 
+            read_all(fd, urb->data, urb->length) < 0) 
+    {
+        free(urb->data);
+        free(urb);
+        return -1;
+    }
+    
+    /* the device has no isochronous endpoints */
+    if (packets > 0) 
+    {
+        if (discard(fd, (size_t) packets * 16) < 0) { return -1; }
+        return give_back(fd, urb, -EINVAL);
+    }
+    
+    tail = &_urbs[urb->ep][urb->ep == 0 ? USBIP_DIR_OUT : urb->dir];
+    while (*tail != NULL) { tail = &(*tail)->next; }
+    *tail = urb;
+    return 0;
+}
+
+int unlink_urb(int fd, const uint8_t *header) 
+{
+    uint8_t reply[USBIP_HEADER_LENGTH];
+    uint32_t seqnum = get32(&header[20]);
+    int32_t status = 0;
+    urb_t **link, *urb;
+    int ep, dir;
+    
+    /* an URB still waiting is given back as unlinked, one that completed
+       already was given back with its status */
+    for (ep = 0; ep < 16; ep++) 
+    {
+        for (dir = 0; dir < 2; dir++) 
+        {
+            for (link = &_urbs[ep][dir]; *link != NULL;
+                    link = &(*link)->next) 
+            {
+                if ((*link)->seqnum != seqnum) { continue; }
+                urb   = *link;
+                *link = urb->next;
+                free(urb->data);
+                free(urb);
+                status = -ECONNRESET;
+                goto reply;
+            }
+        }
+    }
+    
+    reply:
+        memset(reply, 0, sizeof(reply));
+        put32(reply, USBIP_RET_UNLINK);
+        put32(&reply[4], get32(&header[4]));
+        put32(&reply[20], (uint32_t) status);
+        return write_all(fd, reply, sizeof(reply));
+}
+
+/*--- BUS --------------------------------------------------------------------*/
+int service(int fd) 
+{
+    int progress, status, ep, dir;
+    urb_t *urb;
+    
+    do 
+    {
+        progress = 0;
+        for (ep = 0; ep < 16; ep++) 
+        {
+            for (dir = 0; dir < 2; dir++) 
+            {
+                while ((urb = _urbs[ep][dir]) != NULL && 
+                        step(urb, &status, &progress)) 
+                {
+                    _urbs[ep][dir] = urb->next;
+                    if (give_back(fd, urb, status) < 0) { return -1; }
+                }
+            }
+        }
+    } while (progress);
+    
+    /* 1 while URBs wait on the device */
+    for (ep = 0; ep < 16; ep++) 
+    {
+        if (_urbs[ep][0] != NULL || _urbs[ep][1] != NULL) { return 1; }
+    }
+    return 0;
+}
+
+int step(urb_t *urb, int *status, int *progress) 
+{
+    return urb->ep == 0 ? step_control(urb, status, progress) :
+        step_bulk(urb, status, progress);
+}
+
+int step_control(urb_t *urb, int *status, int *progress) 
+{
+    uint16_t length = le16(&urb->setup[6]);
+    size_t count;
+    int result;
+    
+    if (length > urb->length) { length = urb->length; }
+    
+    for (;;) 
+    {
+        switch (urb->stage) 
+        {
+        case SETUP:
+            /* a port reset reaches the server as a request to the device */
+            if (urb->setup[0] == USB_RT_PORT && 
+                    urb->setup[1] == USB_REQ_SET_FEATURE && 
+                    le16(&urb->setup[2]) == USB_PORT_FEAT_RESET) 
+            {
+                usb_fs_reset();
+                *status = 0;
+                return 1;
+            }
+            result = usb_fs_setup(urb->setup);
+            if (result == USB_FS_NAK) { return 0; }
+            if (result != USB_FS_ACK) { break; }
+            *progress  = 1;
+            urb->stage = length > 0 ? DATA : STATUS;
+            continue;
+            
+        case DATA:
+            if (urb->setup[0] & 0x80) 
+            {
+                result = usb_fs_in(0, urb->data + urb->actual, 
+                    length - urb->actual, &count);
+            }
+            else 
+            {
+                count = length - urb->actual;
+                if (count > USB_FS_PACKET_SIZE) { count = USB_FS_PACKET_SIZE; }
+                result = usb_fs_out(0, urb->data + urb->actual, count);
+            }
+            if (result == USB_FS_NAK) { return 0; }
+            if (result != USB_FS_ACK) { break; }
+            *progress    = 1;
+            urb->actual += count;
+            if (urb->actual == length || count < USB_FS_PACKET_SIZE) 
+            {
+                urb->stage = STATUS;
+            }
+            continue;
+            
+        case STATUS:
+        default:
+            /* a zero length packet the other way */
+            result = (urb->setup[0] & 0x80) ? usb_fs_out(0, NULL, 0) :
+                usb_fs_in(0, NULL, 0, &count);
+            if (result == USB_FS_NAK) { return 0; }
+            if (result == USB_FS_ACK) 
+            {
+                *progress = 1;
+                reset_toggles(urb->setup);
+            }
+            break;
+        }
+        
+        *status = urb_status(result);
+        return 1;
+    }
+}
+
+int step_bulk(urb_t *urb, int *status, int *progress) 
+{
+    size_t count;
+    int result;
+    
+    for (;;) 
+    {
+        if (urb->dir == USBIP_DIR_IN) 
+        {
+            result = usb_fs_in(urb->ep, urb->data + urb->actual, 
+                urb->length - urb->actual, &count);
+        }
+        else 
+        {
+            count = urb->length - urb->actual;
+            if (count > USB_FS_PACKET_SIZE) { count = USB_FS_PACKET_SIZE; }
+            result = usb_fs_out(urb->ep, urb->data + urb->actual, count);
+        }
+        if (result == USB_FS_NAK) { return 0; }
+        if (result != USB_FS_ACK) { break; }
+        *progress    = 1;
+        urb->actual += count;
+        
+        /* a short packet ends it, an OUT URB asking for it gets a zero length
+           packet after its last full one */
+        if (count < USB_FS_PACKET_SIZE || urb->stage == ZERO_PACKET) { break; }
+        if (urb->actual == urb->length) 
+        {
+            if (urb->dir == USBIP_DIR_IN || !(urb->flags & URB_ZERO_PACKET)) 
+            {
+                break;
+            }
+            urb->stage = ZERO_PACKET;
+        }
+    }
+    
+    *status = urb_status(result);
+    return 1;
+}
+
+int urb_status(int result) 
+{
+    switch (result) 
+    {
+    case USB_FS_ACK:        return 0;
+    case USB_FS_STALL:      return -EPIPE;
+    case USB_FS_BABBLE:     return -EOVERFLOW;
+    default:                return -EPROTO;
+    }
+}
+
+void reset_toggles(const uint8_t *setup) 
+{
+    int ep, dir;
+    
+    for (ep = 1; ep < 16; ep++) 
+    {
+        for (dir = 0; dir < 2; dir++) 
+        {
+            if (setup[0] == 0x00 && setup[1] == USB_REQ_SET_CONFIGURATION) 
+            {
+                usb_fs_clear_toggle(ep, dir);
+            }
+            if (setup[0] == USB_RT_INTERFACE && 
+                    setup[1] == USB_REQ_SET_INTERFACE && 
+                    _interface[ep][dir] == le16(&setup[4])) 
+            {
+                usb_fs_clear_toggle(ep, dir);
+            }
+        }
+    }
+    if (setup[0] == USB_RT_ENDPOINT && setup[1] == USB_REQ_CLEAR_FEATURE) 
+    {
+        usb_fs_clear_toggle(setup[4] & 0x0f, 
+            setup[4] & 0x80 ? USBIP_DIR_IN : USBIP_DIR_OUT);
+    }
+}
+
+int give_back(int fd, urb_t *urb, int status) 
+{
+    uint8_t reply[USBIP_HEADER_LENGTH];
+    int result = 0;
+    
+    memset(reply, 0, sizeof(reply));
+    put32(reply, USBIP_RET_SUBMIT);
+    put32(&reply[4], urb->seqnum);
+    put32(&reply[20], (uint32_t) status);
+    put32(&reply[24], urb->actual);
+    if (write_all(fd, reply, sizeof(reply)) < 0 || 
+            (urb->dir == USBIP_DIR_IN && 
+             write_all(fd, urb->data, urb->actual) < 0)) 
+    {
+        result = -1;
+    }
+    free(urb->data);
+    free(urb);
+    return result;
+}
+
+void free_urbs(void) 
+{
+    urb_t *urb;
+    int ep, dir;
+    
+    for (ep = 0; ep < 16; ep++) 
+    {
+        for (dir = 0; dir < 2; dir++) 
+        {
+            while ((urb = _urbs[ep][dir]) != NULL) 
+            {
+                _urbs[ep][dir] = urb->next;
+                free(urb->data);
+                free(urb);
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+
+int read_all(int fd, void *dest, size_t length) 
+{
+    uint8_t *bytes = dest;
+    ssize_t count;
+    
+    while (length > 0) 
+    {
+        if ((count = read(fd, bytes, length)) <= 0) 
+        {
+            if (count < 0 && errno == EINTR) { continue; }
+            return -1;
+        }
+        bytes  += count;
+        length -= (size_t) count;
+    }
+    return 0;
+}
+
+int write_all(int fd, const void *src, size_t length) 
+{
+    const uint8_t *bytes = src;
+    ssize_t count;
+    
+    while (length > 0) 
+    {
+        if ((count = write(fd, bytes, length)) < 0) 
+        {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+        bytes  += count;
+        length -= (size_t) count;
+    }
+    return 0;
+}
+
+int discard(int fd, size_t length) 
+{
+    uint8_t bytes[512];
+    size_t count;
+    
+    while (length > 0) 
+    {
+        count = length < sizeof(bytes) ? length : sizeof(bytes);
+        if (read_all(fd, bytes, count) < 0) { return -1; }
+        length -= count;
+    }
+    return 0;
+}
+
+uint16_t get16(const uint8_t *src) 
+{
+    return (uint16_t) (src[0] << 8 | src[1]);
+}
+
+uint32_t get32(const uint8_t *src) 
+{
+    return (uint32_t) get16(src) << 16 | get16(&src[2]);
+}
+
+void put16(uint8_t *dest, uint16_t value) 
+{
+    dest[0] = value >> 8;
+    dest[1] = value;
+}
+
+void put32(uint8_t *dest, uint32_t value) 
+{
+    put16(dest, value >> 16);
+    put16(&dest[2], value);
+}
+
+uint16_t le16(const uint8_t *src) 
+{
+    return (uint16_t) (src[1] << 8 | src[0]);
+}